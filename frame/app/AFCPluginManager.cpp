@@ -284,6 +284,15 @@ namespace ark
             }
         }
 
+        for (const auto& iter : mxModuleInstanceVec)
+        {
+            AFIModule* pModule = iter;
+            if (pModule)
+            {
+                pModule->PostUpdate();
+            }
+        }
+
         return true;
     }
 
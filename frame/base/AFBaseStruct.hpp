@@ -86,6 +86,22 @@ namespace ark
         int self_id{ 0 };
         int max_connection{ 0 };
         uint8_t thread_num{ 0 };
+        bool reuse_port{ false };            //thread_num acceptors listen on the same port
+        bool io_uring{ false };              //use io_uring backend if the kernel supports
+        bool shm{ false };                   //bus links between two shm enabled processes of the same host go through shared memory
+        uint32_t session_msg_budget{ 100 };  //max msgs of one session in one frame
+        uint32_t frame_msg_budget{ 20000 };  //max msgs of all sessions in one frame, 0 means no limit
+        uint32_t idle_timeout{ 0 };          //seconds, close sessions received nothing for this long, 0 means never
+        uint32_t send_high_water{ 0 };       //KB, per-session pending send bytes to enter slow consumer policy, 0 means no limit
+        uint32_t send_low_water{ 0 };        //KB, leave slow consumer policy below this
+        uint8_t slow_policy{ 0 };            //AFNetSlowPolicy, 0 drop droppable msgs, 1 disconnect, 2 throttle
+        uint32_t coalesce{ 0 };              //KB, stage msgs of one frame per session and send them as one packet, 0 means off
+        uint32_t stats_interval{ 0 };        //seconds, log net stats periodically, 0 means never
+        uint32_t reconnect_min{ 500 };       //ms, first retry delay of a dropped bus link, doubled by every failed retry
+        uint32_t reconnect_max{ 30000 };     //ms, max retry delay
+        uint32_t reconnect_queue{ 0 };       //KB, per-target msgs kept while a bus link is down, 0 means dropped
+        std::vector<uint8_t> udp_channels;   //AFKcpChannelMode of udp channels from 0, channels not listed keep their defaults
+        std::map<uint16_t, uint8_t> udp_msg_channels; //msg id -> udp channel, other msgs go channel 0
         AFEndpoint local_ep_;
         AFEndpoint public_ep_;
         //to add other fields
@@ -0,0 +1,271 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFPlatform.hpp"
+#include "AFMacros.hpp"
+
+namespace ark
+{
+
+    //LZ4 block format codec, greedy single-pass matcher, output is readable by any lz4 block decoder
+    class AFLZ4
+    {
+    public:
+        static size_t CompressBound(size_t len)
+        {
+            return len + len / 255 + 16;
+        }
+
+        //return compressed size, 0 if dst is not big enough
+        static size_t Compress(const char* src, size_t len, char* dst, size_t capacity)
+        {
+            const uint8_t* const base = reinterpret_cast<const uint8_t*>(src);
+            const uint8_t* const end = base + len;
+            const uint8_t* ip = base;
+            const uint8_t* anchor = base;
+            uint8_t* op = reinterpret_cast<uint8_t*>(dst);
+            uint8_t* const op_end = op + capacity;
+
+            if (len > MF_LIMIT)
+            {
+                //positions of last seen 4-byte sequences, 0 is checked by content anyway
+                uint32_t table[HASH_SIZE];
+                memset(table, 0, sizeof(table));
+
+                const uint8_t* const match_limit = end - LAST_LITERALS;
+                const uint8_t* const mf_limit = end - MF_LIMIT;
+                ++ip;
+                while (ip < mf_limit)
+                {
+                    uint32_t sequence = Read32(ip);
+                    uint32_t hash = Hash(sequence);
+                    const uint8_t* ref = base + table[hash];
+                    table[hash] = uint32_t(ip - base);
+
+                    if (ref >= ip || ip - ref > MAX_DISTANCE || Read32(ref) != sequence)
+                    {
+                        ++ip;
+                        continue;
+                    }
+
+                    while (ip > anchor && ref > base && ip[-1] == ref[-1])
+                    {
+                        --ip;
+                        --ref;
+                    }
+
+                    const uint8_t* match_end = ip + MIN_MATCH;
+                    const uint8_t* ref_end = ref + MIN_MATCH;
+                    while (match_end < match_limit && *match_end == *ref_end)
+                    {
+                        ++match_end;
+                        ++ref_end;
+                    }
+
+                    op = WriteSequence(op, op_end, anchor, size_t(ip - anchor), uint16_t(ip - ref), size_t(match_end - ip - MIN_MATCH));
+                    if (op == nullptr)
+                    {
+                        return 0;
+                    }
+
+                    ip = match_end;
+                    anchor = ip;
+                    if (ip < mf_limit)
+                    {
+                        table[Hash(Read32(ip - 2))] = uint32_t(ip - 2 - base);
+                    }
+                }
+            }
+
+            //the last sequence is literals only
+            size_t literals = size_t(end - anchor);
+            if (size_t(op_end - op) < 1 + literals / 255 + 1 + literals)
+            {
+                return 0;
+            }
+
+            op = WriteLength(op, literals, 0);
+            memcpy(op, anchor, literals);
+            op += literals;
+            return size_t(op - reinterpret_cast<uint8_t*>(dst));
+        }
+
+        //the whole block must decode to exactly len bytes
+        static bool Decompress(const char* src, size_t src_len, char* dst, size_t len)
+        {
+            const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+            const uint8_t* const ip_end = ip + src_len;
+            uint8_t* const out = reinterpret_cast<uint8_t*>(dst);
+            uint8_t* op = out;
+            uint8_t* const op_end = out + len;
+
+            while (ip < ip_end)
+            {
+                const uint8_t token = *ip++;
+                size_t literals = (token >> 4);
+                if (literals == 15 && !ReadLength(ip, ip_end, literals))
+                {
+                    return false;
+                }
+
+                if (literals > size_t(ip_end - ip) || literals > size_t(op_end - op))
+                {
+                    return false;
+                }
+
+                memcpy(op, ip, literals);
+                op += literals;
+                ip += literals;
+                if (ip == ip_end)
+                {
+                    break;
+                }
+
+                if (ip_end - ip < 2)
+                {
+                    return false;
+                }
+
+                size_t distance = size_t(ip[0]) | (size_t(ip[1]) << 8);
+                ip += 2;
+                if (distance == 0 || distance > size_t(op - out))
+                {
+                    return false;
+                }
+
+                size_t match_len = (token & 0x0F);
+                if (match_len == 15 && !ReadLength(ip, ip_end, match_len))
+                {
+                    return false;
+                }
+
+                match_len += MIN_MATCH;
+                if (match_len > size_t(op_end - op))
+                {
+                    return false;
+                }
+
+                //byte copy, the match may overlap the output
+                const uint8_t* ref = op - distance;
+                for (size_t i = 0; i < match_len; ++i)
+                {
+                    op[i] = ref[i];
+                }
+
+                op += match_len;
+            }
+
+            return (op == op_end);
+        }
+
+    protected:
+        ARK_CONSTEXPR static const size_t MIN_MATCH = 4;
+        ARK_CONSTEXPR static const size_t LAST_LITERALS = 5;
+        ARK_CONSTEXPR static const size_t MF_LIMIT = 12;
+        ARK_CONSTEXPR static const ptrdiff_t MAX_DISTANCE = 65535;
+        ARK_CONSTEXPR static const uint32_t HASH_LOG = 12;
+        ARK_CONSTEXPR static const uint32_t HASH_SIZE = 1 << HASH_LOG;
+
+        static uint32_t Read32(const uint8_t* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        static uint32_t Hash(uint32_t sequence)
+        {
+            return (sequence * 2654435761U) >> (32 - HASH_LOG);
+        }
+
+        //token nibble is at shift, the rest of length follows as 255 runs
+        static uint8_t* WriteLength(uint8_t* op, size_t len, uint8_t match_nibble)
+        {
+            if (len >= 15)
+            {
+                *op++ = uint8_t(0xF0 | match_nibble);
+                len -= 15;
+                for (; len >= 255; len -= 255)
+                {
+                    *op++ = 255;
+                }
+
+                *op++ = uint8_t(len);
+            }
+            else
+            {
+                *op++ = uint8_t((len << 4) | match_nibble);
+            }
+
+            return op;
+        }
+
+        static uint8_t* WriteSequence(uint8_t* op, uint8_t* op_end, const uint8_t* literals, size_t literal_len, uint16_t distance, size_t match_len)
+        {
+            //token + literal length + literals + distance + match length
+            if (size_t(op_end - op) < 1 + literal_len / 255 + 1 + literal_len + 2 + match_len / 255 + 1)
+            {
+                return nullptr;
+            }
+
+            uint8_t* token = op;
+            op = WriteLength(op, literal_len, uint8_t(match_len >= 15 ? 15 : match_len));
+            memcpy(op, literals, literal_len);
+            op += literal_len;
+
+            *op++ = uint8_t(distance);
+            *op++ = uint8_t(distance >> 8);
+
+            if (match_len >= 15)
+            {
+                *token |= 0x0F;
+                match_len -= 15;
+                for (; match_len >= 255; match_len -= 255)
+                {
+                    *op++ = 255;
+                }
+
+                *op++ = uint8_t(match_len);
+            }
+
+            return op;
+        }
+
+        static bool ReadLength(const uint8_t*& ip, const uint8_t* ip_end, size_t& len)
+        {
+            uint8_t value = 255;
+            while (value == 255)
+            {
+                if (ip >= ip_end)
+                {
+                    return false;
+                }
+
+                value = *ip++;
+                len += value;
+            }
+
+            return true;
+        }
+    };
+
+}
@@ -0,0 +1,82 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFPlatform.hpp"
+#include "AFNoncopyable.hpp"
+#include "AFSpinLock.hpp"
+
+namespace ark
+{
+
+    //Multi-producer single-consumer queue, producers append under a spin lock
+    //and the consumer takes the whole batch by swapping buffers, no allocation
+    //once the buffers have grown to the working size
+    template<typename T>
+    class AFMPSCQueue : public AFNoncopyable
+    {
+    public:
+        void Push(const T& object)
+        {
+            std::lock_guard<AFSpinLock> guard(lock_);
+            items_.push_back(object);
+            count_.store(items_.size(), std::memory_order_relaxed);
+        }
+
+        //consumer only, objects are appended to the tail of out
+        bool PopAll(std::vector<T>& out)
+        {
+            if (count_.load(std::memory_order_relaxed) == 0)
+            {
+                return false;
+            }
+
+            do
+            {
+                std::lock_guard<AFSpinLock> guard(lock_);
+                if (out.empty())
+                {
+                    out.swap(items_);
+                }
+                else
+                {
+                    out.insert(out.end(), items_.begin(), items_.end());
+                    items_.clear();
+                }
+
+                count_.store(0, std::memory_order_relaxed);
+            } while (false);
+
+            return !out.empty();
+        }
+
+        size_t Count() const
+        {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        AFSpinLock lock_;
+        std::vector<T> items_;
+        std::atomic<size_t> count_{ 0 };
+    };
+
+}
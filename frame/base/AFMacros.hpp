@@ -124,6 +124,7 @@ static size_t strlcpy(char* dst, const char* src, size_t siz)
 //Windows
 #define ARK_SPRINTF sprintf_s
 #define ARK_STRICMP _stricmp
+#define ARK_STRNICMP _strnicmp
 #define ARK_SLEEP(s) Sleep(s)
 #define ARK_STRNCPY strlcpy
 #define ARK_ASSERT(exp_, msg_, file_, func_)        \
@@ -154,6 +155,7 @@ typedef struct HINSTANCE__* hInstance;
 //Linux
 #define ARK_SPRINTF snprintf
 #define ARK_STRICMP strcasecmp
+#define ARK_STRNICMP strncasecmp
 #define ARK_SLEEP(s) usleep(s * 1000)
 #define ARK_STRNCPY strlcpy
 #define ARK_ASSERT(exp_, msg_, file_, func_)        \
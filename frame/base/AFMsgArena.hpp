@@ -0,0 +1,110 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "google/protobuf/arena.h"
+#include "google/protobuf/message.h"
+#include "AFPlatform.hpp"
+#include "AFMacros.hpp"
+#include "AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const size_t ARK_MSG_ARENA_INITIAL_BLOCK = 256 * 1024; //256K, kept across frames
+    ARK_CONSTEXPR static const size_t ARK_MSG_ARENA_MAX_BLOCK = 1024 * 1024; //1M
+
+    //Decoded msgs of one frame live in this arena and are freed together when the frame ends.
+    //Parsing allocates sub-messages, strings and repeated fields by bumping a pointer, and a
+    //frame fitting in the initial block never touches the heap. Logic thread only, msgs must
+    //not be kept after the frame, copy them out if needed.
+    //The only instance is owned by the msg module, reach it by AFIMsgModule::GetMsgArena.
+    class AFMsgArena : public AFNoncopyable
+    {
+    public:
+        AFMsgArena() :
+            initial_block_(new char[ARK_MSG_ARENA_INITIAL_BLOCK]),
+            arena_(GetOptions(initial_block_.get()))
+        {
+        }
+
+        template<typename T>
+        T* Create()
+        {
+            ++frame_msgs_;
+            return google::protobuf::Arena::CreateMessage<T>(&arena_);
+        }
+
+        //called once per frame after all msgs are handled
+        void Reset()
+        {
+            if (frame_msgs_ == 0)
+            {
+                return;
+            }
+
+            peak_bytes_ = std::max(peak_bytes_, uint64_t(arena_.SpaceUsed()));
+            arena_.Reset();
+            frame_msgs_ = 0;
+        }
+
+        //most bytes used by one frame
+        uint64_t GetPeakBytes() const
+        {
+            return peak_bytes_;
+        }
+
+        //One object per msg type reused by every msg of this type, for the hottest msg ids.
+        //Parsing clears it but keeps the capacity of strings and repeated fields from last time.
+        //It is not reentrant, a handler must not parse the same type again while it is in use.
+        //Keyed by type name, every plugin links its own copy of the generated msg classes.
+        template<typename T>
+        T* Reuse()
+        {
+            std::unique_ptr<google::protobuf::Message>& instance = reuse_msgs_[T::descriptor()->full_name()];
+            if (instance == nullptr)
+            {
+                instance.reset(T::default_instance().New());
+            }
+
+            return static_cast<T*>(instance.get());
+        }
+
+    protected:
+        static google::protobuf::ArenaOptions GetOptions(char* initial_block)
+        {
+            google::protobuf::ArenaOptions options;
+            options.initial_block = initial_block;
+            options.initial_block_size = ARK_MSG_ARENA_INITIAL_BLOCK;
+            options.max_block_size = ARK_MSG_ARENA_MAX_BLOCK;
+            return options;
+        }
+
+    private:
+        //must be declared before the arena using it
+        std::unique_ptr<char[]> initial_block_;
+        google::protobuf::Arena arena_;
+        uint32_t frame_msgs_{ 0 };
+        uint64_t peak_bytes_{ 0 };
+        std::unordered_map<std::string, std::unique_ptr<google::protobuf::Message>> reuse_msgs_;
+    };
+
+}
@@ -0,0 +1,420 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFPlatform.hpp"
+#include "AFMacros.hpp"
+#include "AFNoncopyable.hpp"
+#include "AFSpinLock.hpp"
+
+namespace ark
+{
+
+    //chunk tiers of the shared pool, sessions start with the smallest one
+    ARK_CONSTEXPR static const size_t ARK_NET_CHUNK_TIERS[] = { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+    ARK_CONSTEXPR static const uint32_t ARK_NET_CHUNK_TIER_COUNT = ARRAY_LENTGH(ARK_NET_CHUNK_TIERS);
+    ARK_CONSTEXPR static const uint32_t ARK_NET_CHUNK_NO_TIER = ARK_NET_CHUNK_TIER_COUNT;
+    ARK_CONSTEXPR static const size_t ARK_NET_CHUNK_MAX_CACHED_BYTES = 64 * 1024 * 1024; //64M per tier
+
+    class AFNetChunkPool;
+
+    //Refcounted receive chunk, the session writes socket bytes into it and
+    //decoded msgs are views of it, the chunk goes back to pool with the last reference
+    class AFNetChunk : public AFNoncopyable
+    {
+    public:
+        static AFNetChunk* Create(size_t capacity);
+
+        void AddRef()
+        {
+            ref_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void Release();
+
+        //only the owner holds this chunk, no msg view points to it
+        bool IsUnique() const
+        {
+            return ref_count_.load(std::memory_order_acquire) == 1;
+        }
+
+        char* GetData()
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        size_t GetCapacity() const
+        {
+            return capacity_;
+        }
+
+        uint32_t GetTier() const
+        {
+            return tier_;
+        }
+
+    protected:
+        friend class AFNetChunkPool;
+
+        AFNetChunk(size_t capacity, uint32_t tier) :
+            capacity_(capacity),
+            tier_(tier)
+        {
+        }
+
+        ~AFNetChunk() = default;
+
+    private:
+        std::atomic<int32_t> ref_count_{ 1 };
+        size_t capacity_{ 0 };
+        uint32_t tier_{ ARK_NET_CHUNK_NO_TIER };
+        AFNetChunk* next_{ nullptr };
+    };
+
+    class AFNetChunkTierStats
+    {
+    public:
+        size_t chunk_size_{ 0 };
+        size_t in_use_{ 0 };    //borrowed by sessions or msg views
+        size_t peak_in_use_{ 0 };
+        size_t cached_{ 0 };    //idle in pool
+        uint64_t hits_{ 0 };
+        uint64_t misses_{ 0 };
+    };
+
+    class AFNetChunkPoolStats
+    {
+    public:
+        AFNetChunkTierStats tiers_[ARK_NET_CHUNK_TIER_COUNT];
+        size_t oversize_in_use_{ 0 };
+
+        size_t GetInUseBytes() const
+        {
+            size_t bytes = 0;
+            for (const auto& tier : tiers_)
+            {
+                bytes += tier.in_use_ * tier.chunk_size_;
+            }
+
+            return bytes;
+        }
+
+        size_t GetCachedBytes() const
+        {
+            size_t bytes = 0;
+            for (const auto& tier : tiers_)
+            {
+                bytes += tier.cached_ * tier.chunk_size_;
+            }
+
+            return bytes;
+        }
+    };
+
+    //Process-wide tiered chunk pool shared by all session receive buffers
+    class AFNetChunkPool : public AFNoncopyable
+    {
+    public:
+        static AFNetChunkPool& Instance()
+        {
+            static AFNetChunkPool instance;
+            return instance;
+        }
+
+        static uint32_t GetTier(size_t capacity)
+        {
+            for (uint32_t i = 0; i < ARK_NET_CHUNK_TIER_COUNT; ++i)
+            {
+                if (capacity <= ARK_NET_CHUNK_TIERS[i])
+                {
+                    return i;
+                }
+            }
+
+            return ARK_NET_CHUNK_NO_TIER;
+        }
+
+        AFNetChunk* Acquire(size_t capacity)
+        {
+            uint32_t tier_index = GetTier(capacity);
+            if (tier_index == ARK_NET_CHUNK_NO_TIER)
+            {
+                oversize_in_use_.fetch_add(1, std::memory_order_relaxed);
+                return NewChunk(capacity, ARK_NET_CHUNK_NO_TIER);
+            }
+
+            AFNetChunk* chunk = nullptr;
+            AFTier& tier = tiers_[tier_index];
+            do
+            {
+                std::lock_guard<AFSpinLock> guard(tier.lock_);
+                chunk = tier.free_;
+                if (chunk != nullptr)
+                {
+                    tier.free_ = chunk->next_;
+                    --tier.stats_.cached_;
+                    ++tier.stats_.hits_;
+                }
+                else
+                {
+                    ++tier.stats_.misses_;
+                }
+
+                ++tier.stats_.in_use_;
+                tier.stats_.peak_in_use_ = std::max(tier.stats_.peak_in_use_, tier.stats_.in_use_);
+            } while (false);
+
+            if (chunk == nullptr)
+            {
+                chunk = NewChunk(ARK_NET_CHUNK_TIERS[tier_index], tier_index);
+                if (chunk == nullptr)
+                {
+                    std::lock_guard<AFSpinLock> guard(tier.lock_);
+                    --tier.stats_.in_use_;
+                }
+
+                return chunk;
+            }
+
+            chunk->next_ = nullptr;
+            chunk->ref_count_.store(1, std::memory_order_relaxed);
+            return chunk;
+        }
+
+        void Recycle(AFNetChunk* chunk)
+        {
+            uint32_t tier_index = chunk->GetTier();
+            if (tier_index == ARK_NET_CHUNK_NO_TIER)
+            {
+                oversize_in_use_.fetch_sub(1, std::memory_order_relaxed);
+                DeleteChunk(chunk);
+                return;
+            }
+
+            AFTier& tier = tiers_[tier_index];
+            do
+            {
+                std::lock_guard<AFSpinLock> guard(tier.lock_);
+                --tier.stats_.in_use_;
+                if ((tier.stats_.cached_ + 1) * tier.stats_.chunk_size_ <= ARK_NET_CHUNK_MAX_CACHED_BYTES)
+                {
+                    chunk->next_ = tier.free_;
+                    tier.free_ = chunk;
+                    ++tier.stats_.cached_;
+                    chunk = nullptr;
+                }
+            } while (false);
+
+            if (chunk != nullptr)
+            {
+                DeleteChunk(chunk);
+            }
+        }
+
+        void GetStats(AFNetChunkPoolStats& stats)
+        {
+            for (uint32_t i = 0; i < ARK_NET_CHUNK_TIER_COUNT; ++i)
+            {
+                std::lock_guard<AFSpinLock> guard(tiers_[i].lock_);
+                stats.tiers_[i] = tiers_[i].stats_;
+            }
+
+            stats.oversize_in_use_ = oversize_in_use_.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        AFNetChunkPool()
+        {
+            for (uint32_t i = 0; i < ARK_NET_CHUNK_TIER_COUNT; ++i)
+            {
+                tiers_[i].stats_.chunk_size_ = ARK_NET_CHUNK_TIERS[i];
+            }
+        }
+
+        static AFNetChunk* NewChunk(size_t capacity, uint32_t tier)
+        {
+            void* block = malloc(sizeof(AFNetChunk) + capacity);
+            if (block == nullptr)
+            {
+                return nullptr;
+            }
+
+            return new (block) AFNetChunk(capacity, tier);
+        }
+
+        static void DeleteChunk(AFNetChunk* chunk)
+        {
+            chunk->~AFNetChunk();
+            free(chunk);
+        }
+
+        class AFTier
+        {
+        public:
+            AFSpinLock lock_;
+            AFNetChunk* free_{ nullptr };
+            AFNetChunkTierStats stats_;
+        };
+
+    private:
+        AFTier tiers_[ARK_NET_CHUNK_TIER_COUNT];
+        std::atomic<size_t> oversize_in_use_{ 0 };
+    };
+
+    inline AFNetChunk* AFNetChunk::Create(size_t capacity)
+    {
+        return AFNetChunkPool::Instance().Acquire(capacity);
+    }
+
+    inline void AFNetChunk::Release()
+    {
+        if (ref_count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            AFNetChunkPool::Instance().Recycle(this);
+        }
+    }
+
+    //Session-side receive buffer made of chunks, used by one IO thread.
+    //It starts with the smallest tier, borrows a larger chunk only while a big
+    //frame is being assembled and gives it back once the buffer drains.
+    class AFNetRecvBuffer : public AFNoncopyable
+    {
+    public:
+        AFNetRecvBuffer() = default;
+
+        ~AFNetRecvBuffer()
+        {
+            if (chunk_ != nullptr)
+            {
+                chunk_->Release();
+                chunk_ = nullptr;
+            }
+        }
+
+        bool write(const char* data, size_t len)
+        {
+            if (!reserve(len))
+            {
+                return false;
+            }
+
+            memcpy(chunk_->GetData() + write_pos_, data, len);
+            write_pos_ += len;
+            return true;
+        }
+
+        size_t get_length() const
+        {
+            return write_pos_ - read_pos_;
+        }
+
+        char* get_data()
+        {
+            return (chunk_ != nullptr ? chunk_->GetData() + read_pos_ : nullptr);
+        }
+
+        AFNetChunk* get_chunk()
+        {
+            return chunk_;
+        }
+
+        void remove_data(size_t len)
+        {
+            if (len == 0 || read_pos_ + len > write_pos_)
+            {
+                return;
+            }
+
+            read_pos_ += len;
+            if (read_pos_ != write_pos_)
+            {
+                return;
+            }
+
+            //drained, give back the chunk if it is a borrowed large one or still referenced by msg views
+            if (chunk_->GetTier() != 0 || !chunk_->IsUnique())
+            {
+                chunk_->Release();
+                chunk_ = nullptr;
+            }
+
+            read_pos_ = 0;
+            write_pos_ = 0;
+        }
+
+    protected:
+        //make sure there is len bytes space at tail, the pending bytes of a frame
+        //which is not complete are moved or copied to the head of the chunk
+        bool reserve(size_t len)
+        {
+            size_t pending = get_length();
+            if (chunk_ != nullptr)
+            {
+                if (chunk_->GetCapacity() - write_pos_ >= len)
+                {
+                    return true;
+                }
+
+                //no msg views any more, reuse this chunk
+                if (chunk_->IsUnique() && chunk_->GetCapacity() >= pending + len)
+                {
+                    if (pending > 0 && read_pos_ > 0)
+                    {
+                        memmove(chunk_->GetData(), chunk_->GetData() + read_pos_, pending);
+                    }
+
+                    read_pos_ = 0;
+                    write_pos_ = pending;
+                    return true;
+                }
+            }
+
+            size_t capacity = std::max(ARK_NET_CHUNK_TIERS[0], pending + len);
+            AFNetChunk* new_chunk = AFNetChunk::Create(capacity);
+            if (new_chunk == nullptr)
+            {
+                return false;
+            }
+
+            if (chunk_ != nullptr)
+            {
+                //the frame straddles two chunks, fall back to copy
+                if (pending > 0)
+                {
+                    memcpy(new_chunk->GetData(), chunk_->GetData() + read_pos_, pending);
+                }
+
+                chunk_->Release();
+            }
+
+            chunk_ = new_chunk;
+            read_pos_ = 0;
+            write_pos_ = pending;
+            return true;
+        }
+
+    private:
+        AFNetChunk* chunk_{ nullptr };
+        size_t write_pos_{ 0 };
+        size_t read_pos_{ 0 };
+    };
+
+}
@@ -22,6 +22,8 @@
 
 #include "AFPlatform.hpp"
 #include "AFMacros.hpp"
+#include "AFNetMsgPool.hpp"
+#include "AFNetChunk.hpp"
 
 #pragma pack(push, 1)
 
@@ -32,7 +34,16 @@ namespace ark
     ARK_CONSTEXPR static const std::chrono::seconds ARK_CONNECT_TIMEOUT = std::chrono::seconds(5); //5s
     ARK_CONSTEXPR static const std::chrono::seconds ARK_NET_HEART_TIME = std::chrono::seconds(30);//30s
     ARK_CONSTEXPR static const int ARK_PROCESS_NET_MSG_COUNT_ONCE = 100;
+    ARK_CONSTEXPR static const int ARK_PROCESS_NET_MSG_COUNT_FRAME = 20000; //all sessions in one frame
     ARK_CONSTEXPR static const int ARK_MSG_MAX_LENGTH = 1024 * 5; //5K
+    ARK_CONSTEXPR static const size_t ARK_NET_COALESCE_THRESHOLD = 16 * 1024; //16K staged bytes per session
+    ARK_CONSTEXPR static const size_t ARK_NET_SEND_HARD_LIMIT_FACTOR = 4; //congested session is closed at high water mark * 4
+    ARK_CONSTEXPR static const uint32_t ARK_MSG_COMPRESS_FLAG = 0x80000000; //top bit of length_, body is [raw length(4)][lz4 block]
+    ARK_CONSTEXPR static const uint32_t ARK_MSG_BATCH_FLAG = 0x40000000; //second bit of length_, body is [children(2)][records]
+    ARK_CONSTEXPR static const uint32_t ARK_MSG_LENGTH_MASK = 0x3FFFFFFF;
+    ARK_CONSTEXPR static const uint32_t ARK_MSG_COMPRESS_HEAD_LENGTH = 4;
+    ARK_CONSTEXPR static const uint32_t ARK_MSG_BATCH_MAX_LENGTH = 64 * 1024; //64K, body of a batch frame
+    ARK_CONSTEXPR static const uint16_t ARK_MSG_BATCH_MAX_CHILDREN = 0xFFFF;
 
     enum AFHeadLength
     {
@@ -45,7 +56,27 @@ namespace ark
     public:
         uint16_t id_{ 0 };      //Msg id
         uint32_t length_{ 0 };  //Msg length(without header length)
-        //uint8_t children_{ 0 }; //The number of the children msg(include self)
+
+        //wire length of body, compressed size if the compress flag is set
+        uint32_t GetBodyLength() const
+        {
+            return (length_ & ARK_MSG_LENGTH_MASK);
+        }
+
+        bool IsCompressed() const
+        {
+            return ((length_ & ARK_MSG_COMPRESS_FLAG) != 0);
+        }
+
+        bool IsBatch() const
+        {
+            return ((length_ & ARK_MSG_BATCH_FLAG) != 0);
+        }
+
+        uint32_t GetMaxBodyLength() const
+        {
+            return (IsBatch() ? ARK_MSG_BATCH_MAX_LENGTH : ARK_MSG_MAX_LENGTH);
+        }
     };
 
     /*
@@ -68,6 +99,85 @@ namespace ark
         int32_t dst_bus_{ 0 };  //Destination bus id
     };
 
+    /*
+    batch frame body, src bus and dst bus of children are the ones of frame head
+    | children | record | record | ...
+    |     2    |
+    cs record | msg id | msg len | data |
+              |    2   |    4    |
+    ss record | msg id | msg len | actor id | data |
+              |    2   |    4    |     8    |
+    */
+    class AFMsgBatchHead
+    {
+    public:
+        uint16_t children_{ 0 }; //The number of the children msg
+    };
+
+    //packs several small msgs into the body of one batch frame
+    class AFMsgBatch
+    {
+    public:
+        explicit AFMsgBatch(const uint32_t head_len) :
+            record_head_len_(GetRecordHeadLen(head_len))
+        {
+            Clear();
+        }
+
+        //record head is the head without src bus and dst bus
+        static uint32_t GetRecordHeadLen(const uint32_t head_len)
+        {
+            return (head_len == SS_HEAD_LENGTH ? sizeof(AFMsgHead) + sizeof(int64_t) : sizeof(AFMsgHead));
+        }
+
+        //return false if the batch is full, send it and add again
+        bool Add(const uint16_t msg_id, const int64_t actor_id, const char* data, const uint32_t len)
+        {
+            if (len > ARK_MSG_MAX_LENGTH || GetChildren() == ARK_MSG_BATCH_MAX_CHILDREN ||
+                    body_.size() + record_head_len_ + len > ARK_MSG_BATCH_MAX_LENGTH)
+            {
+                return false;
+            }
+
+            AFSSMsgHead record;
+            record.id_ = msg_id;
+            record.length_ = len;
+            record.actor_id_ = actor_id;
+            body_.append(reinterpret_cast<const char*>(&record), record_head_len_);
+            if (len > 0)
+            {
+                body_.append(data, len);
+            }
+
+            reinterpret_cast<AFMsgBatchHead*>(&body_[0])->children_++;
+            return true;
+        }
+
+        void Clear()
+        {
+            body_.assign(sizeof(AFMsgBatchHead), 0);
+        }
+
+        uint16_t GetChildren() const
+        {
+            return reinterpret_cast<const AFMsgBatchHead*>(body_.data())->children_;
+        }
+
+        bool Empty() const
+        {
+            return (GetChildren() == 0);
+        }
+
+        const std::string& GetBody() const
+        {
+            return body_;
+        }
+
+    private:
+        uint32_t record_head_len_{ 0 };
+        std::string body_;
+    };
+
     class AFNetMsg : public AFSSMsgHead
     {
     public:
@@ -76,19 +186,48 @@ namespace ark
         {
         }
 
+        //msg head and data are in one pooled block, data follows the msg object
         static AFNetMsg* AllocMsg(uint32_t len)
         {
-            AFNetMsg* msg = ARK_NEW AFNetMsg();
+            void* block = AFNetMsgPool::Instance().Alloc(sizeof(AFNetMsg) + len);
+            if (block == nullptr)
+            {
+                return nullptr;
+            }
+
+            AFNetMsg* msg = new (block) AFNetMsg();
             msg->AllocData(len);
             return msg;
         }
 
+        //msg data is a view of a receive chunk, no payload copy
+        static AFNetMsg* AllocView(AFNetChunk* chunk, char* data, uint32_t len)
+        {
+            void* block = AFNetMsgPool::Instance().Alloc(sizeof(AFNetMsg));
+            if (block == nullptr)
+            {
+                return nullptr;
+            }
+
+            AFNetMsg* msg = new (block) AFNetMsg();
+            if (len > 0)
+            {
+                chunk->AddRef();
+                msg->chunk_ = chunk;
+                msg->msg_data_ = data;
+            }
+
+            return msg;
+        }
+
         static void Release(AFNetMsg*& msg)
         {
             if (msg != nullptr)
             {
                 msg->DeallocData();
-                ARK_DELETE(msg);
+                msg->~AFNetMsg();
+                AFNetMsgPool::Instance().Free(msg);
+                msg = nullptr;
             }
         }
 
@@ -102,7 +241,6 @@ namespace ark
         void CopyFrom(AFNetMsg* msg)
         {
             this->id_ = msg->id_;
-            //this->children_ = msg->children_;
             this->actor_id_ = msg->actor_id_;
             this->src_bus_ = msg->src_bus_;
             this->dst_bus_ = msg->dst_bus_;
@@ -115,7 +253,6 @@ namespace ark
         void CopyFrom(const int64_t actor_id, const uint16_t msg_id, const char* data, const uint32_t len, int src_bus, int dst_bus)
         {
             this->id_ = msg_id;
-            //this->children_ = 0;
             this->actor_id_ = actor_id;
             this->src_bus_ = src_bus;
             this->dst_bus_ = dst_bus;
@@ -127,22 +264,27 @@ namespace ark
         {
             if (len > 0)
             {
-                msg_data_ = ARK_NEW char[len];
+                msg_data_ = reinterpret_cast<char*>(this + 1);
             }
         }
 
         void DeallocData()
         {
-            if (msg_data_ != nullptr)
+            if (chunk_ != nullptr)
             {
-                ARK_DELETE_ARRAY(char, msg_data_);
+                chunk_->Release();
+                chunk_ = nullptr;
             }
 
+            msg_data_ = nullptr;
             length_ = 0;
         }
 
     public:
         char* msg_data_{ nullptr };
+
+    private:
+        AFNetChunk* chunk_{ nullptr };
     };
 
 }
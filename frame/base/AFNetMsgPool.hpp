@@ -0,0 +1,328 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFPlatform.hpp"
+#include "AFMacros.hpp"
+#include "AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    class AFNetMsgThreadCache;
+
+    //size class block sizes(include block head), the last one must cover ARK_MSG_MAX_LENGTH + msg head
+    ARK_CONSTEXPR static const size_t ARK_NET_MSG_POOL_CLASSES[] = { 64, 128, 256, 512, 1024, 2048, 4096, 8192 };
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_POOL_CLASS_COUNT = ARRAY_LENTGH(ARK_NET_MSG_POOL_CLASSES);
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_POOL_LARGE_CLASS = ARK_NET_MSG_POOL_CLASS_COUNT;
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_POOL_MAX_CACHED = 4096; //max cached blocks per class per thread
+
+    class AFNetMsgPoolBlock
+    {
+    public:
+        AFNetMsgPoolBlock* next_{ nullptr };
+        AFNetMsgThreadCache* owner_{ nullptr };
+        uint64_t size_class_{ 0 };
+    };
+
+    class AFNetMsgPoolStats
+    {
+    public:
+        uint64_t hits_{ 0 };        //alloc served by thread cache
+        uint64_t misses_{ 0 };      //alloc fall back to global heap
+        uint64_t remote_frees_{ 0 };//blocks returned by other threads
+        uint32_t thread_caches_{ 0 };
+    };
+
+    //Every thread owns one cache, blocks go back to the owner cache
+    //local free is a plain list push, remote free is a lock-free stack push
+    class AFNetMsgThreadCache : public AFNoncopyable
+    {
+    public:
+        AFNetMsgThreadCache()
+        {
+            for (uint32_t i = 0; i < ARK_NET_MSG_POOL_CLASS_COUNT; ++i)
+            {
+                local_free_[i] = nullptr;
+                local_count_[i] = 0;
+                remote_free_[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~AFNetMsgThreadCache()
+        {
+            for (uint32_t i = 0; i < ARK_NET_MSG_POOL_CLASS_COUNT; ++i)
+            {
+                ReclaimRemote(i);
+                FreeList(local_free_[i]);
+                local_free_[i] = nullptr;
+                local_count_[i] = 0;
+            }
+        }
+
+        AFNetMsgPoolBlock* Pop(uint32_t size_class)
+        {
+            AFNetMsgPoolBlock* block = local_free_[size_class];
+            if (block == nullptr)
+            {
+                ReclaimRemote(size_class);
+                block = local_free_[size_class];
+            }
+
+            if (block == nullptr)
+            {
+                misses_.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            local_free_[size_class] = block->next_;
+            --local_count_[size_class];
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return block;
+        }
+
+        void PushLocal(AFNetMsgPoolBlock* block)
+        {
+            uint32_t size_class = uint32_t(block->size_class_);
+            if (local_count_[size_class] >= ARK_NET_MSG_POOL_MAX_CACHED)
+            {
+                free(block);
+                return;
+            }
+
+            block->next_ = local_free_[size_class];
+            local_free_[size_class] = block;
+            ++local_count_[size_class];
+        }
+
+        void PushRemote(AFNetMsgPoolBlock* block)
+        {
+            std::atomic<AFNetMsgPoolBlock*>& head = remote_free_[block->size_class_];
+            AFNetMsgPoolBlock* old_head = head.load(std::memory_order_relaxed);
+            do
+            {
+                block->next_ = old_head;
+            } while (!head.compare_exchange_weak(old_head, block, std::memory_order_release, std::memory_order_relaxed));
+
+            remote_frees_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //owner thread exit, waiting for a new thread to adopt
+        bool TryAdopt()
+        {
+            bool expected = true;
+            return orphaned_.compare_exchange_strong(expected, false, std::memory_order_acq_rel);
+        }
+
+        void SetOrphaned()
+        {
+            orphaned_.store(true, std::memory_order_release);
+        }
+
+        void CollectStats(AFNetMsgPoolStats& stats) const
+        {
+            stats.hits_ += hits_.load(std::memory_order_relaxed);
+            stats.misses_ += misses_.load(std::memory_order_relaxed);
+            stats.remote_frees_ += remote_frees_.load(std::memory_order_relaxed);
+            ++stats.thread_caches_;
+        }
+
+    protected:
+        void ReclaimRemote(uint32_t size_class)
+        {
+            AFNetMsgPoolBlock* block = remote_free_[size_class].exchange(nullptr, std::memory_order_acquire);
+            while (block != nullptr)
+            {
+                AFNetMsgPoolBlock* next = block->next_;
+                PushLocal(block);
+                block = next;
+            }
+        }
+
+        void FreeList(AFNetMsgPoolBlock* block)
+        {
+            while (block != nullptr)
+            {
+                AFNetMsgPoolBlock* next = block->next_;
+                free(block);
+                block = next;
+            }
+        }
+
+    private:
+        AFNetMsgPoolBlock* local_free_[ARK_NET_MSG_POOL_CLASS_COUNT];
+        uint32_t local_count_[ARK_NET_MSG_POOL_CLASS_COUNT];
+        std::atomic<AFNetMsgPoolBlock*> remote_free_[ARK_NET_MSG_POOL_CLASS_COUNT];
+
+        std::atomic<bool> orphaned_{ false };
+
+        std::atomic<uint64_t> hits_{ 0 };
+        std::atomic<uint64_t> misses_{ 0 };
+        std::atomic<uint64_t> remote_frees_{ 0 };
+    };
+
+    //Size-classed pool for net msg, msg head and payload stay in one block.
+    //IO threads alloc from own cache, main thread release to the owner cache remotely.
+    class AFNetMsgPool : public AFNoncopyable
+    {
+    public:
+        static AFNetMsgPool& Instance()
+        {
+            static AFNetMsgPool instance;
+            return instance;
+        }
+
+        void* Alloc(size_t size)
+        {
+            size_t block_size = size + sizeof(AFNetMsgPoolBlock);
+            uint32_t size_class = GetSizeClass(block_size);
+
+            AFNetMsgPoolBlock* block = nullptr;
+            AFNetMsgThreadCache* cache = GetThreadCache();
+            if (size_class != ARK_NET_MSG_POOL_LARGE_CLASS)
+            {
+                block = cache->Pop(size_class);
+                block_size = ARK_NET_MSG_POOL_CLASSES[size_class];
+            }
+            else
+            {
+                large_allocs_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            if (block == nullptr)
+            {
+                block = reinterpret_cast<AFNetMsgPoolBlock*>(malloc(block_size));
+                if (block == nullptr)
+                {
+                    return nullptr;
+                }
+            }
+
+            block->next_ = nullptr;
+            block->owner_ = cache;
+            block->size_class_ = size_class;
+            return block + 1;
+        }
+
+        void Free(void* ptr)
+        {
+            if (ptr == nullptr)
+            {
+                return;
+            }
+
+            AFNetMsgPoolBlock* block = reinterpret_cast<AFNetMsgPoolBlock*>(ptr) - 1;
+            if (block->size_class_ == ARK_NET_MSG_POOL_LARGE_CLASS)
+            {
+                free(block);
+                return;
+            }
+
+            AFNetMsgThreadCache* cache = GetThreadCache();
+            if (block->owner_ == cache)
+            {
+                cache->PushLocal(block);
+            }
+            else
+            {
+                block->owner_->PushRemote(block);
+            }
+        }
+
+        void GetStats(AFNetMsgPoolStats& stats)
+        {
+            stats = AFNetMsgPoolStats();
+
+            std::lock_guard<std::mutex> guard(mutex_);
+            for (auto cache : caches_)
+            {
+                cache->CollectStats(stats);
+            }
+
+            stats.misses_ += large_allocs_.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        AFNetMsgPool() = default;
+
+        static uint32_t GetSizeClass(size_t block_size)
+        {
+            for (uint32_t i = 0; i < ARK_NET_MSG_POOL_CLASS_COUNT; ++i)
+            {
+                if (block_size <= ARK_NET_MSG_POOL_CLASSES[i])
+                {
+                    return i;
+                }
+            }
+
+            return ARK_NET_MSG_POOL_LARGE_CLASS;
+        }
+
+        //orphan the cache when thread exit, blocks in flight still can be returned to it
+        class AFThreadCacheHolder
+        {
+        public:
+            ~AFThreadCacheHolder()
+            {
+                if (cache_ != nullptr)
+                {
+                    cache_->SetOrphaned();
+                }
+            }
+
+            AFNetMsgThreadCache* cache_{ nullptr };
+        };
+
+        AFNetMsgThreadCache* GetThreadCache()
+        {
+            static thread_local AFThreadCacheHolder holder;
+            if (holder.cache_ == nullptr)
+            {
+                holder.cache_ = AcquireCache();
+            }
+
+            return holder.cache_;
+        }
+
+        AFNetMsgThreadCache* AcquireCache()
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            for (auto cache : caches_)
+            {
+                if (cache->TryAdopt())
+                {
+                    return cache;
+                }
+            }
+
+            AFNetMsgThreadCache* cache = new AFNetMsgThreadCache();
+            caches_.push_back(cache);
+            return cache;
+        }
+
+    private:
+        std::mutex mutex_;
+        //thread caches live as long as the process, msg in flight may still point to them
+        std::vector<AFNetMsgThreadCache*> caches_;
+        std::atomic<uint64_t> large_allocs_{ 0 };
+    };
+
+}
@@ -0,0 +1,407 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFPlatform.hpp"
+#include "AFMacros.hpp"
+#include "AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    //latency buckets, two per power of 2 nanoseconds, the last one holds everything above 2s
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_STATS_BUCKETS = 64;
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_STATS_PAGE_SIZE = 256; //msg ids per page
+    ARK_CONSTEXPR static const uint32_t ARK_NET_MSG_STATS_PAGES = 65536 / ARK_NET_MSG_STATS_PAGE_SIZE;
+
+    //traffic of one session since connected
+    class AFNetSessionTraffic
+    {
+    public:
+        int64_t session_id_{ 0 };
+        uint64_t recv_msgs_{ 0 };
+        uint64_t recv_bytes_{ 0 };  //wire bytes
+        uint64_t send_msgs_{ 0 };
+        uint64_t send_bytes_{ 0 };  //wire bytes
+    };
+
+    //log2 latency histogram in nanoseconds, not thread safe
+    class AFNetLatencyHistogram
+    {
+    public:
+        uint64_t total_ns_{ 0 };
+        uint64_t max_ns_{ 0 };
+        uint64_t buckets_[ARK_NET_MSG_STATS_BUCKETS] = { 0 };
+
+        void Record(const uint64_t ns)
+        {
+            total_ns_ += ns;
+            max_ns_ = std::max(max_ns_, ns);
+            ++buckets_[GetBucket(ns)];
+        }
+
+        void Merge(const AFNetLatencyHistogram& other)
+        {
+            total_ns_ += other.total_ns_;
+            max_ns_ = std::max(max_ns_, other.max_ns_);
+            for (uint32_t i = 0; i < ARK_NET_MSG_STATS_BUCKETS; ++i)
+            {
+                buckets_[i] += other.buckets_[i];
+            }
+        }
+
+        uint64_t GetCount() const
+        {
+            uint64_t count = 0;
+            for (auto bucket : buckets_)
+            {
+                count += bucket;
+            }
+
+            return count;
+        }
+
+        //upper bound of the bucket holding the percentile, never above the max
+        uint64_t GetPercentile(double percent) const
+        {
+            uint64_t count = GetCount();
+            if (count == 0)
+            {
+                return 0;
+            }
+
+            uint64_t rank = uint64_t(percent * double(count) / 100.0);
+            rank = std::max<uint64_t>(rank, 1);
+            uint64_t seen = 0;
+            for (uint32_t i = 0; i < ARK_NET_MSG_STATS_BUCKETS; ++i)
+            {
+                seen += buckets_[i];
+                if (seen >= rank)
+                {
+                    return std::min(GetBucketUpper(i), max_ns_);
+                }
+            }
+
+            return max_ns_;
+        }
+
+        static uint32_t GetBucket(uint64_t ns)
+        {
+            if (ns < 2)
+            {
+                return 0;
+            }
+
+            uint32_t octave = Log2(ns);
+            uint32_t bucket = octave * 2 + uint32_t((ns >> (octave - 1)) & 1);
+            return std::min(bucket, ARK_NET_MSG_STATS_BUCKETS - 1);
+        }
+
+        static uint64_t GetBucketUpper(uint32_t bucket)
+        {
+            uint32_t octave = bucket / 2;
+            if (octave == 0)
+            {
+                return 2;
+            }
+
+            return (uint64_t(1) << octave) + (uint64_t(bucket % 2 + 1) << (octave - 1));
+        }
+
+    protected:
+        static uint32_t Log2(uint64_t value)
+        {
+            uint32_t result = 0;
+            for (uint32_t shift = 32; shift > 0; shift /= 2)
+            {
+                if (value >> shift)
+                {
+                    value >>= shift;
+                    result += shift;
+                }
+            }
+
+            return result;
+        }
+    };
+
+    //merged counters of one msg id
+    class AFNetMsgIdStats
+    {
+    public:
+        uint64_t recv_msgs_{ 0 };
+        uint64_t recv_bytes_{ 0 };
+        uint64_t send_msgs_{ 0 };   //a broadcast counts once
+        uint64_t send_bytes_{ 0 };
+        AFNetLatencyHistogram handle_;
+    };
+
+    //counters of one msg id in one thread, only the owner thread writes them,
+    //so every update is a plain relaxed store and readers merge all threads on demand
+    class AFNetMsgStatsEntry
+    {
+    public:
+        AFNetMsgStatsEntry()
+        {
+            for (auto& bucket : buckets_)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void RecordRecv(const uint32_t bytes)
+        {
+            Increase(recv_msgs_, 1);
+            Increase(recv_bytes_, bytes);
+        }
+
+        void RecordSend(const uint32_t bytes)
+        {
+            Increase(send_msgs_, 1);
+            Increase(send_bytes_, bytes);
+        }
+
+        void RecordHandle(const uint64_t ns)
+        {
+            Increase(handle_total_ns_, ns);
+            Increase(buckets_[AFNetLatencyHistogram::GetBucket(ns)], 1);
+            if (ns > handle_max_ns_.load(std::memory_order_relaxed))
+            {
+                handle_max_ns_.store(ns, std::memory_order_relaxed);
+            }
+        }
+
+        bool IsEmpty() const
+        {
+            return (recv_msgs_.load(std::memory_order_relaxed) == 0 && send_msgs_.load(std::memory_order_relaxed) == 0);
+        }
+
+        void Merge(AFNetMsgIdStats& out) const
+        {
+            out.recv_msgs_ += recv_msgs_.load(std::memory_order_relaxed);
+            out.recv_bytes_ += recv_bytes_.load(std::memory_order_relaxed);
+            out.send_msgs_ += send_msgs_.load(std::memory_order_relaxed);
+            out.send_bytes_ += send_bytes_.load(std::memory_order_relaxed);
+            out.handle_.total_ns_ += handle_total_ns_.load(std::memory_order_relaxed);
+            out.handle_.max_ns_ = std::max(out.handle_.max_ns_, handle_max_ns_.load(std::memory_order_relaxed));
+            for (uint32_t k = 0; k < ARK_NET_MSG_STATS_BUCKETS; ++k)
+            {
+                out.handle_.buckets_[k] += buckets_[k].load(std::memory_order_relaxed);
+            }
+        }
+
+    protected:
+        //single writer, no read-modify-write needed
+        static void Increase(std::atomic<uint64_t>& counter, const uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> recv_msgs_{ 0 };
+        std::atomic<uint64_t> recv_bytes_{ 0 };
+        std::atomic<uint64_t> send_msgs_{ 0 };
+        std::atomic<uint64_t> send_bytes_{ 0 };
+        std::atomic<uint64_t> handle_total_ns_{ 0 };
+        std::atomic<uint64_t> handle_max_ns_{ 0 };
+        std::atomic<uint64_t> buckets_[ARK_NET_MSG_STATS_BUCKETS];
+    };
+
+    //counters of all msg ids in one thread
+    class AFNetMsgStatsThread : public AFNoncopyable
+    {
+    public:
+        ~AFNetMsgStatsThread()
+        {
+            for (auto& page : pages_)
+            {
+                delete[] page.load(std::memory_order_relaxed);
+            }
+        }
+
+        void Merge(std::map<uint16_t, AFNetMsgIdStats>& stats) const
+        {
+            for (uint32_t i = 0; i < ARK_NET_MSG_STATS_PAGES; ++i)
+            {
+                const AFNetMsgStatsEntry* page = pages_[i].load(std::memory_order_acquire);
+                if (page == nullptr)
+                {
+                    continue;
+                }
+
+                for (uint32_t j = 0; j < ARK_NET_MSG_STATS_PAGE_SIZE; ++j)
+                {
+                    const AFNetMsgStatsEntry& entry = page[j];
+                    if (entry.IsEmpty())
+                    {
+                        continue;
+                    }
+
+                    entry.Merge(stats[uint16_t(i * ARK_NET_MSG_STATS_PAGE_SIZE + j)]);
+                }
+            }
+        }
+
+        //pages are allocated when the first msg id of them shows up, owner thread only
+        AFNetMsgStatsEntry& GetEntry(const uint16_t msg_id)
+        {
+            std::atomic<AFNetMsgStatsEntry*>& slot = pages_[msg_id / ARK_NET_MSG_STATS_PAGE_SIZE];
+            AFNetMsgStatsEntry* page = slot.load(std::memory_order_relaxed);
+            if (page == nullptr)
+            {
+                page = new AFNetMsgStatsEntry[ARK_NET_MSG_STATS_PAGE_SIZE];
+                slot.store(page, std::memory_order_release);
+            }
+
+            return page[msg_id % ARK_NET_MSG_STATS_PAGE_SIZE];
+        }
+
+    private:
+        std::atomic<AFNetMsgStatsEntry*> pages_[ARK_NET_MSG_STATS_PAGES] = {};
+    };
+
+    //Process-wide per msg id counters and handler time histograms
+    class AFNetMsgStats : public AFNoncopyable
+    {
+    public:
+        static AFNetMsgStats& Instance()
+        {
+            static AFNetMsgStats instance;
+            return instance;
+        }
+
+        bool IsEnabled() const
+        {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        void SetEnabled(bool value)
+        {
+            enabled_.store(value, std::memory_order_relaxed);
+        }
+
+        void RecordRecv(const uint16_t msg_id, const uint32_t bytes)
+        {
+            if (IsEnabled())
+            {
+                GetThreadEntry(msg_id).RecordRecv(bytes);
+            }
+        }
+
+        void RecordSend(const uint16_t msg_id, const uint32_t bytes)
+        {
+            if (IsEnabled())
+            {
+                GetThreadEntry(msg_id).RecordSend(bytes);
+            }
+        }
+
+        void RecordHandle(const uint16_t msg_id, const uint64_t ns)
+        {
+            if (IsEnabled())
+            {
+                GetThreadEntry(msg_id).RecordHandle(ns);
+            }
+        }
+
+        //counters of msg_id in the calling thread, they live as long as the process,
+        //so hot paths may keep the reference and write it from this thread only
+        AFNetMsgStatsEntry& GetThreadEntry(const uint16_t msg_id)
+        {
+            return GetThreadStats()->GetEntry(msg_id);
+        }
+
+        //merge all threads, the counters are totals since process start
+        void GetStats(std::map<uint16_t, AFNetMsgIdStats>& stats)
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            for (auto thread_stats : threads_)
+            {
+                thread_stats->Merge(stats);
+            }
+        }
+
+    protected:
+        AFNetMsgStats() = default;
+
+        AFNetMsgStatsThread* GetThreadStats()
+        {
+            static thread_local AFNetMsgStatsThread* thread_stats = nullptr;
+            if (thread_stats == nullptr)
+            {
+                thread_stats = new AFNetMsgStatsThread();
+                std::lock_guard<std::mutex> guard(mutex_);
+                threads_.push_back(thread_stats);
+            }
+
+            return thread_stats;
+        }
+
+    private:
+        std::atomic<bool> enabled_{ true };
+        std::mutex mutex_;
+        //thread counters live as long as the process, counts of exited threads are kept
+        std::vector<AFNetMsgStatsThread*> threads_;
+    };
+
+    //times one msg handler in scope, nothing is read from the clock when stats are off
+    class AFNetMsgHandleTimer : public AFNoncopyable
+    {
+    public:
+        explicit AFNetMsgHandleTimer(const uint16_t msg_id)
+        {
+            if (AFNetMsgStats::Instance().IsEnabled())
+            {
+                Start(&AFNetMsgStats::Instance().GetThreadEntry(msg_id));
+            }
+        }
+
+        //entry of the calling thread, resolved by the caller already
+        explicit AFNetMsgHandleTimer(AFNetMsgStatsEntry& entry)
+        {
+            if (AFNetMsgStats::Instance().IsEnabled())
+            {
+                Start(&entry);
+            }
+        }
+
+        ~AFNetMsgHandleTimer()
+        {
+            if (entry_ != nullptr)
+            {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+                entry_->RecordHandle(uint64_t(ns));
+            }
+        }
+
+    protected:
+        void Start(AFNetMsgStatsEntry* entry)
+        {
+            entry_ = entry;
+            start_ = std::chrono::steady_clock::now();
+        }
+
+    private:
+        AFNetMsgStatsEntry* entry_{ nullptr };
+        std::chrono::steady_clock::time_point start_;
+    };
+
+}
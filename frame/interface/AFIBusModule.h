@@ -36,6 +36,9 @@ namespace ark
         //get a process info which act a server
         virtual const AFServerConfig* GetAppServerInfo() = 0;
 
+        //get the info of another process, udp clients take channels from the server they connect
+        virtual const AFServerConfig* GetAppServerInfo(const int bus_id) = 0;
+
         //get the host and port of a process
         virtual const std::string GetAppHost(const int bus_id) = 0;
 
@@ -43,6 +46,15 @@ namespace ark
         virtual bool GetDirectBusRelations(std::vector<AFServerConfig>& target_list) = 0;
         virtual bool IsUndirectBusRelation(const int bus_id) = 0;
 
+        //compress threshold of the relation between self and bus_id, 0 means sending raw
+        virtual uint32_t GetCompressThreshold(const int bus_id) = 0;
+
+        //connections from self to bus_id, at least 1
+        virtual uint32_t GetBusLanes(const int bus_id) = 0;
+
+        //self and bus_id are on the same host and both allow shared memory links
+        virtual bool IsShmBusRelation(const int bus_id) = 0;
+
         virtual const uint8_t GetSelfAppType() = 0;
         virtual const int GetSelfBusID() = 0;
         virtual const std::string GetSelfBusName() = 0;
@@ -51,6 +51,13 @@ namespace ark
             logger->log(log_level, new_fmt.c_str(), function, line, args...);
         }
 
+        //check before building expensive log arguments
+        bool ShouldLog(spdlog::level::level_enum log_level)
+        {
+            const std::shared_ptr<spdlog::async_logger>& logger = GetLogger();
+            return (logger != nullptr && logger->should_log(log_level));
+        }
+
         virtual const std::shared_ptr<spdlog::async_logger>& GetLogger() = 0;
     };
 
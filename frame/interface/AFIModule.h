@@ -61,6 +61,12 @@ namespace ark
             return true;
         }
 
+        //called after all modules updated in one frame
+        virtual bool PostUpdate()
+        {
+            return true;
+        }
+
         virtual bool PreShut()
         {
             return true;
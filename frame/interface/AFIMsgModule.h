@@ -21,6 +21,7 @@
 #pragma once
 
 #include "base/AFProtoCPP.hpp"
+#include "base/AFMsgArena.hpp"
 #include "base/AFDataNode.hpp"
 #include "base/AFDataTable.hpp"
 #include "AFIModule.h"
@@ -31,6 +32,27 @@
 namespace ark
 {
 
+    //serializes a pb msg straight into the outbound packet, ByteSizeLong() must be called
+    //on the msg first and the msg must not change until the send returns
+    class AFNetPBWriter : public AFNetIOWriter
+    {
+    public:
+        explicit AFNetPBWriter(const google::protobuf::Message& msg) :
+            msg_(msg)
+        {
+        }
+
+        bool Write(char* out, const size_t len) const override
+        {
+            uint8_t* begin = reinterpret_cast<uint8_t*>(out);
+            uint8_t* end = msg_.SerializeWithCachedSizesToArray(begin);
+            return (size_t(end - begin) == len);
+        }
+
+    private:
+        const google::protobuf::Message& msg_;
+    };
+
     class AFIMsgModule : public AFIModule
     {
     public:
@@ -46,6 +68,9 @@ namespace ark
 
         virtual bool SendSSMsgByRouter(const AFSSMsgHead& head) = 0;
 
+        //the arena of decoded msgs shared by all plugins, reset after every frame
+        virtual AFMsgArena& GetMsgArena() = 0;
+
         static bool RecvPB(const AFNetMsg* msg, std::string& strMsg, AFGUID& nPlayer)
         {
             strMsg.assign(msg->msg_data_, msg->length_);
@@ -53,9 +78,10 @@ namespace ark
             return true;
         }
 
+        //parse from the msg bytes in place, no copy of the body
         static bool RecvPB(const AFNetMsg* msg, google::protobuf::Message& pb_msg, AFGUID& actor_id)
         {
-            if (!pb_msg.ParseFromString(std::string(msg->msg_data_, msg->length_)))
+            if (!pb_msg.ParseFromArray(msg->msg_data_, int(msg->GetBodyLength())))
             {
                 return false;
             }
@@ -64,6 +90,22 @@ namespace ark
             return true;
         }
 
+        //the msg lives in the frame arena and is freed at the end of this frame
+        template<typename T>
+        T* RecvArenaPB(const AFNetMsg* msg, AFGUID& actor_id)
+        {
+            T* pb_msg = GetMsgArena().Create<T>();
+            return (RecvPB(msg, *pb_msg, actor_id) ? pb_msg : nullptr);
+        }
+
+        //the msg object is shared by all msgs of this type, see AFMsgArena::Reuse
+        template<typename T>
+        T* RecvReusePB(const AFNetMsg* msg, AFGUID& actor_id)
+        {
+            T* pb_msg = GetMsgArena().Reuse<T>();
+            return (RecvPB(msg, *pb_msg, actor_id) ? pb_msg : nullptr);
+        }
+
         static Point3D PBToVec(AFMsg::Point3D xPoint)
         {
             Point3D xID;
@@ -310,15 +352,27 @@ namespace ark
         return;                                                                                                         \
     }
 
+//pb_msg is a reference to a msg in the frame arena, it is gone after this frame.
+//the calling module needs m_pMsgModule which owns the arena
 #define ARK_PROCESS_MSG(msg, pb_msg_type)                                       \
+    ARK_PROCESS_MSG_IMPL(msg, pb_msg_type, m_pMsgModule->RecvArenaPB<pb_msg_type>)
+
+//pb_msg is the reused object of this type, for the hottest msg ids.
+//the calling module needs m_pMsgModule which owns the reused objects
+#define ARK_PROCESS_REUSE_MSG(msg, pb_msg_type)                                 \
+    ARK_PROCESS_MSG_IMPL(msg, pb_msg_type, m_pMsgModule->RecvReusePB<pb_msg_type>)
+
+#define ARK_PROCESS_MSG_IMPL(msg, pb_msg_type, recv_func)                       \
     AFGUID actor_id;                                                            \
-    pb_msg_type pb_msg;                                                         \
-    if (!AFIMsgModule::RecvPB(msg, pb_msg, actor_id))                           \
+    pb_msg_type* pb_msg_ptr = recv_func(msg, actor_id);                         \
+    if (pb_msg_ptr == nullptr)                                                  \
     {                                                                           \
-        ARK_LOG_ERROR("Parse msg error, msg_id={} pb_msg_type={}", msg->id_, pb_msg.GetTypeName()); \
+        ARK_LOG_ERROR("Parse msg error, msg_id={} pb_msg_type={}", msg->id_, pb_msg_type::default_instance().GetTypeName()); \
         return;                                                                 \
     }                                                                           \
-    else                                                                        \
+                                                                                \
+    pb_msg_type& pb_msg = *pb_msg_ptr;                                          \
+    if (m_pLogModule->ShouldLog(spdlog::level::debug))                          \
     {                                                                           \
         std::string pb_json;                                                    \
         google::protobuf::util::MessageToJsonString(pb_msg, &pb_json);          \
@@ -327,7 +381,7 @@ namespace ark
               msg->dst_bus_,                                                    \
               pb_msg.GetTypeName(),                                             \
               msg->id_,                                                         \
-              msg->length_,                                                     \
+              msg->GetBodyLength(),                                             \
               pb_json);                                                         \
     }
 
@@ -27,6 +27,7 @@
 #include "base/AFBuffer.hpp"
 #include "base/AFNetMsg.hpp"
 #include "base/AFNetEvent.hpp"
+#include "base/AFNetMsgStats.hpp"
 
 namespace ark
 {
@@ -39,6 +40,80 @@ namespace ark
     using NET_EVENT_FUNCTOR = std::function<void(const AFNetEvent*)>;
     using NET_EVENT_FUNCTOR_PTR = std::shared_ptr<NET_EVENT_FUNCTOR>;
 
+    //return true if the session should receive the broadcast
+    using NET_SESSION_FILTER = std::function<bool(const int64_t)>;
+
+    //called when pending send bytes of a session cross high water mark(congested) or get back to low water mark
+    using NET_BACKPRESSURE_FUNCTOR = std::function<void(const int64_t session_id, const bool congested, const size_t pending_bytes)>;
+
+    //what to do with a session which can not drain its send queue
+    enum class AFNetSlowPolicy : uint8_t
+    {
+        DROP = 0,       //droppable msgs are dropped while congested
+        DISCONNECT = 1, //close the session once congested
+        THROTTLE = 2,   //hold msgs in session until socket drains
+    };
+
+    //encodes a payload segment straight into the packet, it may be called more than once
+    class AFNetIOWriter
+    {
+    public:
+        virtual ~AFNetIOWriter() = default;
+
+        //out has exactly len bytes, false if the encoded size is not len
+        virtual bool Write(char* out, const size_t len) const = 0;
+    };
+
+    //one payload segment of a vectored send, the bytes come from writer_ instead of data_ if it is set
+    class AFNetIOVec
+    {
+    public:
+        const char* data_{ nullptr };
+        size_t len_{ 0 };
+        const AFNetIOWriter* writer_{ nullptr };
+
+        bool CopyTo(char* out) const
+        {
+            if (writer_ != nullptr)
+            {
+                return writer_->Write(out, len_);
+            }
+
+            if (len_ > 0)
+            {
+                memcpy(out, data_, len_);
+            }
+
+            return true;
+        }
+    };
+
+    //queue depth gauges of one net, refreshed every frame
+    class AFNetQueueStats
+    {
+    public:
+        size_t ready_sessions_{ 0 };        //sessions have msgs or events to process
+        size_t carried_sessions_{ 0 };      //ready sessions carried over to next frame by frame budget
+        uint32_t frame_msgs_{ 0 };          //msgs processed in last frame
+        uint64_t budget_hit_frames_{ 0 };   //frames stopped by frame budget
+        uint64_t idle_closed_sessions_{ 0 };//sessions closed by idle timeout
+        size_t congested_sessions_{ 0 };    //sessions over send high water mark
+        uint64_t dropped_msgs_{ 0 };        //droppable msgs dropped for congested sessions
+        uint64_t slow_closed_sessions_{ 0 };//sessions closed by slow consumer policy or hard limit
+        size_t outbound_msgs_{ 0 };         //msgs queued by a client while disconnected
+        size_t outbound_bytes_{ 0 };
+        uint64_t outbound_dropped_msgs_{ 0 };//msgs dropped by a disconnected client for a full queue
+    };
+
+    //send side compression counters of one msg id
+    class AFNetCompressStats
+    {
+    public:
+        uint64_t msgs_{ 0 };                //msgs sent compressed
+        uint64_t raw_bytes_{ 0 };           //body bytes before compression
+        uint64_t compressed_bytes_{ 0 };    //body bytes on the wire
+    };
+
     class AFINet
     {
     public:
@@ -60,13 +135,237 @@ namespace ark
         virtual bool Shutdown() = 0;
 
         virtual bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) = 0;
+
+        //head and payload segments are queued as one packet, head->length_ must be the sum of segments
+        virtual bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id)
+        {
+            return false;
+        }
+
         virtual bool BroadcastMsg(AFMsgHead* head, const char* msg_data)
         {
             return false;
         }
 
+        //the packet is encoded once and shared by all target sessions
+        virtual bool BroadcastMsg(AFMsgHead* head, const char* msg_data, const NET_SESSION_FILTER& filter)
+        {
+            return false;
+        }
+
+        virtual bool BroadcastMsg(AFMsgHead* head, const char* msg_data, const std::vector<int64_t>& session_list)
+        {
+            return false;
+        }
+
         virtual bool CloseSession(const int64_t& session_id) = 0;
 
+        //all children of batch go out in one frame, id_ and length_ of head are set here
+        bool SendBatch(AFMsgHead* head, const AFMsgBatch& batch, const int64_t session_id)
+        {
+            if (head == nullptr || batch.Empty())
+            {
+                return false;
+            }
+
+            const std::string& body = batch.GetBody();
+            head->id_ = 0;
+            head->length_ = uint32_t(body.size()) | ARK_MSG_BATCH_FLAG;
+
+            AFNetIOVec iov;
+            iov.data_ = body.data();
+            iov.len_ = body.size();
+            return SendMsgV(head, &iov, 1, session_id);
+        }
+
+        //an empty batch frame, the receiver only refreshes the idle time of this session
+        virtual bool SendHeartbeat(const int64_t session_id)
+        {
+            AFSSMsgHead head;
+            AFMsgBatchHead body;
+            head.length_ = uint32_t(sizeof(body)) | ARK_MSG_BATCH_FLAG;
+
+            AFNetIOVec iov;
+            iov.data_ = reinterpret_cast<const char*>(&body);
+            iov.len_ = sizeof(body);
+            return SendMsgV(&head, &iov, 1, session_id);
+        }
+
+        //bytes queued to the socket of the session and not written yet
+        virtual size_t GetSessionPendingBytes(const int64_t session_id)
+        {
+            return 0;
+        }
+
+        //traffic totals of every session, the caller derives rates from two samples
+        virtual void GetSessionTraffic(std::vector<AFNetSessionTraffic>& traffic)
+        {
+        }
+
+        //override the net compress threshold of one session, 0 means sending raw
+        virtual bool SetSessionCompressThreshold(const int64_t session_id, const uint32_t threshold)
+        {
+            return false;
+        }
+
+        //send staged msgs of one session right now, for latency-critical msgs in coalescing mode
+        virtual bool Flush(const int64_t session_id)
+        {
+            return true;
+        }
+
+        //called at the end of every frame
+        virtual void FlushAll()
+        {
+        }
+
+        //client only, hand the msgs queued while disconnected to net, which sends or queues them in order
+        virtual void MoveOutbound(AFINet* net)
+        {
+        }
+
+        //coalescing mode, msgs sent in one frame are staged per session and queued as one packet
+        //at frame end, or as soon as the staged bytes reach threshold
+        void SetCoalesce(bool value, size_t threshold = ARK_NET_COALESCE_THRESHOLD)
+        {
+            coalesce_ = value;
+            coalesce_threshold_ = threshold;
+        }
+
+        bool IsCoalesce() const
+        {
+            return coalesce_;
+        }
+
+        size_t GetCoalesceThreshold() const
+        {
+            return coalesce_threshold_;
+        }
+
+        //listen with thread_num SO_REUSEPORT acceptors, every acceptor has its own worker loop
+        //must be set before StartServer, fall back to single listen thread if not supported
+        void SetReusePort(bool value)
+        {
+            reuse_port_ = value;
+        }
+
+        bool IsReusePort() const
+        {
+            return reuse_port_;
+        }
+
+        //session_budget: max msgs of one session in one frame
+        //frame_budget: max msgs of all sessions in one frame, 0 means no limit, the rest sessions go first in next frame
+        void SetMsgBudget(uint32_t session_budget, uint32_t frame_budget)
+        {
+            session_msg_budget_ = std::max<uint32_t>(session_budget, 1);
+            frame_msg_budget_ = frame_budget;
+        }
+
+        uint32_t GetSessionMsgBudget() const
+        {
+            return session_msg_budget_;
+        }
+
+        uint32_t GetFrameMsgBudget() const
+        {
+            return frame_msg_budget_;
+        }
+
+        const AFNetQueueStats& GetQueueStats() const
+        {
+            return queue_stats_;
+        }
+
+        //msg body not smaller than threshold is lz4 compressed, 0 means off
+        //new sessions take this value, must be set before StartServer or StartClient
+        void SetCompressThreshold(uint32_t threshold)
+        {
+            compress_threshold_ = threshold;
+        }
+
+        uint32_t GetCompressThreshold() const
+        {
+            return compress_threshold_;
+        }
+
+        const std::unordered_map<uint16_t, AFNetCompressStats>& GetCompressStats() const
+        {
+            return compress_stats_;
+        }
+
+        //sessions received nothing in timeout seconds are closed, 0 means never
+        void SetIdleTimeout(uint32_t timeout)
+        {
+            idle_timeout_ = timeout;
+        }
+
+        uint32_t GetIdleTimeout() const
+        {
+            return idle_timeout_;
+        }
+
+        uint64_t GetIdleTimeoutMs() const
+        {
+            return uint64_t(idle_timeout_) * 1000;
+        }
+
+        //per-session send queue water marks, high 0 means no limit, must be set before StartServer
+        void SetSendWaterMark(size_t high, size_t low, AFNetSlowPolicy policy)
+        {
+            send_high_water_ = high;
+            send_low_water_ = std::min(low, high);
+            slow_policy_ = policy;
+        }
+
+        size_t GetSendHighWater() const
+        {
+            return send_high_water_;
+        }
+
+        size_t GetSendLowWater() const
+        {
+            return send_low_water_;
+        }
+
+        AFNetSlowPolicy GetSlowPolicy() const
+        {
+            return slow_policy_;
+        }
+
+        void SetBackpressureCallback(const NET_BACKPRESSURE_FUNCTOR& cb)
+        {
+            backpressure_cb_ = cb;
+        }
+
+        //msgs of this id may be dropped for congested sessions in DROP policy
+        void SetDroppableMsg(const uint16_t msg_id, bool value)
+        {
+            if (droppable_msgs_.empty())
+            {
+                droppable_msgs_.resize(std::numeric_limits<uint16_t>::max() + 1, false);
+            }
+
+            droppable_msgs_[msg_id] = value;
+        }
+
+        bool IsDroppableMsg(const uint16_t msg_id) const
+        {
+            return (!droppable_msgs_.empty() && droppable_msgs_[msg_id]);
+        }
+
+        //client only, msgs sent while disconnected are queued up to limit bytes
+        //and replayed in order once connected again, 0 means dropped
+        void SetOutboundQueueLimit(size_t limit)
+        {
+            outbound_queue_limit_ = limit;
+        }
+
+        size_t GetOutboundQueueLimit() const
+        {
+            return outbound_queue_limit_;
+        }
+
         bool IsWorking() const
         {
             return working_;
@@ -77,8 +376,59 @@ namespace ark
             working_ = value;
         }
 
+    protected:
+        AFNetQueueStats queue_stats_;
+        std::unordered_map<uint16_t, AFNetCompressStats> compress_stats_;
+        NET_BACKPRESSURE_FUNCTOR backpressure_cb_{ nullptr };
+
+        //per msg id send counters, a broadcast counts once
+        void RecordSend(const AFMsgHead* head)
+        {
+            AFNetMsgStats::Instance().RecordSend(head->id_, head->GetBodyLength());
+        }
+
+        //call after a msg was appended to a packet, wire_len is the body length on the wire
+        void RecordCompress(const AFMsgHead* head, const size_t wire_len)
+        {
+            if (wire_len >= head->GetBodyLength())
+            {
+                return;
+            }
+
+            AFNetCompressStats& stats = compress_stats_[head->id_];
+            ++stats.msgs_;
+            stats.raw_bytes_ += head->GetBodyLength();
+            stats.compressed_bytes_ += wire_len;
+        }
+
+        //coarse ms clock, refreshed by the logic thread every frame and read by IO threads on recv
+        uint64_t GetNetTime() const
+        {
+            return net_time_.load(std::memory_order_relaxed);
+        }
+
+        uint64_t UpdateNetTime()
+        {
+            uint64_t now = uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+            net_time_.store(now, std::memory_order_relaxed);
+            return now;
+        }
+
     private:
         bool working_{ false };
+        bool coalesce_{ false };
+        bool reuse_port_{ false };
+        size_t coalesce_threshold_{ ARK_NET_COALESCE_THRESHOLD };
+        uint32_t compress_threshold_{ 0 };
+        uint32_t idle_timeout_{ 0 };
+        size_t send_high_water_{ 0 };
+        size_t send_low_water_{ 0 };
+        AFNetSlowPolicy slow_policy_{ AFNetSlowPolicy::DROP };
+        std::vector<bool> droppable_msgs_;
+        size_t outbound_queue_limit_{ 0 };
+        std::atomic<uint64_t> net_time_{ 0 };
+        uint32_t session_msg_budget_{ ARK_PROCESS_NET_MSG_COUNT_ONCE };
+        uint32_t frame_msg_budget_{ ARK_PROCESS_NET_MSG_COUNT_FRAME };
 
     public:
         size_t statistic_recv_size_{ 0 };
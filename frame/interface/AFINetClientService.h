@@ -47,9 +47,15 @@ namespace ark
         int server_bus_id_{ 0 };
         AFEndpoint endpoint_;
         AFINet* net_client_ptr_{ nullptr };
+        bool shm_{ false };                     //same host shm peer, net goes through shared memory while the peer listens on it, tcp otherwise
+        bool shm_net_{ false };                 //net_client_ptr_ is the shm client, checked again at every connect
 
         ConnectState net_state_{ DISCONNECT }; //net state
         int64_t last_active_time_{ 0 };
+        int64_t next_heartbeat_time_{ 0 };
+        int64_t next_reconnect_time_{ 0 };
+        uint32_t retry_times_{ 0 };             //failed connects since last connected, drives the backoff
+        uint64_t reconnect_count_{ 0 };         //reconnect attempts in total
     };
 
     class AFINetClientService : public AFNoncopyable
@@ -80,6 +86,7 @@ namespace ark
 
         virtual bool StartClient(const AFHeadLength head_len, const int& target_bus_id, const AFEndpoint& endpoint) = 0;
         virtual void Update() = 0;
+        virtual void FlushAll() = 0;
         virtual void Shutdown() = 0;
 
         virtual const ARK_SHARE_PTR<AFConnectionData>& GetServerNetInfo(const int nServerID) = 0;
@@ -76,7 +76,7 @@ namespace ark
             return RegNetEventCallback(std::make_shared<NET_EVENT_FUNCTOR>(functor));
         }
 
-        virtual bool Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection) = 0;
+        virtual bool Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection, const bool reuse_port = false, const bool io_uring = false, const bool shm = false) = 0;
         virtual bool Update() = 0;
 
         //virtual bool SendBroadcastMsg(const int nMsgID, const std::string& msg, const AFGUID& player_id) = 0;
@@ -84,6 +84,8 @@ namespace ark
         //virtual bool SendPBMsg(const uint16_t msg_id, const google::protobuf::Message& pb_msg, const AFGUID& connect_id, const AFGUID& player_id, const std::vector<AFGUID>* target_list = nullptr) = 0;
         //virtual bool SendMsg(const uint16_t msg_id, const std::string& data, const AFGUID& connect_id, const AFGUID& player_id, const std::vector<AFGUID>* target_list = nullptr) = 0;
         virtual AFINet* GetNet() = 0;
+        //shared memory listener for same host bus peers, null if not started
+        virtual AFINet* GetShmNet() = 0;
 
         virtual bool RegMsgCallback(const int nMsgID, const NET_MSG_FUNCTOR_PTR& cb) = 0;
         virtual bool RegForwardMsgCallback(const NET_MSG_FUNCTOR_PTR& cb) = 0;
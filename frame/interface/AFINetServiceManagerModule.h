@@ -44,6 +44,10 @@ namespace ark
         virtual bool AddNetConnectionBus(int client_bus_id, AFINet* net_server_ptr) = 0;
         virtual bool RemoveNetConnectionBus(int client_bus_id) = 0;
         virtual AFINet* GetNetConnectionBus(int src_bus, int target_bus) = 0;
+
+        //per msg id counters and handler times, server queue stats and the busiest sessions
+        //session rates are measured since the last dump
+        virtual void DumpNetStats(std::string& stats) = 0;
     };
 
 }
\ No newline at end of file
@@ -27,6 +27,45 @@
 namespace ark
 {
 
+    //optional attribute, default_value if not configured
+    template<typename T>
+    static T GetAttr(rapidxml::xml_node<>* node, const char* name, const T& default_value)
+    {
+        rapidxml::xml_attribute<>* attr = node->first_attribute(name);
+        return (attr != nullptr ? T(ARK_LEXICAL_CAST<int>(attr->value())) : default_value);
+    }
+
+    //optional list attribute like "a,b,c", empty if not configured
+    static std::vector<std::string> GetListAttr(rapidxml::xml_node<>* node, const char* name)
+    {
+        std::vector<std::string> items;
+        rapidxml::xml_attribute<>* attr = node->first_attribute(name);
+        if (attr == nullptr)
+        {
+            return items;
+        }
+
+        std::string value(attr->value());
+        size_t begin = 0;
+        while (begin < value.size())
+        {
+            size_t end = value.find(',', begin);
+            if (end == std::string::npos)
+            {
+                end = value.size();
+            }
+
+            if (end > begin)
+            {
+                items.push_back(value.substr(begin, end - begin));
+            }
+
+            begin = end + 1;
+        }
+
+        return items;
+    }
+
     bool AFCBusModule::Init()
     {
         if (!LoadProcConfig())
@@ -88,6 +127,43 @@ namespace ark
             int max_connection = ARK_LEXICAL_CAST<int>(pServerNode->first_attribute("max_connection")->value());
             uint8_t thread_num = ARK_LEXICAL_CAST<int>(pServerNode->first_attribute("thread_num")->value());
 
+            //optional attributes, the defaults are listed in proc.xml
+            AFServerConfig proc_config;
+            proc_config.max_connection = max_connection;
+            proc_config.thread_num = thread_num;
+            proc_config.reuse_port = GetAttr(pServerNode, "reuse_port", proc_config.reuse_port);
+            proc_config.io_uring = GetAttr(pServerNode, "io_uring", proc_config.io_uring);
+            proc_config.shm = GetAttr(pServerNode, "shm", proc_config.shm);
+            proc_config.session_msg_budget = GetAttr(pServerNode, "session_msg_budget", proc_config.session_msg_budget);
+            proc_config.frame_msg_budget = GetAttr(pServerNode, "frame_msg_budget", proc_config.frame_msg_budget);
+            proc_config.idle_timeout = GetAttr(pServerNode, "idle_timeout", proc_config.idle_timeout);
+            proc_config.send_high_water = GetAttr(pServerNode, "send_high_water", proc_config.send_high_water);
+            proc_config.send_low_water = GetAttr(pServerNode, "send_low_water", proc_config.send_low_water);
+            proc_config.slow_policy = GetAttr(pServerNode, "slow_policy", proc_config.slow_policy);
+            proc_config.coalesce = GetAttr(pServerNode, "coalesce", proc_config.coalesce);
+            proc_config.stats_interval = GetAttr(pServerNode, "stats_interval", proc_config.stats_interval);
+            proc_config.reconnect_min = GetAttr(pServerNode, "reconnect_min", proc_config.reconnect_min);
+            proc_config.reconnect_max = GetAttr(pServerNode, "reconnect_max", proc_config.reconnect_max);
+            proc_config.reconnect_queue = GetAttr(pServerNode, "reconnect_queue", proc_config.reconnect_queue);
+
+            for (const auto& mode : GetListAttr(pServerNode, "udp_channels"))
+            {
+                proc_config.udp_channels.push_back(uint8_t(ARK_LEXICAL_CAST<int>(mode)));
+            }
+
+            //msg_id:channel
+            for (const auto& route : GetListAttr(pServerNode, "udp_msg_channels"))
+            {
+                size_t pos = route.find(':');
+                if (pos == std::string::npos)
+                {
+                    continue;
+                }
+
+                uint16_t msg_id = uint16_t(ARK_LEXICAL_CAST<int>(route.substr(0, pos)));
+                proc_config.udp_msg_channels[msg_id] = uint8_t(ARK_LEXICAL_CAST<int>(route.substr(pos + 1)));
+            }
+
             std::vector<AFServerConfig> instances;
             for (rapidxml::xml_node<>* pProcNode = pServerNode->first_node(); pProcNode != nullptr; pProcNode = pProcNode->next_sibling())
             {
@@ -97,11 +173,9 @@ namespace ark
 
                 for (uint8_t i = start; i <= end; ++i)
                 {
-                    AFServerConfig server_config;
+                    AFServerConfig server_config(proc_config);
                     AFBusAddr server_bus(self_bus_id.channel_id, self_bus_id.zone_id, proc_id, i);
                     server_config.self_id = server_bus.bus_id;
-                    server_config.max_connection = max_connection;
-                    server_config.thread_num = thread_num;
                     uint16_t port = CalcProcPort(server_bus);
                     std::error_code ec;
 #if ARK_PLATFORM == PLATFORM_WIN
@@ -149,6 +223,22 @@ namespace ark
             const uint8_t& proc_type = GetAppType(proc);
             const uint8_t& target_proc_type = GetAppType(target_proc);
 
+            //optional, msg body not smaller than this is compressed on both directions
+            int compress_threshold = GetAttr(pRelationNode, "compress", 0);
+            if (compress_threshold > 0)
+            {
+                mxBusCompress[proc_type][target_proc_type] = compress_threshold;
+                mxBusCompress[target_proc_type][proc_type] = compress_threshold;
+            }
+
+            //optional, connections between one pair of processes, msgs of one actor keep on one lane
+            int lanes = GetAttr(pRelationNode, "lanes", 1);
+            if (lanes > 1)
+            {
+                mxBusLanes[proc_type][target_proc_type] = uint32_t(lanes);
+                mxBusLanes[target_proc_type][proc_type] = uint32_t(lanes);
+            }
+
             auto iter = mxBusRelations.find(proc_type);
             if (iter != mxBusRelations.end())
             {
@@ -203,6 +293,11 @@ namespace ark
         return GetAppServerInfo(bus_addr);
     }
 
+    const AFServerConfig* AFCBusModule::GetAppServerInfo(const int bus_id)
+    {
+        return GetAppServerInfo(AFBusAddr(bus_id));
+    }
+
     const AFServerConfig* AFCBusModule::GetAppServerInfo(const AFBusAddr& bus_addr)
     {
         auto iter = mxProcConfig.instances.find(bus_addr.proc_id);
@@ -285,6 +380,50 @@ namespace ark
         }
     }
 
+    uint32_t AFCBusModule::GetCompressThreshold(const int bus_id)
+    {
+        AFBusAddr target_bus(bus_id);
+        auto iter = mxBusCompress.find(GetSelfAppType());
+        if (iter == mxBusCompress.end())
+        {
+            return 0;
+        }
+
+        auto it = iter->second.find(target_bus.proc_id);
+        return ((it != iter->second.end()) ? it->second : 0);
+    }
+
+    uint32_t AFCBusModule::GetBusLanes(const int bus_id)
+    {
+        AFBusAddr target_bus(bus_id);
+        auto iter = mxBusLanes.find(GetSelfAppType());
+        if (iter == mxBusLanes.end())
+        {
+            return 1;
+        }
+
+        auto it = iter->second.find(target_bus.proc_id);
+        return ((it != iter->second.end()) ? it->second : 1);
+    }
+
+    bool AFCBusModule::IsShmBusRelation(const int bus_id)
+    {
+        if (bus_id == GetSelfBusID())
+        {
+            return false;
+        }
+
+        const AFServerConfig* self_config = GetAppServerInfo();
+        const AFServerConfig* target_config = GetAppServerInfo(AFBusAddr(bus_id));
+        if (self_config == nullptr || target_config == nullptr || !self_config->shm || !target_config->shm)
+        {
+            return false;
+        }
+
+        //host names may differ, the resolved ip decides
+        return (self_config->public_ep_.GetIP() == target_config->public_ep_.GetIP());
+    }
+
     bool AFCBusModule::IsUndirectBusRelation(const int bus_id)
     {
         if (bus_id == GetSelfBusID())
@@ -35,10 +35,14 @@ namespace ark
         const uint8_t GetAppType(const std::string& name) override;
 
         const AFServerConfig* GetAppServerInfo() override;
+        const AFServerConfig* GetAppServerInfo(const int bus_id) override;
         const std::string GetAppHost(const int bus_id) override;
 
         bool GetDirectBusRelations(std::vector<AFServerConfig>& target_list) override;
         bool IsUndirectBusRelation(const int bus_id) override;
+        uint32_t GetCompressThreshold(const int bus_id) override;
+        uint32_t GetBusLanes(const int bus_id) override;
+        bool IsShmBusRelation(const int bus_id) override;
 
         const uint8_t GetSelfAppType() override;
         const int GetSelfBusID() override;
@@ -56,6 +60,8 @@ namespace ark
     private:
         AFProcConfig mxProcConfig;
         std::map<uint8_t, std::map<uint8_t, bool>> mxBusRelations;
+        std::map<uint8_t, std::map<uint8_t, uint32_t>> mxBusCompress;
+        std::map<uint8_t, std::map<uint8_t, uint32_t>> mxBusLanes;
     };
 
 }
\ No newline at end of file
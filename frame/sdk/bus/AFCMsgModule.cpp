@@ -33,6 +33,18 @@ namespace ark
         return true;
     }
 
+    //msgs decoded in this frame are all handled in Update of every module
+    bool AFCMsgModule::PostUpdate()
+    {
+        msg_arena_.Reset();
+        return true;
+    }
+
+    AFMsgArena& AFCMsgModule::GetMsgArena()
+    {
+        return msg_arena_;
+    }
+
     bool AFCMsgModule::SendSuitSSMsg(const uint8_t app_type, const std::string& hash_key, const int msg_id, const google::protobuf::Message& msg, const AFGUID& actor_id/* = 0*/)
     {
         uint32_t crc32 = AFCRC32::Sum(hash_key);
@@ -47,30 +59,38 @@ namespace ark
 
     bool AFCMsgModule::SendParticularSSMsg(const int bus_id, const int msg_id, const google::protobuf::Message& msg, const AFGUID& conn_id, const AFGUID& actor_id/* = 0*/)
     {
-        std::string msg_data = msg.SerializeAsString();
         return SendSSMsg(bus_id, msg_id, msg, conn_id, actor_id);
     }
 
     //////////////////////////////////////////////////////////////////////////
 
+    //the msg is serialized once, right into the packet of the net
     bool AFCMsgModule::SendSSMsg(const int target_bus, const int msg_id, const google::protobuf::Message& msg, const AFGUID& conn_id, const AFGUID& actor_id/* = 0*/)
     {
-        std::string msg_data;
-        ARK_ASSERT_RET_VAL(msg.SerializeToString(&msg_data), false);
+        //caches the sizes of all sub-messages for SerializeWithCachedSizesToArray
+        size_t msg_len = msg.ByteSizeLong();
 
         int src_bus = m_pBusModule->GetSelfBusID();
 #if ARK_RUN_MODE == ARK_RUN_MODE_DEBUG
-        std::string pb_json;
-        google::protobuf::util::MessageToJsonString(msg, &pb_json);
-        ARK_LOG_DEBUG("Send msg log\nsrc={}\ndst={}\nmsg_name={}\nmsg_id={}\nmsg_len={}\nmsg_data={}",
-                      AFMisc::Bus2Str(src_bus),
-                      AFMisc::Bus2Str(target_bus),
-                      msg.GetTypeName(),
-                      msg_id,
-                      msg_data.length(),
-                      pb_json);
+        if (m_pLogModule->ShouldLog(spdlog::level::debug))
+        {
+            std::string pb_json;
+            google::protobuf::util::MessageToJsonString(msg, &pb_json);
+            ARK_LOG_DEBUG("Send msg log\nsrc={}\ndst={}\nmsg_name={}\nmsg_id={}\nmsg_len={}\nmsg_data={}",
+                          AFMisc::Bus2Str(src_bus),
+                          AFMisc::Bus2Str(target_bus),
+                          msg.GetTypeName(),
+                          msg_id,
+                          msg_len,
+                          pb_json);
+        }
 #endif
-        return SendSSMsg(src_bus, target_bus, msg_id, msg_data.c_str(), msg_data.length(), conn_id, actor_id);
+
+        AFNetPBWriter writer(msg);
+        AFNetIOVec body;
+        body.len_ = msg_len;
+        body.writer_ = &writer;
+        return SendSSMsgV(src_bus, target_bus, msg_id, body, conn_id, actor_id);
     }
 
     bool AFCMsgModule::SendSSMsg(const int target_bus, const int msg_id, const char* msg, const int msg_len, const AFGUID& conn_id, const AFGUID& actor_id /*= 0*/)
@@ -79,10 +99,23 @@ namespace ark
     }
 
     bool AFCMsgModule::SendSSMsg(const int src_bus, const int target_bus, const int msg_id, const char* msg_data, const int msg_len, const AFGUID& session_id, const AFGUID& actor_id/* = 0*/)
+    {
+        if (msg_data == nullptr || msg_len < 0)
+        {
+            return false;
+        }
+
+        AFNetIOVec body;
+        body.data_ = msg_data;
+        body.len_ = size_t(msg_len);
+        return SendSSMsgV(src_bus, target_bus, msg_id, body, session_id, actor_id);
+    }
+
+    bool AFCMsgModule::SendSSMsgV(const int src_bus, const int target_bus, const int msg_id, const AFNetIOVec& body, const AFGUID& session_id, const AFGUID& actor_id)
     {
         AFSSMsgHead head;
         head.id_ = msg_id;
-        head.length_ = msg_len;
+        head.length_ = uint32_t(body.len_);
         head.actor_id_ = actor_id;
         head.src_bus_ = src_bus;
         head.dst_bus_ = target_bus;
@@ -90,7 +123,7 @@ namespace ark
         AFINet* net_ptr = m_pNetServiceManagerModule->GetNetConnectionBus(src_bus, target_bus);
         if (net_ptr != nullptr)
         {
-            return net_ptr->SendMsg(&head, msg_data, session_id);
+            return net_ptr->SendMsgV(&head, &body, 1, session_id);
         }
 
         ARK_LOG_ERROR("send ss msg error, src_bus={} target_bus={} msg_id={} conn_id={} target_role_id={}", src_bus, target_bus, msg_id, session_id, actor_id);
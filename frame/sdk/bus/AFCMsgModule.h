@@ -34,6 +34,7 @@ namespace ark
         explicit AFCMsgModule() = default;
 
         bool Init() override;
+        bool PostUpdate() override;
 
         bool SendSuitSSMsg(const uint8_t app_type, const std::string& hash_key, const int msg_id, const google::protobuf::Message& msg, const AFGUID& actor_id = 0) override;
         bool SendSuitSSMsg(const uint8_t app_type, const uint32_t& hash_value, const int msg_id, const google::protobuf::Message& msg, const AFGUID& actor_id = 0) override;
@@ -45,10 +46,17 @@ namespace ark
 
         bool SendSSMsgByRouter(const AFSSMsgHead& head) override;
 
+        AFMsgArena& GetMsgArena() override;
+
+    protected:
+        bool SendSSMsgV(const int src_bus, const int target_bus, const int msg_id, const AFNetIOVec& body, const AFGUID& session_id, const AFGUID& actor_id);
+
     private:
         AFINetServiceManagerModule* m_pNetServiceManagerModule;
         AFIBusModule* m_pBusModule;
         AFILogModule* m_pLogModule;
+
+        AFMsgArena msg_arena_;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,608 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCIOUringServer.h"
+#include "AFNetAcceptor.h"
+
+#if defined(ARK_HAVE_IO_URING)
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_IO_URING_ENTRIES = 4096;
+    ARK_CONSTEXPR static const uint16_t ARK_IO_URING_BUF_GROUP = 0;
+    ARK_CONSTEXPR static const uint16_t ARK_IO_URING_BUF_COUNT = 512;         //must be power of 2
+    ARK_CONSTEXPR static const uint32_t ARK_IO_URING_BUF_SIZE = 16 * 1024;
+    ARK_CONSTEXPR static const size_t ARK_IO_URING_MAX_SEND_IOV = 64;         //packets per sendmsg
+
+    //////////////////////////////////////////////////////////////////////////
+    void AFIOUringConn::send(const std::shared_ptr<std::string>& packet)
+    {
+        if (packet == nullptr || packet->empty())
+        {
+            return;
+        }
+
+        out_queue_.Push(packet);
+
+        //one send request per batch, the worker clears the flag before taking the packets
+        if (!send_scheduled_.exchange(true, std::memory_order_acq_rel))
+        {
+            worker_->PostSend(session_id_);
+        }
+    }
+
+    void AFIOUringConn::postDisConnect()
+    {
+        worker_->PostClose(session_id_);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    AFIOUringWorker::~AFIOUringWorker()
+    {
+        Stop();
+    }
+
+    bool AFIOUringWorker::Start(int listen_fd)
+    {
+        listen_fd_ = listen_fd;
+
+        if (!ring_.Init(ARK_IO_URING_ENTRIES))
+        {
+            return false;
+        }
+
+        if (!ring_.RegisterBufRing(ARK_IO_URING_BUF_GROUP, ARK_IO_URING_BUF_COUNT, ARK_IO_URING_BUF_SIZE))
+        {
+            return false;
+        }
+
+        event_fd_ = ::eventfd(0, EFD_CLOEXEC);
+        if (event_fd_ < 0)
+        {
+            return false;
+        }
+
+        running_ = true;
+        thread_ = std::thread([this]()
+        {
+            Run();
+        });
+
+        return true;
+    }
+
+    void AFIOUringWorker::Stop()
+    {
+        if (running_)
+        {
+            running_ = false;
+            Wakeup();
+        }
+
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        for (auto& iter : conns_)
+        {
+            ::close(iter.second->fd_);
+        }
+
+        conns_.clear();
+        ring_.Close();
+
+        if (listen_fd_ >= 0)
+        {
+            ::close(listen_fd_);
+            listen_fd_ = -1;
+        }
+
+        if (event_fd_ >= 0)
+        {
+            ::close(event_fd_);
+            event_fd_ = -1;
+        }
+    }
+
+    void AFIOUringWorker::PostSend(const int64_t session_id)
+    {
+        send_requests_.Push(session_id);
+        Wakeup();
+    }
+
+    void AFIOUringWorker::PostClose(const int64_t session_id)
+    {
+        close_requests_.Push(session_id);
+        Wakeup();
+    }
+
+    void AFIOUringWorker::Wakeup()
+    {
+        //many requests in one loop only cost one eventfd write
+        if (!wakeup_pending_.exchange(true, std::memory_order_acq_rel))
+        {
+            uint64_t value = 1;
+            ssize_t ret = ::write(event_fd_, &value, sizeof(value));
+            (void)ret;
+        }
+    }
+
+    void AFIOUringWorker::Run()
+    {
+        ArmAccept();
+        ArmWakeup();
+
+        while (running_)
+        {
+            //all SQEs prepared in last loop go to kernel with this call
+            if (ring_.Submit(1) < 0 && errno != EBUSY && errno != EAGAIN)
+            {
+                break;
+            }
+
+            ring_.ForEachCqe([this](const struct io_uring_cqe& cqe)
+            {
+                HandleCqe(cqe);
+            });
+
+            ring_.CommitBufs();
+        }
+    }
+
+    void AFIOUringWorker::ArmAccept()
+    {
+        struct io_uring_sqe* sqe = ring_.GetSqe();
+        if (sqe == nullptr)
+        {
+            return;
+        }
+
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = MakeUserData(0, OP_ACCEPT);
+    }
+
+    void AFIOUringWorker::ArmWakeup()
+    {
+        struct io_uring_sqe* sqe = ring_.GetSqe();
+        if (sqe == nullptr)
+        {
+            return;
+        }
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = event_fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&event_value_);
+        sqe->len = sizeof(event_value_);
+        sqe->user_data = MakeUserData(0, OP_WAKEUP);
+    }
+
+    void AFIOUringWorker::ArmRecv(AFIOUringConn::PTR& conn)
+    {
+        struct io_uring_sqe* sqe = ring_.GetSqe();
+        if (sqe == nullptr)
+        {
+            CloseConn(conn);
+            return;
+        }
+
+        //keeps producing CQEs until error or EOF, data lands in the provided buffers
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn->fd_;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = ring_.GetBufGroup();
+        sqe->user_data = MakeUserData(conn->session_id_, OP_RECV);
+        ++conn->inflight_ops_;
+    }
+
+    void AFIOUringWorker::SubmitSend(AFIOUringConn::PTR& conn)
+    {
+        if (conn->send_in_flight_ || conn->closing_ || conn->pending_.empty())
+        {
+            return;
+        }
+
+        //all queued packets of this connection go out with one sendmsg
+        while (!conn->pending_.empty() && conn->sending_.size() < ARK_IO_URING_MAX_SEND_IOV)
+        {
+            const std::shared_ptr<std::string>& packet = conn->pending_.front();
+
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>(packet->data());
+            iov.iov_len = packet->size();
+            conn->send_iov_.push_back(iov);
+            conn->sending_.push_back(packet);
+            conn->pending_.pop_front();
+        }
+
+        memset(&conn->send_msg_, 0, sizeof(conn->send_msg_));
+        conn->send_msg_.msg_iov = conn->send_iov_.data();
+        conn->send_msg_.msg_iovlen = conn->send_iov_.size();
+
+        struct io_uring_sqe* sqe = ring_.GetSqe();
+        if (sqe == nullptr)
+        {
+            CloseConn(conn);
+            return;
+        }
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn->send_msg_);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = MakeUserData(conn->session_id_, OP_SEND);
+        conn->send_in_flight_ = true;
+        ++conn->inflight_ops_;
+    }
+
+    void AFIOUringWorker::HandleCqe(const struct io_uring_cqe& cqe)
+    {
+        AFIOUringOp op = AFIOUringOp(cqe.user_data & 0x7);
+        int64_t session_id = int64_t(cqe.user_data >> 3);
+
+        switch (op)
+        {
+        case OP_ACCEPT:
+            OnAccept(cqe.res, cqe.flags);
+            return;
+        case OP_WAKEUP:
+            OnWakeup();
+            return;
+        default:
+            break;
+        }
+
+        auto iter = conns_.find(session_id);
+        if (iter == conns_.end())
+        {
+            //connection is gone, still give the buffer back
+            if ((cqe.flags & IORING_CQE_F_BUFFER) != 0)
+            {
+                ring_.AddBuf(uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+
+            return;
+        }
+
+        AFIOUringConn::PTR conn = iter->second;
+        if (op == OP_RECV)
+        {
+            OnRecv(conn, cqe.res, cqe.flags);
+        }
+        else if (op == OP_SEND)
+        {
+            OnSend(conn, cqe.res);
+        }
+    }
+
+    void AFIOUringWorker::OnAccept(const int res, const uint32_t flags)
+    {
+        if (res >= 0)
+        {
+            int fd = res;
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+            char ip[INET6_ADDRSTRLEN] = { 0 };
+            struct sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            if (::getpeername(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len) == 0)
+            {
+                if (addr.ss_family == AF_INET6)
+                {
+                    ::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_addr, ip, sizeof(ip));
+                }
+                else
+                {
+                    ::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(&addr)->sin_addr, ip, sizeof(ip));
+                }
+            }
+
+            AFIOUringConn::PTR conn = std::make_shared<AFIOUringConn>(this, fd, server_->NewSessionId(), ip);
+            conns_.insert(std::make_pair(conn->session_id_, conn));
+            server_->OnConnected(conn->session_id_, conn, conn->ip_);
+            ArmRecv(conn);
+        }
+
+        //multishot accept was terminated, arm it again
+        if ((flags & IORING_CQE_F_MORE) == 0 && running_ && res != -EBADF && res != -EINVAL)
+        {
+            ArmAccept();
+        }
+    }
+
+    void AFIOUringWorker::OnWakeup()
+    {
+        wakeup_pending_.store(false, std::memory_order_release);
+
+        //sends before closes, a reply followed by a kick still reaches the client
+        if (send_requests_.PopAll(requests_))
+        {
+            for (auto session_id : requests_)
+            {
+                auto iter = conns_.find(session_id);
+                if (iter == conns_.end() || iter->second->close_after_send_)
+                {
+                    continue;
+                }
+
+                AFIOUringConn::PTR conn = iter->second;
+                conn->send_scheduled_.store(false, std::memory_order_release);
+                conn->out_queue_.PopAll(packets_);
+                conn->pending_.insert(conn->pending_.end(), packets_.begin(), packets_.end());
+                packets_.clear();
+
+                SubmitSend(conn);
+            }
+
+            requests_.clear();
+        }
+
+        if (close_requests_.PopAll(requests_))
+        {
+            for (auto session_id : requests_)
+            {
+                auto iter = conns_.find(session_id);
+                if (iter != conns_.end())
+                {
+                    AFIOUringConn::PTR conn = iter->second;
+                    CloseAfterSend(conn);
+                }
+            }
+
+            requests_.clear();
+        }
+
+        if (running_)
+        {
+            ArmWakeup();
+        }
+    }
+
+    void AFIOUringWorker::OnRecv(AFIOUringConn::PTR& conn, const int res, const uint32_t flags)
+    {
+        if ((flags & IORING_CQE_F_BUFFER) != 0)
+        {
+            uint16_t buf_id = uint16_t(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (res > 0 && !conn->closing_)
+            {
+                server_->OnRecv(conn->session_id_, ring_.GetBuf(buf_id), size_t(res));
+            }
+
+            //data is copied into session buffer, recycle at once
+            ring_.AddBuf(buf_id);
+        }
+
+        if ((flags & IORING_CQE_F_MORE) != 0)
+        {
+            return;
+        }
+
+        --conn->inflight_ops_;
+        if (conn->closing_)
+        {
+            TryReleaseConn(conn);
+        }
+        else if (res > 0 || res == -ENOBUFS)
+        {
+            //ran out of provided buffers or kernel stopped the multishot, arm it again
+            ArmRecv(conn);
+        }
+        else
+        {
+            CloseConn(conn);
+        }
+    }
+
+    void AFIOUringWorker::OnSend(AFIOUringConn::PTR& conn, const int res)
+    {
+        conn->send_in_flight_ = false;
+        --conn->inflight_ops_;
+
+        if (res < 0 || conn->closing_)
+        {
+            CloseConn(conn);
+            TryReleaseConn(conn);
+            return;
+        }
+
+        //skip the bytes written, a partial write continues from the rest
+        size_t written = size_t(res);
+        struct iovec* iov = conn->send_msg_.msg_iov;
+        size_t iov_count = conn->send_msg_.msg_iovlen;
+        while (iov_count > 0 && written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --iov_count;
+        }
+
+        if (iov_count > 0)
+        {
+            iov->iov_base = reinterpret_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+
+            struct io_uring_sqe* sqe = ring_.GetSqe();
+            if (sqe == nullptr)
+            {
+                CloseConn(conn);
+                TryReleaseConn(conn);
+                return;
+            }
+
+            conn->send_msg_.msg_iov = iov;
+            conn->send_msg_.msg_iovlen = iov_count;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = conn->fd_;
+            sqe->addr = reinterpret_cast<uint64_t>(&conn->send_msg_);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = MakeUserData(conn->session_id_, OP_SEND);
+            conn->send_in_flight_ = true;
+            ++conn->inflight_ops_;
+            return;
+        }
+
+        conn->sending_.clear();
+        conn->send_iov_.clear();
+
+        if (conn->close_after_send_ && conn->pending_.empty())
+        {
+            CloseConn(conn);
+            return;
+        }
+
+        SubmitSend(conn);
+    }
+
+    //packets queued before the close request still go out first, the same order as brynet.
+    //packets queued after it are dropped
+    void AFIOUringWorker::CloseAfterSend(AFIOUringConn::PTR& conn)
+    {
+        if (conn->close_after_send_ || conn->closing_)
+        {
+            return;
+        }
+
+        conn->close_after_send_ = true;
+        conn->out_queue_.PopAll(packets_);
+        conn->pending_.insert(conn->pending_.end(), packets_.begin(), packets_.end());
+        packets_.clear();
+
+        if (!conn->send_in_flight_ && conn->pending_.empty())
+        {
+            CloseConn(conn);
+            return;
+        }
+
+        SubmitSend(conn);
+    }
+
+    void AFIOUringWorker::CloseConn(AFIOUringConn::PTR& conn)
+    {
+        if (conn->closing_)
+        {
+            return;
+        }
+
+        //pending recv and send complete with error, fd is closed after the last one
+        conn->closing_ = true;
+        ::shutdown(conn->fd_, SHUT_RDWR);
+        server_->OnDisconnected(conn->session_id_, conn->ip_);
+        TryReleaseConn(conn);
+    }
+
+    void AFIOUringWorker::TryReleaseConn(AFIOUringConn::PTR& conn)
+    {
+        if (!conn->closing_ || conn->inflight_ops_ > 0 || conn->fd_ < 0)
+        {
+            return;
+        }
+
+        ::close(conn->fd_);
+        conn->fd_ = -1;
+        conns_.erase(conn->session_id_);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    AFCIOUringServer::~AFCIOUringServer()
+    {
+        Shutdown();
+    }
+
+    bool AFCIOUringServer::IsSupported()
+    {
+        //multishot recv needs 6.0
+        struct utsname name;
+        int major = 0;
+        if (::uname(&name) != 0 || sscanf(name.release, "%d", &major) != 1 || major < 6)
+        {
+            return false;
+        }
+
+        //io_uring may be disabled by sysctl or seccomp
+        AFIOUring ring;
+        return ring.Init(8) && ring.RegisterBufRing(ARK_IO_URING_BUF_GROUP, 8, 64);
+    }
+
+    bool AFCIOUringServer::StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6/* = false*/)
+    {
+        InitSessions(busid, head_len);
+
+        //every worker has its own listen socket, kernel spreads connections by SO_REUSEPORT
+        int worker_num = std::max(thread_num, 1);
+        for (int i = 0; i < worker_num; ++i)
+        {
+            int listen_fd = AFNetAcceptor::CreateListenSocket(ip_v6, ip, port, worker_num > 1);
+            if (listen_fd < 0)
+            {
+                Shutdown();
+                return false;
+            }
+
+            AFIOUringWorker* worker = ARK_NEW AFIOUringWorker(this);
+            workers_.push_back(worker);
+            if (!worker->Start(listen_fd))
+            {
+                Shutdown();
+                return false;
+            }
+        }
+
+        SetWorking(true);
+        return true;
+    }
+
+    bool AFCIOUringServer::Shutdown()
+    {
+        //stop workers first, no session is added or visited by them any more
+        for (auto worker : workers_)
+        {
+            worker->Stop();
+        }
+
+        CloseAllSession();
+
+        for (auto worker : workers_)
+        {
+            ARK_DELETE(worker);
+        }
+
+        workers_.clear();
+
+        SetWorking(false);
+        return true;
+    }
+
+}
+
+#endif //ARK_HAVE_IO_URING
@@ -0,0 +1,197 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFNetServerBase.h"
+#include "AFIOUring.h"
+
+#if defined(ARK_HAVE_IO_URING)
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace ark
+{
+
+    class AFIOUringWorker;
+
+    //Connection served by one io_uring worker, other threads only queue packets and close request
+    class AFIOUringConn : public AFNoncopyable
+    {
+    public:
+        using PTR = std::shared_ptr<AFIOUringConn>;
+
+        AFIOUringConn(AFIOUringWorker* worker, int fd, int64_t session_id, const std::string& ip) :
+            worker_(worker),
+            fd_(fd),
+            session_id_(session_id),
+            ip_(ip)
+        {
+        }
+
+        //same names as brynet DataSocket, so AFNetSession works with both
+        void send(const std::shared_ptr<std::string>& packet);
+        void postDisConnect();
+
+        void postShutdown()
+        {
+            postDisConnect();
+        }
+
+        const std::string& getIP() const
+        {
+            return ip_;
+        }
+
+        int64_t GetSessionId() const
+        {
+            return session_id_;
+        }
+
+    protected:
+        friend class AFIOUringWorker;
+
+        AFIOUringWorker* worker_{ nullptr };
+        int fd_{ -1 };
+        int64_t session_id_{ 0 };
+        std::string ip_;
+
+        AFMPSCQueue<std::shared_ptr<std::string>> out_queue_;
+        std::atomic<bool> send_scheduled_{ false };
+
+        //worker thread only
+        std::deque<std::shared_ptr<std::string>> pending_;
+        std::vector<std::shared_ptr<std::string>> sending_;
+        std::vector<struct iovec> send_iov_;
+        struct msghdr send_msg_;
+        bool send_in_flight_{ false };
+        bool close_after_send_{ false };
+        bool closing_{ false };
+        uint32_t inflight_ops_{ 0 };
+    };
+
+    class AFCIOUringServer;
+
+    //One ring, one listen socket and one thread. Accept and recv are multishot,
+    //recv data lands in the registered buffer ring, all SQEs of one loop go in one syscall.
+    class AFIOUringWorker : public AFNoncopyable
+    {
+    public:
+        explicit AFIOUringWorker(AFCIOUringServer* server) :
+            server_(server)
+        {
+        }
+
+        ~AFIOUringWorker();
+
+        bool Start(int listen_fd);
+        void Stop();
+
+        //called by other threads
+        void PostSend(const int64_t session_id);
+        void PostClose(const int64_t session_id);
+
+    protected:
+        enum AFIOUringOp
+        {
+            OP_ACCEPT = 1,
+            OP_WAKEUP = 2,
+            OP_RECV = 3,
+            OP_SEND = 4,
+        };
+
+        static uint64_t MakeUserData(const int64_t session_id, const AFIOUringOp op)
+        {
+            return (uint64_t(session_id) << 3) | uint64_t(op);
+        }
+
+        void Run();
+        void Wakeup();
+
+        void ArmAccept();
+        void ArmWakeup();
+        void ArmRecv(AFIOUringConn::PTR& conn);
+        void SubmitSend(AFIOUringConn::PTR& conn);
+
+        void HandleCqe(const struct io_uring_cqe& cqe);
+        void OnAccept(const int res, const uint32_t flags);
+        void OnWakeup();
+        void OnRecv(AFIOUringConn::PTR& conn, const int res, const uint32_t flags);
+        void OnSend(AFIOUringConn::PTR& conn, const int res);
+
+        void CloseAfterSend(AFIOUringConn::PTR& conn);
+        void CloseConn(AFIOUringConn::PTR& conn);
+        void TryReleaseConn(AFIOUringConn::PTR& conn);
+
+    private:
+        AFCIOUringServer* server_{ nullptr };
+        AFIOUring ring_;
+        int listen_fd_{ -1 };
+        int event_fd_{ -1 };
+        uint64_t event_value_{ 0 };
+
+        std::thread thread_;
+        std::atomic<bool> running_{ false };
+        std::atomic<bool> wakeup_pending_{ false };
+
+        AFMPSCQueue<int64_t> send_requests_;
+        AFMPSCQueue<int64_t> close_requests_;
+        std::vector<int64_t> requests_;
+        std::vector<std::shared_ptr<std::string>> packets_;
+
+        std::unordered_map<int64_t, AFIOUringConn::PTR> conns_;
+    };
+
+    //AFINet on io_uring, the logic thread side is AFNetServerBase
+    class AFCIOUringServer : public AFNetServerBase<AFIOUringConn::PTR>
+    {
+    public:
+        template<typename BaseType>
+        AFCIOUringServer(BaseType* pBaseType, void (BaseType::*handleRecieve)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+        {
+            net_msg_cb_ = std::bind(handleRecieve, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+        }
+
+        ~AFCIOUringServer() override;
+
+        //kernel supports multishot recv and provided buffer ring
+        static bool IsSupported();
+
+        bool StartServer(AFHeadLength head_length, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6 = false) override;
+        bool Shutdown() override final;
+
+    protected:
+        friend class AFIOUringWorker;
+
+        //called by worker threads
+        int64_t NewSessionId()
+        {
+            return trusted_session_id_++;
+        }
+
+    private:
+        std::vector<AFIOUringWorker*> workers_;
+    };
+
+}
+
+#endif //ARK_HAVE_IO_URING
@@ -20,6 +20,9 @@
 
 #include "base/AFDateTime.hpp"
 #include "AFCTCPClient.h"
+#include "AFCUDPClient.h"
+#include "AFCShmClient.h"
+#include "AFCNetLaneClient.h"
 #include "AFCNetClientService.h"
 
 namespace ark
@@ -37,6 +40,19 @@ namespace ark
                             m_pBusModule != nullptr &&
                             m_pMsgModule != nullptr &&
                             m_pLogModule != nullptr);
+
+        heartbeat_wheel_.Start(uint64_t(m_pPluginManager->GetNowTime()));
+
+        const AFServerConfig* server_config = m_pBusModule->GetAppServerInfo();
+        if (server_config != nullptr)
+        {
+            reconnect_min_ = std::max<uint32_t>(server_config->reconnect_min, 1);
+            reconnect_max_ = std::max(server_config->reconnect_max, reconnect_min_);
+            outbound_queue_limit_ = size_t(server_config->reconnect_queue) * 1024;
+            coalesce_threshold_ = size_t(server_config->coalesce) * 1024;
+        }
+
+        random_.SetSeed(uint32_t(m_pBusModule->GetSelfBusID()) ^ uint32_t(m_pPluginManager->GetNowTime()));
     }
 
     AFCNetClientService::~AFCNetClientService()
@@ -58,9 +74,23 @@ namespace ark
     void AFCNetClientService::Update()
     {
         ProcessUpdate();
+        UpdateHeartbeat();
         ProcessAddNewNetClient();
     }
 
+    void AFCNetClientService::FlushAll()
+    {
+        int id = 0;
+
+        for (auto connection_data = target_servers_.First(id); connection_data != nullptr; connection_data = target_servers_.Next(id))
+        {
+            if (connection_data->net_client_ptr_ != nullptr)
+            {
+                connection_data->net_client_ptr_->FlushAll();
+            }
+        }
+    }
+
     void AFCNetClientService::Shutdown()
     {
         int id = 0;
@@ -69,6 +99,7 @@ namespace ark
         {
             if (connection_data->net_client_ptr_ != nullptr)
             {
+                m_pNetServiceManagerModule->RemoveNetConnectionBus(connection_data->server_bus_id_);
                 ARK_DELETE(connection_data->net_client_ptr_); //shutdown in AFINet destructor function
             }
         }
@@ -76,21 +107,12 @@ namespace ark
 
     bool AFCNetClientService::RegMsgCallback(const int msg_id, const NET_MSG_FUNCTOR_PTR& cb)
     {
-        if (net_msg_callbacks_.find(msg_id) != net_msg_callbacks_.end())
-        {
-            return false;
-        }
-        else
-        {
-            net_msg_callbacks_.insert(std::make_pair(msg_id, cb));
-            return true;
-        }
+        return (cb != nullptr && msg_dispatcher_.Register(msg_id, *cb));
     }
 
     bool AFCNetClientService::RegForwardMsgCallback(const NET_MSG_FUNCTOR_PTR& cb)
     {
-        net_msg_forward_callbacks_.push_back(cb);
-        return true;
+        return (cb != nullptr && msg_dispatcher_.AddForward(*cb));
     }
 
     bool AFCNetClientService::RegNetEventCallback(const NET_EVENT_FUNCTOR_PTR& cb)
@@ -101,19 +123,17 @@ namespace ark
 
     void AFCNetClientService::ProcessUpdate()
     {
-        target_servers_.DoEveryElement([this](AFMapEx<int, AFConnectionData>::PTRTYPE & connection_data)
+        int64_t now = m_pPluginManager->GetNowTime();
+        target_servers_.DoEveryElement([this, now](AFMapEx<int, AFConnectionData>::PTRTYPE & connection_data)
         {
             switch (connection_data->net_state_)
             {
             case AFConnectionData::DISCONNECT:
                 {
-                    //TODO:这里不应该释放_net_client_ptr
+                    //the session is gone already, the client and its queue are kept for reconnect
+                    connection_data->next_reconnect_time_ = now + GetReconnectDelay(connection_data->retry_times_);
+                    ++connection_data->retry_times_;
                     connection_data->net_state_ = AFConnectionData::RECONNECT;
-                    if (connection_data->net_client_ptr_ != nullptr)
-                    {
-                        connection_data->net_client_ptr_->Shutdown();
-                        //ARK_DELETE(connection_data->_net_client_ptr);
-                    }
                 }
                 break;
             case AFConnectionData::CONNECTING:
@@ -129,38 +149,21 @@ namespace ark
                     if (connection_data->net_client_ptr_ != nullptr)
                     {
                         connection_data->net_client_ptr_->Update();
-
-                        KeepAlive(connection_data);
                     }
                 }
                 break;
             case AFConnectionData::RECONNECT:
                 {
-                    //计算时间
-                    if ((connection_data->last_active_time_ + 30 * AFTimespan::SECOND_MS) >= m_pPluginManager->GetNowTime())
+                    if (now < connection_data->next_reconnect_time_ || connection_data->net_client_ptr_ == nullptr)
                     {
                         break;
                     }
 
-                    connection_data->last_active_time_ = m_pPluginManager->GetNowTime();
-
-                    if (connection_data->net_client_ptr_ != nullptr)
-                    {
-                        connection_data->net_client_ptr_->Shutdown();
-                        //ARK_DELETE(connection_data->_net_client_ptr);
-                    }
+                    ++connection_data->reconnect_count_;
+                    connection_data->last_active_time_ = now;
+                    ARK_LOG_INFO("Reconnect [{}], retry={} url={}", AFBusAddr(connection_data->server_bus_id_).ToString(), connection_data->retry_times_, connection_data->endpoint_.ToString());
 
-                    //based on protocol to create a new client
-                    //connection_data->_net_client_ptr = CreateNet(connection_data->_protocol);
-                    bool ret = connection_data->net_client_ptr_->StartClient(connection_data->head_len_, connection_data->server_bus_id_, connection_data->endpoint_.GetIP(), connection_data->endpoint_.GetPort(), connection_data->endpoint_.IsV6());
-                    if (!ret)
-                    {
-                        connection_data->net_state_ = AFConnectionData::RECONNECT;
-                    }
-                    else
-                    {
-                        connection_data->net_state_ = AFConnectionData::CONNECTING;
-                    }
+                    StartConnect(connection_data);
                 }
                 break;
             default:
@@ -170,15 +173,86 @@ namespace ark
         });
     }
 
-    AFINet* AFCNetClientService::CreateNet(const proto_type proto)
+    int64_t AFCNetClientService::GetReconnectDelay(const uint32_t retry_times)
+    {
+        uint64_t delay = reconnect_min_;
+        for (uint32_t i = 0; i < retry_times && delay < reconnect_max_; ++i)
+        {
+            delay <<= 1;
+        }
+
+        delay = std::min<uint64_t>(delay, reconnect_max_);
+        uint32_t half = uint32_t(delay / 2);
+        return int64_t(delay - half + random_.Random(half + 1));
+    }
+
+    //async for every protocol, the result comes back as CONNECTED or DISCONNECTED event
+    void AFCNetClientService::StartConnect(ARK_SHARE_PTR<AFConnectionData>& connection_data)
+    {
+#if defined(ARK_HAVE_SHM_NET)
+        //the peer may be down, left a stale segment or run without shm, tcp always works.
+        //checked at every connect, so a restarted peer listening on shm again gets it back
+        if (connection_data->shm_)
+        {
+            bool listening = AFCShmClient::IsServerListening(connection_data->server_bus_id_);
+            if (listening != connection_data->shm_net_)
+            {
+                SwitchNet(connection_data, listening);
+            }
+        }
+#endif
+
+        bool ret = connection_data->net_client_ptr_->StartClient(connection_data->head_len_, connection_data->server_bus_id_, connection_data->endpoint_.GetIP(), connection_data->endpoint_.GetPort(), connection_data->endpoint_.IsV6());
+        connection_data->net_state_ = (ret ? AFConnectionData::CONNECTING : AFConnectionData::DISCONNECT);
+    }
+
+    void AFCNetClientService::SwitchNet(ARK_SHARE_PTR<AFConnectionData>& connection_data, const bool shm)
     {
+        AFINet* old_net = connection_data->net_client_ptr_;
+        ARK_LOG_WARN("Shm of [{}] is {}listening, switch to {}, queued msgs = {}", AFBusAddr(connection_data->server_bus_id_).ToString(), (shm ? "" : "not "), (shm ? "shm" : "tcp"), old_net->GetQueueStats().outbound_msgs_);
+
+        connection_data->shm_net_ = shm;
+        connection_data->net_client_ptr_ = CreateNet(connection_data->endpoint_.proto(), connection_data->server_bus_id_, shm);
+
+        //not connected yet, the new net queues them in the same order
+        old_net->MoveOutbound(connection_data->net_client_ptr_);
+
+        //a reconnect replaces the registered net, the first connect registers it later
+        if (m_pNetServiceManagerModule->RemoveNetConnectionBus(connection_data->server_bus_id_))
+        {
+            m_pNetServiceManagerModule->AddNetConnectionBus(connection_data->server_bus_id_, connection_data->net_client_ptr_);
+        }
+
+        ARK_DELETE(old_net);
+    }
+
+    template<typename BaseType>
+    AFINet* AFCNetClientService::CreateProtoNet(const proto_type proto, const int bus_id, const bool shm, BaseType* pBaseType,
+            void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+    {
+#if defined(ARK_HAVE_SHM_NET)
+        //same host peer, the server listens on shared memory besides tcp
+        if (shm)
+        {
+            return ARK_NEW AFCShmClient(pBaseType, handleRecv, handleEvent, m_pBusModule->GetSelfBusID());
+        }
+#endif
+
         if (proto == proto_type::tcp)
         {
-            return ARK_NEW AFCTCPClient(this, &AFCNetClientService::OnNetMsg, &AFCNetClientService::OnNetEvent);
+            return ARK_NEW AFCTCPClient(pBaseType, handleRecv, handleEvent);
         }
         else if (proto == proto_type::udp)
         {
-            //for now, do not support udp server
+            //both ends must use the channel modes of the server
+            AFCUDPClient* udp_client = ARK_NEW AFCUDPClient(pBaseType, handleRecv, handleEvent);
+            const AFServerConfig* server_config = m_pBusModule->GetAppServerInfo(bus_id);
+            if (server_config != nullptr)
+            {
+                udp_client->GetConfig().Load(*server_config);
+            }
+
+            return udp_client;
         }
         else if (proto == proto_type::ws)
         {
@@ -189,6 +263,44 @@ namespace ark
         return nullptr;
     }
 
+    AFINet* AFCNetClientService::CreateNet(const proto_type proto, const int bus_id, const bool shm)
+    {
+        AFINet* net = nullptr;
+
+        //udp client shares one IO thread already, more lanes bring nothing
+        uint32_t lanes = (proto == proto_type::tcp ? m_pBusModule->GetBusLanes(bus_id) : 1);
+        if (lanes <= 1)
+        {
+            net = CreateProtoNet(proto, bus_id, shm, this, &AFCNetClientService::OnNetMsg, &AFCNetClientService::OnNetEvent);
+        }
+        else
+        {
+            AFCNetLaneClient* lane_net = ARK_NEW AFCNetLaneClient(this, &AFCNetClientService::OnNetMsg, &AFCNetClientService::OnNetEvent);
+            lane_net->SetRegisterMsg(AFMsg::E_SS_MSG_ID_SERVER_REPORT);
+            for (uint32_t i = 0; i < lanes; ++i)
+            {
+                lane_net->AddLane(CreateProtoNet(proto, bus_id, shm, lane_net, &AFCNetLaneClient::OnLaneMsg, &AFCNetLaneClient::OnLaneEvent));
+            }
+
+            net = lane_net;
+        }
+
+        if (net == nullptr)
+        {
+            return nullptr;
+        }
+
+        //lanes take these from the group when they start
+        net->SetCompressThreshold(m_pBusModule->GetCompressThreshold(bus_id));
+        net->SetOutboundQueueLimit(outbound_queue_limit_);
+        if (coalesce_threshold_ > 0)
+        {
+            net->SetCoalesce(true, coalesce_threshold_);
+        }
+
+        return net;
+    }
+
     void AFCNetClientService::LogServerInfo()
     {
         LogServerInfo("This is a client, begin to print Server Info----------------------------------");
@@ -208,17 +320,42 @@ namespace ark
 
     void AFCNetClientService::KeepAlive(ARK_SHARE_PTR<AFConnectionData>& pServerData)
     {
-        if ((pServerData->last_active_time_ + 10) > m_pPluginManager->GetNowTime())
-        {
-            return;
-        }
-
-        pServerData->last_active_time_ = m_pPluginManager->GetNowTime();
+        //keep the session from idle timeout of the server
+        pServerData->net_client_ptr_->SendHeartbeat(pServerData->server_bus_id_);
 
         KeepReport(pServerData);
         LogServerInfo();
     }
 
+    void AFCNetClientService::AddHeartbeat(ARK_SHARE_PTR<AFConnectionData>& pServerData)
+    {
+        int64_t now = m_pPluginManager->GetNowTime();
+        pServerData->next_heartbeat_time_ = now + std::chrono::duration_cast<std::chrono::milliseconds>(ARK_NET_HEART_TIME).count();
+        heartbeat_wheel_.Add(pServerData->server_bus_id_, uint64_t(pServerData->next_heartbeat_time_));
+    }
+
+    void AFCNetClientService::UpdateHeartbeat()
+    {
+        int64_t now = m_pPluginManager->GetNowTime();
+        heartbeat_wheel_.Expire(uint64_t(now), [this, now](const int64_t bus_id)
+        {
+            ARK_SHARE_PTR<AFConnectionData> pServerData = target_servers_.GetElement(int(bus_id));
+            if (pServerData == nullptr || pServerData->net_state_ != AFConnectionData::CONNECTED || pServerData->net_client_ptr_ == nullptr)
+            {
+                return;
+            }
+
+            //stale entry of an earlier connection, the current one is still in wheel
+            if (pServerData->next_heartbeat_time_ > now)
+            {
+                return;
+            }
+
+            KeepAlive(pServerData);
+            AddHeartbeat(pServerData);
+        });
+    }
+
     bool AFCNetClientService::GetServerMachineData(const std::string& strServerID, AFCMachineNode& xMachineData)
     {
         uint32_t nCRC32 = AFCRC32::Sum(strServerID);
@@ -264,10 +401,10 @@ namespace ark
         {
             AddServerWeightData(pServerInfo);
             pServerInfo->net_state_ = AFConnectionData::CONNECTED;
+            pServerInfo->retry_times_ = 0;
+            AddHeartbeat(pServerInfo);
 
-            //add server-bus-id -> client-bus-id
-            m_pNetServiceManagerModule->AddNetConnectionBus(event->bus_id_, pServerInfo->net_client_ptr_);
-            //register to this server
+            //register to this server, the client replays msgs queued while disconnected after this
             RegisterToServer(event->id_, event->bus_id_);
         }
 
@@ -276,19 +413,25 @@ namespace ark
 
     int AFCNetClientService::OnDisconnect(const AFNetEvent* event)
     {
-        ARK_LOG_ERROR("Disconnect [{}] successfully, ip={} session_id={}", AFBusAddr(event->bus_id_).ToString(), event->ip_, event->id_);
-
         ARK_SHARE_PTR<AFConnectionData> pServerInfo = GetServerNetInfo(event->bus_id_);
+        if (pServerInfo == nullptr)
+        {
+            return 0;
+        }
 
-        if (pServerInfo != nullptr)
+        if (pServerInfo->net_state_ == AFConnectionData::CONNECTED)
         {
+            ARK_LOG_ERROR("Disconnect [{}] successfully, ip={} session_id={}", AFBusAddr(event->bus_id_).ToString(), event->ip_, event->id_);
             RemoveServerWeightData(pServerInfo);
-            pServerInfo->net_state_ = AFConnectionData::DISCONNECT;
-            pServerInfo->last_active_time_ = m_pPluginManager->GetNowTime();
-            //remove net bus
-            m_pNetServiceManagerModule->RemoveNetConnectionBus(event->bus_id_);
+        }
+        else
+        {
+            ARK_LOG_ERROR("Connect [{}] failed, ip={} retry={}", AFBusAddr(event->bus_id_).ToString(), event->ip_, pServerInfo->retry_times_);
         }
 
+        //net bus is kept, msgs to this server are queued by the client until reconnected
+        pServerInfo->net_state_ = AFConnectionData::DISCONNECT;
+        pServerInfo->last_active_time_ = m_pPluginManager->GetNowTime();
         return 0;
     }
 
@@ -327,18 +470,15 @@ namespace ark
                 target_connection_data->last_active_time_ = m_pPluginManager->GetNowTime();
 
                 //based on protocol to create a new client
-                target_connection_data->net_client_ptr_ = CreateNet(target_connection_data->endpoint_.proto());
-                int ret = target_connection_data->net_client_ptr_->StartClient(target_connection_data->head_len_, target_connection_data->server_bus_id_, target_connection_data->endpoint_.GetIP(), target_connection_data->endpoint_.GetPort());
-                if (!ret)
-                {
-                    target_connection_data->net_state_ = AFConnectionData::RECONNECT;
-                }
-                else
-                {
-                    target_connection_data->net_state_ = AFConnectionData::CONNECTING;
-                }
+                target_connection_data->shm_ = (target_connection_data->endpoint_.proto() == proto_type::tcp && m_pBusModule->IsShmBusRelation(target_connection_data->server_bus_id_));
+                target_connection_data->shm_net_ = target_connection_data->shm_;
+                target_connection_data->net_client_ptr_ = CreateNet(target_connection_data->endpoint_.proto(), target_connection_data->server_bus_id_, target_connection_data->shm_net_);
+                StartConnect(target_connection_data);
 
                 target_servers_.AddElement(target_connection_data->server_bus_id_, target_connection_data);
+
+                //add server-bus-id -> client-bus-id, msgs sent before connected are queued
+                m_pNetServiceManagerModule->AddNetConnectionBus(target_connection_data->server_bus_id_, target_connection_data->net_client_ptr_);
                 AFINetClientService::RegMsgCallback(AFMsg::E_SS_MSG_ID_SERVER_NOTIFY, this, &AFCNetClientService::OnServerNotify);
             }
         }
@@ -348,21 +488,10 @@ namespace ark
 
     void AFCNetClientService::OnNetMsg(const AFNetMsg* msg, const int64_t session_id)
     {
-        auto it = net_msg_callbacks_.find(msg->id_);
-
-        if (net_msg_callbacks_.end() != it)
+        //recv counters and handler time are recorded by the dispatcher
+        if (!msg_dispatcher_.Dispatch(msg, session_id))
         {
-            (*it->second)(msg, session_id);
-        }
-        else
-        {
-            //TODO:forward to other server process
-
             ARK_LOG_ERROR("Invalid message, id = {}", msg->id_);
-            //for (const auto& iter : mxCallBackList)
-            //{
-            //    (*iter)(head, msg_id, msg, msg_len, session_id);
-            //}
         }
     }
 
@@ -21,6 +21,7 @@
 #pragma once
 
 #include "base/AFMap.hpp"
+#include "base/AFRandom.hpp"
 #include "base/AFCConsistentHash.hpp"
 #include "interface/AFINetClientService.h"
 #include "interface/AFIPluginManager.h"
@@ -28,6 +29,8 @@
 #include "interface/AFIBusModule.h"
 #include "interface/AFIMsgModule.h"
 #include "interface/AFILogModule.h"
+#include "AFNetTimeWheel.h"
+#include "AFNetMsgDispatcher.h"
 
 namespace ark
 {
@@ -45,6 +48,7 @@ namespace ark
 
         bool StartClient(const AFHeadLength head_len, const int& target_bus_id, const AFEndpoint& endpoint) override;
         void Update() override;
+        void FlushAll() override;
         void Shutdown() override;
 
         bool RegMsgCallback(const int msg_id, const NET_MSG_FUNCTOR_PTR& cb) override;
@@ -58,7 +62,16 @@ namespace ark
         void ProcessUpdate();
         void ProcessAddNewNetClient();
 
-        AFINet* CreateNet(const proto_type proto);
+        //exponential backoff with jitter, half of the delay is random so targets do not retry in lockstep
+        int64_t GetReconnectDelay(const uint32_t retry_times);
+        void StartConnect(ARK_SHARE_PTR<AFConnectionData>& connection_data);
+        void SwitchNet(ARK_SHARE_PTR<AFConnectionData>& connection_data, const bool shm);
+
+        AFINet* CreateNet(const proto_type proto, const int bus_id, const bool shm);
+
+        template<typename BaseType>
+        AFINet* CreateProtoNet(const proto_type proto, const int bus_id, const bool shm, BaseType* pBaseType,
+                               void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*));
 
         void RegisterToServer(const AFGUID& session_id, const int bus_id);
         int OnConnect(const AFNetEvent* event);
@@ -72,6 +85,8 @@ namespace ark
 
         void LogServerInfo();
         void KeepAlive(ARK_SHARE_PTR<AFConnectionData>& pServerData);
+        void AddHeartbeat(ARK_SHARE_PTR<AFConnectionData>& pServerData);
+        void UpdateHeartbeat();
 
         bool GetServerMachineData(const std::string& strServerID, AFCMachineNode& xMachineData);
         void AddServerWeightData(ARK_SHARE_PTR<AFConnectionData>& xInfo);
@@ -93,13 +108,20 @@ namespace ark
 
         std::list<AFConnectionData> tmp_nets_;
 
-        std::map<int, NET_MSG_FUNCTOR_PTR> net_msg_callbacks_;
+        //handlers by msg id, msgs without a handler are forwarded to other processes
+        AFNetMsgDispatcher msg_dispatcher_;
         std::list<NET_EVENT_FUNCTOR_PTR> net_event_callbacks_;
 
-        //forward to other processes
-        std::list<NET_MSG_FUNCTOR_PTR> net_msg_forward_callbacks_;
-
         std::map<int, std::map<int, AFMsg::msg_ss_server_report>> reg_servers_;
+
+        //next heartbeat of connected servers, keyed by server bus id
+        AFNetTimeWheel heartbeat_wheel_;
+
+        uint32_t reconnect_min_{ 500 };     //ms
+        uint32_t reconnect_max_{ 30000 };   //ms
+        size_t outbound_queue_limit_{ 0 };  //bytes per target
+        size_t coalesce_threshold_{ 0 };    //bytes, 0 means not coalescing
+        AFRandom random_;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,348 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCNetLaneClient.h"
+
+namespace ark
+{
+
+    AFCNetLaneClient::~AFCNetLaneClient()
+    {
+        Shutdown();
+        for (auto& lane : lanes_)
+        {
+            ARK_DELETE(lane);
+        }
+
+        lanes_.clear();
+    }
+
+    void AFCNetLaneClient::AddLane(AFINet* lane)
+    {
+        if (lane == nullptr)
+        {
+            return;
+        }
+
+        lanes_.push_back(lane);
+        lane_states_.push_back(LANE_DOWN);
+        lane_sessions_.push_back(0);
+
+        lane_traffic_.emplace_back();
+        lane_traffic_.back().session_id_ = int64_t(lane_traffic_.size() - 1);
+    }
+
+    void AFCNetLaneClient::Update()
+    {
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            current_lane_ = i;
+            lanes_[i]->Update();
+        }
+
+        UpdateGroupDown();
+    }
+
+    bool AFCNetLaneClient::StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6/* = false*/)
+    {
+        if (lanes_.empty())
+        {
+            return false;
+        }
+
+        this->dst_bus_id_ = dst_busid;
+        this->head_len_ = head_len;
+        this->dst_ip_ = ip;
+
+        connected_ = false;
+        failing_ = false;
+
+        size_t started = 0;
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            AFINet* lane = lanes_[i];
+            lane->SetCompressThreshold(GetCompressThreshold());
+            lane->SetMsgBudget(GetSessionMsgBudget(), GetFrameMsgBudget());
+            lane->SetCoalesce(IsCoalesce(), GetCoalesceThreshold());
+            //queued by the group, a lane drops msgs while it is down
+            lane->SetOutboundQueueLimit(0);
+
+            if (lane->StartClient(head_len, dst_busid, ip, port, ip_v6))
+            {
+                lane_states_[i] = LANE_CONNECTING;
+                ++started;
+            }
+            else
+            {
+                lane_states_[i] = LANE_DOWN;
+                failing_ = true;
+            }
+        }
+
+        if (started == 0)
+        {
+            failing_ = false;
+            return false;
+        }
+
+        SetWorking(true);
+        return true;
+    }
+
+    bool AFCNetLaneClient::Shutdown()
+    {
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            lanes_[i]->Shutdown();
+            lane_states_[i] = LANE_DOWN;
+            lane_sessions_[i] = 0;
+        }
+
+        outbound_queue_.Clear();
+
+        connected_ = false;
+        failing_ = false;
+        SetWorking(false);
+        return true;
+    }
+
+    void AFCNetLaneClient::OnLaneEvent(const AFNetEvent* event)
+    {
+        size_t lane = current_lane_;
+        switch (event->type_)
+        {
+        case AFNetEventType::CONNECTED:
+            {
+                lane_states_[lane] = LANE_UP;
+                lane_sessions_[lane] = event->id_;
+
+                //other lanes failed in this round, this one goes down too
+                if (failing_)
+                {
+                    lanes_[lane]->CloseSession(event->id_);
+                    break;
+                }
+
+                if (!IsAllLanes(LANE_UP))
+                {
+                    break;
+                }
+
+                AFNetEvent group_event = *event;
+                group_event.id_ = lane_sessions_[0];
+
+                connected_ = true;
+                in_connect_cb_ = true;
+                net_event_cb_(&group_event);
+                in_connect_cb_ = false;
+
+                outbound_queue_.Replay(this);
+            }
+            break;
+        case AFNetEventType::DISCONNECTED:
+            {
+                lane_states_[lane] = LANE_DOWN;
+
+                //one lane down breaks actor order, the whole group reconnects
+                if (!failing_)
+                {
+                    failing_ = true;
+                    CloseLanes();
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void AFCNetLaneClient::OnLaneMsg(const AFNetMsg* msg, const int64_t session_id)
+    {
+        AFNetSessionTraffic& traffic = lane_traffic_[current_lane_];
+        ++traffic.recv_msgs_;
+        traffic.recv_bytes_ += head_len_ + msg->GetBodyLength();
+
+        net_msg_cb_(msg, lane_sessions_[0]);
+    }
+
+    bool AFCNetLaneClient::IsAllLanes(const AFLaneState state) const
+    {
+        for (auto lane_state : lane_states_)
+        {
+            if (lane_state != state)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void AFCNetLaneClient::CloseLanes()
+    {
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            if (lane_states_[i] == LANE_UP)
+            {
+                lanes_[i]->CloseSession(lane_sessions_[i]);
+            }
+        }
+    }
+
+    //connecting lanes end with CONNECTED(closed above) or DISCONNECTED, so every lane gets down at last
+    void AFCNetLaneClient::UpdateGroupDown()
+    {
+        if (!failing_ || !IsAllLanes(LANE_DOWN))
+        {
+            return;
+        }
+
+        AFNetEvent event;
+        event.id_ = (connected_ ? lane_sessions_[0] : 0);
+        event.type_ = AFNetEventType::DISCONNECTED;
+        event.bus_id_ = dst_bus_id_;
+        event.ip_ = dst_ip_;
+
+        connected_ = false;
+        failing_ = false;
+        net_event_cb_(&event);
+    }
+
+    size_t AFCNetLaneClient::GetLaneIndex(const AFMsgHead* head) const
+    {
+        if (head_len_ != AFHeadLength::SS_HEAD_LENGTH || lanes_.size() == 1)
+        {
+            return 0;
+        }
+
+        //msgs without actor go on the first lane
+        uint64_t actor_id = uint64_t(static_cast<const AFSSMsgHead*>(head)->actor_id_);
+        if (actor_id == 0)
+        {
+            return 0;
+        }
+
+        //actor ids are mostly sequential, mix the bits before modulo
+        actor_id ^= (actor_id >> 33);
+        actor_id *= 0xff51afd7ed558ccdULL;
+        actor_id ^= (actor_id >> 33);
+        return size_t(actor_id % lanes_.size());
+    }
+
+    bool AFCNetLaneClient::SendLaneMsg(const size_t lane, AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count)
+    {
+        if (!lanes_[lane]->SendMsgV(head, iov, iov_count, lane_sessions_[lane]))
+        {
+            return false;
+        }
+
+        AFNetSessionTraffic& traffic = lane_traffic_[lane];
+        ++traffic.send_msgs_;
+        traffic.send_bytes_ += head_len_ + head->GetBodyLength();
+        return true;
+    }
+
+    bool AFCNetLaneClient::SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id)
+    {
+        if (head == nullptr || msg_data == nullptr)
+        {
+            return false;
+        }
+
+        AFNetIOVec iov;
+        iov.data_ = msg_data;
+        iov.len_ = head->GetBodyLength();
+        return SendMsgV(head, &iov, 1, session_id);
+    }
+
+    //session_id is ignored, the lane comes from the actor id of head
+    bool AFCNetLaneClient::SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id)
+    {
+        if (head == nullptr || lanes_.empty())
+        {
+            return false;
+        }
+
+        if (!connected_ || failing_)
+        {
+            return outbound_queue_.Push(head_len_, head, iov, iov_count, GetOutboundQueueLimit());
+        }
+
+        if (!in_connect_cb_ || head->id_ != register_msg_id_)
+        {
+            return SendLaneMsg(GetLaneIndex(head), head, iov, iov_count);
+        }
+
+        bool ret = true;
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            ret = (SendLaneMsg(i, head, iov, iov_count) && ret);
+        }
+
+        return ret;
+    }
+
+    //every lane has its own idle time on the server
+    bool AFCNetLaneClient::SendHeartbeat(const int64_t session_id)
+    {
+        bool ret = true;
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            ret = (lanes_[i]->SendHeartbeat(lane_sessions_[i]) && ret);
+        }
+
+        return ret;
+    }
+
+    bool AFCNetLaneClient::CloseSession(const AFGUID& session_id)
+    {
+        CloseLanes();
+        return true;
+    }
+
+    void AFCNetLaneClient::GetSessionTraffic(std::vector<AFNetSessionTraffic>& traffic)
+    {
+        traffic.insert(traffic.end(), lane_traffic_.begin(), lane_traffic_.end());
+    }
+
+    bool AFCNetLaneClient::Flush(const int64_t session_id)
+    {
+        for (size_t i = 0; i < lanes_.size(); ++i)
+        {
+            lanes_[i]->Flush(lane_sessions_[i]);
+        }
+
+        return true;
+    }
+
+    void AFCNetLaneClient::FlushAll()
+    {
+        for (auto lane : lanes_)
+        {
+            lane->FlushAll();
+        }
+    }
+
+    void AFCNetLaneClient::MoveOutbound(AFINet* net)
+    {
+        outbound_queue_.Replay(net);
+    }
+
+}
@@ -0,0 +1,118 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "interface/AFINet.h"
+#include "AFNetOutboundQueue.h"
+
+namespace ark
+{
+
+    //several connections to one peer behave as one client, msgs of one actor always go on the same lane
+    //so they keep order, others are spread by actor id over lanes and their IO threads
+    class AFCNetLaneClient : public AFINet
+    {
+    public:
+        enum AFLaneState
+        {
+            LANE_DOWN = 0,
+            LANE_CONNECTING = 1,
+            LANE_UP = 2,
+        };
+
+        template<typename BaseType>
+        AFCNetLaneClient(BaseType* pBaseType, void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+        {
+            net_msg_cb_ = std::bind(handleRecv, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+        }
+
+        ~AFCNetLaneClient() override;
+
+        //lanes are created by the owner with OnLaneMsg and OnLaneEvent as callbacks, and deleted here
+        void AddLane(AFINet* lane);
+
+        //the server registers every lane session, this msg sent in the CONNECTED callback goes on every lane
+        void SetRegisterMsg(const uint16_t msg_id)
+        {
+            register_msg_id_ = msg_id;
+        }
+
+        void Update() override;
+
+        //CONNECTED comes once all lanes are up, DISCONNECTED once all lanes are down after any of them dropped
+        bool StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6 = false) override;
+
+        bool Shutdown() override final;
+        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
+        bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id) override;
+        bool SendHeartbeat(const int64_t session_id) override;
+
+        bool CloseSession(const AFGUID& session_id) override;
+
+        //session_id_ of every entry is the lane index
+        void GetSessionTraffic(std::vector<AFNetSessionTraffic>& traffic) override;
+
+        bool Flush(const int64_t session_id) override;
+        void FlushAll() override;
+        void MoveOutbound(AFINet* net) override;
+
+        void OnLaneMsg(const AFNetMsg* msg, const int64_t session_id);
+        void OnLaneEvent(const AFNetEvent* event);
+
+    protected:
+        size_t GetLaneIndex(const AFMsgHead* head) const;
+        bool SendLaneMsg(const size_t lane, AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count);
+
+        bool IsAllLanes(const AFLaneState state) const;
+        void CloseLanes();
+        void UpdateGroupDown();
+
+    private:
+        std::vector<AFINet*> lanes_;
+        std::vector<AFLaneState> lane_states_;
+        std::vector<int64_t> lane_sessions_;
+        std::vector<AFNetSessionTraffic> lane_traffic_;
+
+        //lane whose Update is running, lane callbacks come only from there
+        size_t current_lane_{ 0 };
+
+        int dst_bus_id_{ 0 };
+        AFHeadLength head_len_{ AFHeadLength::SS_HEAD_LENGTH };
+        std::string dst_ip_;
+
+        //logic thread only, connected_ after group CONNECTED is delivered,
+        //failing_ from the first lane down until group DISCONNECTED is delivered
+        bool connected_{ false };
+        bool failing_{ false };
+
+        //register msg sent in CONNECTED callback goes on every lane, others go by actor id as usual
+        bool in_connect_cb_{ false };
+        uint16_t register_msg_id_{ 0 };
+
+        //msgs sent while the group is down, replayed on their lanes after the CONNECTED callback
+        AFNetOutboundQueue outbound_queue_{ queue_stats_ };
+
+        NET_MSG_FUNCTOR net_msg_cb_;
+        NET_EVENT_FUNCTOR net_event_cb_;
+    };
+
+}
@@ -1,5 +1,9 @@
 ﻿#include "interface/AFIPluginManager.h"
 #include "AFCTCPServer.h"
+#include "AFCIOUringServer.h"
+#include "AFCUDPServer.h"
+#include "AFCShmServer.h"
+#include "AFCWebSocktServer.h"
 #include "AFCNetServerService.h"
 
 namespace ark
@@ -11,34 +15,68 @@ namespace ark
         m_pNetServiceManagerModule = m_pPluginManager->FindModule<AFINetServiceManagerModule>();
         m_pLogModule = m_pPluginManager->FindModule<AFILogModule>();
         m_pMsgModule = m_pPluginManager->FindModule<AFIMsgModule>();
+        m_pBusModule = m_pPluginManager->FindModule<AFIBusModule>();
 
         ARK_ASSERT_NO_EFFECT(m_pNetServiceManagerModule != nullptr &&
                              m_pLogModule != nullptr &&
-                             m_pMsgModule != nullptr);
+                             m_pMsgModule != nullptr &&
+                             m_pBusModule != nullptr);
     }
 
     AFCNetServerService::~AFCNetServerService()
     {
+        ARK_DELETE(m_pShmNet);
         ARK_DELETE(m_pNet);
     }
 
-    bool AFCNetServerService::Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection)
+    bool AFCNetServerService::Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection, const bool reuse_port/* = false*/, const bool io_uring/* = false*/, const bool shm/* = false*/)
     {
         bool ret = false;
         if (ep.proto() == proto_type::tcp)
         {
-            m_pNet = ARK_NEW AFCTCPServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+#if defined(ARK_HAVE_IO_URING)
+            if (io_uring && AFCIOUringServer::IsSupported())
+            {
+                m_pNet = ARK_NEW AFCIOUringServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+            }
+#endif
+
+            //fall back to brynet if io_uring is not built or not supported by the kernel
+            if (m_pNet == nullptr)
+            {
+                m_pNet = ARK_NEW AFCTCPServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+            }
+
+            m_pNet->SetReusePort(reuse_port);
             ret = m_pNet->StartServer(len, bus_id, ep.GetIP(), ep.GetPort(), thread_count, max_connection, ep.IsV6());
+            if (ret && shm)
+            {
+                StartShm(len, bus_id, max_connection);
+            }
 
             AFINetServerService::RegMsgCallback(AFMsg::E_SS_MSG_ID_SERVER_REPORT, this, &AFCNetServerService::OnClientRegister);
         }
         else if (ep.proto() == proto_type::udp)
         {
-            //for now, do not support udp server
+            //one IO thread drives all udp connections, thread_count is not used
+            AFCUDPServer* udp_server = ARK_NEW AFCUDPServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+            const AFServerConfig* server_config = m_pBusModule->GetAppServerInfo();
+            if (server_config != nullptr)
+            {
+                udp_server->GetConfig().Load(*server_config);
+            }
+
+            m_pNet = udp_server;
+            ret = m_pNet->StartServer(len, bus_id, ep.GetIP(), ep.GetPort(), thread_count, max_connection, ep.IsV6());
+
+            AFINetServerService::RegMsgCallback(AFMsg::E_SS_MSG_ID_SERVER_REPORT, this, &AFCNetServerService::OnClientRegister);
         }
         else if (ep.proto() == proto_type::ws)
         {
-            //will add websocket server
+            m_pNet = ARK_NEW AFCWebSocktServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+            ret = m_pNet->StartServer(len, bus_id, ep.GetIP(), ep.GetPort(), thread_count, max_connection, ep.IsV6());
+
+            AFINetServerService::RegMsgCallback(AFMsg::E_SS_MSG_ID_SERVER_REPORT, this, &AFCNetServerService::OnClientRegister);
         }
         else
         {
@@ -53,6 +91,11 @@ namespace ark
     {
         ARK_ASSERT_RET_VAL(m_pNet != nullptr, false);
         m_pNet->Update();
+        if (m_pShmNet != nullptr)
+        {
+            m_pShmNet->Update();
+        }
+
         return true;
     }
 
@@ -61,23 +104,47 @@ namespace ark
         return m_pNet;
     }
 
-    bool AFCNetServerService::RegMsgCallback(const int nMsgID, const NET_MSG_FUNCTOR_PTR& cb)
+    AFINet* AFCNetServerService::GetShmNet()
+    {
+        return m_pShmNet;
+    }
+
+    //same host clients pick shared memory by bus config, tcp still serves the others
+    void AFCNetServerService::StartShm(const AFHeadLength len, const int bus_id, const uint32_t max_connection)
     {
-        if (net_msg_callbacks_.find(nMsgID) != net_msg_callbacks_.end())
+#if defined(ARK_HAVE_SHM_NET)
+        m_pShmNet = ARK_NEW AFCShmServer(this, &AFCNetServerService::OnNetMsg, &AFCNetServerService::OnNetEvent);
+        if (m_pShmNet->StartServer(len, bus_id, std::string(), 0, 1, max_connection))
         {
-            return false;
+            ARK_LOG_INFO("Start shm net server successful, bus = {}", AFBusAddr(bus_id).ToString());
+            return;
         }
-        else
+
+        ARK_LOG_ERROR("Cannot start shm net server, bus = {}", AFBusAddr(bus_id).ToString());
+        ARK_DELETE(m_pShmNet);
+#endif
+    }
+
+    AFINet* AFCNetServerService::GetSessionNet(const int64_t session_id)
+    {
+#if defined(ARK_HAVE_SHM_NET)
+        if (m_pShmNet != nullptr && session_id >= ARK_NET_SHM_SESSION_BASE)
         {
-            net_msg_callbacks_.insert(std::make_pair(nMsgID, cb));
-            return true;
+            return m_pShmNet;
         }
+#endif
+
+        return m_pNet;
+    }
+
+    bool AFCNetServerService::RegMsgCallback(const int nMsgID, const NET_MSG_FUNCTOR_PTR& cb)
+    {
+        return (cb != nullptr && msg_dispatcher_.Register(nMsgID, *cb));
     }
 
     bool AFCNetServerService::RegForwardMsgCallback(const NET_MSG_FUNCTOR_PTR& cb)
     {
-        net_forward_msg_callbacks_.push_back(cb);
-        return true;
+        return (cb != nullptr && msg_dispatcher_.AddForward(*cb));
     }
 
     bool AFCNetServerService::RegNetEventCallback(const NET_EVENT_FUNCTOR_PTR& cb)
@@ -88,21 +155,10 @@ namespace ark
 
     void AFCNetServerService::OnNetMsg(const AFNetMsg* msg, const int64_t session_id)
     {
-        auto it = net_msg_callbacks_.find(msg->id_);
-        if (it != net_msg_callbacks_.end())
-        {
-            (*it->second)(msg, session_id);
-        }
-        else
+        //recv counters and handler time are recorded by the dispatcher
+        if (!msg_dispatcher_.Dispatch(msg, session_id))
         {
-            //TODO:forward to other server process
-
             ARK_LOG_ERROR("Invalid message, id = {}", msg->id_);
-
-            //for (const auto& iter : mxCallBackList)
-            //{
-            //    (*iter)(head, msg_id, msg, msg_len, session_id);
-            //}
         }
     }
 
@@ -131,8 +187,11 @@ namespace ark
     {
         ARK_PROCESS_MSG(msg, AFMsg::msg_ss_server_report);
 
-        //Add server_bus_id -> client_bus_id relationship with net
-        m_pNetServiceManagerModule->AddNetConnectionBus(pb_msg.bus_id(), m_pNet);
+        //Add server_bus_id -> client_bus_id relationship with the net of this session
+        AFINet* net = GetSessionNet(session_id);
+        m_pNetServiceManagerModule->AddNetConnectionBus(pb_msg.bus_id(), net);
+        //compress msgs to this client if the bus relation asks for it
+        net->SetSessionCompressThreshold(session_id, m_pBusModule->GetCompressThreshold(pb_msg.bus_id()));
         //////////////////////////////////////////////////////////////////////////
         ARK_SHARE_PTR<AFServerData> server_data_ptr = reg_clients_.GetElement(pb_msg.bus_id());
         if (nullptr == server_data_ptr)
@@ -22,9 +22,11 @@
 
 #include "base/AFMap.hpp"
 #include "interface/AFILogModule.h"
+#include "interface/AFIBusModule.h"
 #include "interface/AFIMsgModule.h"
 #include "interface/AFINetServiceManagerModule.h"
 #include "interface/AFINetServerService.h"
+#include "AFNetMsgDispatcher.h"
 
 namespace ark
 {
@@ -35,10 +37,11 @@ namespace ark
         explicit AFCNetServerService(AFIPluginManager* p);
         virtual ~AFCNetServerService();
 
-        bool Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection) override;
+        bool Start(const AFHeadLength len, const int bus_id, const AFEndpoint& ep, const uint8_t thread_count, const uint32_t max_connection, const bool reuse_port = false, const bool io_uring = false, const bool shm = false) override;
         bool Update() override;
 
         AFINet* GetNet() override;
+        AFINet* GetShmNet() override;
 
         bool RegMsgCallback(const int msg_id, const NET_MSG_FUNCTOR_PTR& cb) override;
         bool RegForwardMsgCallback(const NET_MSG_FUNCTOR_PTR& cb) override;
@@ -48,6 +51,9 @@ namespace ark
         void OnNetMsg(const AFNetMsg* msg, const int64_t session_id);
         void OnNetEvent(const AFNetEvent* event);
 
+        void StartShm(const AFHeadLength len, const int bus_id, const uint32_t max_connection);
+        AFINet* GetSessionNet(const int64_t session_id);
+
         void OnClientRegister(const AFNetMsg* msg, const int64_t session_id);
         void SyncToAllClient(const int bus_id, const AFGUID& session_id);
 
@@ -56,11 +62,13 @@ namespace ark
         AFINetServiceManagerModule* m_pNetServiceManagerModule;
         AFILogModule* m_pLogModule;
         AFIMsgModule* m_pMsgModule;
+        AFIBusModule* m_pBusModule;
 
         AFINet* m_pNet{ nullptr };
+        AFINet* m_pShmNet{ nullptr };
 
-        std::map<int, NET_MSG_FUNCTOR_PTR> net_msg_callbacks_;
-        std::list<NET_MSG_FUNCTOR_PTR> net_forward_msg_callbacks_;
+        //handlers by msg id, msgs without a handler are forwarded to other processes
+        AFNetMsgDispatcher msg_dispatcher_;
         std::list<NET_EVENT_FUNCTOR_PTR> net_event_callbacks_;
 
         AFMapEx<int, AFServerData> reg_clients_;
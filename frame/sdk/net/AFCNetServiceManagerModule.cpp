@@ -26,10 +26,18 @@
 namespace ark
 {
 
+    ARK_CONSTEXPR static const size_t ARK_NET_STATS_TOP_SESSIONS = 10;
+
+    static uint64_t GetStatsTime()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
     bool AFCNetServiceManagerModule::Init()
     {
         m_pBusModule = pPluginManager->FindModule<AFIBusModule>();
         m_pLogModule = pPluginManager->FindModule<AFILogModule>();
+        m_pMsgModule = pPluginManager->FindModule<AFIMsgModule>();
 
         return true;
     }
@@ -54,6 +62,48 @@ namespace ark
             return true;
         });
 
+        if (stats_interval_ > 0)
+        {
+            uint64_t now = GetStatsTime();
+            if (now >= next_stats_time_)
+            {
+                next_stats_time_ = now + uint64_t(stats_interval_) * 1000;
+
+                std::string stats;
+                DumpNetStats(stats);
+                ARK_LOG_INFO("net stats\n{}", stats);
+            }
+        }
+
+        return true;
+    }
+
+    bool AFCNetServiceManagerModule::PostUpdate()
+    {
+        //msgs sent in this frame go out together
+        net_servers_.DoEveryElement([&](AFMap<int, AFINetServerService>::PTRTYPE & pServerData)
+        {
+            if (pServerData != nullptr && pServerData->GetNet() != nullptr)
+            {
+                pServerData->GetNet()->FlushAll();
+            }
+
+            if (pServerData != nullptr && pServerData->GetShmNet() != nullptr)
+            {
+                pServerData->GetShmNet()->FlushAll();
+            }
+            return true;
+        });
+
+        net_clients_.DoEveryElement([&](AFMap<uint8_t, AFINetClientService>::PTRTYPE & pData)
+        {
+            if (pData != nullptr)
+            {
+                pData->FlushAll();
+            }
+            return true;
+        });
+
         return true;
     }
 
@@ -93,9 +143,23 @@ namespace ark
         AFINetServerService* pServer = ARK_NEW AFCNetServerService(pPluginManager);
         net_servers_.AddElement(m_pBusModule->GetSelfBusID(), pServer);
 
-        int nRet = pServer->Start(head_len, m_pBusModule->GetSelfBusID(), server_config->local_ep_, server_config->thread_num, server_config->max_connection);
+        int nRet = pServer->Start(head_len, m_pBusModule->GetSelfBusID(), server_config->local_ep_, server_config->thread_num, server_config->max_connection, server_config->reuse_port, server_config->io_uring, server_config->shm);
         if (nRet)
         {
+            pServer->GetNet()->SetMsgBudget(server_config->session_msg_budget, server_config->frame_msg_budget);
+            pServer->GetNet()->SetIdleTimeout(server_config->idle_timeout);
+            stats_interval_ = server_config->stats_interval;
+            pServer->GetNet()->SetSendWaterMark(size_t(server_config->send_high_water) * 1024, size_t(server_config->send_low_water) * 1024, AFNetSlowPolicy(server_config->slow_policy));
+            if (server_config->coalesce > 0)
+            {
+                pServer->GetNet()->SetCoalesce(true, size_t(server_config->coalesce) * 1024);
+            }
+
+            if (pServer->GetShmNet() != nullptr)
+            {
+                pServer->GetShmNet()->SetMsgBudget(server_config->session_msg_budget, server_config->frame_msg_budget);
+                pServer->GetShmNet()->SetCoalesce(pServer->GetNet()->IsCoalesce(), pServer->GetNet()->GetCoalesceThreshold());
+            }
             ARK_LOG_INFO("Start net server successful, url = {}", server_config->local_ep_.ToString());
         }
         else
@@ -210,4 +274,170 @@ namespace ark
         return net_bus_relations_.GetElement(std::make_pair(src_bus, target_bus));
     }
 
-}
\ No newline at end of file
+    void AFCNetServiceManagerModule::DumpNetStats(std::string& stats)
+    {
+        uint64_t now = GetStatsTime();
+        double elapsed = (last_stats_time_ > 0 && now > last_stats_time_ ? double(now - last_stats_time_) / 1000.0 : 0.0);
+        last_stats_time_ = now;
+
+        DumpMsgStats(stats);
+
+        std::string arena_line = ARK_FORMAT("msg arena peak_bytes={}\n", m_pMsgModule->GetMsgArena().GetPeakBytes());
+        stats.append(arena_line);
+
+        net_servers_.DoEveryElement([&](AFMap<int, AFINetServerService>::PTRTYPE & pServerData)
+        {
+            if (pServerData != nullptr && pServerData->GetNet() != nullptr)
+            {
+                DumpServerStats(pServerData->GetNet(), elapsed, stats);
+            }
+
+            if (pServerData != nullptr && pServerData->GetShmNet() != nullptr)
+            {
+                DumpServerStats(pServerData->GetShmNet(), elapsed, stats);
+            }
+            return true;
+        });
+
+        net_clients_.DoEveryElement([&](AFMap<uint8_t, AFINetClientService>::PTRTYPE & pData)
+        {
+            if (pData != nullptr)
+            {
+                DumpClientStats(pData, elapsed, stats);
+            }
+            return true;
+        });
+    }
+
+    void AFCNetServiceManagerModule::DumpMsgStats(std::string& stats)
+    {
+        std::map<uint16_t, AFNetMsgIdStats> msg_stats;
+        AFNetMsgStats::Instance().GetStats(msg_stats);
+
+        //the most expensive handlers first
+        std::vector<std::pair<uint16_t, const AFNetMsgIdStats*>> sorted;
+        sorted.reserve(msg_stats.size());
+        for (const auto& iter : msg_stats)
+        {
+            sorted.emplace_back(iter.first, &iter.second);
+        }
+
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint16_t, const AFNetMsgIdStats*>& lhs, const std::pair<uint16_t, const AFNetMsgIdStats*>& rhs)
+        {
+            return lhs.second->handle_.total_ns_ > rhs.second->handle_.total_ns_;
+        });
+
+        for (const auto& iter : sorted)
+        {
+            const AFNetMsgIdStats& msg = *iter.second;
+            std::string line = ARK_FORMAT("msg id={} recv={} recv_bytes={} send={} send_bytes={} handle_ms={} p50_us={} p99_us={} max_us={}\n",
+                                          iter.first, msg.recv_msgs_, msg.recv_bytes_, msg.send_msgs_, msg.send_bytes_, msg.handle_.total_ns_ / 1000000,
+                                          msg.handle_.GetPercentile(50) / 1000, msg.handle_.GetPercentile(99) / 1000, msg.handle_.max_ns_ / 1000);
+            stats.append(line);
+        }
+    }
+
+    void AFCNetServiceManagerModule::DumpClientStats(AFINetClientService* client, const double elapsed, std::string& stats)
+    {
+        int bus_id = 0;
+        AFMapEx<int, AFConnectionData>& server_list = client->GetServerList();
+        for (auto connection_data = server_list.First(bus_id); connection_data != nullptr; connection_data = server_list.Next(bus_id))
+        {
+            AFNetQueueStats queue;
+            if (connection_data->net_client_ptr_ != nullptr)
+            {
+                queue = connection_data->net_client_ptr_->GetQueueStats();
+            }
+
+            std::string line = ARK_FORMAT("client target={} state={} reconnects={} retry={} queued={} queued_bytes={} queue_dropped={}\n",
+                                          AFBusAddr(connection_data->server_bus_id_).ToString(), int(connection_data->net_state_), connection_data->reconnect_count_,
+                                          connection_data->retry_times_, queue.outbound_msgs_, queue.outbound_bytes_, queue.outbound_dropped_msgs_);
+            stats.append(line);
+
+            if (connection_data->net_client_ptr_ == nullptr)
+            {
+                continue;
+            }
+
+            //only multi-lane clients report traffic, one entry per lane
+            AFINet* net = connection_data->net_client_ptr_;
+            std::vector<AFNetSessionTraffic> traffic;
+            net->GetSessionTraffic(traffic);
+            if (traffic.empty())
+            {
+                continue;
+            }
+
+            std::unordered_map<int64_t, AFNetSessionTraffic>& last_traffic = last_traffic_[net];
+            if (elapsed > 0)
+            {
+                for (const auto& lane : traffic)
+                {
+                    auto iter = last_traffic.find(lane.session_id_);
+                    AFNetSessionTraffic last = (iter != last_traffic.end() ? iter->second : AFNetSessionTraffic());
+                    std::string lane_line = ARK_FORMAT("lane id={} recv_msgs/s={:.1f} recv_bytes/s={:.1f} send_msgs/s={:.1f} send_bytes/s={:.1f}\n",
+                                                       lane.session_id_, double(lane.recv_msgs_ - last.recv_msgs_) / elapsed, double(lane.recv_bytes_ - last.recv_bytes_) / elapsed,
+                                                       double(lane.send_msgs_ - last.send_msgs_) / elapsed, double(lane.send_bytes_ - last.send_bytes_) / elapsed);
+                    stats.append(lane_line);
+                }
+            }
+
+            last_traffic.clear();
+            for (const auto& lane : traffic)
+            {
+                last_traffic.emplace(lane.session_id_, lane);
+            }
+        }
+    }
+
+    void AFCNetServiceManagerModule::DumpServerStats(AFINet* net, const double elapsed, std::string& stats)
+    {
+        const AFNetQueueStats& queue = net->GetQueueStats();
+        std::string line = ARK_FORMAT("server ready={} carried={} frame_msgs={} budget_hit={} idle_closed={} congested={} dropped={} slow_closed={}\n",
+                                      queue.ready_sessions_, queue.carried_sessions_, queue.frame_msgs_, queue.budget_hit_frames_,
+                                      queue.idle_closed_sessions_, queue.congested_sessions_, queue.dropped_msgs_, queue.slow_closed_sessions_);
+        stats.append(line);
+
+        std::vector<AFNetSessionTraffic> traffic;
+        net->GetSessionTraffic(traffic);
+
+        //bytes per second of every session since last dump
+        std::unordered_map<int64_t, AFNetSessionTraffic>& last_traffic = last_traffic_[net];
+        std::vector<std::pair<double, const AFNetSessionTraffic*>> rates;
+        if (elapsed > 0)
+        {
+            rates.reserve(traffic.size());
+            for (const auto& session : traffic)
+            {
+                auto iter = last_traffic.find(session.session_id_);
+                uint64_t last_bytes = (iter != last_traffic.end() ? iter->second.recv_bytes_ + iter->second.send_bytes_ : 0);
+                rates.emplace_back(double(session.recv_bytes_ + session.send_bytes_ - last_bytes) / elapsed, &session);
+            }
+        }
+
+        size_t top = std::min(rates.size(), ARK_NET_STATS_TOP_SESSIONS);
+        std::partial_sort(rates.begin(), rates.begin() + top, rates.end(), [](const std::pair<double, const AFNetSessionTraffic*>& lhs, const std::pair<double, const AFNetSessionTraffic*>& rhs)
+        {
+            return lhs.first > rhs.first;
+        });
+
+        for (size_t i = 0; i < top; ++i)
+        {
+            const AFNetSessionTraffic& session = *rates[i].second;
+            auto iter = last_traffic.find(session.session_id_);
+            AFNetSessionTraffic last = (iter != last_traffic.end() ? iter->second : AFNetSessionTraffic());
+            std::string session_line = ARK_FORMAT("session id={} recv_msgs/s={:.1f} recv_bytes/s={:.1f} send_msgs/s={:.1f} send_bytes/s={:.1f} pending={}\n",
+                                                  session.session_id_, double(session.recv_msgs_ - last.recv_msgs_) / elapsed, double(session.recv_bytes_ - last.recv_bytes_) / elapsed,
+                                                  double(session.send_msgs_ - last.send_msgs_) / elapsed, double(session.send_bytes_ - last.send_bytes_) / elapsed,
+                                                  net->GetSessionPendingBytes(session.session_id_));
+            stats.append(session_line);
+        }
+
+        last_traffic.clear();
+        for (const auto& session : traffic)
+        {
+            last_traffic.emplace(session.session_id_, session);
+        }
+    }
+
+}
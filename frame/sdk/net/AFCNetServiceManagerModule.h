@@ -23,6 +23,7 @@
 #include "base/AFMap.hpp"
 #include "interface/AFIBusModule.h"
 #include "interface/AFILogModule.h"
+#include "interface/AFIMsgModule.h"
 #include "interface/AFINetServiceManagerModule.h"
 #include "interface/AFINetServerService.h"
 
@@ -36,6 +37,7 @@ namespace ark
 
         bool Init() override;
         bool Update() override;
+        bool PostUpdate() override;
         bool Shut() override;
 
         int CreateServer(const AFHeadLength head_len = AFHeadLength::SS_HEAD_LENGTH) override;
@@ -52,14 +54,28 @@ namespace ark
         bool RemoveNetConnectionBus(int client_bus_id) override;
         AFINet* GetNetConnectionBus(int src_bus, int target_bus) override;
 
+        void DumpNetStats(std::string& stats) override;
+
+    protected:
+        void DumpMsgStats(std::string& stats);
+        void DumpServerStats(AFINet* net, const double elapsed, std::string& stats);
+        void DumpClientStats(AFINetClientService* client, const double elapsed, std::string& stats);
+
     private:
         AFMap<int, AFINetServerService> net_servers_;
         AFMap<uint8_t, AFINetClientService> net_clients_;
 
         AFMap<std::pair<int, int>, AFINet> net_bus_relations_;
 
+        //session traffic of last dump, to get rates
+        std::unordered_map<AFINet*, std::unordered_map<int64_t, AFNetSessionTraffic>> last_traffic_;
+        uint64_t last_stats_time_{ 0 };
+        uint64_t next_stats_time_{ 0 };
+        uint32_t stats_interval_{ 0 }; //seconds, 0 means only dump on demand
+
         AFIBusModule* m_pBusModule;
         AFILogModule* m_pLogModule;
+        AFIMsgModule* m_pMsgModule;
     };
 
 }
\ No newline at end of file
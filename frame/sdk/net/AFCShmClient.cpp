@@ -0,0 +1,474 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCShmClient.h"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+namespace ark
+{
+
+    AFCShmClient::~AFCShmClient()
+    {
+        Shutdown();
+    }
+
+    void AFCShmClient::Update()
+    {
+        UpdateNetSession();
+
+        AFScopeRLock guard(rw_lock_);
+        if (client_session_ptr_ != nullptr && client_session_ptr_->GetSession()->GetPendingBytes() > 0)
+        {
+            client_session_ptr_->GetSession()->Flush();
+        }
+    }
+
+    bool AFCShmClient::IsServerListening(const int dst_busid)
+    {
+        return (OpenListen(dst_busid) != nullptr);
+    }
+
+    AFNetShmSegment::PTR AFCShmClient::OpenListen(const int dst_busid)
+    {
+        AFNetShmSegment::PTR listen = std::make_shared<AFNetShmSegment>();
+        if (!listen->Open(AFNetShmSegment::GetListenName(dst_busid)) || listen->GetSize() < sizeof(AFNetShmListenHead))
+        {
+            return nullptr;
+        }
+
+        //left by a crashed server
+        AFNetShmListenHead* listen_head = reinterpret_cast<AFNetShmListenHead*>(listen->GetData());
+        if (listen_head->magic_ != ARK_NET_SHM_MAGIC || !AFNetShmSegment::IsProcessAlive(listen_head->server_pid_))
+        {
+            return nullptr;
+        }
+
+        return listen;
+    }
+
+    bool AFCShmClient::StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6/* = false*/)
+    {
+        //reconnect reuses this client, release the link and thread of last connection
+        if (IsWorking())
+        {
+            Shutdown();
+        }
+
+        this->dst_bus_id_ = dst_busid;
+        this->head_len_ = head_len;
+
+        AFNetShmSegment::PTR listen = OpenListen(dst_busid);
+        if (listen == nullptr)
+        {
+            return false;
+        }
+
+        AFNetShmListenHead* listen_head = reinterpret_cast<AFNetShmListenHead*>(listen->GetData());
+        int pid = AFNetShmSegment::GetPid();
+        uint32_t link_id = AFNetShmSegment::NextLinkId();
+        link_name_ = AFNetShmSegment::GetLinkName(dst_busid, self_bus_id_, pid, link_id);
+        AFNetShmSegment::PTR link = std::make_shared<AFNetShmSegment>();
+        if (!link->Create(link_name_, AFNetShmSegment::GetLinkSize(ARK_NET_SHM_RING_SIZE)))
+        {
+            return false;
+        }
+
+        AFNetShmLinkHead* head = new (link->GetData()) AFNetShmLinkHead();
+        head->ring_size_ = uint32_t(ARK_NET_SHM_RING_SIZE);
+        head->client_bus_ = self_bus_id_;
+        head->client_pid_ = pid;
+
+        //post the link request to a free slot of server
+        AFNetShmSlot* request_slot = nullptr;
+        for (auto& slot : listen_head->slots_)
+        {
+            uint32_t state = ARK_NET_SHM_SLOT_FREE;
+            if (slot.state_.compare_exchange_strong(state, ARK_NET_SHM_SLOT_CLAIMED, std::memory_order_acquire))
+            {
+                request_slot = &slot;
+                break;
+            }
+        }
+
+        if (request_slot == nullptr)
+        {
+            AFNetShmSegment::Unlink(link_name_);
+            return false;
+        }
+
+        request_slot->client_bus_ = self_bus_id_;
+        request_slot->client_pid_ = pid;
+        request_slot->link_id_ = link_id;
+        request_slot->state_.store(ARK_NET_SHM_SLOT_REQUEST, std::memory_order_release);
+        listen_head->bell_.Ring();
+
+        int64_t cur_session_id = trust_session_id_++;
+        AFShmConn::PTR conn = std::make_shared<AFShmConn>(link, listen, cur_session_id);
+
+        do
+        {
+            AFScopeWLock guard(rw_lock_);
+            client_session_ptr_.reset(ARK_NEW AFShmClientSession(head_len, cur_session_id, conn));
+        } while (false);
+
+        running_ = true;
+        thread_ = std::thread([this, conn]()
+        {
+            Run(conn);
+        });
+
+        SetWorking(true);
+        return true;
+    }
+
+    bool AFCShmClient::WaitAccept(const AFShmConn::PTR& conn)
+    {
+        AFNetShmLinkHead* head = conn->GetHead();
+        auto deadline = std::chrono::steady_clock::now() + ARK_CONNECT_TIMEOUT;
+        while (running_ && std::chrono::steady_clock::now() < deadline)
+        {
+            uint32_t seq = head->client_bell_.Prepare();
+            uint32_t state = head->state_.load(std::memory_order_acquire);
+            if (state != ARK_NET_SHM_LINK_INIT)
+            {
+                head->client_bell_.Cancel();
+                return (state == ARK_NET_SHM_LINK_ACCEPTED);
+            }
+
+            head->client_bell_.Wait(seq, ARK_NET_SHM_WAIT_MS);
+        }
+
+        return false;
+    }
+
+    void AFCShmClient::Run(AFShmConn::PTR conn)
+    {
+        bool accepted = WaitAccept(conn);
+
+        //both sides have mapped it or the request is given up, the mapping lives on
+        AFNetShmSegment::Unlink(link_name_);
+
+        if (accepted)
+        {
+            AFNetEvent* net_connect_event = AFNetEvent::AllocEvent();
+            net_connect_event->id_ = conn->GetSessionId();
+            net_connect_event->type_ = AFNetEventType::CONNECTED;
+            net_connect_event->bus_id_ = dst_bus_id_;
+            net_connect_event->ip_ = conn->getIP();
+
+            AFScopeRLock guard(rw_lock_);
+            if (client_session_ptr_ != nullptr)
+            {
+                client_session_ptr_->AddNetEvent(net_connect_event);
+            }
+            else
+            {
+                AFNetEvent::Release(net_connect_event);
+            }
+        }
+
+        AFNetShmBell& bell = conn->GetHead()->client_bell_;
+        uint32_t idle = 0;
+        while (accepted && running_)
+        {
+            if (conn->HasData())
+            {
+                ReadConn(conn);
+                idle = 0;
+                continue;
+            }
+
+            if (conn->IsClosed(AFNetShmSegment::NowMs()))
+            {
+                //msgs written before close are still delivered
+                ReadConn(conn);
+                break;
+            }
+
+            //spin a while for the next msg, then sleep until server rings
+            if (++idle < ARK_NET_SHM_SPIN_COUNT)
+            {
+                AFNetShmBell::Relax();
+                continue;
+            }
+
+            idle = 0;
+            uint32_t seq = bell.Prepare();
+            if (!running_ || conn->HasData() || conn->GetHead()->state_.load(std::memory_order_relaxed) == ARK_NET_SHM_LINK_CLOSED)
+            {
+                bell.Cancel();
+                continue;
+            }
+
+            bell.Wait(seq, ARK_NET_SHM_WAIT_MS);
+        }
+
+        //a late accept of server fails on the closed state
+        conn->postDisConnect();
+
+        AFNetEvent* net_disconnect_event = AFNetEvent::AllocEvent();
+        net_disconnect_event->id_ = conn->GetSessionId();
+        net_disconnect_event->type_ = AFNetEventType::DISCONNECTED;
+        net_disconnect_event->bus_id_ = dst_bus_id_;
+        net_disconnect_event->ip_ = conn->getIP();
+
+        do
+        {
+            AFScopeWLock guard(rw_lock_);
+            if (client_session_ptr_ != nullptr)
+            {
+                client_session_ptr_->AddNetEvent(net_disconnect_event);
+                client_session_ptr_->SetNeedRemove(true);
+            }
+            else
+            {
+                AFNetEvent::Release(net_disconnect_event);
+            }
+        } while (false);
+    }
+
+    void AFCShmClient::ReadConn(const AFShmConn::PTR& conn)
+    {
+        AFScopeRLock guard(rw_lock_);
+        if (client_session_ptr_ == nullptr)
+        {
+            return;
+        }
+
+        AFShmClientSession* session = client_session_ptr_.get();
+        auto append = [session](const char* data, size_t len)
+        {
+            session->AddBuffer(data, len);
+        };
+
+        while (conn->Read(append) > 0)
+        {
+            session->ParseBufferToMsg();
+        }
+    }
+
+    bool AFCShmClient::Shutdown()
+    {
+        if (!CloseAllSession())
+        {
+            //add log
+        }
+
+        running_ = false;
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        outbound_queue_.Clear();
+
+        SetWorking(false);
+        return true;
+    }
+
+    bool AFCShmClient::CloseAllSession()
+    {
+        if (client_session_ptr_ != nullptr)
+        {
+            client_session_ptr_->GetSession()->postDisConnect();
+            client_session_ptr_->GetSession()->GetHead()->client_bell_.Ring();
+        }
+
+        return true;
+    }
+
+    bool AFCShmClient::CloseSession(const AFGUID& session_id)
+    {
+        if (client_session_ptr_ != nullptr)
+        {
+            client_session_ptr_->GetSession()->postDisConnect();
+        }
+
+        return true;
+    }
+
+    void AFCShmClient::UpdateNetSession()
+    {
+        //the IO thread sets need remove under the write lock
+        bool need_remove = false;
+        do
+        {
+            AFScopeRLock guard(rw_lock_);
+            UpdateNetEvent(client_session_ptr_.get());
+            UpdateNetMsg(client_session_ptr_.get());
+            need_remove = (client_session_ptr_ != nullptr && client_session_ptr_->NeedRemove());
+        } while (false);
+
+        if (need_remove)
+        {
+            AFScopeWLock guard(rw_lock_);
+            CloseSession(client_session_ptr_->GetSessionId());
+            client_session_ptr_.reset(nullptr);
+        }
+    }
+
+    void AFCShmClient::UpdateNetEvent(AFShmClientSession* session)
+    {
+        if (session == nullptr)
+        {
+            return;
+        }
+
+        AFNetEvent* event(nullptr);
+        if (!session->PopNetEvent(event))
+        {
+            return;
+        }
+
+        while (event != nullptr)
+        {
+            //msgs sent in CONNECTED callback(register, handshake) go before the queued ones
+            if (event->type_ == AFNetEventType::CONNECTED)
+            {
+                connected_ = true;
+                net_event_cb_(event);
+                outbound_queue_.Replay(this);
+            }
+            else
+            {
+                if (event->type_ == AFNetEventType::DISCONNECTED)
+                {
+                    connected_ = false;
+                }
+
+                net_event_cb_(event);
+            }
+
+            AFNetEvent::Release(event);
+
+            session->PopNetEvent(event);
+        }
+    }
+
+    void AFCShmClient::UpdateNetMsg(AFShmClientSession* session)
+    {
+        if (session == nullptr)
+        {
+            return;
+        }
+
+        AFNetMsg* msg(nullptr);
+        if (!session->PopNetMsg(msg))
+        {
+            return;
+        }
+
+        uint32_t msg_count = 0;
+        while (msg != nullptr)
+        {
+            net_msg_cb_(msg, session->GetSessionId());
+            AFNetMsg::Release(msg);
+
+            ++msg_count;
+            if (msg_count >= GetSessionMsgBudget())
+            {
+                break;
+            }
+
+            session->PopNetMsg(msg);
+        }
+    }
+
+    bool AFCShmClient::SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id)
+    {
+        if (head == nullptr || msg_data == nullptr)
+        {
+            return false;
+        }
+
+        AFNetIOVec iov;
+        iov.data_ = msg_data;
+        iov.len_ = head->GetBodyLength();
+        return SendMsgV(head, &iov, 1, session_id);
+    }
+
+    //no compression, copying is cheaper than lz4 over shared memory.
+    //logic thread only, no rw_lock_: handlers reply from inside UpdateNetSession which already holds it,
+    //and client_session_ptr_ is only replaced on this thread
+    bool AFCShmClient::SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id)
+    {
+        if (head == nullptr)
+        {
+            return false;
+        }
+
+        if (!connected_ || client_session_ptr_ == nullptr)
+        {
+            return outbound_queue_.Push(head_len_, head, iov, iov_count, GetOutboundQueueLimit());
+        }
+
+        RecordSend(head);
+
+        if (IsCoalesce())
+        {
+            std::string& staging = client_session_ptr_->GetStaging(GetCoalesceThreshold());
+            if (!AFNetPacket::Append(staging, client_session_ptr_->GetHeadLen(), head, iov, iov_count))
+            {
+                return false;
+            }
+
+            if (staging.size() >= GetCoalesceThreshold())
+            {
+                client_session_ptr_->FlushStaging();
+            }
+
+            return true;
+        }
+
+        AFNetPacketPtr packet = AFNetPacket::Build(client_session_ptr_->GetHeadLen(), head, iov, iov_count);
+        if (packet == nullptr)
+        {
+            return false;
+        }
+
+        client_session_ptr_->GetSession()->send(packet);
+        return true;
+    }
+
+    bool AFCShmClient::Flush(const int64_t session_id)
+    {
+        if (client_session_ptr_ == nullptr)
+        {
+            return false;
+        }
+
+        client_session_ptr_->FlushStaging();
+        return true;
+    }
+
+    void AFCShmClient::FlushAll()
+    {
+        Flush(0);
+    }
+
+    void AFCShmClient::MoveOutbound(AFINet* net)
+    {
+        outbound_queue_.Replay(net);
+    }
+
+}
+
+#endif //ARK_HAVE_SHM_NET
@@ -0,0 +1,108 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "interface/AFINet.h"
+#include "AFNetSession.h"
+#include "AFNetPacket.h"
+#include "AFNetOutboundQueue.h"
+#include "AFNetShm.h"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+namespace ark
+{
+
+    using AFShmClientSession = AFNetSession<AFShmConn::PTR>;
+
+    //Shared memory client of a bus peer on the same host, one IO thread reads the rx ring.
+    //Like AFCTCPClient, StartClient only posts the link request, the result comes as
+    //CONNECTED or DISCONNECTED event and msgs sent meanwhile are queued.
+    class AFCShmClient : public AFINet
+    {
+    public:
+        template<typename BaseType>
+        AFCShmClient(BaseType* pBaseType, void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*), const int self_busid) :
+            self_bus_id_(self_busid)
+        {
+            net_msg_cb_ = std::bind(handleRecv, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+        }
+
+        ~AFCShmClient() override;
+
+        //the listen segment of dst_busid exists and its owner is alive
+        static bool IsServerListening(const int dst_busid);
+
+        void Update() override;
+
+        //ip and port are not used, the server listen segment is named by dst_busid
+        bool StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6 = false) override;
+
+        bool Shutdown() override final;
+        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
+        bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id) override;
+
+        bool CloseSession(const AFGUID& session_id) override;
+
+        bool Flush(const int64_t session_id) override;
+        void FlushAll() override;
+        void MoveOutbound(AFINet* net) override;
+
+    protected:
+        static AFNetShmSegment::PTR OpenListen(const int dst_busid);
+
+        //IO thread
+        bool WaitAccept(const AFShmConn::PTR& conn);
+        void Run(AFShmConn::PTR conn);
+        void ReadConn(const AFShmConn::PTR& conn);
+
+        void UpdateNetSession();
+        void UpdateNetEvent(AFShmClientSession* session);
+        void UpdateNetMsg(AFShmClientSession* session);
+
+        bool CloseAllSession();
+
+    private:
+        std::thread thread_;
+        std::atomic<bool> running_{ false };
+        std::string link_name_;
+
+        std::unique_ptr<AFShmClientSession> client_session_ptr_{ nullptr };
+        int self_bus_id_{ 0 };
+        int dst_bus_id_{ 0 };
+        AFHeadLength head_len_{ AFHeadLength::SS_HEAD_LENGTH };
+        uint64_t trust_session_id_{ 1 };
+
+        //logic thread only, true after CONNECTED event is delivered and before DISCONNECTED
+        bool connected_{ false };
+
+        //msgs sent while disconnected, replayed after the CONNECTED callback
+        AFNetOutboundQueue outbound_queue_{ queue_stats_ };
+
+        NET_MSG_FUNCTOR net_msg_cb_;
+        NET_EVENT_FUNCTOR net_event_cb_;
+        AFCReaderWriterLock rw_lock_;
+    };
+
+}
+
+#endif //ARK_HAVE_SHM_NET
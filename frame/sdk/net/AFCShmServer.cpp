@@ -0,0 +1,280 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCShmServer.h"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+namespace ark
+{
+
+    AFCShmServer::~AFCShmServer()
+    {
+        Shutdown();
+    }
+
+    void AFCShmServer::Update()
+    {
+        AFNetServerBase::Update();
+        FlushPending();
+    }
+
+    bool AFCShmServer::StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6/* = false*/)
+    {
+        InitSessions(busid, head_len);
+        this->max_client_ = max_client;
+
+        listen_name_ = AFNetShmSegment::GetListenName(busid);
+        listen_ = std::make_shared<AFNetShmSegment>();
+        if (!listen_->Create(listen_name_, sizeof(AFNetShmListenHead)))
+        {
+            listen_ = nullptr;
+            return false;
+        }
+
+        listen_head_ = new (listen_->GetData()) AFNetShmListenHead();
+        listen_head_->server_bus_ = busid;
+        listen_head_->server_pid_ = AFNetShmSegment::GetPid();
+
+        running_ = true;
+        thread_ = std::thread([this]()
+        {
+            Run();
+        });
+
+        SetWorking(true);
+        return true;
+    }
+
+    bool AFCShmServer::Shutdown()
+    {
+        running_ = false;
+        if (listen_head_ != nullptr)
+        {
+            listen_head_->bell_.Ring();
+        }
+
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        CloseAllSession();
+
+        if (listen_ != nullptr)
+        {
+            AFNetShmSegment::Unlink(listen_name_);
+            listen_head_ = nullptr;
+            listen_ = nullptr;
+        }
+
+        SetWorking(false);
+        return true;
+    }
+
+    void AFCShmServer::Run()
+    {
+        uint32_t idle = 0;
+        while (running_)
+        {
+            bool busy = AcceptLinks();
+            busy = ReadConns(AFNetShmSegment::NowMs()) || busy;
+            if (busy)
+            {
+                idle = 0;
+                continue;
+            }
+
+            //spin a while for the next msg, then sleep until a client rings
+            if (++idle < ARK_NET_SHM_SPIN_COUNT)
+            {
+                AFNetShmBell::Relax();
+                continue;
+            }
+
+            idle = 0;
+            uint32_t seq = listen_head_->bell_.Prepare();
+            if (!running_ || HasWork())
+            {
+                listen_head_->bell_.Cancel();
+                continue;
+            }
+
+            listen_head_->bell_.Wait(seq, ARK_NET_SHM_WAIT_MS);
+        }
+
+        //tell clients at once, or they find it by the pid check
+        for (auto& iter : conns_)
+        {
+            iter.second->postDisConnect();
+        }
+
+        conns_.clear();
+    }
+
+    bool AFCShmServer::AcceptLinks()
+    {
+        bool accepted = false;
+        for (auto& slot : listen_head_->slots_)
+        {
+            if (slot.state_.load(std::memory_order_acquire) != ARK_NET_SHM_SLOT_REQUEST)
+            {
+                continue;
+            }
+
+            accepted = true;
+            std::string link_name = AFNetShmSegment::GetLinkName(bus_id_, slot.client_bus_, slot.client_pid_, slot.link_id_);
+            slot.state_.store(ARK_NET_SHM_SLOT_FREE, std::memory_order_release);
+
+            //both sides unlink the name once mapped, whichever process dies first
+            AFNetShmSegment::PTR link = std::make_shared<AFNetShmSegment>();
+            bool opened = link->Open(link_name);
+            AFNetShmSegment::Unlink(link_name);
+            if (!opened || link->GetSize() < sizeof(AFNetShmLinkHead))
+            {
+                continue;
+            }
+
+            AFNetShmLinkHead* head = reinterpret_cast<AFNetShmLinkHead*>(link->GetData());
+            if (head->magic_ != ARK_NET_SHM_MAGIC || !AFNetShmSegment::IsValidRingSize(head->ring_size_) || link->GetSize() < AFNetShmSegment::GetLinkSize(head->ring_size_))
+            {
+                continue;
+            }
+
+            if (max_client_ > 0 && conns_.size() >= max_client_)
+            {
+                continue;
+            }
+
+            head->server_pid_.store(AFNetShmSegment::GetPid(), std::memory_order_relaxed);
+
+            //the client may have given up waiting
+            uint32_t state = ARK_NET_SHM_LINK_INIT;
+            if (!head->state_.compare_exchange_strong(state, ARK_NET_SHM_LINK_ACCEPTED, std::memory_order_acq_rel))
+            {
+                continue;
+            }
+
+            AFShmConn::PTR conn = std::make_shared<AFShmConn>(link, nullptr, trusted_session_id_++);
+            conns_.insert(std::make_pair(conn->GetSessionId(), conn));
+            OnConnected(conn->GetSessionId(), conn, conn->getIP());
+
+            head->client_bell_.Ring();
+        }
+
+        return accepted;
+    }
+
+    bool AFCShmServer::ReadConns(const uint64_t now)
+    {
+        bool busy = false;
+        for (auto iter = conns_.begin(); iter != conns_.end();)
+        {
+            AFShmConn::PTR conn = iter->second;
+            if (conn->HasData())
+            {
+                busy = true;
+                OnRecv(conn);
+            }
+
+            if (!conn->IsClosed(now))
+            {
+                ++iter;
+                continue;
+            }
+
+            //msgs written before close are still delivered
+            busy = true;
+            OnRecv(conn);
+            iter = conns_.erase(iter);
+            conn->postDisConnect();
+            OnDisconnected(conn->GetSessionId(), conn->getIP());
+        }
+
+        return busy;
+    }
+
+    bool AFCShmServer::HasWork()
+    {
+        for (auto& slot : listen_head_->slots_)
+        {
+            if (slot.state_.load(std::memory_order_relaxed) == ARK_NET_SHM_SLOT_REQUEST)
+            {
+                return true;
+            }
+        }
+
+        for (auto& iter : conns_)
+        {
+            if (iter.second->HasData() || iter.second->GetHead()->state_.load(std::memory_order_relaxed) == ARK_NET_SHM_LINK_CLOSED)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void AFCShmServer::OnRecv(const AFShmConn::PTR& conn)
+    {
+        sessions_.Visit(conn->GetSessionId(), [this, &conn](SessionPtr session)
+        {
+            session->Touch(GetNetTime());
+            auto append = [session](const char* data, size_t len)
+            {
+                session->AddBuffer(data, len);
+            };
+
+            while (conn->Read(append) > 0)
+            {
+                if (session->ParseBufferToMsg() > 0)
+                {
+                    PushReadySession(session);
+                }
+            }
+        });
+    }
+
+    //bytes left by a full ring, written in order once the peer catches up
+    void AFCShmServer::FlushPending()
+    {
+        sessions_.ForEach([](const int64_t session_id, SessionPtr session)
+        {
+            if (session->GetSession()->GetPendingBytes() > 0)
+            {
+                session->GetSession()->Flush();
+            }
+        });
+    }
+
+    bool AFCShmServer::SetSessionCompressThreshold(const int64_t session_id, const uint32_t threshold)
+    {
+        return false;
+    }
+
+    size_t AFCShmServer::GetSessionPendingBytes(const int64_t session_id)
+    {
+        SessionPtr session = GetNetSession(session_id);
+        return (session != nullptr ? session->GetPendingBytes() + session->GetSession()->GetPendingBytes() : 0);
+    }
+
+}
+
+#endif //ARK_HAVE_SHM_NET
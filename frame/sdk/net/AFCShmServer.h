@@ -0,0 +1,85 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFNetServerBase.h"
+#include "AFNetShm.h"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+namespace ark
+{
+
+    //Shared memory server for bus peers on the same host, one IO thread accepts links
+    //and reads all rx rings, the logic thread writes tx rings directly.
+    //Msgs and events reach the logic thread the same way as AFCTCPServer.
+    class AFCShmServer : public AFNetServerBase<AFShmConn::PTR>
+    {
+    public:
+        template<typename BaseType>
+        AFCShmServer(BaseType* pBaseType, void (BaseType::*handleRecieve)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+        {
+            net_msg_cb_ = std::bind(handleRecieve, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+            trusted_session_id_ = ARK_NET_SHM_SESSION_BASE;
+        }
+
+        ~AFCShmServer() override;
+
+        void Update() override;
+
+        //ip and port are not used, the listen segment is named by busid
+        bool StartServer(AFHeadLength head_length, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6 = false) override;
+        bool Shutdown() override final;
+
+        //same host, msgs are never compressed
+        bool SetSessionCompressThreshold(const int64_t session_id, const uint32_t threshold) override;
+        size_t GetSessionPendingBytes(const int64_t session_id) override;
+
+    protected:
+        //IO thread
+        void Run();
+        bool AcceptLinks();
+        bool ReadConns(const uint64_t now);
+        bool HasWork();
+
+        void OnRecv(const AFShmConn::PTR& conn);
+
+        //logic thread
+        void FlushPending();
+
+    private:
+        AFNetShmSegment::PTR listen_{ nullptr };
+        AFNetShmListenHead* listen_head_{ nullptr };
+        std::string listen_name_;
+
+        std::thread thread_;
+        std::atomic<bool> running_{ false };
+
+        //IO thread only
+        std::unordered_map<int64_t, AFShmConn::PTR> conns_;
+
+        size_t max_client_{ 0 };
+    };
+
+}
+
+#endif //ARK_HAVE_SHM_NET
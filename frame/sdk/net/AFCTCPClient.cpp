@@ -30,6 +30,7 @@ namespace ark
 
         tcp_service_ptr_ = (service != nullptr ? service : brynet::net::TcpService::Create());
         connector_ptr_ = (connector != nullptr ? connector : brynet::net::AsyncConnector::Create());
+        shared_service_ = (service != nullptr && connector != nullptr);
     }
 
     AFCTCPClient::~AFCTCPClient()
@@ -41,22 +42,41 @@ namespace ark
 
     void AFCTCPClient::Update()
     {
+        UpdateConnectFailed();
         UpdateNetSession();
     }
 
     bool AFCTCPClient::StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6/* = false*/)
     {
         this->dst_bus_id_ = dst_busid;
+        this->head_len_ = head_len;
+        this->dst_ip_ = ip;
 
-        tcp_service_ptr_->startWorkerThread(1);
-        connector_ptr_->startWorkerThread();
-
-        brynet::net::TcpSocket::PTR socket = brynet::net::SyncConnectSocket(ip, port, ARK_CONNECT_TIMEOUT, connector_ptr_);
-        if (socket == nullptr)
+        //reconnect keeps the worker threads
+        if (!shared_service_ && !IsWorking())
         {
-            return false;
+            tcp_service_ptr_->startWorkerThread(1);
+            connector_ptr_->startWorkerThread();
         }
 
+        connect_failed_.store(false, std::memory_order_relaxed);
+        connector_ptr_->asyncConnect(ip, port, ARK_CONNECT_TIMEOUT, [this](brynet::net::TcpSocket::PTR socket)
+        {
+            OnConnected(std::move(socket));
+        }, [this]()
+        {
+            connect_failed_.store(true, std::memory_order_release);
+        });
+
+        SetWorking(true);
+        return true;
+    }
+
+    //connector thread
+    void AFCTCPClient::OnConnected(brynet::net::TcpSocket::PTR socket)
+    {
+        const AFHeadLength head_len = head_len_;
+
         socket->SocketNodelay();
         auto OnEnterCallback = [&, head_len](const brynet::net::DataSocket::PTR & session)
         {
@@ -82,6 +102,7 @@ namespace ark
                 AFScopeWLock guard(this_ptr->rw_lock_);
 
                 AFTCPSessionPtr session_ptr = ARK_NEW AFTCPSession(head_len, cur_session_id, session);
+                session_ptr->SetCompressThreshold(this_ptr->GetCompressThreshold());
                 this_ptr->client_session_ptr_.reset(session_ptr);
                 session_ptr->AddNetEvent(net_connect_event);
             } while (false);
@@ -127,10 +148,6 @@ namespace ark
         tcp_service_ptr_->addDataSocket(std::move(socket),
                                         brynet::net::TcpService::AddSocketOption::WithEnterCallback(OnEnterCallback),
                                         brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(ARK_TCP_RECV_BUFFER_SIZE));
-
-
-        SetWorking(true);
-        return true;
     }
 
     bool AFCTCPClient::Shutdown()
@@ -140,8 +157,14 @@ namespace ark
             //add log
         }
 
-        connector_ptr_->stopWorkerThread();
-        tcp_service_ptr_->stopWorkerThread();
+        outbound_queue_.Clear();
+
+        if (!shared_service_)
+        {
+            connector_ptr_->stopWorkerThread();
+            tcp_service_ptr_->stopWorkerThread();
+        }
+
         SetWorking(false);
         return true;
     }
@@ -204,13 +227,48 @@ namespace ark
 
         while (event != nullptr)
         {
-            net_event_cb_(event);
+            //msgs sent in CONNECTED callback(register, handshake) go before the queued ones
+            if (event->type_ == AFNetEventType::CONNECTED)
+            {
+                connected_ = true;
+                net_event_cb_(event);
+                outbound_queue_.Replay(this);
+            }
+            else
+            {
+                if (event->type_ == AFNetEventType::DISCONNECTED)
+                {
+                    connected_ = false;
+                }
+
+                net_event_cb_(event);
+            }
+
             AFNetEvent::Release(event);
 
             session->PopNetEvent(event);
         }
     }
 
+    //async connect failed, there is no session to carry the event
+    void AFCTCPClient::UpdateConnectFailed()
+    {
+        if (!connect_failed_.exchange(false, std::memory_order_acquire))
+        {
+            return;
+        }
+
+        AFNetEvent* event = AFNetEvent::AllocEvent();
+        event->id_ = 0;
+        event->type_ = AFNetEventType::DISCONNECTED;
+        event->bus_id_ = dst_bus_id_;
+        event->ip_ = dst_ip_;
+
+        connected_ = false;
+        net_event_cb_(event);
+        AFNetEvent::Release(event);
+    }
+
     void AFCTCPClient::UpdateNetMsg(AFTCPSessionPtr session)
     {
         if (session == nullptr)
@@ -224,14 +282,14 @@ namespace ark
             return;
         }
 
-        int msg_count = 0;
+        uint32_t msg_count = 0;
         while (msg != nullptr)
         {
             net_msg_cb_(msg, session->GetSessionId());
             AFNetMsg::Release(msg);
 
             ++msg_count;
-            if (msg_count > ARK_PROCESS_NET_MSG_COUNT_ONCE)
+            if (msg_count >= GetSessionMsgBudget())
             {
                 break;
             }
@@ -247,33 +305,78 @@ namespace ark
             return false;
         }
 
-        if (client_session_ptr_ == nullptr)
+        AFNetIOVec iov;
+        iov.data_ = msg_data;
+        iov.len_ = head->GetBodyLength();
+        return SendMsgV(head, &iov, 1, session_id);
+    }
+
+    //logic thread only, no rw_lock_: handlers reply from inside UpdateNetSession which already holds it.
+    //the io thread replaces client_session_ptr_ only before CONNECTED is delivered, so it is stable while connected_
+    bool AFCTCPClient::SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id)
+    {
+        if (head == nullptr)
         {
             return false;
         }
 
-        std::string buffer;
-        switch (client_session_ptr_->GetHeadLen())
+        if (!connected_ || client_session_ptr_ == nullptr)
+        {
+            return outbound_queue_.Push(head_len_, head, iov, iov_count, GetOutboundQueueLimit());
+        }
+
+        RecordSend(head);
+
+        if (IsCoalesce())
+        {
+            std::string& staging = client_session_ptr_->GetStaging(GetCoalesceThreshold());
+            size_t offset = staging.size();
+            if (!AFNetPacket::Append(staging, client_session_ptr_->GetHeadLen(), head, iov, iov_count, client_session_ptr_->GetCompressThreshold()))
+            {
+                return false;
+            }
+
+            RecordCompress(head, staging.size() - offset - client_session_ptr_->GetHeadLen());
+
+            if (staging.size() >= GetCoalesceThreshold())
+            {
+                client_session_ptr_->FlushStaging();
+            }
+
+            return true;
+        }
+
+        AFNetPacketPtr packet = AFNetPacket::Build(client_session_ptr_->GetHeadLen(), head, iov, iov_count, client_session_ptr_->GetCompressThreshold());
+        if (packet == nullptr)
         {
-        case AFHeadLength::CS_HEAD_LENGTH:
-            buffer.append(reinterpret_cast<char*>(head), AFHeadLength::CS_HEAD_LENGTH);
-            break;
-        case AFHeadLength::SS_HEAD_LENGTH:
-            buffer.append(reinterpret_cast<char*>(head), AFHeadLength::SS_HEAD_LENGTH);
-            break;
-        default:
             return false;
-            break;
         }
 
-        if (buffer.empty())
+        RecordCompress(head, packet->size() - client_session_ptr_->GetHeadLen());
+
+        client_session_ptr_->GetSession()->send(packet);
+        return true;
+    }
+
+    bool AFCTCPClient::Flush(const int64_t session_id)
+    {
+        if (!connected_ || client_session_ptr_ == nullptr)
         {
             return false;
         }
 
-        buffer.append(msg_data, head->length_);
-        client_session_ptr_->GetSession()->send(buffer.c_str(), buffer.length());
+        client_session_ptr_->FlushStaging();
         return true;
     }
 
+    void AFCTCPClient::FlushAll()
+    {
+        Flush(0);
+    }
+
+    void AFCTCPClient::MoveOutbound(AFINet* net)
+    {
+        outbound_queue_.Replay(net);
+    }
+
 }
\ No newline at end of file
@@ -22,6 +22,8 @@
 
 #include "interface/AFINet.h"
 #include "AFNetSession.h"
+#include "AFNetPacket.h"
+#include "AFNetOutboundQueue.h"
 
 namespace ark
 {
@@ -43,37 +45,70 @@ namespace ark
             connector_ptr_ = brynet::net::AsyncConnector::Create();
         }
 
+        //many clients share one service and connector, the owner starts and stops their threads
+        template<typename BaseType>
+        AFCTCPClient(BaseType* pBaseType, void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*),
+                     const brynet::net::TcpService::PTR& service, const brynet::net::AsyncConnector::PTR& connector) :
+            tcp_service_ptr_(service),
+            connector_ptr_(connector),
+            shared_service_(true)
+        {
+            net_msg_cb_ = std::bind(handleRecv, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+
+            brynet::net::base::InitSocket();
+        }
+
         ~AFCTCPClient() override;
 
         void Update() override;
 
+        //connects asynchronously, the result comes as CONNECTED or DISCONNECTED event in Update
         bool StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6 = false) override;
 
         bool Shutdown() override final;
         bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
+        bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id) override;
 
         bool CloseSession(const AFGUID& session_id) override;
 
+        bool Flush(const int64_t session_id) override;
+        void FlushAll() override;
+        void MoveOutbound(AFINet* net) override;
+
     protected:
         bool SendMsg(const char* msg, const size_t msg_len, const AFGUID& session_id = 0);
 
         void UpdateNetSession();
         void UpdateNetEvent(AFTCPSessionPtr session);
         void UpdateNetMsg(AFTCPSessionPtr session);
+        void UpdateConnectFailed();
+
+        void OnConnected(brynet::net::TcpSocket::PTR socket);
 
         bool CloseAllSession();
 
     private:
         std::unique_ptr<AFTCPSession> client_session_ptr_{ nullptr };
         int dst_bus_id_{ 0 };
+        AFHeadLength head_len_{ AFHeadLength::SS_HEAD_LENGTH };
+        std::string dst_ip_;
         uint64_t trust_session_id_{ 1 };
 
+        //logic thread only, true after CONNECTED event is delivered and before DISCONNECTED
+        bool connected_{ false };
+        std::atomic<bool> connect_failed_{ false };
+
+        //msgs sent while disconnected, replayed after the CONNECTED callback
+        AFNetOutboundQueue outbound_queue_{ queue_stats_ };
+
         NET_MSG_FUNCTOR net_msg_cb_;
         NET_EVENT_FUNCTOR net_event_cb_;
         AFCReaderWriterLock rw_lock_;
 
         brynet::net::TcpService::PTR tcp_service_ptr_{ nullptr };
         brynet::net::AsyncConnector::PTR connector_ptr_{ nullptr };
+        bool shared_service_{ false };
     };
 
 }
\ No newline at end of file
@@ -45,165 +45,116 @@ namespace ark
         brynet::net::base::DestroySocket();
     }
 
-    void AFCTCPServer::Update()
-    {
-        UpdateNetSession();
-    }
-
     bool AFCTCPServer::StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6/* = false*/)
     {
-        this->bus_id_ = busid;
+        InitSessions(busid, head_len);
 
-        tcp_service_ptr_->startWorkerThread(thread_num);
-        listen_thread_ptr_->startListen(ip_v6, ip, port, [&, head_len](brynet::net::TcpSocket::PTR socket)
+        if (IsReusePort() && thread_num > 1 && AFNetAcceptor::IsReusePortSupported())
         {
-            AFCTCPServer* this_ptr = this;
-            socket->SocketNodelay();
-            auto OnEnterCallback = [this_ptr, head_len](const brynet::net::DataSocket::PTR & session)
+            if (StartReusePortListen(ip, port, thread_num, ip_v6))
             {
-                int64_t cur_session_id = this_ptr->trusted_session_id_++;
-
-                session->setUD(cur_session_id);
+                SetWorking(true);
+                return true;
+            }
 
-                AFNetEvent* net_connect_event = AFNetEvent::AllocEvent();
-                net_connect_event->id_ = cur_session_id;
-                net_connect_event->type_ = AFNetEventType::CONNECTED;
-                net_connect_event->bus_id_ = this_ptr->bus_id_;
-                net_connect_event->ip_ = session->getIP();
+            //fall back to single listen thread
+            StopReusePortListen();
+            tcp_service_ptr_->stopWorkerThread();
+        }
 
-                do
-                {
-                    AFScopeWLock guard(this_ptr->rw_lock_);
-                    AFTCPSessionPtr session_ptr = ARK_NEW AFTCPSession(head_len, cur_session_id, session);
-                    if (this_ptr->AddNetSession(session_ptr))
-                    {
-                        session_ptr->AddNetEvent(net_connect_event);
-                    }
-                } while (false);
-
-                session->setDataCallback([this_ptr, session](const char* buffer, size_t len)
-                {
-                    auto pUD = brynet::net::cast<int64_t>(session->getUD());
-                    if (pUD != nullptr)
-                    {
-                        const AFTCPSessionPtr session_ptr = this_ptr->GetNetSession(*pUD);
-                        session_ptr->AddBuffer(buffer, len);
-                        session_ptr->ParseBufferToMsg();
-                    }
-
-                    return len;
-                });
-
-                session->setDisConnectCallback([this_ptr](const brynet::net::DataSocket::PTR & session)
-                {
-                    auto pUD = brynet::net::cast<int64_t>(session->getUD());
-                    if (pUD == nullptr)
-                    {
-                        return;
-                    }
-
-                    int64_t session_id = *pUD;
-
-                    AFNetEvent* net_disconnect_event = AFNetEvent::AllocEvent();
-                    net_disconnect_event->id_ = session_id;
-                    net_disconnect_event->type_ = AFNetEventType::DISCONNECTED;
-                    net_disconnect_event->bus_id_ = this_ptr->bus_id_;
-                    net_disconnect_event->ip_ = session->getIP();
-
-                    const AFTCPSessionPtr session_ptr = this_ptr->GetNetSession(session_id);
-                    if (session_ptr == nullptr)
-                    {
-                        return;
-                    }
-
-                    session_ptr->AddNetEvent(net_disconnect_event);
-                    session_ptr->SetNeedRemove(true);
-                });
-            };
-
-            tcp_service_ptr_->addDataSocket(std::move(socket),
-                                            brynet::net::TcpService::AddSocketOption::WithEnterCallback(OnEnterCallback),
-                                            brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(ARK_TCP_RECV_BUFFER_SIZE));
+        tcp_service_ptr_->startWorkerThread(thread_num);
+        listen_thread_ptr_->startListen(ip_v6, ip, port, [this](brynet::net::TcpSocket::PTR socket)
+        {
+            AcceptSocket(std::move(socket), tcp_service_ptr_);
         });
 
         SetWorking(true);
         return true;
     }
 
-    void AFCTCPServer::UpdateNetSession()
+    bool AFCTCPServer::StartReusePortListen(const std::string& ip, const int port, const int thread_num, bool ip_v6)
     {
-        std::list<int64_t> remove_sessions;
-
-        do
+        //every acceptor owns one worker loop, accepted sockets go to that loop directly
+        for (int i = 0; i < thread_num; ++i)
         {
-            AFScopeRLock guard(rw_lock_);
-            for (auto& iter : sessions_)
-            {
-                auto& session = iter.second;
-                if (session == nullptr)
-                {
-                    continue;
-                }
+            brynet::net::TcpService::PTR service = (i == 0 ? tcp_service_ptr_ : brynet::net::TcpService::Create());
+            service->startWorkerThread(1);
 
-                UpdateNetEvent(session);
-                UpdateNetMsg(session);
+            AFNetAcceptor* acceptor = ARK_NEW AFNetAcceptor();
+            reuse_port_listeners_.emplace_back(acceptor, service);
 
-                if (!session->NeedRemove())
-                {
-                    continue;
-                }
+            bool ret = acceptor->Start(ip_v6, ip, port, [this, service](brynet::net::TcpSocket::PTR socket)
+            {
+                AcceptSocket(std::move(socket), service);
+            });
 
-                remove_sessions.emplace_back(session->GetSessionId());
+            if (!ret)
+            {
+                return false;
             }
-        } while (false);
-
-        for (auto& iter : remove_sessions)
-        {
-            auto& session_id = iter;
-            AFScopeWLock guard(rw_lock_);
-            CloseSession(session_id);
         }
+
+        return true;
     }
 
-    void AFCTCPServer::UpdateNetEvent(AFTCPSessionPtr session)
+    void AFCTCPServer::StopReusePortListen()
     {
-        AFNetEvent* event(nullptr);
-        if (!session->PopNetEvent(event))
+        if (reuse_port_listeners_.empty())
         {
             return;
         }
 
-        while (event != nullptr)
+        for (auto& iter : reuse_port_listeners_)
         {
-            net_event_cb_(event);
-            AFNetEvent::Release(event);
-
-            session->PopNetEvent(event);
+            iter.first->Stop();
+            ARK_DELETE(iter.first);
+            if (iter.second != tcp_service_ptr_)
+            {
+                iter.second->stopWorkerThread();
+            }
         }
+
+        reuse_port_listeners_.clear();
     }
 
-    void AFCTCPServer::UpdateNetMsg(AFTCPSessionPtr session)
+    void AFCTCPServer::AcceptSocket(brynet::net::TcpSocket::PTR socket, const brynet::net::TcpService::PTR& service)
     {
-        AFNetMsg* msg(nullptr);
-        if (!session->PopNetMsg(msg))
+        AFCTCPServer* this_ptr = this;
+        socket->SocketNodelay();
+        auto OnEnterCallback = [this_ptr](const brynet::net::DataSocket::PTR & session)
         {
-            return;
-        }
+            int64_t cur_session_id = this_ptr->trusted_session_id_++;
 
-        int msg_count = 0;
-        while (msg != nullptr)
-        {
-            net_msg_cb_(msg, session->GetSessionId());
-            AFNetMsg::Release(msg);
-
-            ++msg_count;
-            if (msg_count > ARK_PROCESS_NET_MSG_COUNT_ONCE)
+            session->setUD(cur_session_id);
+            if (!this_ptr->OnConnected(cur_session_id, session, session->getIP()))
             {
-                break;
+                return;
             }
 
-            session->PopNetMsg(msg);
-        }
+            session->setDataCallback([this_ptr, session](const char* buffer, size_t len)
+            {
+                auto pUD = brynet::net::cast<int64_t>(session->getUD());
+                if (pUD != nullptr)
+                {
+                    this_ptr->OnRecv(*pUD, buffer, len);
+                }
+
+                return len;
+            });
+
+            session->setDisConnectCallback([this_ptr](const brynet::net::DataSocket::PTR & session)
+            {
+                auto pUD = brynet::net::cast<int64_t>(session->getUD());
+                if (pUD != nullptr)
+                {
+                    this_ptr->OnDisconnected(*pUD, session->getIP());
+                }
+            });
+        };
+
+        service->addDataSocket(std::move(socket),
+                               brynet::net::TcpService::AddSocketOption::WithEnterCallback(OnEnterCallback),
+                               brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(ARK_TCP_RECV_BUFFER_SIZE));
     }
 
     bool AFCTCPServer::Shutdown()
@@ -211,6 +162,7 @@ namespace ark
         CloseAllSession();
 
         listen_thread_ptr_->stopListen();
+        StopReusePortListen();
         tcp_service_ptr_->stopWorkerThread();
 
         SetWorking(false);
@@ -219,21 +171,12 @@ namespace ark
 
     bool AFCTCPServer::SendMsgToAllClient(const char* msg, const size_t msg_len)
     {
-        for (auto it : sessions_)
-        {
-            auto& session = it.second;
-            if (session != nullptr && !session->NeedRemove())
-            {
-                session->GetSession()->send(msg, msg_len);
-            }
-        }
-
-        return true;
+        AFNetPacketPtr packet = std::make_shared<std::string>(msg, msg_len);
+        return SendPacket(packet, 0, nullptr);
     }
 
     bool AFCTCPServer::SendMsg(const char* msg, const size_t msg_len, const int64_t& session_id)
     {
-        AFScopeRLock xGuard(rw_lock_);
         auto session = GetNetSession(session_id);
         if (session == nullptr)
         {
@@ -241,57 +184,11 @@ namespace ark
         }
         else
         {
-            session->GetSession()->send(msg, msg_len);
+            QueuePacket(session, std::make_shared<std::string>(msg, msg_len));
             return true;
         }
     }
 
-    bool AFCTCPServer::AddNetSession(AFTCPSessionPtr session)
-    {
-        return sessions_.insert(std::make_pair(session->GetSessionId(), session)).second;
-    }
-
-    bool AFCTCPServer::CloseSession(AFTCPSessionPtr& session)
-    {
-        if (session != nullptr)
-        {
-            auto session_id = session->GetSessionId();
-            session->GetSession()->postDisConnect();
-            ARK_DELETE(session);
-            sessions_.erase(session_id);
-            return true;
-        }
-        else
-        {
-            return true;
-        }
-    }
-
-    bool AFCTCPServer::CloseSession(const int64_t& session_id)
-    {
-        AFTCPSessionPtr session = GetNetSession(session_id);
-        return CloseSession(session);
-    }
-
-    bool AFCTCPServer::CloseAllSession()
-    {
-        for (auto& iter : sessions_)
-        {
-            auto& session = iter.second;
-            session->GetSession()->postShutdown();
-            ARK_DELETE(session);
-        }
-
-        sessions_.clear();
-        return true;
-    }
-
-    AFTCPSessionPtr AFCTCPServer::GetNetSession(const int64_t& session_id)
-    {
-        auto iter = sessions_.find(session_id);
-        return (iter != sessions_.end() ? iter->second : nullptr);
-    }
-
     //bool AFCTCPServer::SendMsg(const uint16_t msg_id, const char* msg, const size_t msg_len, const AFGUID& session_id, const AFGUID& actor_id)
     //{
     //    //AFTCPMsg msg;
@@ -315,73 +212,4 @@ namespace ark
     //    return true;
     //}
 
-    bool AFCTCPServer::SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id)
-    {
-        if (head == nullptr || msg_data == nullptr || session_id <= 0)
-        {
-            return false;
-        }
-
-        auto session = GetNetSession(session_id);
-        if (session == nullptr)
-        {
-            return false;
-        }
-
-        std::string buffer;
-        switch (session->GetHeadLen())
-        {
-        case AFHeadLength::CS_HEAD_LENGTH:
-            buffer.append(reinterpret_cast<char*>(head), AFHeadLength::CS_HEAD_LENGTH);
-            break;
-        case AFHeadLength::SS_HEAD_LENGTH:
-            buffer.append(reinterpret_cast<char*>(head), AFHeadLength::SS_HEAD_LENGTH);
-            break;
-        default:
-            return false;
-            break;
-        }
-
-        if (buffer.empty())
-        {
-            return false;
-        }
-
-        buffer.append(msg_data, head->length_);
-        session->GetSession()->send(buffer.c_str(), buffer.length());
-        return true;
-    }
-
-    bool AFCTCPServer::BroadcastMsg(AFMsgHead* head, const char* msg_data)
-    {
-        if (head == nullptr || msg_data == nullptr)
-        {
-            return false;
-        }
-
-        if (sessions_.empty())
-        {
-            return false;
-        }
-
-        auto iter = sessions_.begin();
-        auto first_session = iter->second;
-        if (first_session == nullptr)
-        {
-            return false;
-        }
-
-        char* new_buffer = reinterpret_cast<char*>(head);
-
-        uint32_t new_buffer_len = first_session->GetHeadLen() + head->length_;
-        memcpy(new_buffer + first_session->GetHeadLen(), msg_data, head->length_);
-
-        for (auto& session : sessions_)
-        {
-            session.second->GetSession()->send(new_buffer, new_buffer_len);
-        }
-
-        return true;
-    }
-
 }
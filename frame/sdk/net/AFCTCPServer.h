@@ -20,13 +20,13 @@
 
 #pragma once
 
-#include "interface/AFINet.h"
-#include "AFNetSession.h"
+#include "AFNetServerBase.h"
+#include "AFNetAcceptor.h"
 
 namespace ark
 {
 
-    class AFCTCPServer : public AFINet
+    class AFCTCPServer : public AFNetServerBase<brynet::net::DataSocket::PTR, true>
     {
     public:
         AFCTCPServer();
@@ -44,42 +44,24 @@ namespace ark
 
         ~AFCTCPServer() override;
 
-        void Update() override;
-
         bool StartServer(AFHeadLength head_length, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6 = false) override;
         bool Shutdown() override final;
 
-        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
-        bool BroadcastMsg(AFMsgHead* head, const char* msg_data) override;
-
-        bool CloseSession(const int64_t& session_id) override;
+        using AFNetServerBase::SendMsg;
 
     protected:
+        bool StartReusePortListen(const std::string& ip, const int port, const int thread_num, bool ip_v6);
+        void StopReusePortListen();
+        void AcceptSocket(brynet::net::TcpSocket::PTR socket, const brynet::net::TcpService::PTR& service);
+
         bool SendMsgToAllClient(const char* msg, const size_t msg_len);
         bool SendMsg(const char* msg, const size_t msg_len, const int64_t& session_id);
 
-        bool AddNetSession(AFTCPSessionPtr session);
-        AFTCPSessionPtr GetNetSession(const int64_t& session_id);
-        bool CloseSession(AFTCPSessionPtr& session);
-
-        void UpdateNetSession();
-        void UpdateNetEvent(AFTCPSessionPtr session);
-        void UpdateNetMsg(AFTCPSessionPtr session);
-
-        bool CloseAllSession();
-
     private:
-        std::map<int64_t, AFTCPSessionPtr> sessions_;
-        AFCReaderWriterLock rw_lock_;
-        int max_connection_{ 0 };
-        int bus_id_{ 0 };
-
-        NET_MSG_FUNCTOR net_msg_cb_;
-        NET_EVENT_FUNCTOR net_event_cb_;
-
         brynet::net::TcpService::PTR tcp_service_ptr_{ nullptr };
         brynet::net::ListenThread::PTR listen_thread_ptr_{ nullptr };
-        std::atomic<std::int64_t> trusted_session_id_{ 1 };
+        //SO_REUSEPORT mode, acceptor and its own worker service
+        std::vector<std::pair<AFNetAcceptor*, brynet::net::TcpService::PTR>> reuse_port_listeners_;
     };
 
-}
\ No newline at end of file
+}
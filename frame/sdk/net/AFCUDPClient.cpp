@@ -0,0 +1,460 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "base/AFBaseStruct.hpp"
+#include "AFCUDPClient.h"
+
+namespace ark
+{
+
+    AFCUDPClient::~AFCUDPClient()
+    {
+        Shutdown();
+        brynet::net::base::DestroySocket();
+    }
+
+    void AFCUDPClient::Update()
+    {
+        UpdateConnectFailed();
+        UpdateNetSession();
+    }
+
+    bool AFCUDPClient::StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6/* = false*/)
+    {
+        //reconnect reuses this client, release the socket and thread of last connection
+        if (IsWorking())
+        {
+            StopConnection();
+        }
+
+        this->dst_bus_id_ = dst_busid;
+        this->head_len_ = head_len;
+        this->dst_ip_ = ip;
+
+        //channels and routing can not change any more
+        runtime_config_ = std::make_shared<AFUDPConfig>(config_);
+
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!AFUDPConn::ResolveAddr(ip, port, ip_v6, addr, addr_len))
+        {
+            return false;
+        }
+
+        fd_ = int(::socket(addr.ss_family, SOCK_DGRAM, 0));
+        if (fd_ < 0)
+        {
+            return false;
+        }
+
+        int buffer_size = ARK_UDP_SOCKET_BUFFER_SIZE;
+        ::setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&buffer_size), sizeof(buffer_size));
+        ::setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&buffer_size), sizeof(buffer_size));
+
+        //connected socket, datagrams from other addresses are dropped by kernel
+        if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0 || !brynet::net::base::SocketNonblock(fd_))
+        {
+            brynet::net::base::SocketClose(fd_);
+            fd_ = -1;
+            return false;
+        }
+
+        uint32_t nonce = uint32_t(std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+        connect_failed_.store(false, std::memory_order_relaxed);
+
+        running_ = true;
+        thread_ = std::thread([this, addr, nonce]()
+        {
+            Run(addr, nonce);
+        });
+
+        SetWorking(true);
+        return true;
+    }
+
+    uint32_t AFCUDPClient::Handshake(const uint32_t nonce)
+    {
+        AFKcpSegHead syn;
+        syn.cmd_ = ARK_KCP_CMD_SYN;
+        syn.sn_ = nonce;
+
+        char packet[ARK_KCP_HEAD_LENGTH];
+        char buffer[ARK_KCP_MTU];
+
+        auto deadline = std::chrono::steady_clock::now() + ARK_CONNECT_TIMEOUT;
+        while (running_ && std::chrono::steady_clock::now() < deadline)
+        {
+            syn.ts_ = AFUDPConn::NowMs();
+            syn.Encode(packet);
+            ::send(fd_, packet, ARK_KCP_HEAD_LENGTH, 0);
+
+            if (AFUDPConn::PollRead(fd_, int(ARK_UDP_SYN_INTERVAL)) <= 0)
+            {
+                continue;
+            }
+
+            int len = 0;
+            while ((len = int(::recv(fd_, buffer, sizeof(buffer), 0))) > 0)
+            {
+                AFKcpSegHead head;
+                if (!head.Decode(buffer, size_t(len)) || head.sn_ != nonce)
+                {
+                    continue;
+                }
+
+                //server wants its cookie back before it keeps any state, the next SYN carries it
+                if (head.cmd_ == ARK_KCP_CMD_COOKIE)
+                {
+                    syn.una_ = head.una_;
+                }
+                else if (head.cmd_ == ARK_KCP_CMD_SYN_ACK && head.conv_ != 0)
+                {
+                    return head.conv_;
+                }
+            }
+        }
+
+        return 0;
+    }
+
+    void AFCUDPClient::Run(const struct sockaddr_storage& addr, const uint32_t nonce)
+    {
+        uint32_t conv = Handshake(nonce);
+        if (conv == 0)
+        {
+            //not by Shutdown
+            if (running_)
+            {
+                connect_failed_.store(true, std::memory_order_release);
+            }
+
+            return;
+        }
+
+        int64_t cur_session_id = trust_session_id_++;
+        AFUDPConn::PTR conn = std::make_shared<AFUDPConn>(fd_, conv, cur_session_id, head_len_, addr, 0, runtime_config_);
+        conn->SetNonce(nonce);
+
+        AFNetEvent* net_connect_event = AFNetEvent::AllocEvent();
+        net_connect_event->id_ = cur_session_id;
+        net_connect_event->type_ = AFNetEventType::CONNECTED;
+        net_connect_event->bus_id_ = dst_bus_id_;
+        net_connect_event->ip_ = conn->getIP();
+
+        do
+        {
+            AFScopeWLock guard(rw_lock_);
+
+            AFUDPClientSession* session_ptr = ARK_NEW AFUDPClientSession(head_len_, cur_session_id, conn);
+            client_session_ptr_.reset(session_ptr);
+            session_ptr->AddNetEvent(net_connect_event);
+        } while (false);
+
+        const int tick = int(runtime_config_->GetTickInterval());
+        std::vector<char> buffer(64 * 1024);
+
+        auto OnFrame = [this](const char* data, size_t len)
+        {
+            AFScopeRLock guard(rw_lock_);
+            if (client_session_ptr_ != nullptr)
+            {
+                client_session_ptr_->AddBuffer(data, len);
+                client_session_ptr_->ParseBufferToMsg();
+            }
+        };
+
+        uint32_t now = AFUDPConn::NowMs();
+        while (running_ && !conn->IsClosed(now))
+        {
+            if (AFUDPConn::PollRead(fd_, tick) > 0)
+            {
+                for (uint32_t i = 0; i < ARK_UDP_RECV_BATCH; ++i)
+                {
+                    int len = int(::recv(fd_, buffer.data(), int(buffer.size()), 0));
+                    if (len <= 0)
+                    {
+                        break;
+                    }
+
+                    conn->Input(buffer.data(), size_t(len), AFUDPConn::NowMs(), OnFrame);
+                }
+            }
+
+            now = AFUDPConn::NowMs();
+            conn->Update(now);
+        }
+
+        if (!conn->IsFinReceived())
+        {
+            conn->SendCtrl(ARK_KCP_CMD_FIN, 0, now);
+        }
+
+        AFNetEvent* net_disconnect_event = AFNetEvent::AllocEvent();
+        net_disconnect_event->id_ = conn->GetSessionId();
+        net_disconnect_event->type_ = AFNetEventType::DISCONNECTED;
+        net_disconnect_event->bus_id_ = dst_bus_id_;
+        net_disconnect_event->ip_ = conn->getIP();
+
+        do
+        {
+            AFScopeWLock guard(rw_lock_);
+            if (client_session_ptr_ != nullptr)
+            {
+                client_session_ptr_->AddNetEvent(net_disconnect_event);
+                client_session_ptr_->SetNeedRemove(true);
+            }
+            else
+            {
+                AFNetEvent::Release(net_disconnect_event);
+            }
+        } while (false);
+    }
+
+    bool AFCUDPClient::Shutdown()
+    {
+        StopConnection();
+        outbound_queue_.Clear();
+
+        SetWorking(false);
+        return true;
+    }
+
+    void AFCUDPClient::StopConnection()
+    {
+        if (!CloseAllSession())
+        {
+            //add log
+        }
+
+        running_ = false;
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        if (fd_ >= 0)
+        {
+            brynet::net::base::SocketClose(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void AFCUDPClient::UpdateConnectFailed()
+    {
+        if (!connect_failed_.exchange(false, std::memory_order_acquire))
+        {
+            return;
+        }
+
+        AFNetEvent* event = AFNetEvent::AllocEvent();
+        event->id_ = 0;
+        event->type_ = AFNetEventType::DISCONNECTED;
+        event->bus_id_ = dst_bus_id_;
+        event->ip_ = dst_ip_;
+
+        connected_ = false;
+        net_event_cb_(event);
+        AFNetEvent::Release(event);
+    }
+
+    bool AFCUDPClient::CloseAllSession()
+    {
+        if (client_session_ptr_ != nullptr)
+        {
+            client_session_ptr_->GetSession()->postDisConnect();
+        }
+
+        return true;
+    }
+
+    bool AFCUDPClient::CloseSession(const AFGUID& session_id)
+    {
+        if (client_session_ptr_ != nullptr)
+        {
+            client_session_ptr_->GetSession()->postDisConnect();
+        }
+
+        return true;
+    }
+
+    void AFCUDPClient::UpdateNetSession()
+    {
+        //the IO thread sets need remove under the write lock
+        bool need_remove = false;
+        do
+        {
+            AFScopeRLock guard(rw_lock_);
+            UpdateNetEvent(client_session_ptr_.get());
+            UpdateNetMsg(client_session_ptr_.get());
+            need_remove = (client_session_ptr_ != nullptr && client_session_ptr_->NeedRemove());
+        } while (false);
+
+        if (need_remove)
+        {
+            AFScopeWLock guard(rw_lock_);
+            CloseSession(client_session_ptr_->GetSessionId());
+            client_session_ptr_.reset(nullptr);
+        }
+    }
+
+    void AFCUDPClient::UpdateNetEvent(AFUDPClientSession* session)
+    {
+        if (session == nullptr)
+        {
+            return;
+        }
+
+        AFNetEvent* event(nullptr);
+        if (!session->PopNetEvent(event))
+        {
+            return;
+        }
+
+        while (event != nullptr)
+        {
+            //msgs sent in CONNECTED callback(register, handshake) go before the queued ones
+            if (event->type_ == AFNetEventType::CONNECTED)
+            {
+                connected_ = true;
+                net_event_cb_(event);
+                outbound_queue_.Replay(this);
+            }
+            else
+            {
+                if (event->type_ == AFNetEventType::DISCONNECTED)
+                {
+                    connected_ = false;
+                }
+
+                net_event_cb_(event);
+            }
+
+            AFNetEvent::Release(event);
+
+            session->PopNetEvent(event);
+        }
+    }
+
+    void AFCUDPClient::UpdateNetMsg(AFUDPClientSession* session)
+    {
+        if (session == nullptr)
+        {
+            return;
+        }
+
+        AFNetMsg* msg(nullptr);
+        if (!session->PopNetMsg(msg))
+        {
+            return;
+        }
+
+        uint32_t msg_count = 0;
+        while (msg != nullptr)
+        {
+            net_msg_cb_(msg, session->GetSessionId());
+            AFNetMsg::Release(msg);
+
+            ++msg_count;
+            if (msg_count >= GetSessionMsgBudget())
+            {
+                break;
+            }
+
+            session->PopNetMsg(msg);
+        }
+    }
+
+    bool AFCUDPClient::SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id)
+    {
+        if (head == nullptr || msg_data == nullptr)
+        {
+            return false;
+        }
+
+        AFNetIOVec iov;
+        iov.data_ = msg_data;
+        iov.len_ = head->GetBodyLength();
+        return SendMsgV(head, &iov, 1, session_id);
+    }
+
+    //logic thread only, no rw_lock_: handlers reply from inside UpdateNetSession which already holds it.
+    //the io thread replaces client_session_ptr_ only before CONNECTED is delivered, so it is stable while connected_
+    bool AFCUDPClient::SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id)
+    {
+        if (head == nullptr)
+        {
+            return false;
+        }
+
+        if (!connected_ || client_session_ptr_ == nullptr)
+        {
+            return outbound_queue_.Push(head_len_, head, iov, iov_count, GetOutboundQueueLimit());
+        }
+
+        RecordSend(head);
+
+        if (IsCoalesce())
+        {
+            std::string& staging = client_session_ptr_->GetStaging(GetCoalesceThreshold());
+            if (!AFNetPacket::Append(staging, client_session_ptr_->GetHeadLen(), head, iov, iov_count))
+            {
+                return false;
+            }
+
+            if (staging.size() >= GetCoalesceThreshold())
+            {
+                client_session_ptr_->FlushStaging();
+            }
+
+            return true;
+        }
+
+        AFNetPacketPtr packet = AFNetPacket::Build(client_session_ptr_->GetHeadLen(), head, iov, iov_count);
+        if (packet == nullptr)
+        {
+            return false;
+        }
+
+        client_session_ptr_->GetSession()->send(packet);
+        return true;
+    }
+
+    bool AFCUDPClient::Flush(const int64_t session_id)
+    {
+        if (!connected_ || client_session_ptr_ == nullptr)
+        {
+            return false;
+        }
+
+        client_session_ptr_->FlushStaging();
+        return true;
+    }
+
+    void AFCUDPClient::FlushAll()
+    {
+        Flush(0);
+    }
+
+    void AFCUDPClient::MoveOutbound(AFINet* net)
+    {
+        outbound_queue_.Replay(net);
+    }
+
+}
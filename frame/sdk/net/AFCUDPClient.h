@@ -0,0 +1,111 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "interface/AFINet.h"
+#include "AFNetSession.h"
+#include "AFNetPacket.h"
+#include "AFNetUDPConn.h"
+#include "AFNetOutboundQueue.h"
+
+namespace ark
+{
+
+    using AFUDPClientSession = AFNetSession<AFUDPConn::PTR>;
+
+    //Reliable udp client, one IO thread owns the socket and the connection.
+    //The handshake runs on the IO thread too, the result comes back as CONNECTED or DISCONNECTED event.
+    class AFCUDPClient : public AFINet
+    {
+    public:
+        template<typename BaseType>
+        AFCUDPClient(BaseType* pBaseType, void (BaseType::*handleRecv)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+        {
+            net_msg_cb_ = std::bind(handleRecv, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+
+            brynet::net::base::InitSocket();
+        }
+
+        ~AFCUDPClient() override;
+
+        //must be set before StartClient
+        AFUDPConfig& GetConfig()
+        {
+            return config_;
+        }
+
+        void Update() override;
+
+        bool StartClient(AFHeadLength head_len, const int dst_busid, const std::string& ip, const int port, bool ip_v6 = false) override;
+
+        bool Shutdown() override final;
+        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
+        bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id) override;
+
+        bool CloseSession(const AFGUID& session_id) override;
+
+        bool Flush(const int64_t session_id) override;
+        void FlushAll() override;
+        void MoveOutbound(AFINet* net) override;
+
+    protected:
+        //IO thread, wait SYN_ACK, return the conv given by server or 0
+        uint32_t Handshake(const uint32_t nonce);
+        void Run(const struct sockaddr_storage& addr, const uint32_t nonce);
+
+        //join the IO thread and close the socket of last connection
+        void StopConnection();
+
+        void UpdateNetSession();
+        void UpdateNetEvent(AFUDPClientSession* session);
+        void UpdateNetMsg(AFUDPClientSession* session);
+        void UpdateConnectFailed();
+
+        bool CloseAllSession();
+
+    private:
+        AFUDPConfig config_;
+        AFUDPConfigPtr runtime_config_{ nullptr };
+
+        int fd_{ -1 };
+        std::thread thread_;
+        std::atomic<bool> running_{ false };
+
+        std::unique_ptr<AFUDPClientSession> client_session_ptr_{ nullptr };
+        int dst_bus_id_{ 0 };
+        AFHeadLength head_len_{ AFHeadLength::SS_HEAD_LENGTH };
+        std::string dst_ip_;
+        uint64_t trust_session_id_{ 1 };
+
+        //logic thread only, true after CONNECTED event is delivered and before DISCONNECTED
+        bool connected_{ false };
+        std::atomic<bool> connect_failed_{ false };
+
+        //msgs sent while disconnected, replayed after the CONNECTED callback
+        AFNetOutboundQueue outbound_queue_{ queue_stats_ };
+
+        NET_MSG_FUNCTOR net_msg_cb_;
+        NET_EVENT_FUNCTOR net_event_cb_;
+        AFCReaderWriterLock rw_lock_;
+    };
+
+}
@@ -0,0 +1,323 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCUDPServer.h"
+
+#if ARK_PLATFORM == PLATFORM_WIN
+#include <WS2tcpip.h>
+#else
+#include <netinet/in.h>
+#endif
+
+namespace ark
+{
+
+    AFCUDPServer::~AFCUDPServer()
+    {
+        Shutdown();
+    }
+
+    bool AFCUDPServer::StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6/* = false*/)
+    {
+        InitSessions(busid, head_len);
+        this->max_client_ = max_client;
+
+        //channels and routing can not change any more
+        runtime_config_ = std::make_shared<AFUDPConfig>(config_);
+
+        std::random_device device;
+        random_.seed(device());
+        cookie_secret_ = (uint64_t(device()) << 32) | device();
+
+        struct sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        if (!AFUDPConn::ResolveAddr(ip, port, ip_v6, addr, addr_len))
+        {
+            return false;
+        }
+
+        fd_ = int(::socket(addr.ss_family, SOCK_DGRAM, 0));
+        if (fd_ < 0)
+        {
+            return false;
+        }
+
+        int buffer_size = ARK_UDP_SOCKET_BUFFER_SIZE;
+        ::setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&buffer_size), sizeof(buffer_size));
+        ::setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&buffer_size), sizeof(buffer_size));
+
+        if (::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0 || !brynet::net::base::SocketNonblock(fd_))
+        {
+            brynet::net::base::SocketClose(fd_);
+            fd_ = -1;
+            return false;
+        }
+
+        running_ = true;
+        thread_ = std::thread([this]()
+        {
+            Run();
+        });
+
+        SetWorking(true);
+        return true;
+    }
+
+    bool AFCUDPServer::Shutdown()
+    {
+        running_ = false;
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+        CloseAllSession();
+
+        if (fd_ >= 0)
+        {
+            brynet::net::base::SocketClose(fd_);
+            fd_ = -1;
+        }
+
+        SetWorking(false);
+        return true;
+    }
+
+    void AFCUDPServer::Run()
+    {
+        const int tick = int(runtime_config_->GetTickInterval());
+        std::vector<char> buffer(64 * 1024);
+
+        while (running_)
+        {
+            if (AFUDPConn::PollRead(fd_, tick) > 0)
+            {
+                for (uint32_t i = 0; i < ARK_UDP_RECV_BATCH; ++i)
+                {
+                    struct sockaddr_storage addr;
+                    memset(&addr, 0, sizeof(addr));
+                    socklen_t addr_len = sizeof(addr);
+                    int len = int(::recvfrom(fd_, buffer.data(), int(buffer.size()), 0, reinterpret_cast<struct sockaddr*>(&addr), &addr_len));
+                    if (len <= 0)
+                    {
+                        break;
+                    }
+
+                    OnDatagram(buffer.data(), size_t(len), addr, addr_len);
+                }
+            }
+
+            UpdateConns(AFUDPConn::NowMs());
+        }
+
+        //tell peers at once, or they find it by timeout
+        uint32_t now = AFUDPConn::NowMs();
+        for (auto& iter : conns_)
+        {
+            iter.second->SendCtrl(ARK_KCP_CMD_FIN, 0, now);
+        }
+
+        conns_.clear();
+        addr_conns_.clear();
+    }
+
+    void AFCUDPServer::OnDatagram(const char* data, const size_t len, const struct sockaddr_storage& addr, socklen_t addr_len)
+    {
+        AFKcpSegHead head;
+        if (!head.Decode(data, len))
+        {
+            return;
+        }
+
+        uint32_t now = AFUDPConn::NowMs();
+        if (head.cmd_ == ARK_KCP_CMD_SYN)
+        {
+            OnSyn(head, addr, addr_len, now);
+            return;
+        }
+
+        //conv and peer address must both match
+        auto iter = conns_.find(head.conv_);
+        if (iter == conns_.end() || !iter->second->IsSameAddr(addr, addr_len))
+        {
+            return;
+        }
+
+        int64_t session_id = iter->second->GetSessionId();
+        iter->second->Input(data, len, now, [this, session_id](const char* frame, size_t frame_len)
+        {
+            OnRecv(session_id, frame, frame_len);
+        });
+    }
+
+    void AFCUDPServer::OnSyn(const AFKcpSegHead& syn, const struct sockaddr_storage& addr, socklen_t addr_len, const uint32_t now)
+    {
+        const uint32_t nonce = syn.sn_;
+        std::string key = AFUDPConn::GetAddrKey(addr, addr_len);
+        auto addr_iter = addr_conns_.find(key);
+        if (addr_iter != addr_conns_.end())
+        {
+            auto iter = conns_.find(addr_iter->second);
+            if (iter != conns_.end())
+            {
+                AFUDPConn::PTR conn = iter->second;
+                if (conn->GetNonce() == nonce)
+                {
+                    //our SYN_ACK was lost
+                    conn->SendCtrl(ARK_KCP_CMD_SYN_ACK, nonce, now);
+                    return;
+                }
+            }
+        }
+
+        //the peer proves it receives at its address before any state is kept
+        if (!CheckCookie(key, nonce, syn.una_, now))
+        {
+            SendCookie(nonce, key, addr, addr_len, now);
+            return;
+        }
+
+        if (addr_iter != addr_conns_.end())
+        {
+            //peer restarted with the same address
+            auto iter = conns_.find(addr_iter->second);
+            if (iter != conns_.end())
+            {
+                AFUDPConn::PTR conn = iter->second;
+                conns_.erase(iter);
+                CloseConn(conn, now);
+            }
+        }
+
+        if (max_client_ > 0 && conns_.size() >= max_client_)
+        {
+            return;
+        }
+
+        int64_t session_id = trusted_session_id_++;
+        uint32_t conv = NewConv();
+        AFUDPConn::PTR conn = std::make_shared<AFUDPConn>(fd_, conv, session_id, head_len_, addr, addr_len, runtime_config_);
+        conn->SetNonce(nonce);
+        conns_.insert(std::make_pair(conv, conn));
+        addr_conns_[key] = conv;
+
+        OnConnected(session_id, conn, conn->getIP());
+        conn->SendCtrl(ARK_KCP_CMD_SYN_ACK, nonce, now);
+    }
+
+    uint32_t AFCUDPServer::MakeCookie(const std::string& addr_key, const uint32_t nonce, const uint32_t slot) const
+    {
+        //fnv-1a keyed by a random secret, then a 64 bit finalizer
+        uint64_t hash = 14695981039346656037ULL;
+        auto mix = [&hash](const void* data, size_t len)
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < len; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ULL;
+            }
+        };
+
+        mix(&cookie_secret_, sizeof(cookie_secret_));
+        mix(addr_key.data(), addr_key.size());
+        mix(&nonce, sizeof(nonce));
+        mix(&slot, sizeof(slot));
+        mix(&cookie_secret_, sizeof(cookie_secret_));
+
+        hash ^= (hash >> 33);
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= (hash >> 33);
+
+        //0 means no cookie
+        return (uint32_t(hash) | 1);
+    }
+
+    bool AFCUDPServer::CheckCookie(const std::string& addr_key, const uint32_t nonce, const uint32_t cookie, const uint32_t now) const
+    {
+        if (cookie == 0)
+        {
+            return false;
+        }
+
+        const uint32_t slot = now / ARK_UDP_COOKIE_SLOT;
+        return (cookie == MakeCookie(addr_key, nonce, slot) || cookie == MakeCookie(addr_key, nonce, slot - 1));
+    }
+
+    void AFCUDPServer::SendCookie(const uint32_t nonce, const std::string& addr_key, const struct sockaddr_storage& addr, socklen_t addr_len, const uint32_t now)
+    {
+        //same size as the SYN, nothing to amplify
+        AFKcpSegHead head;
+        head.cmd_ = ARK_KCP_CMD_COOKIE;
+        head.ts_ = now;
+        head.sn_ = nonce;
+        head.una_ = MakeCookie(addr_key, nonce, now / ARK_UDP_COOKIE_SLOT);
+
+        char packet[ARK_KCP_HEAD_LENGTH];
+        head.Encode(packet);
+        ::sendto(fd_, packet, ARK_KCP_HEAD_LENGTH, 0, reinterpret_cast<const struct sockaddr*>(&addr), addr_len);
+    }
+
+    //random, so a conv can not be guessed from the ones seen before
+    uint32_t AFCUDPServer::NewConv()
+    {
+        uint32_t conv = random_();
+        while (conv == 0 || conns_.find(conv) != conns_.end())
+        {
+            conv = random_();
+        }
+
+        return conv;
+    }
+
+    void AFCUDPServer::UpdateConns(const uint32_t now)
+    {
+        for (auto iter = conns_.begin(); iter != conns_.end();)
+        {
+            AFUDPConn::PTR conn = iter->second;
+            conn->Update(now);
+            if (!conn->IsClosed(now))
+            {
+                ++iter;
+                continue;
+            }
+
+            iter = conns_.erase(iter);
+            CloseConn(conn, now);
+        }
+    }
+
+    void AFCUDPServer::CloseConn(const AFUDPConn::PTR& conn, const uint32_t now)
+    {
+        if (!conn->IsFinReceived())
+        {
+            conn->SendCtrl(ARK_KCP_CMD_FIN, 0, now);
+        }
+
+        auto iter = addr_conns_.find(conn->GetPeerKey());
+        if (iter != addr_conns_.end() && iter->second == conn->GetConv())
+        {
+            addr_conns_.erase(iter);
+        }
+
+        OnDisconnected(conn->GetSessionId(), conn->getIP());
+    }
+
+}
@@ -0,0 +1,84 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include <random>
+#include "AFNetServerBase.h"
+#include "AFNetUDPConn.h"
+
+namespace ark
+{
+
+    //Reliable udp server, one IO thread reads the socket and drives all connections.
+    //Msgs and events reach the logic thread the same way as AFCTCPServer.
+    class AFCUDPServer : public AFNetServerBase<AFUDPConn::PTR>
+    {
+    public:
+        template<typename BaseType>
+        AFCUDPServer(BaseType* pBaseType, void (BaseType::*handleRecieve)(const AFNetMsg*, const int64_t), void (BaseType::*handleEvent)(const AFNetEvent*))
+        {
+            net_msg_cb_ = std::bind(handleRecieve, pBaseType, std::placeholders::_1, std::placeholders::_2);
+            net_event_cb_ = std::bind(handleEvent, pBaseType, std::placeholders::_1);
+        }
+
+        ~AFCUDPServer() override;
+
+        //must be set before StartServer
+        AFUDPConfig& GetConfig()
+        {
+            return config_;
+        }
+
+        bool StartServer(AFHeadLength head_length, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6 = false) override;
+        bool Shutdown() override final;
+
+    protected:
+        //IO thread
+        void Run();
+        void OnDatagram(const char* data, const size_t len, const struct sockaddr_storage& addr, socklen_t addr_len);
+        void OnSyn(const AFKcpSegHead& syn, const struct sockaddr_storage& addr, socklen_t addr_len, const uint32_t now);
+
+        //a conn is created only for a SYN echoing the cookie sent to its address, spoofed SYNs never get one
+        uint32_t MakeCookie(const std::string& addr_key, const uint32_t nonce, const uint32_t slot) const;
+        bool CheckCookie(const std::string& addr_key, const uint32_t nonce, const uint32_t cookie, const uint32_t now) const;
+        void SendCookie(const uint32_t nonce, const std::string& addr_key, const struct sockaddr_storage& addr, socklen_t addr_len, const uint32_t now);
+        uint32_t NewConv();
+        void UpdateConns(const uint32_t now);
+        void CloseConn(const AFUDPConn::PTR& conn, const uint32_t now);
+
+    private:
+        AFUDPConfig config_;
+        AFUDPConfigPtr runtime_config_{ nullptr };
+
+        int fd_{ -1 };
+        std::thread thread_;
+        std::atomic<bool> running_{ false };
+
+        //IO thread only
+        std::unordered_map<uint32_t, AFUDPConn::PTR> conns_;    //conv -> conn
+        std::unordered_map<std::string, uint32_t> addr_conns_;  //peer address -> conv
+        std::mt19937 random_;
+        uint64_t cookie_secret_{ 0 };
+
+        size_t max_client_{ 0 };
+    };
+
+}
@@ -37,351 +37,107 @@ namespace ark
         brynet::net::base::DestroySocket();
     }
 
-    void AFCWebSocktServer::Update()
-    {
-        UpdateNetSession();
-    }
-
     bool AFCWebSocktServer::StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6/* = false*/)
     {
-        bus_id_ = busid;
+        InitSessions(busid, head_len);
 
         tcp_service_ptr_->startWorkerThread(thread_num);
-        listen_thread_ptr_->startListen(ip_v6, ip, port, [&](brynet::net::TcpSocket::PTR socket)
+        listen_thread_ptr_->startListen(ip_v6, ip, port, [this](brynet::net::TcpSocket::PTR socket)
         {
-            std::string session_ip = socket->GetIP();
-            AFCWebSocktServer* this_ptr = this;
-            auto OnEnterCallback = [this_ptr, &head_len, &session_ip](const brynet::net::DataSocket::PTR & session)
-            {
-                brynet::net::http::HttpService::setup(session, [this_ptr, &head_len, &session_ip](const brynet::net::http::HttpSession::PTR & httpSession)
-                {
-                    int64_t cur_session_id = this_ptr->trusted_session_id_++;
-                    AFNetEvent* net_connect_event = AFNetEvent::AllocEvent();
-                    net_connect_event->id_ = cur_session_id;
-                    net_connect_event->type_ = AFNetEventType::CONNECTED;
-                    net_connect_event->bus_id_ = this_ptr->bus_id_;
-                    net_connect_event->ip_ = session_ip;
-
-                    do
-                    {
-                        AFScopeWLock guard(this_ptr->rw_lock_);
-                        AFHttpSessionPtr session_ptr = ARK_NEW AFHttpSession(head_len, cur_session_id, httpSession);
-                        if (this_ptr->AddNetSession(session_ptr))
-                        {
-                            session_ptr->AddNetEvent(net_connect_event);
-                        }
-                    } while (false);
-
-                    httpSession->setWSCallback([this_ptr](const brynet::net::http::HttpSession::PTR & httpSession,
-                                                          brynet::net::http::WebSocketFormat::WebSocketFrameType opcode,
-                                                          const std::string & payload)
-                    {
-                        switch (opcode)
-                        {
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::ERROR_FRAME:
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::CONTINUATION_FRAME:
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::TEXT_FRAME:
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::BINARY_FRAME:
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::CLOSE_FRAME:
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::PING_FRAME:
-                            {
-                                auto frame = std::make_shared<std::string>();
-                                brynet::net::http::WebSocketFormat::wsFrameBuild(payload.c_str(),
-                                        payload.size(),
-                                        *frame,
-                                        brynet::net::http::WebSocketFormat::WebSocketFrameType::PONG_FRAME,
-                                        true,
-                                        false);
-                                httpSession->send(frame);
-                                return;
-                            }
-                            break;
-                        case brynet::net::http::WebSocketFormat::WebSocketFrameType::PONG_FRAME:
-                            break;
-                        default:
-                            break;
-                        }
-
-                        const auto ud = brynet::net::cast<int64_t>(httpSession->getUD());
-                        int64_t session_id = *ud;
-
-                        do
-                        {
-                            AFScopeRLock guard(this_ptr->rw_lock_);
-                            auto session_ptr = this_ptr->GetNetSession(session_id);
-                            if (session_ptr == nullptr)
-                            {
-                                return;
-                            }
-
-                            session_ptr->AddBuffer(payload.c_str(), payload.size());
-                            session_ptr->ParseBufferToMsg();
-                        } while (false);
-                    });
-
-                    httpSession->setHttpCallback([](const brynet::net::http::HTTPParser & httpParser, const brynet::net::http::HttpSession::PTR & session)
-                    {
-                        brynet::net::http::HttpResponse response;
-                        response.setBody("<html>Hello QuadHex.ARK</html>");
-                        std::string result = response.getResult();
-                        session->send(result.c_str(), result.size(), [session]()
-                        {
-                            session->postShutdown();
-                        });
-                    });
-
-                    httpSession->setCloseCallback([this_ptr, &session_ip](const brynet::net::http::HttpSession::PTR & httpSession)
-                    {
-                        const auto ud = brynet::net::cast<int64_t>(httpSession->getUD());
-                        int64_t session_id = *ud;
-
-                        AFNetEvent* net_disconnect_event = AFNetEvent::AllocEvent();
-                        net_disconnect_event->id_ = session_id;
-                        net_disconnect_event->type_ = AFNetEventType::DISCONNECTED;
-                        net_disconnect_event->bus_id_ = this_ptr->bus_id_;
-                        net_disconnect_event->ip_ = session_ip;
-
-                        AFScopeWLock guard(this_ptr->rw_lock_);
-                        const AFHttpSessionPtr session_ptr = this_ptr->GetNetSession(session_id);
-                        if (session_ptr == nullptr)
-                        {
-                            return;
-                        }
-
-                        session_ptr->AddNetEvent(net_disconnect_event);
-                        session_ptr->SetNeedRemove(true);
-                    });
-                });
-            };
-
-            tcp_service_ptr_->addDataSocket(std::move(socket),
-                                            brynet::net::TcpService::AddSocketOption::WithEnterCallback(OnEnterCallback),
-                                            brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(ARK_HTTP_RECV_BUFFER_SIZE));
+            AcceptSocket(std::move(socket));
         });
 
+        SetWorking(true);
         return true;
     }
 
-    void AFCWebSocktServer::UpdateNetSession()
-    {
-        std::list<AFGUID> remove_sessions;
-        do
-        {
-            AFScopeRLock guard(rw_lock_);
-            for (auto& iter : sessions_)
-            {
-                auto& session = iter.second;
-                if (session == nullptr)
-                {
-                    continue;
-                }
-
-                UpdateNetEvent(session);
-                UpdateNetMsg(session);
-
-                if (!session->NeedRemove())
-                {
-                    continue;
-                }
-
-                remove_sessions.push_back(session->GetSessionId());
-            }
-        } while (false);
-
-        for (auto iter : remove_sessions)
-        {
-            auto& session_id = iter;
-            AFScopeWLock guard(rw_lock_);
-            CloseSession(session_id);
-        }
-
-        remove_sessions.clear();
-    }
-
-    void AFCWebSocktServer::UpdateNetEvent(AFHttpSessionPtr session)
-    {
-        AFNetEvent* event(nullptr);
-        if (!session->PopNetEvent(event))
-        {
-            return;
-        }
-
-        while (event != nullptr)
-        {
-            net_event_cb_(event);
-            AFNetEvent::Release(event);
-
-            session->PopNetEvent(event);
-        }
-    }
-
-    void AFCWebSocktServer::UpdateNetMsg(AFHttpSessionPtr session)
+    bool AFCWebSocktServer::Shutdown()
     {
-        AFNetMsg* msg(nullptr);
-        if (!session->PopNetMsg(msg))
-        {
-            return;
-        }
-
-        int msg_count = 0;
-        while (msg != nullptr)
-        {
-            net_msg_cb_(msg, session->GetSessionId());
-            AFNetMsg::Release(msg);
-
-            ++msg_count;
-            if (msg_count > ARK_PROCESS_NET_MSG_COUNT_ONCE)
-            {
-                break;
-            }
+        CloseAllSession();
 
-            session->PopNetMsg(msg);
-        }
-    }
+        listen_thread_ptr_->stopListen();
+        tcp_service_ptr_->stopWorkerThread();
 
-    bool AFCWebSocktServer::Shutdown()
-    {
         SetWorking(false);
         return true;
     }
 
-    bool AFCWebSocktServer::SendMsgToAllClient(const char* msg, const size_t nLen)
+    void AFCWebSocktServer::AcceptSocket(brynet::net::TcpSocket::PTR socket)
     {
-        //auto frame = std::make_shared<std::string>();
-        //brynet::net::WebSocketFormat::wsFrameBuild(msg,
-        //        nLen,
-        //        *frame,
-        //        brynet::net::WebSocketFormat::WebSocketFrameType::BINARY_FRAME,
-        //        true,
-        //        false);
-
-        //for (auto& it : sessions_)
-        //{
-        //    AFHttpEntityPtr pNetObject = it.second;
-
-        //    if (pNetObject && !pNetObject->NeedRemove())
-        //    {
-        //        pNetObject->GetSession()->send(frame);
-        //    }
-        //}
+        AFCWebSocktServer* this_ptr = this;
+        socket->SocketNodelay();
+        auto OnEnterCallback = [this_ptr](const brynet::net::DataSocket::PTR & session)
+        {
+            AFWSConn::PTR conn = std::make_shared<AFWSConn>(session);
 
-        return true;
-    }
+            session->setDataCallback([this_ptr, session, conn](const char* buffer, size_t len)
+            {
+                size_t used = 0;
+                if (!conn->IsOpen())
+                {
+                    used = conn->Handshake(buffer, len);
+                    if (!conn->IsOpen())
+                    {
+                        return used;
+                    }
 
-    bool AFCWebSocktServer::SendMsg(const char* msg, const size_t msg_len, const AFGUID& session_id)
-    {
-        //AFScopeRdLock xGuard(rw_lock_);
+                    this_ptr->OpenSession(session, conn);
+                }
 
-        //AFHttpEntity* pNetObject = GetNetSession(session_id);
+                auto pUD = brynet::net::cast<int64_t>(session->getUD());
+                if (pUD == nullptr)
+                {
+                    return len;
+                }
 
-        //if (pNetObject == nullptr)
-        //{
-        //    return false;
-        //}
+                bool found = this_ptr->sessions_.Visit(*pUD, [this_ptr, &conn, &used, buffer, len](AFWSSessionPtr session_ptr)
+                {
+                    //control frames count too, browsers keep the link alive with ping
+                    session_ptr->Touch(this_ptr->GetNetTime());
+                    int msg_count = 0;
+                    used += conn->Input(const_cast<char*>(buffer) + used, len - used, [session_ptr, &msg_count](const char* payload, size_t payload_len)
+                    {
+                        session_ptr->AddBuffer(payload, payload_len);
+                        msg_count += session_ptr->ParseBufferToMsg();
+                    });
 
-        //auto frame = std::make_shared<std::string>();
-        //brynet::net::WebSocketFormat::wsFrameBuild(msg,
-        //        msg_len,
-        //        *frame,
-        //        brynet::net::WebSocketFormat::WebSocketFrameType::BINARY_FRAME,
-        //        true,
-        //        false);
+                    if (msg_count > 0)
+                    {
+                        this_ptr->PushReadySession(session_ptr);
+                    }
 
-        //pNetObject->GetSession()->send(frame);
-        return true;
-    }
+                    if (session_ptr->IsRefused())
+                    {
+                        conn->postDisConnect();
+                    }
+                });
 
-    bool AFCWebSocktServer::AddNetSession(AFHttpSessionPtr session)
-    {
-        return sessions_.insert(std::make_pair(session->GetSessionId(), session)).second;
-    }
+                return (found ? used : len);
+            });
 
-    bool AFCWebSocktServer::CloseSession(AFHttpSessionPtr session)
-    {
-        if (session != nullptr)
-        {
-            auto session_id = session->GetSessionId();
-            session->GetSession()->postShutdown();
-            ARK_DELETE(session);
-            sessions_.erase(session_id);
-            return true;
-        }
-        else
-        {
-            return false;
-        }
-    }
+            session->setDisConnectCallback([this_ptr](const brynet::net::DataSocket::PTR & session)
+            {
+                //the session is not created if handshake is not done
+                auto pUD = brynet::net::cast<int64_t>(session->getUD());
+                if (pUD != nullptr)
+                {
+                    this_ptr->OnDisconnected(*pUD, session->getIP());
+                }
+            });
+        };
 
-    bool AFCWebSocktServer::CloseSession(const AFGUID& session_id)
-    {
-        auto session = GetNetSession(session_id);
-        return CloseSession(session);
+        tcp_service_ptr_->addDataSocket(std::move(socket),
+                                        brynet::net::TcpService::AddSocketOption::WithEnterCallback(OnEnterCallback),
+                                        brynet::net::TcpService::AddSocketOption::WithMaxRecvBufferSize(ARK_HTTP_RECV_BUFFER_SIZE));
     }
 
-    bool AFCWebSocktServer::CloseAllSession()
+    void AFCWebSocktServer::OpenSession(const brynet::net::DataSocket::PTR& socket, const AFWSConn::PTR& conn)
     {
-        for (auto& iter : sessions_)
+        int64_t cur_session_id = trusted_session_id_++;
+        if (OnConnected(cur_session_id, conn, socket->getIP()))
         {
-            auto& session = iter.second;
-            session->GetSession()->postShutdown();
-            ARK_DELETE(session);
+            socket->setUD(cur_session_id);
         }
-
-        sessions_.clear();
-        return true;
-    }
-
-    AFHttpSessionPtr AFCWebSocktServer::GetNetSession(const AFGUID& session_id)
-    {
-        auto it = sessions_.find(session_id);
-        return (it != sessions_.end() ? it->second : nullptr);
-    }
-
-    bool AFCWebSocktServer::SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id)
-    {
-        //AFCSMsgHead head;
-        //head.set_msg_id(msg_id);
-        //head.set_uid(actor_id);
-        //head.set_body_length(msg_len);
-
-        //std::string out_data;
-        //size_t whole_len = EnCode(head, msg, msg_len, out_data);
-        //if (whole_len == msg_len + GetHeadLength())
-        //{
-        //    return SendMsg(out_data.c_str(), out_data.length(), session_id);
-        //}
-        //else
-        //{
-        //    return false;
-        //}
-
-        return true;
-    }
-
-    bool AFCWebSocktServer::BroadcastMsg(AFMsgHead* head, const char* msg_data)
-    {
-        //AFCSMsgHead head;
-        //head.set_msg_id(msg_id);
-        //head.set_uid(actor_id);
-        //head.set_body_length(msg_len);
-
-        //std::string out_data;
-        //size_t whole_len = EnCode(head, msg, msg_len, out_data);
-        //if (whole_len == msg_len + GetHeadLength())
-        //{
-        //    return SendMsgToAllClient(out_data.c_str(), out_data.length());
-        //}
-        //else
-        //{
-        //    return false;
-        //}
-
-        return true;
     }
 
-}
\ No newline at end of file
+}
@@ -20,15 +20,18 @@
 
 #pragma once
 
-#include <brynet/net/http/HttpService.h>
-#include <brynet/net/http/HttpFormat.h>
-#include "interface/AFINet.h"
-#include "AFNetSession.h"
+#include "AFNetServerBase.h"
+#include "AFNetWebSocket.h"
 
 namespace ark
 {
 
-    class AFCWebSocktServer : public AFINet
+    using AFWSSession = AFNetSession<AFWSConn::PTR>;
+    using AFWSSessionPtr = AFWSSession * ;
+
+    //WebSocket server, binary frames carry the same msg stream as tcp and
+    //go through the same session, ready queue and dispatch path as AFCTCPServer
+    class AFCWebSocktServer : public AFNetServerBase<AFWSConn::PTR, true>
     {
     public:
         AFCWebSocktServer();
@@ -46,43 +49,17 @@ namespace ark
 
         ~AFCWebSocktServer() override;
 
-        void Update() override;
-
         bool StartServer(AFHeadLength head_len, const int busid, const std::string& ip, const int port, const int thread_num, const unsigned int max_client, bool ip_v6 = false) override;
         bool Shutdown() override final;
 
-        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override;
-        bool BroadcastMsg(AFMsgHead* head, const char* msg_data) override;
-
-        bool CloseSession(const AFGUID& session_id) override;
-
     protected:
-        bool SendMsgToAllClient(const char* msg, const size_t msg_len);
-        bool SendMsg(const char* msg, const size_t msg_len, const AFGUID& session_id);
-
-        bool AddNetSession(AFHttpSessionPtr session);
-        AFHttpSessionPtr GetNetSession(const AFGUID& session_id);
-        bool CloseSession(const AFHttpSessionPtr session);
-
-        void UpdateNetSession();
-        void UpdateNetEvent(AFHttpSessionPtr session);
-        void UpdateNetMsg(AFHttpSessionPtr session);
-
-        bool CloseAllSession();
+        void AcceptSocket(brynet::net::TcpSocket::PTR socket);
+        //handshake is done, the session starts to receive msgs
+        void OpenSession(const brynet::net::DataSocket::PTR& socket, const AFWSConn::PTR& conn);
 
     private:
-        std::map<int64_t, AFHttpSessionPtr> sessions_;
-        AFCReaderWriterLock rw_lock_;
-        int max_connection_{ 0 };
-        int thread_num_{ 0 };
-        int bus_id_{ 0 };
-
-        NET_MSG_FUNCTOR net_msg_cb_;
-        NET_EVENT_FUNCTOR net_event_cb_;
-
         brynet::net::TcpService::PTR tcp_service_ptr_{ nullptr };
         brynet::net::ListenThread::PTR listen_thread_ptr_{ nullptr };
-        std::atomic<std::uint64_t> trusted_session_id_{ 1 };
     };
 
-}
\ No newline at end of file
+}
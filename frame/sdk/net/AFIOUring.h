@@ -0,0 +1,348 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFPlatform.hpp"
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+
+#if defined(ARK_HAVE_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ark
+{
+
+    //Thin io_uring wrapper on raw syscalls, owned and used by one thread.
+    //SQEs are prepared in user space and submitted in one batch by Submit.
+    class AFIOUring : public AFNoncopyable
+    {
+    public:
+        AFIOUring() = default;
+
+        ~AFIOUring()
+        {
+            Close();
+        }
+
+        bool Init(uint32_t entries)
+        {
+            struct io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            //the ring is set up by the starting thread and driven by the worker thread, so no SINGLE_ISSUER
+            params.flags = IORING_SETUP_COOP_TASKRUN;
+            ring_fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+            if (ring_fd_ < 0)
+            {
+                //older kernel, no setup flags
+                memset(&params, 0, sizeof(params));
+                ring_fd_ = int(syscall(__NR_io_uring_setup, entries, &params));
+            }
+
+            if (ring_fd_ < 0)
+            {
+                return false;
+            }
+
+            sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+            bool single_mmap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+            if (single_mmap)
+            {
+                sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+            }
+
+            sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+            if (sq_ring_ == MAP_FAILED)
+            {
+                sq_ring_ = nullptr;
+                Close();
+                return false;
+            }
+
+            if (single_mmap)
+            {
+                cq_ring_ = sq_ring_;
+            }
+            else
+            {
+                cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+                if (cq_ring_ == MAP_FAILED)
+                {
+                    cq_ring_ = nullptr;
+                    Close();
+                    return false;
+                }
+            }
+
+            sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+            void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+            {
+                Close();
+                return false;
+            }
+
+            sqes_ = reinterpret_cast<struct io_uring_sqe*>(sqes);
+
+            char* sq = reinterpret_cast<char*>(sq_ring_);
+            sq_head_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+            sq_tail_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+            sq_mask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+            sq_entries_ = params.sq_entries;
+            sq_array_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+            char* cq = reinterpret_cast<char*>(cq_ring_);
+            cq_head_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+            cq_tail_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+            cq_mask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+            cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            sqe_tail_ = sq_tail_->load(std::memory_order_relaxed);
+            return true;
+        }
+
+        void Close()
+        {
+            UnregisterBufRing();
+
+            if (sqes_ != nullptr)
+            {
+                munmap(sqes_, sqes_size_);
+                sqes_ = nullptr;
+            }
+
+            if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+            {
+                munmap(cq_ring_, cq_ring_size_);
+            }
+
+            cq_ring_ = nullptr;
+
+            if (sq_ring_ != nullptr)
+            {
+                munmap(sq_ring_, sq_ring_size_);
+                sq_ring_ = nullptr;
+            }
+
+            if (ring_fd_ >= 0)
+            {
+                ::close(ring_fd_);
+                ring_fd_ = -1;
+            }
+        }
+
+        //a zeroed SQE, flush the queued SQEs to kernel when the SQ ring is full
+        struct io_uring_sqe* GetSqe()
+        {
+            uint32_t head = sq_head_->load(std::memory_order_acquire);
+            if (sqe_tail_ - head >= sq_entries_)
+            {
+                if (Submit(0) < 0)
+                {
+                    return nullptr;
+                }
+
+                head = sq_head_->load(std::memory_order_acquire);
+                if (sqe_tail_ - head >= sq_entries_)
+                {
+                    return nullptr;
+                }
+            }
+
+            uint32_t index = sqe_tail_ & sq_mask_;
+            struct io_uring_sqe* sqe = &sqes_[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sq_array_[index] = index;
+            ++sqe_tail_;
+            return sqe;
+        }
+
+        //submit all prepared SQEs and wait for at least wait_nr CQEs, one syscall
+        int Submit(uint32_t wait_nr)
+        {
+            sq_tail_->store(sqe_tail_, std::memory_order_release);
+            //also the ones kernel did not consume in last call
+            uint32_t to_submit = sqe_tail_ - sq_head_->load(std::memory_order_acquire);
+            if (to_submit == 0 && wait_nr == 0)
+            {
+                return 0;
+            }
+
+            uint32_t flags = (wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+            int ret = int(syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr, flags, nullptr, 0));
+            return (ret < 0 && errno == EINTR ? 0 : ret);
+        }
+
+        //call func for every completed CQE, return the count
+        template<typename FUNC>
+        uint32_t ForEachCqe(FUNC&& func)
+        {
+            uint32_t head = cq_head_->load(std::memory_order_relaxed);
+            uint32_t tail = cq_tail_->load(std::memory_order_acquire);
+            uint32_t count = 0;
+            for (; head != tail; ++head, ++count)
+            {
+                func(cqes_[head & cq_mask_]);
+            }
+
+            cq_head_->store(head, std::memory_order_release);
+            return count;
+        }
+
+        //provided buffer ring, multishot recv picks buffers from it
+        bool RegisterBufRing(uint16_t group_id, uint16_t count, uint32_t buf_size)
+        {
+            if ((count & (count - 1)) != 0)
+            {
+                return false;
+            }
+
+            buf_ring_size_ = count * sizeof(struct io_uring_buf);
+            void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+            if (ring == MAP_FAILED)
+            {
+                return false;
+            }
+
+            //touch the pages before kernel maps them, the tail starts at 0
+            memset(ring, 0, buf_ring_size_);
+            buf_ring_ = reinterpret_cast<struct io_uring_buf_ring*>(ring);
+            buf_data_ = reinterpret_cast<char*>(malloc(size_t(count) * buf_size));
+            if (buf_data_ == nullptr)
+            {
+                munmap(buf_ring_, buf_ring_size_);
+                buf_ring_ = nullptr;
+                return false;
+            }
+
+            struct io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+            reg.ring_entries = count;
+            reg.bgid = group_id;
+            if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+            {
+                free(buf_data_);
+                buf_data_ = nullptr;
+                munmap(buf_ring_, buf_ring_size_);
+                buf_ring_ = nullptr;
+                return false;
+            }
+
+            buf_group_ = group_id;
+            buf_count_ = count;
+            buf_size_ = buf_size;
+            buf_tail_ = 0;
+            for (uint16_t i = 0; i < count; ++i)
+            {
+                AddBuf(i);
+            }
+
+            CommitBufs();
+            return true;
+        }
+
+        char* GetBuf(uint16_t buf_id)
+        {
+            return buf_data_ + size_t(buf_id) * buf_size_;
+        }
+
+        //give the buffer back to kernel, visible after CommitBufs
+        void AddBuf(uint16_t buf_id)
+        {
+            //not bufs[], the flex array member is not at offset 0 when the uapi header is built as C++
+            struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(buf_ring_) + (buf_tail_ & (buf_count_ - 1));
+            buf->addr = reinterpret_cast<uint64_t>(GetBuf(buf_id));
+            buf->len = buf_size_;
+            buf->bid = buf_id;
+            ++buf_tail_;
+        }
+
+        void CommitBufs()
+        {
+            reinterpret_cast<std::atomic<uint16_t>*>(&buf_ring_->tail)->store(buf_tail_, std::memory_order_release);
+        }
+
+        uint16_t GetBufGroup() const
+        {
+            return buf_group_;
+        }
+
+    protected:
+        void UnregisterBufRing()
+        {
+            if (buf_ring_ == nullptr)
+            {
+                return;
+            }
+
+            if (ring_fd_ >= 0)
+            {
+                struct io_uring_buf_reg reg;
+                memset(&reg, 0, sizeof(reg));
+                reg.bgid = buf_group_;
+                syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+            }
+
+            munmap(buf_ring_, buf_ring_size_);
+            buf_ring_ = nullptr;
+            free(buf_data_);
+            buf_data_ = nullptr;
+        }
+
+    private:
+        int ring_fd_{ -1 };
+
+        void* sq_ring_{ nullptr };
+        size_t sq_ring_size_{ 0 };
+        void* cq_ring_{ nullptr };
+        size_t cq_ring_size_{ 0 };
+        struct io_uring_sqe* sqes_{ nullptr };
+        size_t sqes_size_{ 0 };
+
+        std::atomic<uint32_t>* sq_head_{ nullptr };
+        std::atomic<uint32_t>* sq_tail_{ nullptr };
+        uint32_t* sq_array_{ nullptr };
+        uint32_t sq_mask_{ 0 };
+        uint32_t sq_entries_{ 0 };
+        uint32_t sqe_tail_{ 0 };
+
+        std::atomic<uint32_t>* cq_head_{ nullptr };
+        std::atomic<uint32_t>* cq_tail_{ nullptr };
+        uint32_t cq_mask_{ 0 };
+        struct io_uring_cqe* cqes_{ nullptr };
+
+        struct io_uring_buf_ring* buf_ring_{ nullptr };
+        size_t buf_ring_size_{ 0 };
+        char* buf_data_{ nullptr };
+        uint16_t buf_group_{ 0 };
+        uint16_t buf_count_{ 0 };
+        uint32_t buf_size_{ 0 };
+        uint16_t buf_tail_{ 0 };
+    };
+
+}
+
+#endif //ARK_HAVE_IO_URING
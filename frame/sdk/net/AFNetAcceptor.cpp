@@ -0,0 +1,194 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFNetAcceptor.h"
+
+#if ARK_PLATFORM != PLATFORM_WIN
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace ark
+{
+
+    //poll timeout of accept thread, also the max delay of Stop
+    ARK_CONSTEXPR static const int ARK_ACCEPT_POLL_TIMEOUT = 100; //ms
+    ARK_CONSTEXPR static const int ARK_ACCEPT_BACKLOG = 512;
+
+    AFNetAcceptor::~AFNetAcceptor()
+    {
+        Stop();
+    }
+
+    bool AFNetAcceptor::IsReusePortSupported()
+    {
+#if ARK_PLATFORM != PLATFORM_WIN && defined(SO_REUSEPORT)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    int AFNetAcceptor::CreateListenSocket(bool ip_v6, const std::string& ip, const int port, bool reuse_port)
+    {
+#if ARK_PLATFORM != PLATFORM_WIN
+        int fd = ::socket(ip_v6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        int on = 1;
+        if (::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+#if defined(SO_REUSEPORT)
+        if (reuse_port && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+#else
+        if (reuse_port)
+        {
+            ::close(fd);
+            return -1;
+        }
+#endif
+
+        int ret = -1;
+        if (ip_v6)
+        {
+            struct sockaddr_in6 addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin6_family = AF_INET6;
+            addr.sin6_port = htons(port);
+            if (::inet_pton(AF_INET6, ip.c_str(), &addr.sin6_addr) == 1)
+            {
+                ret = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+            }
+        }
+        else
+        {
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if (::inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) == 1)
+            {
+                ret = ::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+            }
+        }
+
+        if (ret != 0 || ::listen(fd, ARK_ACCEPT_BACKLOG) != 0)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        return fd;
+#else
+        return -1;
+#endif
+    }
+
+    bool AFNetAcceptor::Start(bool ip_v6, const std::string& ip, const int port, const ACCEPT_CALLBACK& callback)
+    {
+        if (!IsReusePortSupported() || running_ || callback == nullptr)
+        {
+            return false;
+        }
+
+        int fd = CreateListenSocket(ip_v6, ip, port, true);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        listen_fd_ = fd;
+        accept_cb_ = callback;
+        running_ = true;
+        thread_ = std::thread([this]()
+        {
+            Run();
+        });
+
+        return true;
+    }
+
+    void AFNetAcceptor::Stop()
+    {
+        if (!running_)
+        {
+            return;
+        }
+
+        running_ = false;
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+
+#if ARK_PLATFORM != PLATFORM_WIN
+        ::close(listen_fd_);
+#endif
+        listen_fd_ = -1;
+    }
+
+    void AFNetAcceptor::Run()
+    {
+#if ARK_PLATFORM != PLATFORM_WIN
+        while (running_)
+        {
+            struct pollfd pfd;
+            pfd.fd = listen_fd_;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (::poll(&pfd, 1, ARK_ACCEPT_POLL_TIMEOUT) <= 0)
+            {
+                continue;
+            }
+
+            int client_fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (client_fd < 0)
+            {
+                //out of fds or memory, the socket stays readable and poll would spin, wait for sessions to close
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(ARK_ACCEPT_POLL_TIMEOUT));
+                }
+
+                continue;
+            }
+
+            accept_cb_(brynet::net::TcpSocket::Create(client_fd, true));
+        }
+#endif
+    }
+
+}
@@ -0,0 +1,56 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "interface/AFINet.h"
+
+namespace ark
+{
+
+    //Accept thread with its own listen socket bound by SO_REUSEPORT, several acceptors
+    //listen on the same port and the kernel spreads new connections among them
+    class AFNetAcceptor : public AFNoncopyable
+    {
+    public:
+        using ACCEPT_CALLBACK = std::function<void(brynet::net::TcpSocket::PTR)>;
+
+        AFNetAcceptor() = default;
+        ~AFNetAcceptor();
+
+        static bool IsReusePortSupported();
+
+        //bound and listening socket, -1 if failed
+        static int CreateListenSocket(bool ip_v6, const std::string& ip, const int port, bool reuse_port);
+
+        bool Start(bool ip_v6, const std::string& ip, const int port, const ACCEPT_CALLBACK& callback);
+        void Stop();
+
+    protected:
+        void Run();
+
+    private:
+        int listen_fd_{ -1 };
+        std::atomic<bool> running_{ false };
+        std::thread thread_;
+        ACCEPT_CALLBACK accept_cb_;
+    };
+
+}
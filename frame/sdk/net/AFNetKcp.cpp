@@ -0,0 +1,617 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFNetKcp.h"
+
+namespace ark
+{
+
+    void AFKcpSegHead::Encode(char* buffer) const
+    {
+        memcpy(buffer, &conv_, 4);
+        buffer[4] = char(cmd_);
+        buffer[5] = char(chan_);
+        buffer[6] = char(frg_);
+        buffer[7] = char(cnt_);
+        memcpy(buffer + 8, &wnd_, 2);
+        memcpy(buffer + 10, &len_, 2);
+        memcpy(buffer + 12, &ts_, 4);
+        memcpy(buffer + 16, &sn_, 4);
+        memcpy(buffer + 20, &una_, 4);
+    }
+
+    bool AFKcpSegHead::Decode(const char* buffer, size_t len)
+    {
+        if (len < ARK_KCP_HEAD_LENGTH)
+        {
+            return false;
+        }
+
+        memcpy(&conv_, buffer, 4);
+        cmd_ = uint8_t(buffer[4]);
+        chan_ = uint8_t(buffer[5]);
+        frg_ = uint8_t(buffer[6]);
+        cnt_ = uint8_t(buffer[7]);
+        memcpy(&wnd_, buffer + 8, 2);
+        memcpy(&len_, buffer + 10, 2);
+        memcpy(&ts_, buffer + 12, 4);
+        memcpy(&sn_, buffer + 16, 4);
+        memcpy(&una_, buffer + 20, 4);
+        return (len >= ARK_KCP_HEAD_LENGTH + len_);
+    }
+
+    AFNetKcp::AFNetKcp(uint32_t conv, uint8_t channel, const AFKcpChannelConfig& config, AFNetKcpOutput* output) :
+        conv_(conv),
+        channel_(channel),
+        config_(config),
+        output_(output)
+    {
+        config_.interval_ = std::min<uint32_t>(std::max<uint32_t>(config_.interval_, 1), 5000);
+        config_.snd_wnd_ = std::max<uint32_t>(config_.snd_wnd_, 1);
+        config_.rcv_wnd_ = std::max<uint32_t>(config_.rcv_wnd_, 1);
+        rx_minrto_ = (config_.nodelay_ ? ARK_KCP_RTO_NODELAY_MIN : ARK_KCP_RTO_MIN);
+        incr_ = mss_;
+    }
+
+    bool AFNetKcp::Send(const char* data, size_t len)
+    {
+        if (data == nullptr || len == 0)
+        {
+            return false;
+        }
+
+        if (config_.mode_ == ARK_KCP_UNRELIABLE && len <= mss_)
+        {
+            AFKcpSegment seg;
+            seg.data_.assign(data, len);
+            OutputSeg(ARK_KCP_CMD_UNRELIABLE, &seg);
+            return true;
+        }
+
+        //all fragments of a msg must fit in the receive window
+        size_t count = (len + mss_ - 1) / mss_;
+        if (count > ARK_KCP_MAX_FRAGMENTS + 1 || count >= config_.rcv_wnd_)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t offset = i * mss_;
+            AFKcpSegment seg;
+            seg.data_.assign(data + offset, std::min<size_t>(mss_, len - offset));
+            seg.frg_ = uint8_t(count - i - 1);
+            seg.cnt_ = uint8_t(count - 1);
+            snd_queue_.emplace_back(std::move(seg));
+        }
+
+        return true;
+    }
+
+    void AFNetKcp::Input(const AFKcpSegHead& head, const char* data, uint32_t now)
+    {
+        current_ = now;
+
+        if (head.cmd_ == ARK_KCP_CMD_UNRELIABLE)
+        {
+            //an ordered channel can not put it between fragments
+            if (IsUnordered())
+            {
+                AFKcpSegment seg;
+                seg.data_.assign(data, head.len_);
+                rcv_queue_.emplace_back(std::move(seg));
+            }
+
+            return;
+        }
+
+        uint32_t prev_una = snd_una_;
+        rmt_wnd_ = head.wnd_;
+        ParseUna(head.una_);
+        ShrinkBuf();
+
+        switch (head.cmd_)
+        {
+        case ARK_KCP_CMD_ACK:
+            {
+                int32_t rtt = TimeDiff(current_, head.ts_);
+                if (rtt >= 0)
+                {
+                    UpdateAck(rtt);
+                }
+
+                ParseAck(head.sn_);
+                ShrinkBuf();
+                ParseFastAck(head.sn_, head.ts_);
+            }
+            break;
+        case ARK_KCP_CMD_PUSH:
+            if (TimeDiff(head.sn_, rcv_nxt_ + config_.rcv_wnd_) < 0)
+            {
+                //ack every segment in window, also the duplicated ones whose ack was lost
+                ack_list_.emplace_back(head.sn_, head.ts_);
+                if (TimeDiff(head.sn_, rcv_nxt_) >= 0)
+                {
+                    ParseData(head, data);
+                }
+            }
+            break;
+        case ARK_KCP_CMD_WASK:
+            probe_ |= ARK_KCP_ASK_TELL;
+            break;
+        default:
+            break;
+        }
+
+        if (TimeDiff(snd_una_, prev_una) > 0)
+        {
+            GrowCwnd();
+        }
+    }
+
+    bool AFNetKcp::Recv(std::string& msg)
+    {
+        if (rcv_queue_.empty())
+        {
+            return false;
+        }
+
+        if (IsUnordered())
+        {
+            //whole msgs only
+            msg.swap(rcv_queue_.front().data_);
+            rcv_queue_.pop_front();
+            return true;
+        }
+
+        //the front is always the first fragment of a msg
+        size_t count = size_t(rcv_queue_.front().frg_) + 1;
+        if (rcv_queue_.size() < count)
+        {
+            return false;
+        }
+
+        bool recover = (rcv_queue_.size() >= config_.rcv_wnd_);
+
+        msg.clear();
+        for (size_t i = 0; i < count; ++i)
+        {
+            msg.append(rcv_queue_.front().data_);
+            rcv_queue_.pop_front();
+        }
+
+        MoveToRecvQueue();
+
+        //window was full, tell remote it is open again
+        if (recover && rcv_queue_.size() < config_.rcv_wnd_)
+        {
+            probe_ |= ARK_KCP_ASK_TELL;
+        }
+
+        return true;
+    }
+
+    void AFNetKcp::Update(uint32_t now)
+    {
+        current_ = now;
+        if (!updated_)
+        {
+            updated_ = true;
+            ts_flush_ = now;
+        }
+
+        int32_t slap = TimeDiff(now, ts_flush_);
+        if (slap >= 10000 || slap < -10000)
+        {
+            ts_flush_ = now;
+            slap = 0;
+        }
+
+        if (slap >= 0)
+        {
+            ts_flush_ += config_.interval_;
+            if (TimeDiff(now, ts_flush_) >= 0)
+            {
+                ts_flush_ = now + config_.interval_;
+            }
+
+            Flush();
+        }
+    }
+
+    void AFNetKcp::Flush()
+    {
+        if (!updated_)
+        {
+            return;
+        }
+
+        for (auto& ack : ack_list_)
+        {
+            AFKcpSegment seg;
+            seg.sn_ = ack.first;
+            seg.ts_ = ack.second;
+            OutputSeg(ARK_KCP_CMD_ACK, &seg);
+        }
+
+        ack_list_.clear();
+
+        //remote window is zero, probe it from time to time
+        if (rmt_wnd_ == 0)
+        {
+            if (probe_wait_ == 0)
+            {
+                probe_wait_ = ARK_KCP_PROBE_INIT;
+                ts_probe_ = current_ + probe_wait_;
+            }
+            else if (TimeDiff(current_, ts_probe_) >= 0)
+            {
+                probe_wait_ = std::min(std::max(probe_wait_, ARK_KCP_PROBE_INIT) * 3 / 2, ARK_KCP_PROBE_LIMIT);
+                ts_probe_ = current_ + probe_wait_;
+                probe_ |= ARK_KCP_ASK_SEND;
+            }
+        }
+        else
+        {
+            ts_probe_ = 0;
+            probe_wait_ = 0;
+        }
+
+        if ((probe_ & ARK_KCP_ASK_SEND) != 0)
+        {
+            OutputSeg(ARK_KCP_CMD_WASK, nullptr);
+        }
+
+        if ((probe_ & ARK_KCP_ASK_TELL) != 0)
+        {
+            OutputSeg(ARK_KCP_CMD_WINS, nullptr);
+        }
+
+        probe_ = 0;
+
+        uint32_t cwnd = std::min(config_.snd_wnd_, rmt_wnd_);
+        if (config_.congestion_)
+        {
+            cwnd = std::min(cwnd_, cwnd);
+        }
+
+        while (!snd_queue_.empty() && TimeDiff(snd_nxt_, snd_una_ + cwnd) < 0)
+        {
+            AFKcpSegment seg = std::move(snd_queue_.front());
+            snd_queue_.pop_front();
+
+            seg.sn_ = snd_nxt_++;
+            seg.ts_ = current_;
+            seg.rto_ = rx_rto_;
+            seg.resend_ts_ = current_;
+            seg.fast_ack_ = 0;
+            seg.xmit_ = 0;
+            snd_buf_.emplace_back(std::move(seg));
+        }
+
+        uint32_t resent = (config_.fast_resend_ > 0 ? config_.fast_resend_ : 0xffffffff);
+        uint32_t rto_min = (config_.nodelay_ ? 0 : uint32_t(rx_rto_ >> 3));
+        bool change = false;
+        bool lost = false;
+
+        for (auto& seg : snd_buf_)
+        {
+            bool need_send = false;
+            if (seg.xmit_ == 0)
+            {
+                need_send = true;
+                seg.rto_ = rx_rto_;
+                seg.resend_ts_ = current_ + seg.rto_ + rto_min;
+            }
+            else if (TimeDiff(current_, seg.resend_ts_) >= 0)
+            {
+                //timeout
+                need_send = true;
+                seg.rto_ += (config_.nodelay_ ? seg.rto_ / 2 : std::max<uint32_t>(seg.rto_, rx_rto_));
+                seg.resend_ts_ = current_ + seg.rto_;
+                lost = true;
+            }
+            else if (seg.fast_ack_ >= resent)
+            {
+                //skipped by enough later acks
+                need_send = true;
+                seg.fast_ack_ = 0;
+                seg.resend_ts_ = current_ + seg.rto_;
+                change = true;
+            }
+
+            if (!need_send)
+            {
+                continue;
+            }
+
+            ++seg.xmit_;
+            seg.ts_ = current_;
+            OutputSeg(ARK_KCP_CMD_PUSH, &seg);
+
+            if (seg.xmit_ >= ARK_KCP_DEAD_LINK)
+            {
+                dead_link_ = true;
+            }
+        }
+
+        if (!config_.congestion_)
+        {
+            return;
+        }
+
+        if (change)
+        {
+            uint32_t inflight = snd_nxt_ - snd_una_;
+            ssthresh_ = std::max(inflight / 2, ARK_KCP_THRESH_MIN);
+            cwnd_ = ssthresh_ + resent;
+            incr_ = cwnd_ * mss_;
+        }
+
+        if (lost)
+        {
+            ssthresh_ = std::max(cwnd / 2, ARK_KCP_THRESH_MIN);
+            cwnd_ = 1;
+            incr_ = mss_;
+        }
+
+        if (cwnd_ < 1)
+        {
+            cwnd_ = 1;
+            incr_ = mss_;
+        }
+    }
+
+    void AFNetKcp::UpdateAck(int32_t rtt)
+    {
+        if (rx_srtt_ == 0)
+        {
+            rx_srtt_ = rtt;
+            rx_rttval_ = rtt / 2;
+        }
+        else
+        {
+            int32_t delta = std::abs(rtt - rx_srtt_);
+            rx_rttval_ = (3 * rx_rttval_ + delta) / 4;
+            rx_srtt_ = std::max((7 * rx_srtt_ + rtt) / 8, 1);
+        }
+
+        int32_t rto = rx_srtt_ + std::max<int32_t>(int32_t(config_.interval_), 4 * rx_rttval_);
+        rx_rto_ = std::min(std::max(rto, rx_minrto_), int32_t(ARK_KCP_RTO_MAX));
+    }
+
+    void AFNetKcp::ShrinkBuf()
+    {
+        snd_una_ = (snd_buf_.empty() ? snd_nxt_ : snd_buf_.front().sn_);
+    }
+
+    void AFNetKcp::ParseAck(uint32_t sn)
+    {
+        if (TimeDiff(sn, snd_una_) < 0 || TimeDiff(sn, snd_nxt_) >= 0)
+        {
+            return;
+        }
+
+        for (auto iter = snd_buf_.begin(); iter != snd_buf_.end(); ++iter)
+        {
+            if (iter->sn_ == sn)
+            {
+                snd_buf_.erase(iter);
+                break;
+            }
+
+            if (TimeDiff(sn, iter->sn_) < 0)
+            {
+                break;
+            }
+        }
+    }
+
+    void AFNetKcp::ParseUna(uint32_t una)
+    {
+        while (!snd_buf_.empty() && TimeDiff(una, snd_buf_.front().sn_) > 0)
+        {
+            snd_buf_.pop_front();
+        }
+    }
+
+    void AFNetKcp::ParseFastAck(uint32_t sn, uint32_t ts)
+    {
+        if (TimeDiff(sn, snd_una_) < 0 || TimeDiff(sn, snd_nxt_) >= 0)
+        {
+            return;
+        }
+
+        for (auto& seg : snd_buf_)
+        {
+            if (TimeDiff(sn, seg.sn_) < 0)
+            {
+                break;
+            }
+
+            //a later segment sent no earlier than this one is acked
+            if (sn != seg.sn_ && TimeDiff(ts, seg.ts_) >= 0)
+            {
+                ++seg.fast_ack_;
+            }
+        }
+    }
+
+    void AFNetKcp::ParseData(const AFKcpSegHead& head, const char* data)
+    {
+        uint32_t sn = head.sn_;
+        if (TimeDiff(sn, rcv_nxt_ + config_.rcv_wnd_) >= 0 || TimeDiff(sn, rcv_nxt_) < 0)
+        {
+            return;
+        }
+
+        //sorted by sn, most segments arrive in order so search from the tail
+        auto iter = rcv_buf_.end();
+        while (iter != rcv_buf_.begin())
+        {
+            auto prev = iter - 1;
+            if (prev->sn_ == sn)
+            {
+                return;
+            }
+
+            if (TimeDiff(sn, prev->sn_) > 0)
+            {
+                break;
+            }
+
+            iter = prev;
+        }
+
+        AFKcpSegment seg;
+        seg.sn_ = sn;
+        seg.frg_ = head.frg_;
+        seg.cnt_ = head.cnt_;
+        seg.ts_ = head.ts_;
+        seg.data_.assign(data, head.len_);
+        iter = rcv_buf_.insert(iter, std::move(seg));
+
+        if (IsUnordered())
+        {
+            DeliverUnordered(iter);
+        }
+
+        MoveToRecvQueue();
+    }
+
+    void AFNetKcp::DeliverUnordered(std::deque<AFKcpSegment>::iterator iter)
+    {
+        if (iter->cnt_ < iter->frg_)
+        {
+            return;
+        }
+
+        //fragments of one msg have continuous sn, rcv_buf has no duplicated sn,
+        //so the msg is complete when both ends are at the expected positions
+        size_t index = size_t(iter - rcv_buf_.begin());
+        size_t before = size_t(iter->cnt_ - iter->frg_);
+        if (index < before || index - before + iter->cnt_ >= rcv_buf_.size())
+        {
+            return;
+        }
+
+        size_t first = index - before;
+        size_t last = first + iter->cnt_;
+        uint32_t first_sn = iter->sn_ - uint32_t(before);
+        if (rcv_buf_[first].sn_ != first_sn || rcv_buf_[last].sn_ != first_sn + iter->cnt_)
+        {
+            return;
+        }
+
+        AFKcpSegment msg;
+        for (size_t i = first; i <= last; ++i)
+        {
+            msg.data_.append(rcv_buf_[i].data_);
+            rcv_buf_[i].delivered_ = true;
+            std::string().swap(rcv_buf_[i].data_);
+        }
+
+        rcv_queue_.emplace_back(std::move(msg));
+    }
+
+    void AFNetKcp::MoveToRecvQueue()
+    {
+        if (IsUnordered())
+        {
+            //only skip the delivered ones, the rest are waiting for fragments
+            while (!rcv_buf_.empty() && rcv_buf_.front().sn_ == rcv_nxt_ && rcv_buf_.front().delivered_)
+            {
+                rcv_buf_.pop_front();
+                ++rcv_nxt_;
+            }
+
+            return;
+        }
+
+        while (!rcv_buf_.empty() && rcv_buf_.front().sn_ == rcv_nxt_ && rcv_queue_.size() < config_.rcv_wnd_)
+        {
+            rcv_queue_.emplace_back(std::move(rcv_buf_.front()));
+            rcv_buf_.pop_front();
+            ++rcv_nxt_;
+        }
+    }
+
+    void AFNetKcp::GrowCwnd()
+    {
+        if (!config_.congestion_ || cwnd_ >= rmt_wnd_)
+        {
+            return;
+        }
+
+        if (cwnd_ < ssthresh_)
+        {
+            //slow start
+            ++cwnd_;
+            incr_ += mss_;
+        }
+        else
+        {
+            //congestion avoidance
+            incr_ = std::max(incr_, mss_);
+            incr_ += (mss_ * mss_) / incr_ + (mss_ / 16);
+            if ((cwnd_ + 1) * mss_ <= incr_)
+            {
+                cwnd_ = (incr_ + mss_ - 1) / mss_;
+            }
+        }
+
+        if (cwnd_ > rmt_wnd_)
+        {
+            cwnd_ = rmt_wnd_;
+            incr_ = rmt_wnd_ * mss_;
+        }
+    }
+
+    uint16_t AFNetKcp::GetUnusedWnd() const
+    {
+        size_t used = rcv_queue_.size();
+        return uint16_t(used < config_.rcv_wnd_ ? std::min<size_t>(config_.rcv_wnd_ - used, 0xffff) : 0);
+    }
+
+    void AFNetKcp::OutputSeg(uint8_t cmd, const AFKcpSegment* seg)
+    {
+        AFKcpSegHead head;
+        head.conv_ = conv_;
+        head.cmd_ = cmd;
+        head.chan_ = channel_;
+        head.wnd_ = GetUnusedWnd();
+        head.una_ = rcv_nxt_;
+        if (seg != nullptr)
+        {
+            head.frg_ = seg->frg_;
+            head.cnt_ = seg->cnt_;
+            head.ts_ = seg->ts_;
+            head.sn_ = seg->sn_;
+            head.len_ = uint16_t(cmd == ARK_KCP_CMD_ACK ? 0 : seg->data_.size());
+        }
+        else
+        {
+            head.ts_ = current_;
+        }
+
+        output_->Output(head, (head.len_ > 0 ? seg->data_.data() : nullptr));
+    }
+
+}
@@ -0,0 +1,224 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFPlatform.hpp"
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_HEAD_LENGTH = 24;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_MTU = 1400;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_RTO_MIN = 30;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_RTO_NODELAY_MIN = 10;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_RTO_DEFAULT = 200;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_RTO_MAX = 60000;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_PROBE_INIT = 7000;     //7s to probe remote window
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_PROBE_LIMIT = 120000;  //up to 120s
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_DEAD_LINK = 20;        //resend times of one segment
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_THRESH_INIT = 2;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_THRESH_MIN = 2;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_MAX_FRAGMENTS = 255;
+    ARK_CONSTEXPR static const size_t ARK_KCP_MAX_WAIT_SEGMENTS = 8192; //segments not acked yet, more means peer is gone
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_ASK_SEND = 1;
+    ARK_CONSTEXPR static const uint32_t ARK_KCP_ASK_TELL = 2;
+
+    enum AFKcpCmd
+    {
+        //channel commands
+        ARK_KCP_CMD_PUSH = 81,          //reliable data
+        ARK_KCP_CMD_ACK = 82,
+        ARK_KCP_CMD_WASK = 83,          //ask remote window
+        ARK_KCP_CMD_WINS = 84,          //tell local window
+        ARK_KCP_CMD_UNRELIABLE = 85,    //data without sn and ack
+        //connection commands
+        ARK_KCP_CMD_SYN = 90,
+        ARK_KCP_CMD_SYN_ACK = 91,
+        ARK_KCP_CMD_FIN = 92,
+        ARK_KCP_CMD_PING = 93,
+        ARK_KCP_CMD_COOKIE = 94,        //stateless reply of SYN, the next SYN echoes it in una
+    };
+
+    enum AFKcpChannelMode
+    {
+        ARK_KCP_RELIABLE_ORDERED = 0,   //like tcp, no loss and in order
+        ARK_KCP_RELIABLE_UNORDERED = 1, //no loss, a msg is delivered as soon as all its fragments arrive
+        ARK_KCP_UNRELIABLE = 2,         //may lost, msgs larger than mss still go the reliable way
+    };
+
+    class AFKcpChannelConfig
+    {
+    public:
+        AFKcpChannelMode mode_{ ARK_KCP_RELIABLE_ORDERED };
+        bool nodelay_{ true };          //smaller min rto and slower rto backoff
+        uint32_t interval_{ 10 };       //ms of flush timer
+        uint32_t fast_resend_{ 2 };     //resend when skipped by this many acks, 0 means off
+        bool congestion_{ true };       //cwnd with slow start, off means only limited by windows
+        uint32_t snd_wnd_{ 128 };       //segments
+        uint32_t rcv_wnd_{ 128 };
+    };
+
+    /*
+    | conv | cmd | chan | frg | cnt | wnd | len | ts | sn | una |
+    |  4   |  1  |  1   |  1  |  1  |  2  |  2  | 4  | 4  |  4  | = 24
+    frg: fragments left behind this one, cnt: fragment count of the msg - 1
+    */
+    class AFKcpSegHead
+    {
+    public:
+        uint32_t conv_{ 0 };
+        uint8_t cmd_{ 0 };
+        uint8_t chan_{ 0 };
+        uint8_t frg_{ 0 };
+        uint8_t cnt_{ 0 };
+        uint16_t wnd_{ 0 };
+        uint16_t len_{ 0 };
+        uint32_t ts_{ 0 };
+        uint32_t sn_{ 0 };
+        uint32_t una_{ 0 };
+
+        void Encode(char* buffer) const;
+        bool Decode(const char* buffer, size_t len);
+    };
+
+    //where the channel writes segments, the connection packs them into datagrams
+    class AFNetKcpOutput
+    {
+    public:
+        virtual ~AFNetKcpOutput() = default;
+        virtual void Output(const AFKcpSegHead& head, const char* data) = 0;
+    };
+
+    //ARQ of one channel, the same algorithm as KCP: selective repeat with una and
+    //per-segment acks, fast retransmit, rto backoff and cwnd congestion control.
+    //Only used by the connection IO thread.
+    class AFNetKcp : public AFNoncopyable
+    {
+    public:
+        AFNetKcp(uint32_t conv, uint8_t channel, const AFKcpChannelConfig& config, AFNetKcpOutput* output);
+
+        //one whole msg, split into fragments of mss
+        bool Send(const char* data, size_t len);
+
+        //one segment parsed from a datagram
+        void Input(const AFKcpSegHead& head, const char* data, uint32_t now);
+
+        //pop one whole msg
+        bool Recv(std::string& msg);
+
+        //drive timers, flush when interval is up
+        void Update(uint32_t now);
+
+        //send acks, new data and timed out segments right now
+        void Flush();
+
+        size_t GetWaitSend() const
+        {
+            return snd_buf_.size() + snd_queue_.size();
+        }
+
+        bool IsDeadLink() const
+        {
+            return dead_link_;
+        }
+
+        uint32_t GetMss() const
+        {
+            return mss_;
+        }
+
+        //for sn and ms timestamps which wrap around
+        static int32_t TimeDiff(uint32_t later, uint32_t earlier)
+        {
+            return int32_t(later - earlier);
+        }
+
+    protected:
+        class AFKcpSegment
+        {
+        public:
+            uint32_t sn_{ 0 };
+            uint8_t frg_{ 0 };
+            uint8_t cnt_{ 0 };
+            uint32_t ts_{ 0 };
+            uint32_t resend_ts_{ 0 };
+            uint32_t rto_{ 0 };
+            uint32_t fast_ack_{ 0 };
+            uint32_t xmit_{ 0 };
+            bool delivered_{ false };   //unordered mode, already given to user
+            std::string data_;
+        };
+
+        void UpdateAck(int32_t rtt);
+        void ShrinkBuf();
+        void ParseAck(uint32_t sn);
+        void ParseUna(uint32_t una);
+        void ParseFastAck(uint32_t sn, uint32_t ts);
+        void ParseData(const AFKcpSegHead& head, const char* data);
+        void MoveToRecvQueue();
+        void DeliverUnordered(std::deque<AFKcpSegment>::iterator iter);
+        void GrowCwnd();
+
+        bool IsUnordered() const
+        {
+            //unreliable channel has no order either, its large msgs take the reliable way
+            return (config_.mode_ != ARK_KCP_RELIABLE_ORDERED);
+        }
+
+        uint16_t GetUnusedWnd() const;
+        void OutputSeg(uint8_t cmd, const AFKcpSegment* seg);
+
+    private:
+        uint32_t conv_{ 0 };
+        uint8_t channel_{ 0 };
+        AFKcpChannelConfig config_;
+        AFNetKcpOutput* output_{ nullptr };
+
+        uint32_t mss_{ ARK_KCP_MTU - ARK_KCP_HEAD_LENGTH };
+        uint32_t snd_una_{ 0 };
+        uint32_t snd_nxt_{ 0 };
+        uint32_t rcv_nxt_{ 0 };
+        uint32_t ssthresh_{ ARK_KCP_THRESH_INIT };
+        int32_t rx_rttval_{ 0 };
+        int32_t rx_srtt_{ 0 };
+        int32_t rx_rto_{ ARK_KCP_RTO_DEFAULT };
+        int32_t rx_minrto_{ ARK_KCP_RTO_MIN };
+        uint32_t rmt_wnd_{ 128 };
+        uint32_t cwnd_{ 1 };
+        uint32_t incr_{ 0 };
+        uint32_t probe_{ 0 };
+        uint32_t current_{ 0 };
+        uint32_t ts_flush_{ 0 };
+        uint32_t ts_probe_{ 0 };
+        uint32_t probe_wait_{ 0 };
+        bool updated_{ false };
+        bool dead_link_{ false };
+
+        std::deque<AFKcpSegment> snd_queue_;
+        std::deque<AFKcpSegment> snd_buf_;
+        std::deque<AFKcpSegment> rcv_buf_;
+        std::deque<AFKcpSegment> rcv_queue_;
+        std::vector<std::pair<uint32_t, uint32_t>> ack_list_; //sn, ts
+    };
+
+}
@@ -0,0 +1,138 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFNetMsgStats.hpp"
+#include "interface/AFINet.h"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_NET_DISPATCH_PAGE_SIZE = 256; //msg ids per page
+    ARK_CONSTEXPR static const uint32_t ARK_NET_DISPATCH_PAGES = 65536 / ARK_NET_DISPATCH_PAGE_SIZE;
+
+    //handler and counters of one msg id
+    class AFNetMsgSlot
+    {
+    public:
+        NET_MSG_FUNCTOR handler_{ nullptr };
+        //counters of the dispatching thread, resolved by the first msg
+        AFNetMsgStatsEntry* stats_{ nullptr };
+    };
+
+    //Two-level table of msg handlers indexed by msg id, a page of slots is
+    //allocated when the first handler of it is registered, so a lookup is
+    //two array loads and the handler is called without a shared_ptr hop.
+    //Msgs without a handler go to the forward callbacks. Used by one thread only.
+    class AFNetMsgDispatcher : public AFNoncopyable
+    {
+    public:
+        ~AFNetMsgDispatcher()
+        {
+            for (auto& page : pages_)
+            {
+                delete[] page;
+                page = nullptr;
+            }
+        }
+
+        //one handler per msg id, false if registered already
+        bool Register(const int msg_id, const NET_MSG_FUNCTOR& cb)
+        {
+            if (msg_id < 0 || msg_id > std::numeric_limits<uint16_t>::max() || cb == nullptr)
+            {
+                return false;
+            }
+
+            AFNetMsgSlot*& page = pages_[msg_id / ARK_NET_DISPATCH_PAGE_SIZE];
+            if (page == nullptr)
+            {
+                page = new AFNetMsgSlot[ARK_NET_DISPATCH_PAGE_SIZE];
+            }
+
+            AFNetMsgSlot& slot = page[msg_id % ARK_NET_DISPATCH_PAGE_SIZE];
+            if (slot.handler_ != nullptr)
+            {
+                return false;
+            }
+
+            slot.handler_ = cb;
+            return true;
+        }
+
+        bool AddForward(const NET_MSG_FUNCTOR& cb)
+        {
+            if (cb == nullptr)
+            {
+                return false;
+            }
+
+            forwards_.push_back(cb);
+            return true;
+        }
+
+        //false if there is neither a handler nor a forward callback
+        bool Dispatch(const AFNetMsg* msg, const int64_t session_id)
+        {
+            AFNetMsgSlot* page = pages_[msg->id_ / ARK_NET_DISPATCH_PAGE_SIZE];
+            AFNetMsgSlot* slot = (page != nullptr ? &page[msg->id_ % ARK_NET_DISPATCH_PAGE_SIZE] : nullptr);
+            if (slot == nullptr || slot->handler_ == nullptr)
+            {
+                return Forward(msg, session_id);
+            }
+
+            AFNetMsgStats& stats = AFNetMsgStats::Instance();
+            if (!stats.IsEnabled())
+            {
+                slot->handler_(msg, session_id);
+                return true;
+            }
+
+            if (slot->stats_ == nullptr)
+            {
+                slot->stats_ = &stats.GetThreadEntry(msg->id_);
+            }
+
+            slot->stats_->RecordRecv(msg->GetBodyLength());
+
+            AFNetMsgHandleTimer timer(*slot->stats_);
+            slot->handler_(msg, session_id);
+            return true;
+        }
+
+    protected:
+        bool Forward(const AFNetMsg* msg, const int64_t session_id)
+        {
+            AFNetMsgStats::Instance().RecordRecv(msg->id_, msg->GetBodyLength());
+            for (auto& forward : forwards_)
+            {
+                forward(msg, session_id);
+            }
+
+            return !forwards_.empty();
+        }
+
+    private:
+        AFNetMsgSlot* pages_[ARK_NET_DISPATCH_PAGES] = {};
+        std::vector<NET_MSG_FUNCTOR> forwards_;
+    };
+
+}
@@ -0,0 +1,121 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "interface/AFINet.h"
+
+namespace ark
+{
+
+    //msgs sent by a client while its link is down, kept in send order and sent again once it is up
+    class AFNetOutboundQueue
+    {
+    public:
+        explicit AFNetOutboundQueue(AFNetQueueStats& stats) :
+            stats_(stats)
+        {
+        }
+
+        //false if the msg goes over limit bytes, it is counted as dropped
+        bool Push(const uint32_t head_len, const AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const size_t limit)
+        {
+            size_t body_len = 0;
+            for (size_t i = 0; i < iov_count; ++i)
+            {
+                body_len += iov[i].len_;
+            }
+
+            if (stats_.outbound_bytes_ + head_len + body_len > limit)
+            {
+                ++stats_.outbound_dropped_msgs_;
+                return false;
+            }
+
+            msgs_.emplace_back();
+            AFOutboundMsg& msg = msgs_.back();
+            if (head_len == SS_HEAD_LENGTH)
+            {
+                msg.head_ = *static_cast<const AFSSMsgHead*>(head);
+            }
+            else
+            {
+                static_cast<AFMsgHead&>(msg.head_) = *head;
+            }
+
+            msg.body_.resize(body_len);
+            size_t offset = 0;
+            for (size_t i = 0; i < iov_count; ++i)
+            {
+                if (!iov[i].CopyTo(&msg.body_[offset]))
+                {
+                    msgs_.pop_back();
+                    return false;
+                }
+
+                offset += iov[i].len_;
+            }
+
+            stats_.outbound_bytes_ += head_len + body_len;
+            stats_.outbound_msgs_ = msgs_.size();
+            return true;
+        }
+
+        //net is the connected client, the msgs go through its SendMsgV as if sent right now
+        void Replay(AFINet* net)
+        {
+            std::deque<AFOutboundMsg> msgs;
+            msgs.swap(msgs_);
+            Clear();
+
+            for (auto& msg : msgs)
+            {
+                AFNetIOVec iov;
+                iov.data_ = msg.body_.data();
+                iov.len_ = msg.body_.size();
+                net->SendMsgV(&msg.head_, &iov, 1, 0);
+            }
+        }
+
+        void Clear()
+        {
+            msgs_.clear();
+            stats_.outbound_msgs_ = 0;
+            stats_.outbound_bytes_ = 0;
+        }
+
+        bool Empty() const
+        {
+            return msgs_.empty();
+        }
+
+    private:
+        class AFOutboundMsg
+        {
+        public:
+            AFSSMsgHead head_;
+            std::string body_;
+        };
+
+        AFNetQueueStats& stats_;
+        std::deque<AFOutboundMsg> msgs_;
+    };
+
+}
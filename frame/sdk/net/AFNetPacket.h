@@ -0,0 +1,165 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFLZ4.hpp"
+#include "interface/AFINet.h"
+
+namespace ark
+{
+
+    //refcounted immutable packet, brynet queues it by reference and flushes
+    //all pending packets of a socket with one writev
+    using AFNetPacketPtr = std::shared_ptr<std::string>;
+
+    class AFNetPacket
+    {
+    public:
+        static bool IsValidHeadLen(const uint32_t head_len)
+        {
+            return (head_len == AFHeadLength::CS_HEAD_LENGTH || head_len == AFHeadLength::SS_HEAD_LENGTH);
+        }
+
+        //append one encoded msg to the tail of packet, nothing is written if head is invalid
+        //body not smaller than compress_threshold is lz4 compressed if it gets smaller, 0 means never
+        static bool Append(std::string& packet, const uint32_t head_len, const AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const uint32_t compress_threshold = 0)
+        {
+            if (head == nullptr || !IsValidHeadLen(head_len))
+            {
+                return false;
+            }
+
+            size_t body_len = 0;
+            for (size_t i = 0; i < iov_count; ++i)
+            {
+                body_len += iov[i].len_;
+            }
+
+            if (body_len != head->GetBodyLength())
+            {
+                return false;
+            }
+
+            if (compress_threshold > 0 && body_len >= compress_threshold && !head->IsCompressed() && AppendCompressed(packet, head_len, head, iov, iov_count))
+            {
+                return true;
+            }
+
+            const size_t offset = packet.size();
+            packet.reserve(offset + head_len + body_len);
+            packet.append(reinterpret_cast<const char*>(head), head_len);
+            for (size_t i = 0; i < iov_count; ++i)
+            {
+                if (iov[i].len_ == 0)
+                {
+                    continue;
+                }
+
+                if (iov[i].writer_ == nullptr)
+                {
+                    packet.append(iov[i].data_, iov[i].len_);
+                    continue;
+                }
+
+                //encoded in place, the body is not built anywhere else
+                size_t segment = packet.size();
+                packet.resize(segment + iov[i].len_);
+                if (!iov[i].writer_->Write(&packet[segment], iov[i].len_))
+                {
+                    packet.resize(offset);
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        //gather head and payload segments into one packet, payload bytes are copied once
+        static AFNetPacketPtr Build(const uint32_t head_len, const AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const uint32_t compress_threshold = 0)
+        {
+            AFNetPacketPtr packet = std::make_shared<std::string>();
+            if (!Append(*packet, head_len, head, iov, iov_count, compress_threshold))
+            {
+                return nullptr;
+            }
+
+            return packet;
+        }
+
+        static AFNetPacketPtr Build(const uint32_t head_len, const AFMsgHead* head, const char* msg_data)
+        {
+            AFNetIOVec iov;
+            iov.data_ = msg_data;
+            iov.len_ = head->GetBodyLength();
+            return Build(head_len, head, &iov, 1);
+        }
+
+    protected:
+        //head copy with compress flag + raw length + lz4 block, false if it does not save bytes
+        static bool AppendCompressed(std::string& packet, const uint32_t head_len, const AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count)
+        {
+            const uint32_t body_len = head->GetBodyLength();
+            if (body_len <= ARK_MSG_COMPRESS_HEAD_LENGTH)
+            {
+                return false;
+            }
+
+            //the codec needs one continuous source
+            const char* raw = (iov_count == 1 && iov[0].writer_ == nullptr ? iov[0].data_ : nullptr);
+            if (raw == nullptr)
+            {
+                static thread_local std::string gather;
+                gather.resize(body_len);
+                size_t gathered = 0;
+                for (size_t i = 0; i < iov_count; ++i)
+                {
+                    if (!iov[i].CopyTo(&gather[gathered]))
+                    {
+                        return false;
+                    }
+
+                    gathered += iov[i].len_;
+                }
+
+                raw = gather.data();
+            }
+
+            const size_t offset = packet.size();
+            const size_t capacity = body_len - ARK_MSG_COMPRESS_HEAD_LENGTH - 1;
+            packet.resize(offset + head_len + ARK_MSG_COMPRESS_HEAD_LENGTH + capacity);
+
+            char* out = &packet[offset];
+            size_t compressed_len = AFLZ4::Compress(raw, body_len, out + head_len + ARK_MSG_COMPRESS_HEAD_LENGTH, capacity);
+            if (compressed_len == 0)
+            {
+                packet.resize(offset);
+                return false;
+            }
+
+            memcpy(out, head, head_len);
+            reinterpret_cast<AFMsgHead*>(out)->length_ = uint32_t(ARK_MSG_COMPRESS_HEAD_LENGTH + compressed_len) | ARK_MSG_COMPRESS_FLAG | (head->length_ & ARK_MSG_BATCH_FLAG);
+            memcpy(out + head_len, &body_len, ARK_MSG_COMPRESS_HEAD_LENGTH);
+            packet.resize(offset + head_len + ARK_MSG_COMPRESS_HEAD_LENGTH + compressed_len);
+            return true;
+        }
+    };
+
+}
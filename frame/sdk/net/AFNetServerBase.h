@@ -0,0 +1,681 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFMPSCQueue.hpp"
+#include "interface/AFINet.h"
+#include "AFNetSession.h"
+#include "AFNetPacket.h"
+#include "AFNetSessionTable.h"
+#include "AFNetTimeWheel.h"
+
+namespace ark
+{
+
+    //Logic thread half of all servers: session table, ready queue, msg budgets, coalescing,
+    //broadcast, idle reaping and send water marks. A transport only runs its IO side and
+    //reports conns by OnConnected, OnRecv and OnDisconnected.
+    //TRACK_SEND means the conn calls back when a packet is written, water marks need it.
+    template<typename ConnPTR, bool TRACK_SEND = false>
+    class AFNetServerBase : public AFINet
+    {
+    public:
+        using Session = AFNetSession<ConnPTR>;
+        using SessionPtr = Session * ;
+
+        void Update() override
+        {
+            UpdateNetSession();
+            UpdateIdleSession();
+            UpdateCongestedSession();
+        }
+
+        bool SendMsg(AFMsgHead* head, const char* msg_data, const int64_t session_id) override
+        {
+            if (head == nullptr || msg_data == nullptr)
+            {
+                return false;
+            }
+
+            AFNetIOVec iov;
+            iov.data_ = msg_data;
+            iov.len_ = head->GetBodyLength();
+            return SendMsgV(head, &iov, 1, session_id);
+        }
+
+        bool SendMsgV(AFMsgHead* head, const AFNetIOVec* iov, const size_t iov_count, const int64_t session_id) override
+        {
+            if (head == nullptr || session_id <= 0)
+            {
+                return false;
+            }
+
+            SessionPtr session = GetNetSession(session_id);
+            if (session == nullptr || IsDroppedMsg(session, head->id_))
+            {
+                return false;
+            }
+
+            RecordSend(head);
+            session->CountSendMsg();
+
+            if (IsCoalesce())
+            {
+                std::string& staging = session->GetStaging(GetCoalesceThreshold());
+                size_t offset = staging.size();
+                if (!AFNetPacket::Append(staging, session->GetHeadLen(), head, iov, iov_count, session->GetCompressThreshold()))
+                {
+                    return false;
+                }
+
+                RecordCompress(head, staging.size() - offset - session->GetHeadLen());
+
+                //listed once per frame, even if the threshold flushed it in between
+                if (session->MarkStaged())
+                {
+                    staged_sessions_.push_back(session_id);
+                }
+
+                if (staging.size() >= GetCoalesceThreshold())
+                {
+                    FlushSession(session);
+                }
+
+                return true;
+            }
+
+            AFNetPacketPtr packet = AFNetPacket::Build(session->GetHeadLen(), head, iov, iov_count, session->GetCompressThreshold());
+            if (packet == nullptr)
+            {
+                return false;
+            }
+
+            RecordCompress(head, packet->size() - session->GetHeadLen());
+            QueuePacket(session, packet);
+            return true;
+        }
+
+        bool BroadcastMsg(AFMsgHead* head, const char* msg_data) override
+        {
+            return BroadcastMsg(head, msg_data, NET_SESSION_FILTER(nullptr));
+        }
+
+        bool BroadcastMsg(AFMsgHead* head, const char* msg_data, const NET_SESSION_FILTER& filter) override
+        {
+            if (head == nullptr || msg_data == nullptr)
+            {
+                return false;
+            }
+
+            AFNetPacketPtr packet = AFNetPacket::Build(head_len_, head, msg_data);
+            if (packet == nullptr)
+            {
+                return false;
+            }
+
+            RecordSend(head);
+
+            return SendPacket(packet, head->id_, filter);
+        }
+
+        bool BroadcastMsg(AFMsgHead* head, const char* msg_data, const std::vector<int64_t>& session_list) override
+        {
+            if (head == nullptr || msg_data == nullptr)
+            {
+                return false;
+            }
+
+            if (session_list.empty())
+            {
+                return true;
+            }
+
+            AFNetPacketPtr packet = AFNetPacket::Build(head_len_, head, msg_data);
+            if (packet == nullptr)
+            {
+                return false;
+            }
+
+            RecordSend(head);
+
+            for (auto session_id : session_list)
+            {
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr || session->NeedRemove() || IsDroppedMsg(session, head->id_))
+                {
+                    continue;
+                }
+
+                FlushSession(session);
+                session->CountSendMsg();
+                QueuePacket(session, packet);
+            }
+
+            return true;
+        }
+
+        bool CloseSession(const int64_t& session_id) override
+        {
+            //the session is removed and deleted in next UpdateNetSession
+            SessionPtr session = GetNetSession(session_id);
+            if (session != nullptr)
+            {
+                session->GetSession()->postDisConnect();
+                session->SetNeedRemove(true);
+                PushReadySession(session);
+            }
+
+            return true;
+        }
+
+        bool SetSessionCompressThreshold(const int64_t session_id, const uint32_t threshold) override
+        {
+            SessionPtr session = GetNetSession(session_id);
+            if (session == nullptr)
+            {
+                return false;
+            }
+
+            session->SetCompressThreshold(threshold);
+            session->SetAcceptPacked(head_len_ == SS_HEAD_LENGTH || threshold > 0);
+            return true;
+        }
+
+        size_t GetSessionPendingBytes(const int64_t session_id) override
+        {
+            SessionPtr session = GetNetSession(session_id);
+            return (session != nullptr ? session->GetPendingBytes() : 0);
+        }
+
+        void GetSessionTraffic(std::vector<AFNetSessionTraffic>& traffic) override
+        {
+            sessions_.ForEach([&traffic](const int64_t session_id, SessionPtr session)
+            {
+                traffic.emplace_back();
+                session->GetTraffic(traffic.back());
+            });
+        }
+
+        bool Flush(const int64_t session_id) override
+        {
+            SessionPtr session = GetNetSession(session_id);
+            if (session == nullptr)
+            {
+                return false;
+            }
+
+            FlushSession(session);
+            return true;
+        }
+
+        void FlushAll() override
+        {
+            if (staged_sessions_.empty())
+            {
+                return;
+            }
+
+            for (auto session_id : staged_sessions_)
+            {
+                SessionPtr session = GetNetSession(session_id);
+                if (session != nullptr)
+                {
+                    session->ClearStaged();
+                    FlushSession(session);
+                }
+            }
+
+            staged_sessions_.clear();
+        }
+
+    protected:
+        //called by StartServer before any conn comes
+        void InitSessions(const int bus_id, const uint32_t head_len)
+        {
+            bus_id_ = bus_id;
+            head_len_ = head_len;
+            idle_wheel_.Start(UpdateNetTime());
+        }
+
+        //IO threads, the session gets CONNECTED event, false if the conn is refused
+        bool OnConnected(const int64_t session_id, const ConnPTR& conn, const std::string& ip)
+        {
+            AFNetEvent* net_connect_event = AFNetEvent::AllocEvent();
+            net_connect_event->id_ = session_id;
+            net_connect_event->type_ = AFNetEventType::CONNECTED;
+            net_connect_event->bus_id_ = bus_id_;
+            net_connect_event->ip_ = ip;
+
+            SessionPtr session = ARK_NEW Session(AFHeadLength(head_len_), session_id, conn);
+            session->SetCompressThreshold(GetCompressThreshold());
+            session->SetAcceptPacked(head_len_ == SS_HEAD_LENGTH);
+            session->SetStagingPool(staging_pool_);
+            session->Touch(GetNetTime());
+            session->AddNetEvent(net_connect_event);
+            if (!sessions_.Add(session_id, session))
+            {
+                ARK_DELETE(session);
+                conn->postDisConnect();
+                return false;
+            }
+
+            PushReadySession(session);
+            return true;
+        }
+
+        //IO threads, bytes of the msg stream
+        void OnRecv(const int64_t session_id, const char* data, const size_t len)
+        {
+            sessions_.Visit(session_id, [this, data, len](SessionPtr session)
+            {
+                session->Touch(GetNetTime());
+                session->AddBuffer(data, len);
+                if (session->ParseBufferToMsg() > 0)
+                {
+                    PushReadySession(session);
+                }
+
+                //DISCONNECTED event comes as usual
+                if (session->IsRefused())
+                {
+                    session->GetSession()->postDisConnect();
+                }
+            });
+        }
+
+        //IO threads, the session gets DISCONNECTED event and is removed in next UpdateNetSession
+        void OnDisconnected(const int64_t session_id, const std::string& ip)
+        {
+            sessions_.Visit(session_id, [this, session_id, &ip](SessionPtr session)
+            {
+                AFNetEvent* net_disconnect_event = AFNetEvent::AllocEvent();
+                net_disconnect_event->id_ = session_id;
+                net_disconnect_event->type_ = AFNetEventType::DISCONNECTED;
+                net_disconnect_event->bus_id_ = bus_id_;
+                net_disconnect_event->ip_ = ip;
+
+                session->AddNetEvent(net_disconnect_event);
+                session->SetNeedRemove(true);
+                PushReadySession(session);
+            });
+        }
+
+        void PushReadySession(SessionPtr session)
+        {
+            if (session->MarkReady())
+            {
+                ready_sessions_.Push(session->GetSessionId());
+            }
+        }
+
+        SessionPtr GetNetSession(const int64_t& session_id)
+        {
+            return sessions_.Find(session_id);
+        }
+
+        void UpdateNetSession()
+        {
+            //only the sessions which have msgs or events, idle sessions cost nothing
+            //sessions carried over from last frame are in front, new ready sessions are appended
+            ready_sessions_.PopAll(update_sessions_);
+
+            const uint32_t frame_budget = GetFrameMsgBudget();
+            uint32_t frame_msgs = 0;
+            size_t index = 0;
+            for (; index < update_sessions_.size(); ++index)
+            {
+                if (frame_budget > 0 && frame_msgs >= frame_budget)
+                {
+                    break;
+                }
+
+                int64_t session_id = update_sessions_[index];
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr)
+                {
+                    continue;
+                }
+
+                uint32_t budget = GetSessionMsgBudget();
+                if (frame_budget > 0)
+                {
+                    budget = std::min(budget, frame_budget - frame_msgs);
+                }
+
+                session->ClearReady();
+                UpdateNetEvent(session);
+
+                uint32_t msg_count = 0;
+                bool has_more = UpdateNetMsg(session, budget, msg_count);
+                frame_msgs += msg_count;
+
+                if (session->NeedRemove())
+                {
+                    remove_sessions_.emplace_back(session_id);
+                }
+                else if (has_more)
+                {
+                    //round robin, the rest msgs wait behind other ready sessions
+                    PushReadySession(session);
+                }
+            }
+
+            //budget used up, events of the carried sessions still go this frame, msgs wait
+            for (size_t i = index; i < update_sessions_.size(); ++i)
+            {
+                int64_t session_id = update_sessions_[i];
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr)
+                {
+                    continue;
+                }
+
+                UpdateNetEvent(session);
+                if (session->NeedRemove())
+                {
+                    remove_sessions_.emplace_back(session_id);
+                }
+            }
+
+            update_sessions_.erase(update_sessions_.begin(), update_sessions_.begin() + index);
+
+            queue_stats_.carried_sessions_ = update_sessions_.size();
+            queue_stats_.ready_sessions_ = update_sessions_.size() + ready_sessions_.Count();
+            queue_stats_.frame_msgs_ = frame_msgs;
+            if (!update_sessions_.empty())
+            {
+                ++queue_stats_.budget_hit_frames_;
+            }
+
+            if (remove_sessions_.empty())
+            {
+                return;
+            }
+
+            sessions_.Remove(remove_sessions_, removed_sessions_);
+            for (auto session : removed_sessions_)
+            {
+                DestroySession(session);
+            }
+
+            removed_sessions_.clear();
+            remove_sessions_.clear();
+        }
+
+        void UpdateNetEvent(SessionPtr session)
+        {
+            AFNetEvent* event(nullptr);
+            if (!session->PopNetEvent(event))
+            {
+                return;
+            }
+
+            while (event != nullptr)
+            {
+                if (event->type_ == AFNetEventType::CONNECTED && GetIdleTimeout() > 0)
+                {
+                    idle_wheel_.Add(session->GetSessionId(), session->GetLastActiveTime() + GetIdleTimeoutMs());
+                }
+
+                net_event_cb_(event);
+                AFNetEvent::Release(event);
+
+                session->PopNetEvent(event);
+            }
+        }
+
+        bool UpdateNetMsg(SessionPtr session, const uint32_t budget, uint32_t& msg_count)
+        {
+            while (msg_count < budget)
+            {
+                AFNetMsg* msg(nullptr);
+                if (!session->PopNetMsg(msg))
+                {
+                    return false;
+                }
+
+                net_msg_cb_(msg, session->GetSessionId());
+                AFNetMsg::Release(msg);
+                ++msg_count;
+            }
+
+            return true;
+        }
+
+        void UpdateIdleSession()
+        {
+            const uint64_t now = UpdateNetTime();
+            idle_wheel_.Expire(now, [this, now](const int64_t session_id)
+            {
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr || session->NeedRemove() || GetIdleTimeout() == 0)
+                {
+                    return;
+                }
+
+                //touched since added, wait for the new deadline
+                uint64_t deadline = session->GetLastActiveTime() + GetIdleTimeoutMs();
+                if (deadline > now)
+                {
+                    idle_wheel_.Add(session_id, deadline);
+                    return;
+                }
+
+                ++queue_stats_.idle_closed_sessions_;
+                CloseSession(session_id);
+            });
+        }
+
+        void UpdateCongestedSession()
+        {
+            for (auto session_id : new_congested_sessions_)
+            {
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr || session->NeedRemove())
+                {
+                    continue;
+                }
+
+                if (backpressure_cb_ != nullptr)
+                {
+                    backpressure_cb_(session_id, true, session->GetPendingBytes());
+                }
+
+                if (GetSlowPolicy() == AFNetSlowPolicy::DISCONNECT)
+                {
+                    ++queue_stats_.slow_closed_sessions_;
+                    CloseSession(session_id);
+                    continue;
+                }
+
+                congested_sessions_.push_back(session_id);
+            }
+
+            new_congested_sessions_.clear();
+
+            //only congested sessions are checked, until they drain to low water mark
+            size_t count = 0;
+            for (auto session_id : congested_sessions_)
+            {
+                SessionPtr session = GetNetSession(session_id);
+                if (session == nullptr || session->NeedRemove())
+                {
+                    continue;
+                }
+
+                size_t pending = session->GetPendingBytes();
+                if (pending <= GetSendLowWater())
+                {
+                    session->SetCongested(false);
+                    if (backpressure_cb_ != nullptr)
+                    {
+                        backpressure_cb_(session_id, false, pending);
+                    }
+
+                    //throttled msgs go out now
+                    FlushSession(session);
+                    continue;
+                }
+
+                if (pending >= GetSendHighWater() * ARK_NET_SEND_HARD_LIMIT_FACTOR)
+                {
+                    ++queue_stats_.slow_closed_sessions_;
+                    CloseSession(session_id);
+                    continue;
+                }
+
+                congested_sessions_[count++] = session_id;
+            }
+
+            congested_sessions_.resize(count);
+            queue_stats_.congested_sessions_ = count;
+        }
+
+        bool SendPacket(const AFNetPacketPtr& packet, const uint16_t msg_id, const NET_SESSION_FILTER& filter)
+        {
+            sessions_.ForEach([this, &packet, msg_id, &filter](const int64_t session_id, SessionPtr session)
+            {
+                if (session->NeedRemove() || IsDroppedMsg(session, msg_id))
+                {
+                    return;
+                }
+
+                if (filter != nullptr && !filter(session_id))
+                {
+                    return;
+                }
+
+                //keep the order with staged msgs, every session queues the same packet by reference
+                FlushSession(session);
+                session->CountSendMsg();
+                QueuePacket(session, packet);
+            });
+
+            return true;
+        }
+
+        void QueuePacket(SessionPtr session, const AFNetPacketPtr& packet)
+        {
+            //throttled, msgs wait in session until the socket drains
+            if (session->IsCongested() && GetSlowPolicy() == AFNetSlowPolicy::THROTTLE)
+            {
+                session->GetStaging(packet->size()).append(*packet);
+                return;
+            }
+
+            if (GetSendHighWater() > 0)
+            {
+                SendTrackedPacket(session, packet, std::integral_constant<bool, TRACK_SEND>());
+            }
+            else
+            {
+                session->SendPacket(packet);
+            }
+
+            if (GetSendHighWater() > 0 && !session->IsCongested() && session->GetPendingBytes() >= GetSendHighWater())
+            {
+                //callback and policy are applied in next Update, out of any session lock
+                session->SetCongested(true);
+                new_congested_sessions_.push_back(session->GetSessionId());
+            }
+        }
+
+        void SendTrackedPacket(SessionPtr session, const AFNetPacketPtr& packet, std::true_type)
+        {
+            session->SendTrackedPacket(packet);
+        }
+
+        //written bytes are not reported, water marks only see the staged ones
+        void SendTrackedPacket(SessionPtr session, const AFNetPacketPtr& packet, std::false_type)
+        {
+            session->SendPacket(packet);
+        }
+
+        void FlushSession(SessionPtr session)
+        {
+            if (session->IsCongested() && GetSlowPolicy() == AFNetSlowPolicy::THROTTLE)
+            {
+                return;
+            }
+
+            AFNetPacketPtr packet = session->TakeStaging();
+            if (packet != nullptr)
+            {
+                QueuePacket(session, packet);
+            }
+        }
+
+        bool IsDroppedMsg(SessionPtr session, const uint16_t msg_id)
+        {
+            if (!session->IsCongested() || GetSlowPolicy() != AFNetSlowPolicy::DROP || !IsDroppableMsg(msg_id))
+            {
+                return false;
+            }
+
+            ++queue_stats_.dropped_msgs_;
+            return true;
+        }
+
+        void DestroySession(SessionPtr session)
+        {
+            session->GetSession()->postDisConnect();
+            ARK_DELETE(session);
+        }
+
+        bool CloseAllSession()
+        {
+            std::vector<SessionPtr> sessions;
+            sessions_.Clear(sessions);
+            for (auto session : sessions)
+            {
+                session->GetSession()->postShutdown();
+                ARK_DELETE(session);
+            }
+
+            return true;
+        }
+
+    protected:
+        AFNetSessionTable<SessionPtr> sessions_;
+        std::vector<int64_t> staged_sessions_;
+        //staging buffers come back here after written, shared by all sessions
+        std::shared_ptr<AFNetStagingPool> staging_pool_{ std::make_shared<AFNetStagingPool>() };
+        //session ids which have msgs or events, pushed by IO threads
+        AFMPSCQueue<int64_t> ready_sessions_;
+        //ready sessions, the ones not processed because of frame budget stay at the head for next frame
+        std::vector<int64_t> update_sessions_;
+        std::vector<int64_t> remove_sessions_;
+        std::vector<SessionPtr> removed_sessions_;
+        //idle deadlines of sessions, touched on recv by IO threads
+        AFNetTimeWheel idle_wheel_;
+        //sessions over send high water mark, new ones wait for callback and policy
+        std::vector<int64_t> new_congested_sessions_;
+        std::vector<int64_t> congested_sessions_;
+        int bus_id_{ 0 };
+        uint32_t head_len_{ 0 };
+
+        NET_MSG_FUNCTOR net_msg_cb_;
+        NET_EVENT_FUNCTOR net_event_cb_;
+
+        std::atomic<std::int64_t> trusted_session_id_{ 1 };
+    };
+
+}
@@ -27,14 +27,91 @@
 #include <brynet/net/Connector.h>
 #include <brynet/net/SyncConnector.h>
 #include "base/AFMacros.hpp"
-#include "base/AFBuffer.hpp"
+#include "base/AFNetChunk.hpp"
+#include "base/AFLZ4.hpp"
 #include "base/AFRWLock.hpp"
 #include "base/AFLockFreeQueue.hpp"
+#include "base/AFMPSCQueue.hpp"
 #include "base/AFNetMsg.hpp"
+#include "base/AFNetEvent.hpp"
+#include "base/AFNetMsgStats.hpp"
 
 namespace ark
 {
 
+    //outbound bytes queued in socket and not written yet, shared with send callbacks
+    //so that it outlives the session while IO thread still holds its packets
+    class AFNetSendCounter
+    {
+    public:
+        std::atomic<size_t> pending_{ 0 };
+    };
+
+    ARK_CONSTEXPR static const size_t ARK_NET_STAGING_POOL_MAX = 1024;              //idle staging buffers kept by one pool
+    ARK_CONSTEXPR static const size_t ARK_NET_STAGING_KEEP_CAPACITY = 64 * 1024;    //larger buffers are freed, not kept
+
+    //Staging buffers of coalescing mode. A buffer goes to the socket as a packet and comes back
+    //when its last owner drops it, usually an IO thread after the write, so sessions sending every
+    //frame reuse the capacity. Alloc on the logic thread only, buffers come back from any thread.
+    class AFNetStagingPool : public std::enable_shared_from_this<AFNetStagingPool>, public AFNoncopyable
+    {
+    public:
+        ~AFNetStagingPool()
+        {
+            returned_.PopAll(idle_);
+            for (auto buffer : idle_)
+            {
+                ARK_DELETE(buffer);
+            }
+        }
+
+        std::shared_ptr<std::string> Alloc(const size_t reserve_len)
+        {
+            if (idle_.empty())
+            {
+                returned_.PopAll(idle_);
+            }
+
+            std::string* buffer = nullptr;
+            if (idle_.empty())
+            {
+                buffer = ARK_NEW std::string();
+            }
+            else
+            {
+                buffer = idle_.back();
+                idle_.pop_back();
+                buffer->clear();
+            }
+
+            buffer->reserve(reserve_len);
+
+            //the pool lives until its last buffer is back
+            std::shared_ptr<AFNetStagingPool> pool = shared_from_this();
+            return std::shared_ptr<std::string>(buffer, [pool](std::string * released)
+            {
+                pool->Free(released);
+            });
+        }
+
+    protected:
+        void Free(std::string* buffer)
+        {
+            if (buffer->capacity() > ARK_NET_STAGING_KEEP_CAPACITY || returned_.Count() >= ARK_NET_STAGING_POOL_MAX)
+            {
+                ARK_DELETE(buffer);
+                return;
+            }
+
+            returned_.Push(buffer);
+        }
+
+    private:
+        //logic thread only
+        std::vector<std::string*> idle_;
+        AFMPSCQueue<std::string*> returned_;
+    };
+
     template <typename SessionPTR>
     class AFNetSession
     {
@@ -58,7 +135,7 @@ namespace ark
             {
                 while (event != nullptr)
                 {
-                    ARK_DELETE(event);
+                    AFNetEvent::Release(event);
                     PopNetEvent(event);
                 }
             }
@@ -68,7 +145,7 @@ namespace ark
             {
                 while (msg != nullptr)
                 {
-                    ARK_DELETE(msg);
+                    AFNetMsg::Release(msg);
                     PopNetMsg(msg);
                 }
             }
@@ -81,7 +158,11 @@ namespace ark
 
         int AddBuffer(const char* data, size_t len)
         {
-            buffer_.write(data, len);
+            if (!buffer_.write(data, len))
+            {
+                return -1;
+            }
+
             return (int)buffer_.get_length();
         }
 
@@ -131,6 +212,53 @@ namespace ark
             need_remove_ = value;
         }
 
+        //stamped by IO thread on connect and recv, read by logic thread for idle check
+        void Touch(const uint64_t now)
+        {
+            last_active_time_.store(now, std::memory_order_relaxed);
+        }
+
+        uint64_t GetLastActiveTime() const
+        {
+            return last_active_time_.load(std::memory_order_relaxed);
+        }
+
+        //msgs with body not smaller than threshold are compressed, 0 means off, logic thread only
+        uint32_t GetCompressThreshold() const
+        {
+            return compress_threshold_;
+        }
+
+        void SetCompressThreshold(uint32_t value)
+        {
+            compress_threshold_ = value;
+        }
+
+        //batch and compressed frames are taken only from trusted links, the others may send the empty batch heartbeat
+        //a packed frame fans out to many msgs and costs decompression on IO thread, so it is refused and the link is closed
+        void SetAcceptPacked(bool value)
+        {
+            accept_packed_.store(value, std::memory_order_relaxed);
+        }
+
+        //IO thread, parsing stopped at a refused frame, the caller closes the link
+        bool IsRefused() const
+        {
+            return refused_;
+        }
+
+        //return true if the session was idle, then the caller should put it into ready queue
+        bool MarkReady()
+        {
+            return !ready_.exchange(true, std::memory_order_acq_rel);
+        }
+
+        //logic thread clears the flag before draining queues, so new data marks it again
+        void ClearReady()
+        {
+            ready_.store(false, std::memory_order_release);
+        }
+
         bool AddNetEvent(AFNetEvent*& event)
         {
             return event_queue_.Push(event);
@@ -138,7 +266,14 @@ namespace ark
 
         bool PopNetEvent(AFNetEvent*& event)
         {
-            return event_queue_.Pop(event);
+            //reset to null when empty, callers loop until null
+            if (!event_queue_.Pop(event))
+            {
+                event = nullptr;
+                return false;
+            }
+
+            return true;
         }
 
         bool AddNetMsg(AFNetMsg*& msg)
@@ -148,31 +283,193 @@ namespace ark
 
         bool PopNetMsg(AFNetMsg*& msg)
         {
-            return msg_queue_.Pop(msg);
+            //reset to null when empty, callers loop until null
+            if (!msg_queue_.Pop(msg))
+            {
+                msg = nullptr;
+                return false;
+            }
+
+            return true;
+        }
+
+        //staging packet of coalescing mode, only used by the logic thread
+        std::string& GetStaging(size_t reserve_len)
+        {
+            if (send_staging_ == nullptr)
+            {
+                if (staging_pool_ == nullptr)
+                {
+                    staging_pool_ = std::make_shared<AFNetStagingPool>();
+                }
+
+                send_staging_ = staging_pool_->Alloc(reserve_len);
+            }
+
+            return *send_staging_;
+        }
+
+        //sessions of one server share the pool, a client session has its own
+        void SetStagingPool(const std::shared_ptr<AFNetStagingPool>& pool)
+        {
+            staging_pool_ = pool;
+        }
+
+        //true if the session is not listed for FlushAll yet, logic thread only
+        bool MarkStaged()
+        {
+            if (staged_)
+            {
+                return false;
+            }
+
+            staged_ = true;
+            return true;
+        }
+
+        void ClearStaged()
+        {
+            staged_ = false;
+        }
+
+        bool HasStaging() const
+        {
+            return (send_staging_ != nullptr);
+        }
+
+        //staged bytes are handed over to caller
+        std::shared_ptr<std::string> TakeStaging()
+        {
+            std::shared_ptr<std::string> staging;
+            staging.swap(send_staging_);
+            if (staging != nullptr && staging->empty())
+            {
+                staging.reset();
+            }
+
+            return staging;
+        }
+
+        void SendPacket(const std::shared_ptr<std::string>& packet)
+        {
+            send_bytes_ += packet->size();
+            session_->send(packet);
+        }
+
+        //queue packet to socket, counted in pending bytes until written
+        //the conn must support send with a written callback
+        void SendTrackedPacket(const std::shared_ptr<std::string>& packet)
+        {
+            send_bytes_ += packet->size();
+            if (send_counter_ == nullptr)
+            {
+                send_counter_ = std::make_shared<AFNetSendCounter>();
+            }
+
+            const size_t len = packet->size();
+            std::shared_ptr<AFNetSendCounter> counter = send_counter_;
+            counter->pending_.fetch_add(len, std::memory_order_relaxed);
+            session_->send(packet, [counter, len]()
+            {
+                counter->pending_.fetch_sub(len, std::memory_order_relaxed);
+            });
+        }
+
+        //bytes not written to socket yet, staged ones included
+        size_t GetPendingBytes() const
+        {
+            size_t pending = (send_counter_ != nullptr ? send_counter_->pending_.load(std::memory_order_relaxed) : 0);
+            return pending + (send_staging_ != nullptr ? send_staging_->size() : 0);
+        }
+
+        //over high water mark and not back to low water mark yet, logic thread only
+        bool IsCongested() const
+        {
+            return congested_;
+        }
+
+        void SetCongested(bool value)
+        {
+            congested_ = value;
+        }
+
+        //msgs handed to this session by logic thread, staged ones included
+        void CountSendMsg()
+        {
+            ++send_msgs_;
+        }
+
+        void GetTraffic(AFNetSessionTraffic& traffic) const
+        {
+            traffic.session_id_ = session_id_;
+            traffic.recv_msgs_ = recv_msgs_.load(std::memory_order_relaxed);
+            traffic.recv_bytes_ = recv_bytes_.load(std::memory_order_relaxed);
+            traffic.send_msgs_ = send_msgs_;
+            traffic.send_bytes_ = send_bytes_;
         }
 
-        void ParseBufferToMsg()
+        void FlushStaging()
         {
+            if (send_staging_ == nullptr)
+            {
+                return;
+            }
+
+            if (!send_staging_->empty())
+            {
+                send_bytes_ += send_staging_->size();
+                session_->send(send_staging_);
+            }
+
+            send_staging_.reset();
+        }
+
+        //return the count of decoded msgs
+        int ParseBufferToMsg()
+        {
+            int msg_count = 0;
             uint32_t pos = 0;
+            if (refused_)
+            {
+                return msg_count;
+            }
+
             AFMsgHead* msg_head = CheckRecvDataValid(pos);
             if (msg_head == nullptr)
             {
-                return;
+                return msg_count;
             }
 
-            while (GetBufferLen() >= pos + GetHeadLen() + msg_head->length_)
+            while (GetBufferLen() >= pos + GetHeadLen() + msg_head->GetBodyLength())
             {
-                AFNetMsg* msg = AFNetMsg::AllocMsg(msg_head->length_);
-                memcpy(msg, msg_head, GetHeadLen());
-
-                pos += GetHeadLen();
-                if (msg_head->length_ > 0)
+                const uint32_t body_len = msg_head->GetBodyLength();
+                char* body = GetBuffer() + pos + GetHeadLen();
+                if (msg_head->IsCompressed() || msg_head->IsBatch())
+                {
+                    if (!accept_packed_.load(std::memory_order_relaxed) && reinterpret_cast<const AFMsgBatchHead*>(body)->children_ != 0)
+                    {
+                        refused_ = true;
+                        break;
+                    }
+
+                    //corrupt payload is dropped, the stream is still in sync
+                    msg_count += ParsePackedMsg(msg_head, body, body_len);
+                }
+                else
                 {
-                    msg->CopyData(GetBuffer() + pos, msg_head->length_);
-                    pos += msg_head->length_;
+                    //msg data points to the receive chunk, no copy
+                    AFNetMsg* msg = AFNetMsg::AllocView(buffer_.get_chunk(), body, body_len);
+                    if (msg == nullptr)
+                    {
+                        break;
+                    }
+
+                    CopyHead(msg, msg_head);
+                    AddNetMsg(msg);
+                    ++msg_count;
                 }
 
-                AddNetMsg(msg);
+                pos += GetHeadLen() + body_len;
 
                 msg_head = CheckRecvDataValid(pos);
                 if (msg_head == nullptr)
@@ -184,11 +481,28 @@ namespace ark
             //remove [0, pos] buffers
             if (pos > 0)
             {
+                recv_msgs_.fetch_add(msg_count, std::memory_order_relaxed);
+                recv_bytes_.fetch_add(pos, std::memory_order_relaxed);
                 RemoveBuffer(pos);
             }
+
+            return msg_count;
         }
 
     protected:
+        //wire head fields of the session head length, the rest of msg keeps its defaults
+        void CopyHead(AFNetMsg* msg, const AFMsgHead* head)
+        {
+            if (GetHeadLen() == SS_HEAD_LENGTH)
+            {
+                static_cast<AFSSMsgHead&>(*msg) = *static_cast<const AFSSMsgHead*>(head);
+            }
+            else
+            {
+                static_cast<AFMsgHead&>(*msg) = *head;
+            }
+        }
+
         AFMsgHead* CheckRecvDataValid(uint32_t pos)
         {
             if (GetBufferLen() < (pos + GetHeadLen()))
@@ -197,23 +511,169 @@ namespace ark
             }
 
             auto head = reinterpret_cast<AFMsgHead*>(GetBuffer() + pos);
-            ARK_ASSERT_RET_VAL(head->length_ <= ARK_MSG_MAX_LENGTH, nullptr);
+            ARK_ASSERT_RET_VAL(head->GetBodyLength() <= head->GetMaxBodyLength(), nullptr);
+
+            //refused before the body arrives, the heartbeat is a raw batch with no children
+            if (!accept_packed_.load(std::memory_order_relaxed) && (head->IsCompressed() || head->IsBatch()) &&
+                    (head->IsCompressed() || head->GetBodyLength() != sizeof(AFMsgBatchHead)))
+            {
+                refused_ = true;
+                return nullptr;
+            }
 
             return head;
         }
 
+        //return the count of msgs decoded from a compressed or batch frame
+        int ParsePackedMsg(const AFMsgHead* msg_head, char* body, const uint32_t body_len)
+        {
+            if (!msg_head->IsCompressed())
+            {
+                return SplitBatch(msg_head, body, body_len, buffer_.get_chunk());
+            }
+
+            AFNetMsg* msg = DecompressMsg(msg_head, body, body_len);
+            if (msg == nullptr)
+            {
+                return 0;
+            }
+
+            if (!msg_head->IsBatch())
+            {
+                AddNetMsg(msg);
+                return 1;
+            }
+
+            int msg_count = SplitBatch(msg_head, msg->msg_data_, msg->length_, nullptr);
+            AFNetMsg::Release(msg);
+            return msg_count;
+        }
+
+        //fan children out to msgs, they are views of chunk or copies if chunk is null
+        //the whole batch is checked first and dropped if any record is corrupt
+        int SplitBatch(const AFMsgHead* msg_head, char* body, const uint32_t body_len, AFNetChunk* chunk)
+        {
+            if (body_len < sizeof(AFMsgBatchHead))
+            {
+                return 0;
+            }
+
+            const uint32_t record_head_len = AFMsgBatch::GetRecordHeadLen(GetHeadLen());
+            const uint16_t children = reinterpret_cast<const AFMsgBatchHead*>(body)->children_;
+            uint32_t pos = sizeof(AFMsgBatchHead);
+            for (uint16_t i = 0; i < children; ++i)
+            {
+                if (body_len - pos < record_head_len)
+                {
+                    return 0;
+                }
+
+                const uint32_t len = reinterpret_cast<const AFMsgHead*>(body + pos)->length_;
+                if (len > ARK_MSG_MAX_LENGTH || body_len - pos - record_head_len < len)
+                {
+                    return 0;
+                }
+
+                pos += record_head_len + len;
+            }
+
+            if (pos != body_len)
+            {
+                return 0;
+            }
+
+            int msg_count = 0;
+            pos = sizeof(AFMsgBatchHead);
+            for (uint16_t i = 0; i < children; ++i)
+            {
+                char* record = body + pos;
+                char* data = record + record_head_len;
+                const uint32_t len = reinterpret_cast<const AFMsgHead*>(record)->length_;
+                AFNetMsg* msg = (chunk != nullptr ? AFNetMsg::AllocView(chunk, data, len) : AFNetMsg::AllocMsg(len));
+                if (msg == nullptr)
+                {
+                    break;
+                }
+
+                //bus ids come from frame head, msg id, length and actor id from record
+                CopyHead(msg, msg_head);
+                static_cast<AFMsgHead&>(*msg) = *reinterpret_cast<const AFMsgHead*>(record);
+                if (record_head_len > sizeof(AFMsgHead))
+                {
+                    msg->actor_id_ = reinterpret_cast<const AFSSMsgHead*>(record)->actor_id_;
+                }
+
+                if (chunk == nullptr && len > 0)
+                {
+                    memcpy(msg->msg_data_, data, len);
+                }
+
+                AddNetMsg(msg);
+                ++msg_count;
+                pos += record_head_len + len;
+            }
+
+            return msg_count;
+        }
+
+        //compressed body is decoded into a pooled msg, its length_ is the raw length
+        AFNetMsg* DecompressMsg(const AFMsgHead* msg_head, const char* body, const uint32_t body_len)
+        {
+            uint32_t raw_len = 0;
+            if (body_len < ARK_MSG_COMPRESS_HEAD_LENGTH)
+            {
+                return nullptr;
+            }
+
+            memcpy(&raw_len, body, ARK_MSG_COMPRESS_HEAD_LENGTH);
+            if (raw_len == 0 || raw_len > msg_head->GetMaxBodyLength())
+            {
+                return nullptr;
+            }
+
+            AFNetMsg* msg = AFNetMsg::AllocMsg(raw_len);
+            if (msg == nullptr)
+            {
+                return nullptr;
+            }
+
+            CopyHead(msg, msg_head);
+            msg->length_ = raw_len;
+            if (!AFLZ4::Decompress(body + ARK_MSG_COMPRESS_HEAD_LENGTH, body_len - ARK_MSG_COMPRESS_HEAD_LENGTH, msg->msg_data_, raw_len))
+            {
+                AFNetMsg::Release(msg);
+                return nullptr;
+            }
+
+            return msg;
+        }
+
     private:
         uint32_t head_len_{ 0 };
         int64_t session_id_{ 0 };
         AFGUID object_id_{ 0 };
-        AFBuffer buffer_;
+        AFNetRecvBuffer buffer_;
 
         AFLockFreeQueue<AFNetMsg*> msg_queue_;
         AFLockFreeQueue<AFNetEvent*> event_queue_;
         const SessionPTR session_;
+        std::shared_ptr<std::string> send_staging_{ nullptr };
+        std::shared_ptr<AFNetStagingPool> staging_pool_{ nullptr };
+        bool staged_{ false };
+        std::shared_ptr<AFNetSendCounter> send_counter_{ nullptr };
+        bool congested_{ false };
+        uint32_t compress_threshold_{ 0 };
+        std::atomic<bool> accept_packed_{ true };
+        bool refused_{ false };
+        std::atomic<uint64_t> last_active_time_{ 0 };
+        std::atomic<uint64_t> recv_msgs_{ 0 };
+        std::atomic<uint64_t> recv_bytes_{ 0 };
+        uint64_t send_msgs_{ 0 };
+        uint64_t send_bytes_{ 0 };
 
         volatile bool connected_{ false };
         volatile bool need_remove_{ false };
+        std::atomic<bool> ready_{ false };
     };
 
     using AFTCPSession = AFNetSession<brynet::net::DataSocket::PTR>;
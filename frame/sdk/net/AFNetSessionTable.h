@@ -0,0 +1,187 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFPlatform.hpp"
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+#include "base/AFRWLock.hpp"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SESSION_SHARD_COUNT = 32; //must be power of 2
+
+    //Session registry split into shards, every shard has its own lock.
+    //IO threads add sessions and visit them under the shard read lock,
+    //sessions are only removed and deleted by the logic thread.
+    template<typename SessionPTR>
+    class AFNetSessionTable : public AFNoncopyable
+    {
+    public:
+        bool Add(const int64_t session_id, SessionPTR session)
+        {
+            AFShard& shard = GetShard(session_id);
+            AFScopeWLock guard(shard.lock_);
+            if (!shard.sessions_.insert(std::make_pair(session_id, session)).second)
+            {
+                return false;
+            }
+
+            size_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        SessionPTR Remove(const int64_t session_id)
+        {
+            AFShard& shard = GetShard(session_id);
+            AFScopeWLock guard(shard.lock_);
+            return EraseSession(shard, session_id);
+        }
+
+        //remove a batch of sessions, every shard is write locked once
+        void Remove(std::vector<int64_t>& session_list, std::vector<SessionPTR>& removed)
+        {
+            std::sort(session_list.begin(), session_list.end(), [](const int64_t lhs, const int64_t rhs)
+            {
+                return GetShardIndex(lhs) < GetShardIndex(rhs);
+            });
+
+            size_t begin = 0;
+            while (begin < session_list.size())
+            {
+                uint32_t shard_index = GetShardIndex(session_list[begin]);
+                AFShard& shard = shards_[shard_index];
+
+                AFScopeWLock guard(shard.lock_);
+                for (; begin < session_list.size() && GetShardIndex(session_list[begin]) == shard_index; ++begin)
+                {
+                    SessionPTR session = EraseSession(shard, session_list[begin]);
+                    if (session != nullptr)
+                    {
+                        removed.push_back(session);
+                    }
+                }
+            }
+        }
+
+        //the returned session is only safe to use in the logic thread
+        SessionPTR Find(const int64_t session_id)
+        {
+            AFShard& shard = GetShard(session_id);
+            AFScopeRLock guard(shard.lock_);
+            auto iter = shard.sessions_.find(session_id);
+            return (iter != shard.sessions_.end() ? iter->second : nullptr);
+        }
+
+        //call func with the session under the shard read lock, the session can not be removed meanwhile
+        template<typename FUNC>
+        bool Visit(const int64_t session_id, FUNC&& func)
+        {
+            AFShard& shard = GetShard(session_id);
+            AFScopeRLock guard(shard.lock_);
+            auto iter = shard.sessions_.find(session_id);
+            if (iter == shard.sessions_.end() || iter->second == nullptr)
+            {
+                return false;
+            }
+
+            func(iter->second);
+            return true;
+        }
+
+        template<typename FUNC>
+        void ForEach(FUNC&& func)
+        {
+            for (auto& shard : shards_)
+            {
+                AFScopeRLock guard(shard.lock_);
+                for (auto& iter : shard.sessions_)
+                {
+                    if (iter.second != nullptr)
+                    {
+                        func(iter.first, iter.second);
+                    }
+                }
+            }
+        }
+
+        void Clear(std::vector<SessionPTR>& removed)
+        {
+            for (auto& shard : shards_)
+            {
+                AFScopeWLock guard(shard.lock_);
+                for (auto& iter : shard.sessions_)
+                {
+                    if (iter.second != nullptr)
+                    {
+                        removed.push_back(iter.second);
+                    }
+                }
+
+                size_.fetch_sub(shard.sessions_.size(), std::memory_order_relaxed);
+                shard.sessions_.clear();
+            }
+        }
+
+        size_t Size() const
+        {
+            return size_.load(std::memory_order_relaxed);
+        }
+
+    protected:
+        class AFShard
+        {
+        public:
+            AFCReaderWriterLock lock_;
+            std::unordered_map<int64_t, SessionPTR> sessions_;
+        };
+
+        static uint32_t GetShardIndex(const int64_t session_id)
+        {
+            return uint32_t(uint64_t(session_id) & (ARK_NET_SESSION_SHARD_COUNT - 1));
+        }
+
+        AFShard& GetShard(const int64_t session_id)
+        {
+            return shards_[GetShardIndex(session_id)];
+        }
+
+        SessionPTR EraseSession(AFShard& shard, const int64_t session_id)
+        {
+            auto iter = shard.sessions_.find(session_id);
+            if (iter == shard.sessions_.end())
+            {
+                return nullptr;
+            }
+
+            SessionPTR session = iter->second;
+            shard.sessions_.erase(iter);
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            return session;
+        }
+
+    private:
+        AFShard shards_[ARK_NET_SESSION_SHARD_COUNT];
+        std::atomic<size_t> size_{ 0 };
+    };
+
+}
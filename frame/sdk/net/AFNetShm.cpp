@@ -0,0 +1,280 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFNetShm.h"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace ark
+{
+
+    void AFNetShmBell::Wait(uint32_t seq, uint32_t timeout_ms)
+    {
+        struct timespec timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = long(timeout_ms % 1000) * 1000000;
+
+        //returns at once if seq was changed by a writer after Prepare
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq_), FUTEX_WAIT, seq, &timeout, nullptr, 0);
+        waiting_.store(0, std::memory_order_relaxed);
+    }
+
+    void AFNetShmBell::Wake()
+    {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq_), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+
+    bool AFNetShmSegment::Create(const std::string& name, size_t size)
+    {
+        Close();
+        if (IsListenInUse(name))
+        {
+            return false;
+        }
+
+        ::shm_unlink(name.c_str());
+
+        int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        if (::ftruncate(fd, off_t(size)) != 0)
+        {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            return false;
+        }
+
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            ::shm_unlink(name.c_str());
+            return false;
+        }
+
+        data_ = data;
+        size_ = size;
+        return true;
+    }
+
+    bool AFNetShmSegment::Open(const std::string& name)
+    {
+        Close();
+
+        int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat file_stat;
+        if (::fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        size_t size = size_t(file_stat.st_size);
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            return false;
+        }
+
+        data_ = data;
+        size_ = size;
+        return true;
+    }
+
+    void AFNetShmSegment::Close()
+    {
+        if (data_ != nullptr)
+        {
+            ::munmap(data_, size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    void AFNetShmSegment::Unlink(const std::string& name)
+    {
+        ::shm_unlink(name.c_str());
+    }
+
+    std::string AFNetShmSegment::GetListenName(const int server_bus)
+    {
+        std::string name = ARK_FORMAT("/ark_shm_{}", server_bus);
+        return name;
+    }
+
+    std::string AFNetShmSegment::GetLinkName(const int server_bus, const int client_bus, const int client_pid, const uint32_t link_id)
+    {
+        std::string name = ARK_FORMAT("/ark_shm_{}_{}_{}_{}", server_bus, client_bus, client_pid, link_id);
+        return name;
+    }
+
+    uint32_t AFNetShmSegment::NextLinkId()
+    {
+        static std::atomic<uint32_t> link_id{ 0 };
+        return link_id++;
+    }
+
+    size_t AFNetShmSegment::GetLinkSize(size_t ring_size)
+    {
+        return sizeof(AFNetShmLinkHead) + ring_size * 2;
+    }
+
+    bool AFNetShmSegment::IsValidRingSize(size_t ring_size)
+    {
+        return (ring_size != 0 && (ring_size & (ring_size - 1)) == 0 && ring_size <= ARK_NET_SHM_RING_MAX);
+    }
+
+    bool AFNetShmSegment::IsListenInUse(const std::string& name)
+    {
+        //only a listen segment has this size, link segments carry the rings
+        AFNetShmSegment segment;
+        if (!segment.Open(name) || segment.GetSize() != sizeof(AFNetShmListenHead))
+        {
+            return false;
+        }
+
+        const AFNetShmListenHead* head = reinterpret_cast<const AFNetShmListenHead*>(segment.GetData());
+        return (head->magic_ == ARK_NET_SHM_MAGIC && IsProcessAlive(head->server_pid_));
+    }
+
+    bool AFNetShmSegment::IsProcessAlive(const int pid)
+    {
+        return (pid > 0 && (::kill(pid, 0) == 0 || errno != ESRCH));
+    }
+
+    int AFNetShmSegment::GetPid()
+    {
+        return int(::getpid());
+    }
+
+    uint64_t AFNetShmSegment::NowMs()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    AFShmConn::AFShmConn(const AFNetShmSegment::PTR& link, const AFNetShmSegment::PTR& listen, int64_t session_id) :
+        link_(link),
+        listen_(listen),
+        session_id_(session_id),
+        server_side_(listen == nullptr),
+        ip_("shm")
+    {
+        head_ = reinterpret_cast<AFNetShmLinkHead*>(link_->GetData());
+        char* c2s_data = link_->GetData() + sizeof(AFNetShmLinkHead);
+        char* s2c_data = c2s_data + head_->ring_size_;
+
+        if (server_side_)
+        {
+            tx_.Init(&head_->s2c_, s2c_data, head_->ring_size_);
+            rx_.Init(&head_->c2s_, c2s_data, head_->ring_size_);
+            peer_bell_ = &head_->client_bell_;
+        }
+        else
+        {
+            tx_.Init(&head_->c2s_, c2s_data, head_->ring_size_);
+            rx_.Init(&head_->s2c_, s2c_data, head_->ring_size_);
+            peer_bell_ = &reinterpret_cast<AFNetShmListenHead*>(listen_->GetData())->bell_;
+        }
+
+        last_peer_check_ = AFNetShmSegment::NowMs();
+    }
+
+    void AFShmConn::send(const std::shared_ptr<std::string>& packet)
+    {
+        if (packet == nullptr || packet->empty() || head_->state_.load(std::memory_order_relaxed) == ARK_NET_SHM_LINK_CLOSED)
+        {
+            return;
+        }
+
+        pending_.push_back(packet);
+        pending_bytes_ += packet->size();
+        Flush();
+    }
+
+    void AFShmConn::postDisConnect()
+    {
+        head_->state_.store(ARK_NET_SHM_LINK_CLOSED, std::memory_order_release);
+        peer_bell_->Ring();
+    }
+
+    bool AFShmConn::Flush()
+    {
+        bool written = false;
+        while (!pending_.empty())
+        {
+            const std::string& packet = *pending_.front();
+            size_t count = tx_.Write(packet.data() + pending_offset_, packet.size() - pending_offset_);
+            written = (written || count > 0);
+            pending_offset_ += count;
+            pending_bytes_ -= count;
+            if (pending_offset_ < packet.size())
+            {
+                break;
+            }
+
+            pending_.pop_front();
+            pending_offset_ = 0;
+        }
+
+        if (written)
+        {
+            peer_bell_->Ring();
+        }
+
+        return pending_.empty();
+    }
+
+    bool AFShmConn::IsClosed(const uint64_t now)
+    {
+        if (head_->state_.load(std::memory_order_acquire) == ARK_NET_SHM_LINK_CLOSED)
+        {
+            return true;
+        }
+
+        if (!peer_dead_ && now >= last_peer_check_ + ARK_NET_SHM_PEER_CHECK_MS)
+        {
+            last_peer_check_ = now;
+            int peer_pid = (server_side_ ? head_->client_pid_ : head_->server_pid_.load(std::memory_order_relaxed));
+            peer_dead_ = (peer_pid != 0 && !AFNetShmSegment::IsProcessAlive(peer_pid));
+        }
+
+        return peer_dead_;
+    }
+
+}
+
+#endif //ARK_HAVE_SHM_NET
@@ -0,0 +1,344 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFPlatform.hpp"
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+
+#if defined(ARK_HAVE_SHM_NET)
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SHM_MAGIC = 0x41524b53;              //"ARKS"
+    ARK_CONSTEXPR static const size_t ARK_NET_SHM_RING_SIZE = 8 * 1024 * 1024;       //bytes per direction, must be power of 2
+    ARK_CONSTEXPR static const size_t ARK_NET_SHM_RING_MAX = 64 * 1024 * 1024;       //max ring size a server accepts from a client
+    ARK_CONSTEXPR static const size_t ARK_NET_SHM_READ_BATCH = 256 * 1024;           //bytes parsed at most in one read
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SHM_LISTEN_SLOTS = 64;               //links being accepted at the same time
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SHM_SPIN_COUNT = 2048;               //idle polls before sleeping on futex
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SHM_WAIT_MS = 100;                   //max futex sleep
+    ARK_CONSTEXPR static const uint32_t ARK_NET_SHM_PEER_CHECK_MS = 1000;            //peer process alive check
+    ARK_CONSTEXPR static const int64_t ARK_NET_SHM_SESSION_BASE = int64_t(1) << 48;  //shm server session ids never clash with tcp ones
+
+    enum AFNetShmSlotState : uint32_t
+    {
+        ARK_NET_SHM_SLOT_FREE = 0,
+        ARK_NET_SHM_SLOT_CLAIMED = 1,   //client is filling the slot
+        ARK_NET_SHM_SLOT_REQUEST = 2,   //waiting for server to accept
+    };
+
+    enum AFNetShmLinkState : uint32_t
+    {
+        ARK_NET_SHM_LINK_INIT = 0,
+        ARK_NET_SHM_LINK_ACCEPTED = 1,
+        ARK_NET_SHM_LINK_CLOSED = 2,
+    };
+
+    //Futex word one thread sleeps on, writers ring it only if the thread is going to sleep.
+    //Lives in shared memory, so it is woken with the shared(not private) futex ops.
+    class AFNetShmBell
+    {
+    public:
+        //sleeper, re-check the work after Prepare and then Wait or Cancel
+        uint32_t Prepare()
+        {
+            uint32_t seq = seq_.load(std::memory_order_acquire);
+            waiting_.store(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return seq;
+        }
+
+        void Wait(uint32_t seq, uint32_t timeout_ms);
+
+        void Cancel()
+        {
+            waiting_.store(0, std::memory_order_relaxed);
+        }
+
+        //writer, after the data is published
+        void Ring()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting_.load(std::memory_order_relaxed) != 0)
+            {
+                seq_.fetch_add(1, std::memory_order_release);
+                Wake();
+            }
+        }
+
+        //spin hint between idle polls
+        static void Relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+    protected:
+        void Wake();
+
+    private:
+        std::atomic<uint32_t> seq_{ 0 };
+        std::atomic<uint32_t> waiting_{ 0 };
+    };
+
+    //positions only grow, the ring offset is pos & (size - 1)
+    class AFNetShmRingHead
+    {
+    public:
+        alignas(64) std::atomic<uint64_t> write_pos_{ 0 };
+        alignas(64) std::atomic<uint64_t> read_pos_{ 0 };
+    };
+
+    //Single-producer single-consumer byte ring, a view of the head and data in a segment.
+    //The stream is the same as tcp, so frames may wrap and be split between writes.
+    class AFNetShmRing
+    {
+    public:
+        void Init(AFNetShmRingHead* head, char* data, size_t size)
+        {
+            head_ = head;
+            data_ = data;
+            size_ = size;
+        }
+
+        //producer, returns bytes written, less than len if the ring is full
+        size_t Write(const char* src, size_t len)
+        {
+            uint64_t write_pos = head_->write_pos_.load(std::memory_order_relaxed);
+            uint64_t read_pos = head_->read_pos_.load(std::memory_order_acquire);
+            size_t count = std::min(len, size_ - size_t(write_pos - read_pos));
+            if (count == 0)
+            {
+                return 0;
+            }
+
+            size_t offset = size_t(write_pos & (size_ - 1));
+            size_t first = std::min(count, size_ - offset);
+            memcpy(data_ + offset, src, first);
+            if (count > first)
+            {
+                memcpy(data_, src + first, count - first);
+            }
+
+            head_->write_pos_.store(write_pos + count, std::memory_order_release);
+            return count;
+        }
+
+        //consumer, func is called with at most two continuous spans
+        template<typename FUNC>
+        size_t Read(size_t max_len, FUNC&& func)
+        {
+            uint64_t read_pos = head_->read_pos_.load(std::memory_order_relaxed);
+            uint64_t write_pos = head_->write_pos_.load(std::memory_order_acquire);
+            size_t count = std::min(size_t(write_pos - read_pos), max_len);
+            if (count == 0)
+            {
+                return 0;
+            }
+
+            size_t offset = size_t(read_pos & (size_ - 1));
+            size_t first = std::min(count, size_ - offset);
+            func(data_ + offset, first);
+            if (count > first)
+            {
+                func(data_, count - first);
+            }
+
+            head_->read_pos_.store(read_pos + count, std::memory_order_release);
+            return count;
+        }
+
+        bool IsEmpty() const
+        {
+            return head_->read_pos_.load(std::memory_order_relaxed) == head_->write_pos_.load(std::memory_order_acquire);
+        }
+
+    private:
+        AFNetShmRingHead* head_{ nullptr };
+        char* data_{ nullptr };
+        size_t size_{ 0 };
+    };
+
+    class AFNetShmSlot
+    {
+    public:
+        std::atomic<uint32_t> state_{ ARK_NET_SHM_SLOT_FREE };
+        int32_t client_bus_{ 0 };
+        int32_t client_pid_{ 0 };
+        uint32_t link_id_{ 0 };
+    };
+
+    //segment /ark_shm_{server bus}, created by the server, clients post link requests into slots
+    class AFNetShmListenHead
+    {
+    public:
+        uint32_t magic_{ ARK_NET_SHM_MAGIC };
+        int32_t server_bus_{ 0 };
+        int32_t server_pid_{ 0 };
+        AFNetShmBell bell_;             //server IO thread sleeps here
+        AFNetShmSlot slots_[ARK_NET_SHM_LISTEN_SLOTS];
+    };
+
+    //segment /ark_shm_{server bus}_{client bus}_{client pid}_{link id}, created by the client,
+    //the two rings follow the head. The name is unlinked once both sides mapped it.
+    class AFNetShmLinkHead
+    {
+    public:
+        uint32_t magic_{ ARK_NET_SHM_MAGIC };
+        uint32_t ring_size_{ 0 };
+        int32_t client_bus_{ 0 };
+        int32_t client_pid_{ 0 };
+        std::atomic<int32_t> server_pid_{ 0 };
+        std::atomic<uint32_t> state_{ ARK_NET_SHM_LINK_INIT };
+        AFNetShmBell client_bell_;      //client IO thread sleeps here
+        AFNetShmRingHead c2s_;
+        AFNetShmRingHead s2c_;
+    };
+
+    //One posix shared memory mapping
+    class AFNetShmSegment : public AFNoncopyable
+    {
+    public:
+        using PTR = std::shared_ptr<AFNetShmSegment>;
+
+        ~AFNetShmSegment()
+        {
+            Close();
+        }
+
+        //a stale segment of a dead process with the same name is replaced,
+        //fails if it is the listen segment of a live server
+        bool Create(const std::string& name, size_t size);
+        bool Open(const std::string& name);
+        void Close();
+
+        char* GetData()
+        {
+            return reinterpret_cast<char*>(data_);
+        }
+
+        size_t GetSize() const
+        {
+            return size_;
+        }
+
+        static void Unlink(const std::string& name);
+        static std::string GetListenName(const int server_bus);
+        static std::string GetLinkName(const int server_bus, const int client_bus, const int client_pid, const uint32_t link_id);
+        //unique per process, so several links to the same server do not share a name
+        static uint32_t NextLinkId();
+        static size_t GetLinkSize(size_t ring_size);
+        //ring offsets are masked with size - 1
+        static bool IsValidRingSize(size_t ring_size);
+        static bool IsProcessAlive(const int pid);
+        static int GetPid();
+        static uint64_t NowMs();
+
+    private:
+        static bool IsListenInUse(const std::string& name);
+
+        void* data_{ nullptr };
+        size_t size_{ 0 };
+    };
+
+    //One side of a shm link. The logic thread is the only producer of the tx ring and
+    //the IO thread the only consumer of the rx ring. Bytes which do not fit are kept
+    //in order and written by Flush, so a full ring never drops or reorders msgs.
+    class AFShmConn : public AFNoncopyable
+    {
+    public:
+        using PTR = std::shared_ptr<AFShmConn>;
+
+        //listen is the server listen segment mapped by a client, null at server side
+        AFShmConn(const AFNetShmSegment::PTR& link, const AFNetShmSegment::PTR& listen, int64_t session_id);
+
+        //same names as brynet DataSocket, so AFNetSession works with both
+        void send(const std::shared_ptr<std::string>& packet);
+        void postDisConnect();
+
+        void postShutdown()
+        {
+            postDisConnect();
+        }
+
+        const std::string& getIP() const
+        {
+            return ip_;
+        }
+
+        //logic thread, write pending bytes, true if nothing is left
+        bool Flush();
+
+        size_t GetPendingBytes() const
+        {
+            return pending_bytes_;
+        }
+
+        //IO thread
+        template<typename FUNC>
+        size_t Read(FUNC&& func)
+        {
+            return rx_.Read(ARK_NET_SHM_READ_BATCH, std::forward<FUNC>(func));
+        }
+
+        bool HasData() const
+        {
+            return !rx_.IsEmpty();
+        }
+
+        bool IsClosed(const uint64_t now);
+
+        AFNetShmLinkHead* GetHead()
+        {
+            return head_;
+        }
+
+        int64_t GetSessionId() const
+        {
+            return session_id_;
+        }
+
+    private:
+        AFNetShmSegment::PTR link_;
+        AFNetShmSegment::PTR listen_;
+        AFNetShmLinkHead* head_{ nullptr };
+        AFNetShmBell* peer_bell_{ nullptr };
+        AFNetShmRing tx_;
+        AFNetShmRing rx_;
+        int64_t session_id_{ 0 };
+        bool server_side_{ false };
+        std::string ip_;
+
+        //logic thread only
+        std::deque<std::shared_ptr<std::string>> pending_;
+        size_t pending_offset_{ 0 };
+        size_t pending_bytes_{ 0 };
+
+        //IO thread only
+        uint64_t last_peer_check_{ 0 };
+        bool peer_dead_{ false };
+    };
+
+}
+
+#endif //ARK_HAVE_SHM_NET
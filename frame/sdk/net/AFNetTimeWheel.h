@@ -0,0 +1,121 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFPlatform.hpp"
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_NET_TIME_WHEEL_SLOTS = 512; //must be power of 2
+    ARK_CONSTEXPR static const uint32_t ARK_NET_TIME_WHEEL_TICK = 100;  //ms
+
+    //Hashed timing wheel of per-connection deadlines, used by one thread only.
+    //Nothing is moved when a connection is touched, the owner checks the real
+    //deadline when a slot comes due and adds it again if it was touched meanwhile,
+    //so every frame costs O(due entries) instead of O(connections).
+    class AFNetTimeWheel : public AFNoncopyable
+    {
+    public:
+        void Start(const uint64_t now_ms)
+        {
+            current_tick_ = now_ms / ARK_NET_TIME_WHEEL_TICK;
+        }
+
+        void Add(const int64_t id, const uint64_t deadline_ms)
+        {
+            //round up, an entry never fires before its deadline
+            uint64_t tick = (deadline_ms + ARK_NET_TIME_WHEEL_TICK - 1) / ARK_NET_TIME_WHEEL_TICK;
+            tick = std::max(tick, current_tick_ + 1);
+
+            AFEntry entry;
+            entry.id_ = id;
+            entry.tick_ = tick;
+            slots_[tick & (ARK_NET_TIME_WHEEL_SLOTS - 1)].push_back(entry);
+            ++size_;
+        }
+
+        //func(id) is called for every entry whose deadline passed, it may add the id again
+        template<typename FUNC>
+        void Expire(const uint64_t now_ms, FUNC&& func)
+        {
+            const uint64_t now_tick = now_ms / ARK_NET_TIME_WHEEL_TICK;
+            if (now_tick <= current_tick_)
+            {
+                return;
+            }
+
+            //a long stall visits every slot once
+            const uint64_t end_tick = std::min<uint64_t>(now_tick, current_tick_ + ARK_NET_TIME_WHEEL_SLOTS);
+            while (current_tick_ < end_tick)
+            {
+                ++current_tick_;
+                std::vector<AFEntry>& slot = slots_[current_tick_ & (ARK_NET_TIME_WHEEL_SLOTS - 1)];
+                if (slot.empty())
+                {
+                    continue;
+                }
+
+                due_.swap(slot);
+                size_ -= due_.size();
+                for (const auto& entry : due_)
+                {
+                    if (entry.tick_ > now_tick)
+                    {
+                        //later round
+                        slots_[entry.tick_ & (ARK_NET_TIME_WHEEL_SLOTS - 1)].push_back(entry);
+                        ++size_;
+                    }
+                    else
+                    {
+                        func(entry.id_);
+                    }
+                }
+
+                due_.clear();
+            }
+
+            current_tick_ = now_tick;
+        }
+
+        size_t Size() const
+        {
+            return size_;
+        }
+
+    protected:
+        class AFEntry
+        {
+        public:
+            int64_t id_{ 0 };
+            uint64_t tick_{ 0 };
+        };
+
+    private:
+        std::vector<AFEntry> slots_[ARK_NET_TIME_WHEEL_SLOTS];
+        std::vector<AFEntry> due_;
+        uint64_t current_tick_{ 0 };
+        size_t size_{ 0 };
+    };
+
+}
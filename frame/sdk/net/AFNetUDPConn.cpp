@@ -0,0 +1,353 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFNetUDPConn.h"
+
+#if ARK_PLATFORM == PLATFORM_WIN
+#include <WS2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#endif
+
+namespace ark
+{
+
+    void AFUDPConfig::Load(const AFServerConfig& server_config)
+    {
+        for (size_t i = 0; i < server_config.udp_channels.size() && i < ARK_UDP_CHANNEL_COUNT; ++i)
+        {
+            channels_[i].mode_ = AFKcpChannelMode(std::min<uint8_t>(server_config.udp_channels[i], ARK_KCP_UNRELIABLE));
+        }
+
+        for (const auto& iter : server_config.udp_msg_channels)
+        {
+            if (iter.second < ARK_UDP_CHANNEL_COUNT)
+            {
+                msg_channels_[iter.first] = iter.second;
+            }
+        }
+    }
+
+    AFUDPConn::AFUDPConn(int fd, uint32_t conv, int64_t session_id, uint32_t head_len, const struct sockaddr_storage& addr, socklen_t addr_len, const AFUDPConfigPtr& config) :
+        fd_(fd),
+        conv_(conv),
+        session_id_(session_id),
+        head_len_(head_len),
+        addr_(addr),
+        addr_len_(addr_len),
+        config_(config)
+    {
+        ip_ = GetAddrIP(addr);
+        for (uint32_t i = 0; i < ARK_UDP_CHANNEL_COUNT; ++i)
+        {
+            channels_[i] = ARK_NEW AFNetKcp(conv, uint8_t(i), config_->channels_[i], this);
+            flush_channels_[i] = false;
+        }
+
+        now_ = NowMs();
+        last_recv_time_ = now_;
+        last_send_time_ = now_;
+        datagram_.reserve(ARK_KCP_MTU);
+    }
+
+    AFUDPConn::~AFUDPConn()
+    {
+        for (auto& channel : channels_)
+        {
+            ARK_DELETE(channel);
+        }
+    }
+
+    void AFUDPConn::send(const std::shared_ptr<std::string>& packet)
+    {
+        if (packet != nullptr && !packet->empty())
+        {
+            out_queue_.Push(packet);
+        }
+    }
+
+    void AFUDPConn::postDisConnect()
+    {
+        close_requested_.store(true, std::memory_order_release);
+    }
+
+    void AFUDPConn::Input(const char* data, size_t len, uint32_t now, const FRAME_CALLBACK& callback)
+    {
+        now_ = now;
+
+        //a datagram packs segments of any channels
+        size_t pos = 0;
+        while (pos < len)
+        {
+            AFKcpSegHead head;
+            if (!head.Decode(data + pos, len - pos) || head.conv_ != conv_)
+            {
+                break;
+            }
+
+            last_recv_time_ = now;
+            const char* payload = data + pos + ARK_KCP_HEAD_LENGTH;
+            pos += ARK_KCP_HEAD_LENGTH + head.len_;
+
+            switch (head.cmd_)
+            {
+            case ARK_KCP_CMD_FIN:
+                fin_received_ = true;
+                break;
+            case ARK_KCP_CMD_PING:
+            case ARK_KCP_CMD_SYN:
+            case ARK_KCP_CMD_SYN_ACK:
+                break;
+            default:
+                if (head.chan_ < ARK_UDP_CHANNEL_COUNT)
+                {
+                    channels_[head.chan_]->Input(head, payload, now);
+                    flush_channels_[head.chan_] = true;
+                }
+                break;
+            }
+        }
+
+        for (uint32_t i = 0; i < ARK_UDP_CHANNEL_COUNT; ++i)
+        {
+            if (!flush_channels_[i])
+            {
+                continue;
+            }
+
+            while (channels_[i]->Recv(frame_))
+            {
+                callback(frame_.data(), frame_.size());
+            }
+        }
+
+        //ack at once, and send what the new window allows
+        for (uint32_t i = 0; i < ARK_UDP_CHANNEL_COUNT; ++i)
+        {
+            if (flush_channels_[i])
+            {
+                channels_[i]->Flush();
+                flush_channels_[i] = false;
+            }
+        }
+
+        FlushDatagram();
+    }
+
+    void AFUDPConn::Update(uint32_t now)
+    {
+        now_ = now;
+
+        if (out_queue_.PopAll(packets_))
+        {
+            for (auto& packet : packets_)
+            {
+                RoutePacket(*packet);
+            }
+
+            packets_.clear();
+        }
+
+        for (uint32_t i = 0; i < ARK_UDP_CHANNEL_COUNT; ++i)
+        {
+            //new msgs go out now, timers are driven by Update
+            channels_[i]->Update(now);
+            if (flush_channels_[i])
+            {
+                channels_[i]->Flush();
+                flush_channels_[i] = false;
+            }
+        }
+
+        if (datagram_.empty() && AFNetKcp::TimeDiff(now, last_send_time_) >= int32_t(ARK_UDP_PING_INTERVAL))
+        {
+            SendCtrl(ARK_KCP_CMD_PING, 0, now);
+        }
+
+        FlushDatagram();
+    }
+
+    bool AFUDPConn::IsClosed(uint32_t now) const
+    {
+        if (close_requested_.load(std::memory_order_acquire) || fin_received_ || overload_)
+        {
+            return true;
+        }
+
+        if (AFNetKcp::TimeDiff(now, last_recv_time_) >= int32_t(ARK_UDP_TIMEOUT))
+        {
+            return true;
+        }
+
+        for (auto channel : channels_)
+        {
+            if (channel->IsDeadLink() || channel->GetWaitSend() > ARK_KCP_MAX_WAIT_SEGMENTS)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void AFUDPConn::SendCtrl(uint8_t cmd, uint32_t sn, uint32_t now)
+    {
+        now_ = now;
+
+        AFKcpSegHead head;
+        head.conv_ = conv_;
+        head.cmd_ = cmd;
+        head.ts_ = now;
+        head.sn_ = sn;
+        Output(head, nullptr);
+        FlushDatagram();
+    }
+
+    bool AFUDPConn::IsSameAddr(const struct sockaddr_storage& addr, socklen_t addr_len) const
+    {
+        return (addr_len == addr_len_ && memcmp(&addr, &addr_, size_t(addr_len)) == 0);
+    }
+
+    void AFUDPConn::Output(const AFKcpSegHead& head, const char* data)
+    {
+        if (datagram_.size() + ARK_KCP_HEAD_LENGTH + head.len_ > ARK_KCP_MTU)
+        {
+            FlushDatagram();
+        }
+
+        char buffer[ARK_KCP_HEAD_LENGTH];
+        head.Encode(buffer);
+        datagram_.append(buffer, ARK_KCP_HEAD_LENGTH);
+        if (head.len_ > 0)
+        {
+            datagram_.append(data, head.len_);
+        }
+    }
+
+    void AFUDPConn::RoutePacket(const std::string& packet)
+    {
+        //a packet may hold several coalesced msgs, every msg goes to the channel of its id
+        size_t pos = 0;
+        while (pos + head_len_ <= packet.size())
+        {
+            const AFMsgHead* head = reinterpret_cast<const AFMsgHead*>(packet.data() + pos);
+            size_t frame_len = head_len_ + head->GetBodyLength();
+            if (pos + frame_len > packet.size())
+            {
+                break;
+            }
+
+            uint8_t channel = config_->GetMsgChannel(head->id_);
+            if (channel >= ARK_UDP_CHANNEL_COUNT)
+            {
+                channel = 0;
+            }
+
+            if (!channels_[channel]->Send(packet.data() + pos, frame_len))
+            {
+                overload_ = true;
+                return;
+            }
+
+            flush_channels_[channel] = true;
+            pos += frame_len;
+        }
+    }
+
+    void AFUDPConn::FlushDatagram()
+    {
+        if (datagram_.empty())
+        {
+            return;
+        }
+
+        last_send_time_ = now_;
+
+        const struct sockaddr* addr = (addr_len_ > 0 ? reinterpret_cast<const struct sockaddr*>(&addr_) : nullptr);
+        ::sendto(fd_, datagram_.data(), int(datagram_.size()), 0, addr, addr_len_);
+
+        datagram_.clear();
+    }
+
+    uint32_t AFUDPConn::NowMs()
+    {
+        return uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    bool AFUDPConn::ResolveAddr(const std::string& ip, const int port, bool ip_v6, struct sockaddr_storage& addr, socklen_t& addr_len)
+    {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = (ip_v6 ? AF_INET6 : AF_INET);
+        hints.ai_socktype = SOCK_DGRAM;
+
+        struct addrinfo* result = nullptr;
+        if (::getaddrinfo(ip.c_str(), ARK_TO_STRING(port).c_str(), &hints, &result) != 0 || result == nullptr)
+        {
+            return false;
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr, result->ai_addr, result->ai_addrlen);
+        addr_len = socklen_t(result->ai_addrlen);
+        ::freeaddrinfo(result);
+        return true;
+    }
+
+    std::string AFUDPConn::GetAddrIP(const struct sockaddr_storage& addr)
+    {
+        char ip[INET6_ADDRSTRLEN] = { 0 };
+        if (addr.ss_family == AF_INET6)
+        {
+            ::inet_ntop(AF_INET6, const_cast<struct in6_addr*>(&reinterpret_cast<const struct sockaddr_in6*>(&addr)->sin6_addr), ip, sizeof(ip));
+        }
+        else if (addr.ss_family == AF_INET)
+        {
+            ::inet_ntop(AF_INET, const_cast<struct in_addr*>(&reinterpret_cast<const struct sockaddr_in*>(&addr)->sin_addr), ip, sizeof(ip));
+        }
+
+        return ip;
+    }
+
+    std::string AFUDPConn::GetAddrKey(const struct sockaddr_storage& addr, socklen_t addr_len)
+    {
+        return std::string(reinterpret_cast<const char*>(&addr), size_t(addr_len));
+    }
+
+    int AFUDPConn::PollRead(int fd, int timeout)
+    {
+#if ARK_PLATFORM == PLATFORM_WIN
+        WSAPOLLFD pfd;
+        pfd.fd = fd;
+        pfd.events = POLLRDNORM;
+        pfd.revents = 0;
+        return ::WSAPoll(&pfd, 1, timeout);
+#else
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        return ::poll(&pfd, 1, timeout);
+#endif
+    }
+
+}
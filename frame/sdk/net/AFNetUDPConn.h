@@ -0,0 +1,181 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFMPSCQueue.hpp"
+#include "base/AFBaseStruct.hpp"
+#include "interface/AFINet.h"
+#include "AFNetKcp.h"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_CHANNEL_COUNT = 4;
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_TIMEOUT = 10000;        //ms without any datagram from peer
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_PING_INTERVAL = 1000;   //ms without any datagram to peer
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_SYN_INTERVAL = 200;     //ms between handshake retries
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_COOKIE_SLOT = 5000;     //ms, a SYN cookie is valid in its slot and the next one
+    ARK_CONSTEXPR static const uint32_t ARK_UDP_RECV_BATCH = 1024;      //datagrams read in one loop
+    ARK_CONSTEXPR static const int ARK_UDP_SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    //Channels and msg routing of a reliable udp net, set before start.
+    //Both sides must use the same channel modes.
+    class AFUDPConfig
+    {
+    public:
+        AFUDPConfig()
+        {
+            //0: reliable ordered(default), 1: reliable unordered, 2: unreliable, 3: reliable ordered
+            channels_[1].mode_ = ARK_KCP_RELIABLE_UNORDERED;
+            channels_[2].mode_ = ARK_KCP_UNRELIABLE;
+        }
+
+        //udp attributes of proc.xml, a client loads the config of the server it connects
+        void Load(const AFServerConfig& server_config);
+
+        uint8_t GetMsgChannel(uint16_t msg_id) const
+        {
+            auto iter = msg_channels_.find(msg_id);
+            return (iter != msg_channels_.end() ? iter->second : 0);
+        }
+
+        //io loop tick, the smallest flush interval of channels
+        uint32_t GetTickInterval() const
+        {
+            uint32_t interval = channels_[0].interval_;
+            for (const auto& channel : channels_)
+            {
+                interval = std::min(interval, channel.interval_);
+            }
+
+            return std::max<uint32_t>(interval, 1);
+        }
+
+        AFKcpChannelConfig channels_[ARK_UDP_CHANNEL_COUNT];
+        std::unordered_map<uint16_t, uint8_t> msg_channels_; //msg id -> channel, others go channel 0
+    };
+
+    using AFUDPConfigPtr = std::shared_ptr<const AFUDPConfig>;
+
+    //One reliable udp connection, frames of a packet are routed to channels by msg id.
+    //Other threads only queue packets and close request, the rest runs in the IO thread.
+    class AFUDPConn : public AFNetKcpOutput, public AFNoncopyable
+    {
+    public:
+        using PTR = std::shared_ptr<AFUDPConn>;
+        using FRAME_CALLBACK = std::function<void(const char*, size_t)>;
+
+        //addr_len 0 means fd is a connected socket
+        AFUDPConn(int fd, uint32_t conv, int64_t session_id, uint32_t head_len, const struct sockaddr_storage& addr, socklen_t addr_len, const AFUDPConfigPtr& config);
+        ~AFUDPConn() override;
+
+        //same names as brynet DataSocket, so AFNetSession works with both
+        void send(const std::shared_ptr<std::string>& packet);
+        void postDisConnect();
+
+        void postShutdown()
+        {
+            postDisConnect();
+        }
+
+        const std::string& getIP() const
+        {
+            return ip_;
+        }
+
+        //IO thread only
+        void Input(const char* data, size_t len, uint32_t now, const FRAME_CALLBACK& callback);
+        void Update(uint32_t now);
+        bool IsClosed(uint32_t now) const;
+        void SendCtrl(uint8_t cmd, uint32_t sn, uint32_t now);
+        bool IsSameAddr(const struct sockaddr_storage& addr, socklen_t addr_len) const;
+
+        void Output(const AFKcpSegHead& head, const char* data) override;
+
+        uint32_t GetConv() const
+        {
+            return conv_;
+        }
+
+        int64_t GetSessionId() const
+        {
+            return session_id_;
+        }
+
+        uint32_t GetNonce() const
+        {
+            return nonce_;
+        }
+
+        void SetNonce(uint32_t nonce)
+        {
+            nonce_ = nonce;
+        }
+
+        bool IsFinReceived() const
+        {
+            return fin_received_;
+        }
+
+        std::string GetPeerKey() const
+        {
+            return GetAddrKey(addr_, addr_len_);
+        }
+
+        static uint32_t NowMs();
+        static bool ResolveAddr(const std::string& ip, const int port, bool ip_v6, struct sockaddr_storage& addr, socklen_t& addr_len);
+        static std::string GetAddrIP(const struct sockaddr_storage& addr);
+        static std::string GetAddrKey(const struct sockaddr_storage& addr, socklen_t addr_len);
+        static int PollRead(int fd, int timeout);
+
+    protected:
+        void RoutePacket(const std::string& packet);
+        void FlushDatagram();
+
+    private:
+        int fd_{ -1 };
+        uint32_t conv_{ 0 };
+        int64_t session_id_{ 0 };
+        uint32_t head_len_{ 0 };
+        struct sockaddr_storage addr_;
+        socklen_t addr_len_{ 0 };
+        std::string ip_;
+        AFUDPConfigPtr config_;
+
+        AFNetKcp* channels_[ARK_UDP_CHANNEL_COUNT];
+        bool flush_channels_[ARK_UDP_CHANNEL_COUNT];
+
+        AFMPSCQueue<std::shared_ptr<std::string>> out_queue_;
+        std::vector<std::shared_ptr<std::string>> packets_;
+        std::atomic<bool> close_requested_{ false };
+
+        //IO thread only
+        bool fin_received_{ false };
+        bool overload_{ false };
+        uint32_t nonce_{ 0 };
+        uint32_t now_{ 0 };
+        uint32_t last_recv_time_{ 0 };
+        uint32_t last_send_time_{ 0 };
+        std::string datagram_;
+        std::string frame_;
+    };
+
+}
@@ -0,0 +1,386 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <brynet/net/http/HttpService.h>
+#include "AFNetWebSocket.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ARK_WS_UNMASK_SSE2
+#endif
+
+namespace ark
+{
+
+    int AFNetWebSocket::DecodeHead(const char* data, size_t len, AFWSFrameHead& head)
+    {
+        if (len < 2)
+        {
+            return 0;
+        }
+
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+        //no extension is negotiated, rsv bits must be 0
+        if ((p[0] & 0x70) != 0)
+        {
+            return -1;
+        }
+
+        head.fin_ = ((p[0] & 0x80) != 0);
+        head.opcode_ = (p[0] & 0x0F);
+        head.masked_ = ((p[1] & 0x80) != 0);
+
+        size_t head_len = 2;
+        uint64_t payload_len = (p[1] & 0x7F);
+        if (payload_len == 126)
+        {
+            head_len += 2;
+        }
+        else if (payload_len == 127)
+        {
+            head_len += 8;
+        }
+
+        if (head.masked_)
+        {
+            head_len += 4;
+        }
+
+        if (len < head_len)
+        {
+            return 0;
+        }
+
+        size_t pos = 2;
+        if (payload_len == 126)
+        {
+            payload_len = (uint64_t(p[2]) << 8) | p[3];
+            pos += 2;
+        }
+        else if (payload_len == 127)
+        {
+            payload_len = 0;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                payload_len = (payload_len << 8) | p[pos + i];
+            }
+
+            pos += 8;
+        }
+
+        if (head.masked_)
+        {
+            memcpy(head.mask_, p + pos, 4);
+        }
+
+        head.payload_len_ = payload_len;
+        return int(head_len);
+    }
+
+    size_t AFNetWebSocket::EncodeHead(char* out, uint8_t opcode, uint64_t payload_len)
+    {
+        uint8_t* p = reinterpret_cast<uint8_t*>(out);
+        p[0] = uint8_t(0x80 | (opcode & 0x0F));
+        if (payload_len < 126)
+        {
+            p[1] = uint8_t(payload_len);
+            return 2;
+        }
+
+        if (payload_len <= 0xFFFF)
+        {
+            p[1] = 126;
+            p[2] = uint8_t(payload_len >> 8);
+            p[3] = uint8_t(payload_len);
+            return 4;
+        }
+
+        p[1] = 127;
+        for (size_t i = 0; i < 8; ++i)
+        {
+            p[2 + i] = uint8_t(payload_len >> (8 * (7 - i)));
+        }
+
+        return 10;
+    }
+
+    void AFNetWebSocket::Unmask(char* data, size_t len, const uint8_t mask[4], uint64_t offset)
+    {
+        //rotate the mask so that key[0] applies to data[0]
+        uint8_t key[4];
+        for (size_t i = 0; i < 4; ++i)
+        {
+            key[i] = mask[(offset + i) & 3];
+        }
+
+        size_t pos = 0;
+#if defined(ARK_WS_UNMASK_SSE2)
+        uint8_t wide_key[16];
+        for (size_t i = 0; i < 16; ++i)
+        {
+            wide_key[i] = key[i & 3];
+        }
+
+        const __m128i wide_mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(wide_key));
+        for (; pos + 16 <= len; pos += 16)
+        {
+            __m128i* block = reinterpret_cast<__m128i*>(data + pos);
+            _mm_storeu_si128(block, _mm_xor_si128(_mm_loadu_si128(block), wide_mask));
+        }
+#endif
+
+        uint64_t word_mask = 0;
+        for (size_t i = 0; i < 8; ++i)
+        {
+            reinterpret_cast<uint8_t*>(&word_mask)[i] = key[i & 3];
+        }
+
+        for (; pos + 8 <= len; pos += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + pos, 8);
+            word ^= word_mask;
+            memcpy(data + pos, &word, 8);
+        }
+
+        //pos is a multiple of 4 here
+        for (; pos < len; ++pos)
+        {
+            data[pos] ^= char(key[pos & 3]);
+        }
+    }
+
+    size_t AFNetWebSocket::FindRequestEnd(const char* data, size_t len)
+    {
+        for (size_t i = 3; i < len; ++i)
+        {
+            if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r')
+            {
+                return i + 1;
+            }
+        }
+
+        return 0;
+    }
+
+    bool AFNetWebSocket::GetHeadValue(const char* data, size_t len, const char* name, std::string& value)
+    {
+        const size_t name_len = strlen(name);
+        size_t line = 0;
+        while (line < len)
+        {
+            const char* line_end = static_cast<const char*>(memchr(data + line, '\n', len - line));
+            size_t end = (line_end != nullptr ? size_t(line_end - data) : len);
+            if (end - line > name_len && data[line + name_len] == ':' && ARK_STRNICMP(data + line, name, name_len) == 0)
+            {
+                size_t begin = line + name_len + 1;
+                while (begin < end && (data[begin] == ' ' || data[begin] == '\t'))
+                {
+                    ++begin;
+                }
+
+                size_t value_end = end;
+                while (value_end > begin && (data[value_end - 1] == '\r' || data[value_end - 1] == ' '))
+                {
+                    --value_end;
+                }
+
+                value.assign(data + begin, value_end - begin);
+                return true;
+            }
+
+            line = end + 1;
+        }
+
+        return false;
+    }
+
+    void AFWSConn::send(const std::shared_ptr<std::string>& packet, const brynet::net::DataSocket::PACKED_SENDED_CALLBACK& callback/* = nullptr*/)
+    {
+        if (packet == nullptr || packet->empty())
+        {
+            if (callback != nullptr)
+            {
+                callback();
+            }
+
+            return;
+        }
+
+        char head[ARK_WS_MAX_FRAME_HEAD_LENGTH];
+        size_t head_len = AFNetWebSocket::EncodeHead(head, ARK_WS_OP_BINARY, packet->size());
+        if (packet->size() <= ARK_WS_SMALL_FRAME_LENGTH)
+        {
+            auto frame = std::make_shared<std::string>();
+            frame->reserve(head_len + packet->size());
+            frame->append(head, head_len);
+            frame->append(*packet);
+            socket_->send(frame, callback);
+            return;
+        }
+
+        //the packet may be shared by a broadcast, queue the frame head in front of it
+        socket_->send(std::make_shared<std::string>(head, head_len));
+        socket_->send(packet, callback);
+    }
+
+    size_t AFWSConn::Handshake(const char* data, size_t len)
+    {
+        if (open_ || failed_)
+        {
+            return len;
+        }
+
+        size_t request_len = AFNetWebSocket::FindRequestEnd(data, std::min(len, ARK_WS_MAX_HANDSHAKE_LENGTH));
+        if (request_len == 0)
+        {
+            if (len >= ARK_WS_MAX_HANDSHAKE_LENGTH)
+            {
+                Fail();
+                return len;
+            }
+
+            return 0;
+        }
+
+        std::string key;
+        if (!AFNetWebSocket::GetHeadValue(data, request_len, "Sec-WebSocket-Key", key) || key.empty())
+        {
+            Fail();
+            return len;
+        }
+
+        std::string response = brynet::net::http::WebSocketFormat::wsHandshake(key);
+        socket_->send(std::make_shared<std::string>(std::move(response)));
+        open_ = true;
+        return request_len;
+    }
+
+    size_t AFWSConn::Input(char* data, size_t len, const PAYLOAD_CALLBACK& callback)
+    {
+        size_t pos = 0;
+        while (pos < len && !failed_)
+        {
+            if (frame_remain_ == 0)
+            {
+                AFWSFrameHead head;
+                int head_len = AFNetWebSocket::DecodeHead(data + pos, len - pos, head);
+                if (head_len == 0)
+                {
+                    break;
+                }
+
+                //client frames must be masked
+                if (head_len < 0 || !head.masked_)
+                {
+                    Fail();
+                    return len;
+                }
+
+                if (head.opcode_ >= ARK_WS_OP_CLOSE)
+                {
+                    //control frames are small, wait for the whole frame
+                    if (!head.fin_ || head.payload_len_ > ARK_WS_MAX_CONTROL_LENGTH)
+                    {
+                        Fail();
+                        return len;
+                    }
+
+                    if (len - pos < head_len + head.payload_len_)
+                    {
+                        break;
+                    }
+
+                    char* payload = data + pos + head_len;
+                    AFNetWebSocket::Unmask(payload, size_t(head.payload_len_), head.mask_, 0);
+                    pos += head_len + size_t(head.payload_len_);
+                    if (!OnControlFrame(head, payload))
+                    {
+                        return len;
+                    }
+
+                    continue;
+                }
+
+                //msgs are binary, fragments are joined by the msg head anyway
+                if ((head.opcode_ != ARK_WS_OP_BINARY && head.opcode_ != ARK_WS_OP_CONTINUATION) || head.payload_len_ > ARK_WS_MAX_FRAME_LENGTH)
+                {
+                    Fail();
+                    return len;
+                }
+
+                pos += head_len;
+                frame_remain_ = head.payload_len_;
+                mask_offset_ = 0;
+                memcpy(mask_, head.mask_, sizeof(mask_));
+                continue;
+            }
+
+            //stream the payload of a big frame as it comes, no frame-sized buffer
+            size_t payload_len = size_t(std::min<uint64_t>(frame_remain_, len - pos));
+            //brynet hands out its own receive buffer, unmask it in place
+            AFNetWebSocket::Unmask(data + pos, payload_len, mask_, mask_offset_);
+            callback(data + pos, payload_len);
+
+            pos += payload_len;
+            mask_offset_ += payload_len;
+            frame_remain_ -= payload_len;
+        }
+
+        return (failed_ ? len : pos);
+    }
+
+    bool AFWSConn::OnControlFrame(const AFWSFrameHead& head, const char* payload)
+    {
+        switch (head.opcode_)
+        {
+        case ARK_WS_OP_PING:
+            SendFrame(ARK_WS_OP_PONG, payload, size_t(head.payload_len_));
+            return true;
+        case ARK_WS_OP_PONG:
+            return true;
+        case ARK_WS_OP_CLOSE:
+            //echo the status code and close
+            SendFrame(ARK_WS_OP_CLOSE, payload, std::min<size_t>(size_t(head.payload_len_), 2));
+            failed_ = true;
+            socket_->postShutdown();
+            return false;
+        default:
+            Fail();
+            return false;
+        }
+    }
+
+    void AFWSConn::SendFrame(uint8_t opcode, const char* payload, size_t len)
+    {
+        auto frame = std::make_shared<std::string>(ARK_WS_MAX_FRAME_HEAD_LENGTH, '\0');
+        size_t head_len = AFNetWebSocket::EncodeHead(&(*frame)[0], opcode, len);
+        frame->resize(head_len);
+        frame->append(payload, len);
+        socket_->send(frame);
+    }
+
+    void AFWSConn::Fail()
+    {
+        failed_ = true;
+        socket_->postDisConnect();
+    }
+
+}
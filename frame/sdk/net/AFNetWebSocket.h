@@ -0,0 +1,132 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include <brynet/net/TCPService.h>
+#include "base/AFMacros.hpp"
+#include "base/AFNoncopyable.hpp"
+
+namespace ark
+{
+
+    ARK_CONSTEXPR static const size_t ARK_WS_MAX_HANDSHAKE_LENGTH = 8 * 1024;
+    ARK_CONSTEXPR static const size_t ARK_WS_MAX_FRAME_HEAD_LENGTH = 14;
+    ARK_CONSTEXPR static const size_t ARK_WS_MAX_CONTROL_LENGTH = 125;
+    ARK_CONSTEXPR static const uint64_t ARK_WS_MAX_FRAME_LENGTH = 64 * 1024 * 1024;
+    ARK_CONSTEXPR static const size_t ARK_WS_SMALL_FRAME_LENGTH = 256;   //smaller packets are framed by copy
+
+    enum AFWSOpcode
+    {
+        ARK_WS_OP_CONTINUATION  = 0x0,
+        ARK_WS_OP_TEXT          = 0x1,
+        ARK_WS_OP_BINARY        = 0x2,
+        ARK_WS_OP_CLOSE         = 0x8,
+        ARK_WS_OP_PING          = 0x9,
+        ARK_WS_OP_PONG          = 0xA,
+    };
+
+    class AFWSFrameHead
+    {
+    public:
+        bool fin_{ false };
+        uint8_t opcode_{ 0 };
+        bool masked_{ false };
+        uint8_t mask_[4] = { 0 };
+        uint64_t payload_len_{ 0 };
+    };
+
+    //RFC 6455 frame codec
+    class AFNetWebSocket
+    {
+    public:
+        //return head length, 0 if the head is not complete, -1 if invalid
+        static int DecodeHead(const char* data, size_t len, AFWSFrameHead& head);
+
+        //server frames are not masked, out needs ARK_WS_MAX_FRAME_HEAD_LENGTH bytes
+        static size_t EncodeHead(char* out, uint8_t opcode, uint64_t payload_len);
+
+        //offset is the count of payload bytes of this frame already unmasked
+        static void Unmask(char* data, size_t len, const uint8_t mask[4], uint64_t offset);
+
+        //return the end of the http request head, 0 if not complete
+        static size_t FindRequestEnd(const char* data, size_t len);
+        static bool GetHeadValue(const char* data, size_t len, const char* name, std::string& value);
+    };
+
+    //Server side websocket connection over a brynet socket.
+    //Binary frames are unmasked in place and streamed into the session buffer,
+    //every outgoing packet goes as one binary frame.
+    class AFWSConn : public AFNoncopyable
+    {
+    public:
+        using PTR = std::shared_ptr<AFWSConn>;
+        using PAYLOAD_CALLBACK = std::function<void(const char*, size_t)>;
+
+        explicit AFWSConn(const brynet::net::DataSocket::PTR& socket) :
+            socket_(socket)
+        {
+        }
+
+        //same names as brynet DataSocket, so AFNetSession works with both
+        //callback is called when the whole frame is written
+        void send(const std::shared_ptr<std::string>& packet, const brynet::net::DataSocket::PACKED_SENDED_CALLBACK& callback = nullptr);
+
+        void postDisConnect()
+        {
+            socket_->postDisConnect();
+        }
+
+        void postShutdown()
+        {
+            socket_->postShutdown();
+        }
+
+        const std::string& getIP() const
+        {
+            return socket_->getIP();
+        }
+
+        //IO thread only, return the consumed bytes
+        size_t Handshake(const char* data, size_t len);
+        size_t Input(char* data, size_t len, const PAYLOAD_CALLBACK& callback);
+
+        bool IsOpen() const
+        {
+            return open_;
+        }
+
+    protected:
+        bool OnControlFrame(const AFWSFrameHead& head, const char* payload);
+        void SendFrame(uint8_t opcode, const char* payload, size_t len);
+        void Fail();
+
+    private:
+        brynet::net::DataSocket::PTR socket_;
+
+        //IO thread only
+        bool open_{ false };
+        bool failed_{ false };
+        uint64_t frame_remain_{ 0 };
+        uint64_t mask_offset_{ 0 };
+        uint8_t mask_[4] = { 0 };
+    };
+
+}
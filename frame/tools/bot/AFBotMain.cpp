@@ -0,0 +1,100 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <args/args.hxx>
+#include "AFCBotManager.h"
+
+using namespace ark;
+
+std::atomic<bool> g_exit_loop{ false };
+
+bool ParseArgs(int argc, char* argv[], AFBotConfig& config)
+{
+    args::ArgumentParser parser("Headless bot clients for load testing proxy and game with the cs protocol", "If you have any questions, please report an issue in GitHub.");
+    args::HelpFlag help(parser, "help", "Display the help menu", { 'h', "help" });
+    args::ValueFlag<std::string> host(parser, "host", "Proxy host", { "host" }, config.host_);
+    args::ValueFlag<int> port(parser, "port", "Proxy port", { "port" }, args::Options::Required);
+    args::ValueFlag<uint32_t> clients(parser, "clients", "Count of simulated clients", { 'c', "clients" }, config.clients_);
+    args::ValueFlag<uint32_t> connect_rate(parser, "connect rate", "New connections per second", { "rate" }, config.connect_rate_);
+    args::ValueFlag<uint32_t> connect_threads(parser, "connect threads", "Threads pacing the async connects", { "connect_threads" }, config.connect_threads_);
+    args::ValueFlag<uint32_t> io_threads(parser, "io threads", "Net IO threads", { "io_threads" }, config.io_threads_);
+    args::ValueFlag<uint32_t> duration(parser, "duration", "Seconds to run", { 'd', "duration" }, config.duration_);
+    args::ValueFlag<uint32_t> report(parser, "report", "Seconds between reports", { "report" }, config.report_interval_);
+    args::ValueFlag<uint32_t> timeout(parser, "timeout", "Request timeout in ms", { "timeout" }, config.timeout_);
+    args::ValueFlag<uint32_t> move(parser, "move", "Move interval in ms, 0 means no move", { "move" }, config.move_interval_);
+    args::ValueFlag<uint32_t> chat(parser, "chat", "Chat interval in ms, 0 means no chat", { "chat" }, config.chat_interval_);
+    args::ValueFlag<int> game_id(parser, "game id", "Game server id to enter", { "game" }, config.game_id_);
+    args::ValueFlag<std::string> key(parser, "key", "Connect key, also the account prefix", { "key" }, config.key_);
+
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (args::Help)
+    {
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+    catch (args::Error& e)
+    {
+        CONSOLE_ERROR_LOG << e.what() << std::endl;
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+
+    config.host_ = host.Get();
+    config.port_ = port.Get();
+    config.clients_ = clients.Get();
+    config.connect_rate_ = connect_rate.Get();
+    config.connect_threads_ = connect_threads.Get();
+    config.io_threads_ = io_threads.Get();
+    config.duration_ = duration.Get();
+    config.report_interval_ = report.Get();
+    config.timeout_ = timeout.Get();
+    config.move_interval_ = move.Get();
+    config.chat_interval_ = chat.Get();
+    config.game_id_ = game_id.Get();
+    config.key_ = key.Get();
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    AFBotConfig config;
+    if (!ParseArgs(argc, argv, config))
+    {
+        return -1;
+    }
+
+#if ARK_PLATFORM == PLATFORM_UNIX
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    AFCBotManager manager(config);
+    if (!manager.Start())
+    {
+        CONSOLE_ERROR_LOG << "Start bots failed, check port, clients and rate" << std::endl;
+        return -1;
+    }
+
+    manager.Run();
+    manager.Stop();
+    return 0;
+}
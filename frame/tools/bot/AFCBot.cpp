@@ -0,0 +1,291 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCBot.h"
+
+namespace ark
+{
+
+    AFCBot::AFCBot(const uint32_t index, const AFBotConfig& config, AFBotStats& stats,
+                   const brynet::net::TcpService::PTR& service, const brynet::net::AsyncConnector::PTR& connector) :
+        index_(index),
+        config_(config),
+        stats_(stats),
+        service_(service),
+        connector_(connector)
+    {
+        account_ = ARK_FORMAT("{}{}", config.key_, index);
+    }
+
+    AFCBot::~AFCBot()
+    {
+        if (client_ != nullptr && connect_result_.load(std::memory_order_acquire) == CONNECT_STARTED)
+        {
+            client_->Shutdown();
+        }
+    }
+
+    void AFCBot::Connect()
+    {
+        connect_start_ = std::chrono::steady_clock::now();
+        client_.reset(ARK_NEW AFCTCPClient(this, &AFCBot::OnNetMsg, &AFCBot::OnNetEvent, service_, connector_));
+        bool ret = client_->StartClient(AFHeadLength::CS_HEAD_LENGTH, 0, config_.host_, config_.port_);
+
+        //publish client_ to the logic thread
+        connect_result_.store(ret ? CONNECT_STARTED : CONNECT_FAILED, std::memory_order_release);
+    }
+
+    void AFCBot::Update(const uint64_t now_ms)
+    {
+        now_ms_ = now_ms;
+        switch (state_)
+        {
+        case AFBotState::IDLE:
+            state_ = AFBotState::CONNECTING;
+            return;
+        case AFBotState::CONNECTING:
+            if (!CheckConnect())
+            {
+                return;
+            }
+            break;
+        case AFBotState::CLOSED:
+            return;
+        default:
+            break;
+        }
+
+        //connect result and msgs come as events
+        client_->Update();
+        if (state_ == AFBotState::CLOSED || state_ == AFBotState::CONNECTING)
+        {
+            return;
+        }
+
+        CheckTimeout(now_ms);
+        if (state_ == AFBotState::PLAYING)
+        {
+            UpdatePlaying(now_ms);
+        }
+
+        if (now_ms >= next_heartbeat_ms_)
+        {
+            next_heartbeat_ms_ = now_ms + uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(ARK_NET_HEART_TIME).count());
+            client_->SendHeartbeat(0);
+        }
+    }
+
+    //true if the client is started and can be updated
+    bool AFCBot::CheckConnect()
+    {
+        int result = connect_result_.load(std::memory_order_acquire);
+        if (result == CONNECT_PENDING)
+        {
+            return false;
+        }
+
+        if (result == CONNECT_FAILED)
+        {
+            ++stats_.connect_failed_;
+            state_ = AFBotState::CLOSED;
+            return false;
+        }
+
+        return true;
+    }
+
+    void AFCBot::OnConnected(const uint64_t now_ms)
+    {
+        auto connect_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - connect_start_).count();
+        ++stats_.connected_;
+        stats_.connect_.Record(uint64_t(connect_ns));
+        next_heartbeat_ms_ = now_ms + uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(ARK_NET_HEART_TIME).count());
+
+        state_ = AFBotState::CONNECT_KEY;
+        AFMsg::ReqAccountLogin login;
+        login.set_account(account_);
+        login.set_security_code(config_.key_);
+        SendRequest(AFMsg::EGMI_REQ_CONNECT_KEY, AFMsg::EGMI_ACK_CONNECT_KEY, login, now_ms);
+    }
+
+    //the login flow goes on even if the server does not ack, so the load keeps coming
+    void AFCBot::CheckTimeout(const uint64_t now_ms)
+    {
+        bool login_timeout = false;
+        while (!pending_.empty() && now_ms >= pending_.front().send_ms_ + config_.timeout_)
+        {
+            ++stats_.timeouts_;
+            login_timeout = (state_ != AFBotState::PLAYING);
+            pending_.pop_front();
+        }
+
+        if (login_timeout)
+        {
+            NextStep(now_ms);
+        }
+    }
+
+    void AFCBot::NextStep(const uint64_t now_ms)
+    {
+        switch (state_)
+        {
+        case AFBotState::CONNECT_KEY:
+            {
+                state_ = AFBotState::ROLE_LIST;
+                AFMsg::ReqRoleList req;
+                req.set_game_id(config_.game_id_);
+                req.set_account(account_);
+                SendRequest(AFMsg::EGMI_REQ_ROLE_LIST, AFMsg::EGMI_ACK_ROLE_LIST, req, now_ms);
+            }
+            break;
+        case AFBotState::ROLE_LIST:
+            {
+                state_ = AFBotState::ENTER_GAME;
+                AFMsg::ReqEnterGameServer req;
+                req.set_account(account_);
+                req.set_game_id(config_.game_id_);
+                req.set_name(account_);
+                SendRequest(AFMsg::EGMI_REQ_ENTER_GAME, AFMsg::EGMI_ACK_ENTER_GAME, req, now_ms);
+            }
+            break;
+        case AFBotState::ENTER_GAME:
+            {
+                state_ = AFBotState::PLAYING;
+                ++stats_.entered_;
+
+                //spread loops of all bots over the interval
+                next_move_ms_ = now_ms + (config_.move_interval_ > 0 ? index_ % config_.move_interval_ : 0);
+                next_chat_ms_ = now_ms + (config_.chat_interval_ > 0 ? index_ % config_.chat_interval_ : 0);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void AFCBot::UpdatePlaying(const uint64_t now_ms)
+    {
+        if (config_.move_interval_ > 0 && now_ms >= next_move_ms_)
+        {
+            next_move_ms_ = now_ms + config_.move_interval_;
+
+            pos_x_ += float(index_ % 3) - 1.0f;
+            pos_z_ += float(index_ % 5) - 2.0f;
+
+            AFMsg::ReqAckPlayerMove move;
+            move.set_movetype(0);
+            AFMsg::Position* pos = move.add_target_pos();
+            pos->set_x(pos_x_);
+            pos->set_z(pos_z_);
+            SendRequest(AFMsg::EGMI_REQ_MOVE, AFMsg::EGMI_ACK_MOVE, move, now_ms);
+        }
+
+        if (config_.chat_interval_ > 0 && now_ms >= next_chat_ms_)
+        {
+            next_chat_ms_ = now_ms + config_.chat_interval_;
+
+            AFMsg::ReqAckPlayerChat chat;
+            chat.set_chat_type(AFMsg::ReqAckPlayerChat::EGCT_WORLD);
+            chat.set_chat_name(account_);
+            chat.set_chat_info("hello from bot");
+            SendRequest(AFMsg::EGMI_REQ_CHAT, AFMsg::EGMI_ACK_CHAT, chat, now_ms);
+        }
+    }
+
+    void AFCBot::SendRequest(const uint16_t req_id, const uint16_t ack_id, const google::protobuf::Message& pb_msg, const uint64_t now_ms)
+    {
+        std::string data;
+        if (!pb_msg.SerializeToString(&data))
+        {
+            return;
+        }
+
+        AFCSMsgHead head;
+        head.id_ = req_id;
+        head.length_ = uint32_t(data.size());
+        if (!client_->SendMsg(&head, data.data(), 0))
+        {
+            return;
+        }
+
+        ++stats_.send_msgs_;
+
+        AFBotRequest request;
+        request.req_id_ = req_id;
+        request.ack_id_ = ack_id;
+        request.send_ms_ = now_ms;
+        request.send_time_ = std::chrono::steady_clock::now();
+        pending_.push_back(request);
+    }
+
+    //rtt is measured to the first ack of the same kind, pushed acks of other bots may match too
+    void AFCBot::OnNetMsg(const AFNetMsg* msg, const int64_t session_id)
+    {
+        ++stats_.recv_msgs_;
+
+        auto iter = std::find_if(pending_.begin(), pending_.end(), [msg](const AFBotRequest & request)
+        {
+            return request.ack_id_ == msg->id_;
+        });
+
+        if (iter == pending_.end())
+        {
+            return;
+        }
+
+        auto rtt = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - iter->send_time_).count();
+        stats_.rtt_[iter->req_id_].Record(uint64_t(rtt));
+        pending_.erase(iter);
+
+        if (state_ != AFBotState::PLAYING)
+        {
+            NextStep(now_ms_);
+        }
+    }
+
+    void AFCBot::OnNetEvent(const AFNetEvent* event)
+    {
+        switch (event->type_)
+        {
+        case CONNECTED:
+            if (state_ == AFBotState::CONNECTING)
+            {
+                OnConnected(now_ms_);
+            }
+            break;
+        case DISCONNECTED:
+            if (state_ == AFBotState::CONNECTING)
+            {
+                ++stats_.connect_failed_;
+            }
+            else if (state_ != AFBotState::CLOSED)
+            {
+                ++stats_.disconnected_;
+            }
+
+            state_ = AFBotState::CLOSED;
+            pending_.clear();
+            break;
+        default:
+            break;
+        }
+    }
+
+}
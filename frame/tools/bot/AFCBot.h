@@ -0,0 +1,144 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "base/AFProtoCPP.hpp"
+#include "base/AFNetMsgStats.hpp"
+#include "sdk/net/AFCTCPClient.h"
+
+namespace ark
+{
+
+    //command line options of the load generator
+    class AFBotConfig
+    {
+    public:
+        std::string host_{ "127.0.0.1" };
+        int port_{ 0 };
+        uint32_t clients_{ 1000 };
+        uint32_t connect_rate_{ 500 };      //new connections per second
+        uint32_t connect_threads_{ 2 };     //threads pacing the connects
+        uint32_t io_threads_{ 4 };
+        uint32_t duration_{ 60 };           //seconds
+        uint32_t report_interval_{ 5 };     //seconds
+        uint32_t timeout_{ 5000 };          //ms, a request without ack counts as error
+        uint32_t move_interval_{ 200 };     //ms, 0 means no move
+        uint32_t chat_interval_{ 5000 };    //ms, 0 means no chat
+        int game_id_{ 0 };
+        std::string key_{ "bot" };          //connect key sent with login
+    };
+
+    //counters of all bots, only touched by the logic thread
+    class AFBotStats
+    {
+    public:
+        uint64_t connected_{ 0 };
+        uint64_t connect_failed_{ 0 };
+        uint64_t disconnected_{ 0 };
+        uint64_t timeouts_{ 0 };
+        uint64_t send_msgs_{ 0 };
+        uint64_t recv_msgs_{ 0 };
+        uint64_t entered_{ 0 };             //bots got through the login flow
+        AFNetLatencyHistogram connect_;
+        std::map<uint16_t, AFNetLatencyHistogram> rtt_; //by request msg id
+    };
+
+    enum class AFBotState : uint8_t
+    {
+        IDLE,
+        CONNECTING,
+        CONNECT_KEY,
+        ROLE_LIST,
+        ENTER_GAME,
+        PLAYING,
+        CLOSED,
+    };
+
+    //One simulated client running connect key -> role list -> enter game,
+    //then move and chat loops. Connect runs in a connect thread, the rest in logic thread.
+    class AFCBot
+    {
+    public:
+        AFCBot(const uint32_t index, const AFBotConfig& config, AFBotStats& stats,
+               const brynet::net::TcpService::PTR& service, const brynet::net::AsyncConnector::PTR& connector);
+        ~AFCBot();
+
+        //called by connect threads, the connect itself is async
+        void Connect();
+
+        void Update(const uint64_t now_ms);
+
+        AFBotState GetState() const
+        {
+            return state_;
+        }
+
+    protected:
+        enum ConnectResult
+        {
+            CONNECT_PENDING = 0,
+            CONNECT_STARTED = 1,
+            CONNECT_FAILED = 2,
+        };
+
+        class AFBotRequest
+        {
+        public:
+            uint16_t req_id_{ 0 };
+            uint16_t ack_id_{ 0 };
+            uint64_t send_ms_{ 0 };
+            std::chrono::steady_clock::time_point send_time_;
+        };
+
+        void OnNetMsg(const AFNetMsg* msg, const int64_t session_id);
+        void OnNetEvent(const AFNetEvent* event);
+
+        bool CheckConnect();
+        void OnConnected(const uint64_t now_ms);
+        void CheckTimeout(const uint64_t now_ms);
+        void UpdatePlaying(const uint64_t now_ms);
+        void NextStep(const uint64_t now_ms);
+        void SendRequest(const uint16_t req_id, const uint16_t ack_id, const google::protobuf::Message& pb_msg, const uint64_t now_ms);
+
+    private:
+        uint32_t index_{ 0 };
+        std::string account_;
+        const AFBotConfig& config_;
+        AFBotStats& stats_;
+        brynet::net::TcpService::PTR service_;
+        brynet::net::AsyncConnector::PTR connector_;
+
+        std::unique_ptr<AFCTCPClient> client_;
+        std::atomic<int> connect_result_{ CONNECT_PENDING };
+        std::chrono::steady_clock::time_point connect_start_;
+
+        uint64_t now_ms_{ 0 };
+
+        AFBotState state_{ AFBotState::IDLE };
+        std::deque<AFBotRequest> pending_;
+        uint64_t next_move_ms_{ 0 };
+        uint64_t next_chat_ms_{ 0 };
+        uint64_t next_heartbeat_ms_{ 0 };
+        float pos_x_{ 0.0f };
+        float pos_z_{ 0.0f };
+    };
+
+}
@@ -0,0 +1,179 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include "AFCBotManager.h"
+
+namespace ark
+{
+
+    static uint64_t GetBotTime()
+    {
+        return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    AFCBotManager::AFCBotManager(const AFBotConfig& config) :
+        config_(config)
+    {
+    }
+
+    AFCBotManager::~AFCBotManager()
+    {
+        Stop();
+    }
+
+    bool AFCBotManager::Start()
+    {
+        if (config_.clients_ == 0 || config_.connect_rate_ == 0 || config_.port_ <= 0)
+        {
+            return false;
+        }
+
+        brynet::net::base::InitSocket();
+        service_ = brynet::net::TcpService::Create();
+        connector_ = brynet::net::AsyncConnector::Create();
+        service_->startWorkerThread(std::max<uint32_t>(config_.io_threads_, 1));
+        connector_->startWorkerThread();
+
+        bots_.reserve(config_.clients_);
+        for (uint32_t i = 0; i < config_.clients_; ++i)
+        {
+            bots_.emplace_back(ARK_NEW AFCBot(i, config_, stats_, service_, connector_));
+        }
+
+        start_time_ = std::chrono::steady_clock::now();
+        last_report_ms_ = GetBotTime();
+        for (uint32_t i = 0; i < std::max<uint32_t>(config_.connect_threads_, 1); ++i)
+        {
+            connect_threads_.emplace_back(&AFCBotManager::ConnectThread, this);
+        }
+
+        return true;
+    }
+
+    //bot i is connected at start + i / connect_rate, so the rate holds with any thread count
+    void AFCBotManager::ConnectThread()
+    {
+        while (!stopped_.load(std::memory_order_relaxed))
+        {
+            uint32_t index = next_connect_.fetch_add(1, std::memory_order_relaxed);
+            if (index >= bots_.size())
+            {
+                break;
+            }
+
+            std::this_thread::sleep_until(start_time_ + std::chrono::microseconds(uint64_t(index) * 1000000 / config_.connect_rate_));
+            bots_[index]->Connect();
+        }
+    }
+
+    void AFCBotManager::Run()
+    {
+        const uint64_t end_ms = GetBotTime() + uint64_t(config_.duration_) * 1000;
+        while (!stopped_.load(std::memory_order_relaxed))
+        {
+            uint64_t now_ms = GetBotTime();
+            if (now_ms >= end_ms)
+            {
+                break;
+            }
+
+            for (auto& bot : bots_)
+            {
+                bot->Update(now_ms);
+            }
+
+            if (now_ms >= last_report_ms_ + uint64_t(config_.report_interval_) * 1000)
+            {
+                Report(now_ms, false);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        Report(GetBotTime(), true);
+    }
+
+    void AFCBotManager::Stop()
+    {
+        stopped_.store(true, std::memory_order_relaxed);
+        for (auto& thread : connect_threads_)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+
+        connect_threads_.clear();
+
+        //net callbacks point to bots, stop them first
+        if (connector_ != nullptr)
+        {
+            connector_->stopWorkerThread();
+        }
+
+        if (service_ != nullptr)
+        {
+            service_->stopWorkerThread();
+        }
+
+        bots_.clear();
+
+        if (service_ != nullptr)
+        {
+            service_ = nullptr;
+            connector_ = nullptr;
+            brynet::net::base::DestroySocket();
+        }
+    }
+
+    void AFCBotManager::Report(const uint64_t now_ms, const bool final_report)
+    {
+        double elapsed = double(std::max<uint64_t>(now_ms - last_report_ms_, 1)) / 1000.0;
+        size_t online = std::count_if(bots_.begin(), bots_.end(), [](const std::unique_ptr<AFCBot>& bot)
+        {
+            return bot->GetState() != AFBotState::IDLE && bot->GetState() != AFBotState::CONNECTING && bot->GetState() != AFBotState::CLOSED;
+        });
+
+        std::string line = ARK_FORMAT("[bot]{} clients={} online={} entered={} connect/s={:.1f} send/s={:.1f} recv/s={:.1f} connect_failed={} disconnected={} timeouts={}",
+                                      (final_report ? "[final]" : ""), bots_.size(), online, stats_.entered_,
+                                      double(stats_.connected_ - last_connected_) / elapsed, double(stats_.send_msgs_ - last_send_msgs_) / elapsed,
+                                      double(stats_.recv_msgs_ - last_recv_msgs_) / elapsed, stats_.connect_failed_, stats_.disconnected_, stats_.timeouts_);
+        CONSOLE_INFO_LOG << line << std::endl;
+
+        std::string connect_line = ARK_FORMAT("[bot] connect count={} p50_ms={:.2f} p99_ms={:.2f} max_ms={:.2f}", stats_.connect_.GetCount(),
+                                              double(stats_.connect_.GetPercentile(50)) / 1e6, double(stats_.connect_.GetPercentile(99)) / 1e6, double(stats_.connect_.max_ns_) / 1e6);
+        CONSOLE_INFO_LOG << connect_line << std::endl;
+
+        for (const auto& iter : stats_.rtt_)
+        {
+            const AFNetLatencyHistogram& rtt = iter.second;
+            std::string rtt_line = ARK_FORMAT("[bot] rtt msg={} count={} p50_ms={:.2f} p99_ms={:.2f} max_ms={:.2f}", iter.first, rtt.GetCount(),
+                                              double(rtt.GetPercentile(50)) / 1e6, double(rtt.GetPercentile(99)) / 1e6, double(rtt.max_ns_) / 1e6);
+            CONSOLE_INFO_LOG << rtt_line << std::endl;
+        }
+
+        last_report_ms_ = now_ms;
+        last_connected_ = stats_.connected_;
+        last_send_msgs_ = stats_.send_msgs_;
+        last_recv_msgs_ = stats_.recv_msgs_;
+    }
+
+}
@@ -0,0 +1,63 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#pragma once
+
+#include "AFCBot.h"
+
+namespace ark
+{
+
+    //Owns all bots, the shared net service and the connect threads, drives bots
+    //in one logic thread and prints connect rate, rtt percentiles and errors
+    class AFCBotManager
+    {
+    public:
+        explicit AFCBotManager(const AFBotConfig& config);
+        ~AFCBotManager();
+
+        bool Start();
+        void Run();
+        void Stop();
+
+    protected:
+        void ConnectThread();
+        void Report(const uint64_t now_ms, const bool final_report);
+
+    private:
+        AFBotConfig config_;
+        AFBotStats stats_;
+        std::vector<std::unique_ptr<AFCBot>> bots_;
+
+        brynet::net::TcpService::PTR service_{ nullptr };
+        brynet::net::AsyncConnector::PTR connector_{ nullptr };
+
+        std::vector<std::thread> connect_threads_;
+        std::atomic<uint32_t> next_connect_{ 0 };
+        std::atomic<bool> stopped_{ false };
+        std::chrono::steady_clock::time_point start_time_;
+
+        uint64_t last_report_ms_{ 0 };
+        uint64_t last_connected_{ 0 };
+        uint64_t last_send_msgs_{ 0 };
+        uint64_t last_recv_msgs_{ 0 };
+    };
+
+}
@@ -0,0 +1,285 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <args/args.hxx>
+#include <random>
+#include "base/AFLZ4.hpp"
+
+#if defined(ARK_HAVE_LZ4_REFERENCE)
+#include <lz4.h>
+#endif
+
+using namespace ark;
+
+class AFLZ4CheckConfig
+{
+public:
+    uint32_t rounds_{ 5000 };
+    uint32_t max_size_{ 64 * 1024 }; //bytes, the max body of a batch frame
+    uint32_t seed_{ 1 };
+};
+
+//blocks written by LZ4_compress_default of lz4 1.9.4
+class AFLZ4Reference
+{
+public:
+    const char* name_;
+    std::string raw_;
+    std::vector<uint8_t> block_;
+};
+
+std::vector<AFLZ4Reference> MakeReferences()
+{
+    std::vector<AFLZ4Reference> references;
+
+    //long literal run, one match
+    references.push_back(AFLZ4Reference{ "text", "ARK lz4 reference vector, ARK lz4 reference vector, ARK lz4 reference vector.",
+    {
+        0xFF, 0x0B, 0x41, 0x52, 0x4B, 0x20, 0x6C, 0x7A, 0x34, 0x20, 0x72, 0x65, 0x66, 0x65, 0x72, 0x65,
+        0x6E, 0x63, 0x65, 0x20, 0x76, 0x65, 0x63, 0x74, 0x6F, 0x72, 0x2C, 0x20, 0x1A, 0x00, 0x1B, 0x50,
+        0x63, 0x74, 0x6F, 0x72, 0x2E,
+    } });
+
+    //overlapped match of distance 1, long match length
+    references.push_back(AFLZ4Reference{ "run", std::string(1000, 'a'),
+    {
+        0x1F, 0x61, 0x01, 0x00, 0xFF, 0xFF, 0xFF, 0xD2, 0x50, 0x61, 0x61, 0x61, 0x61, 0x61,
+    } });
+
+    return references;
+}
+
+//a few shapes of game msgs, from noise to long runs
+std::string MakeInput(std::mt19937& random, size_t len)
+{
+    std::string input(len, '\0');
+    uint32_t shape = random() % 4;
+    for (size_t i = 0; i < len; ++i)
+    {
+        switch (shape)
+        {
+        case 0:
+            input[i] = char(random());
+            break;
+        case 1:
+            input[i] = char('a' + random() % 3);
+            break;
+        case 2:
+            input[i] = (i >= 7 ? char(input[i - 7] ^ (random() % 50 == 0 ? 1 : 0)) : char(random()));
+            break;
+        default:
+            input[i] = char((i / 100) & 0xFF);
+            break;
+        }
+    }
+
+    return input;
+}
+
+//decode into a buffer with guard bytes, false if the decoder wrote past len
+bool GuardedDecompress(const char* src, size_t src_len, size_t len, std::string& output, bool& decoded)
+{
+    const size_t guard = 64;
+    std::string buffer(len + guard, '\x5A');
+    decoded = AFLZ4::Decompress(src, src_len, &buffer[0], len);
+    if (buffer.compare(len, guard, std::string(guard, '\x5A')) != 0)
+    {
+        return false;
+    }
+
+    output.assign(buffer.data(), len);
+    return true;
+}
+
+bool CheckReferences()
+{
+    bool ok = true;
+    for (auto& reference : MakeReferences())
+    {
+        std::string output;
+        bool decoded = false;
+        bool sane = GuardedDecompress(reinterpret_cast<const char*>(reference.block_.data()), reference.block_.size(), reference.raw_.size(), output, decoded);
+        bool same = (sane && decoded && output == reference.raw_);
+
+        std::string block(AFLZ4::CompressBound(reference.raw_.size()), '\0');
+        size_t block_len = AFLZ4::Compress(reference.raw_.data(), reference.raw_.size(), &block[0], block.size());
+        bool round_trip = (block_len > 0 && GuardedDecompress(block.data(), block_len, reference.raw_.size(), output, decoded) && decoded && output == reference.raw_);
+
+        CONSOLE_INFO_LOG << "reference " << reference.name_ << ": decode " << (same ? "ok" : "FAILED")
+                         << ", round trip " << (round_trip ? "ok" : "FAILED") << std::endl;
+        ok = (ok && same && round_trip);
+    }
+
+    return ok;
+}
+
+//compress and decompress, a short dst is either refused or still valid
+bool CheckRoundTrip(const AFLZ4CheckConfig& config)
+{
+    std::mt19937 random(config.seed_);
+    uint64_t raw_bytes = 0;
+    uint64_t compressed_bytes = 0;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < config.rounds_; ++i)
+    {
+        std::string input = MakeInput(random, random() % (config.max_size_ + 1));
+        std::string block(AFLZ4::CompressBound(input.size()), '\0');
+        size_t block_len = AFLZ4::Compress(input.data(), input.size(), &block[0], block.size());
+
+        std::string output;
+        bool decoded = false;
+        if ((block_len == 0 && !input.empty()) || !GuardedDecompress(block.data(), block_len, input.size(), output, decoded) || !decoded || output != input)
+        {
+            ++failed;
+            continue;
+        }
+
+        raw_bytes += input.size();
+        compressed_bytes += block_len;
+
+        std::string short_block(random() % (block_len + 1), '\0');
+        size_t short_len = AFLZ4::Compress(input.data(), input.size(), &short_block[0], short_block.size());
+        if (short_len > short_block.size() ||
+                (short_len > 0 && (!GuardedDecompress(short_block.data(), short_len, input.size(), output, decoded) || !decoded || output != input)))
+        {
+            ++failed;
+        }
+
+#if defined(ARK_HAVE_LZ4_REFERENCE)
+        //lz4 reads ours and we read lz4
+        std::string reference_output(input.size(), '\0');
+        int reference_len = LZ4_decompress_safe(block.data(), &reference_output[0], int(block_len), int(input.size()));
+        if (reference_len != int(input.size()) || reference_output != input)
+        {
+            ++failed;
+        }
+
+        std::string reference_block(LZ4_compressBound(int(input.size())), '\0');
+        reference_len = LZ4_compress_default(input.data(), &reference_block[0], int(input.size()), int(reference_block.size()));
+        if (!GuardedDecompress(reference_block.data(), size_t(reference_len), input.size(), output, decoded) || !decoded || output != input)
+        {
+            ++failed;
+        }
+#endif
+    }
+
+    CONSOLE_INFO_LOG << "round trip: " << (config.rounds_ - failed) << "/" << config.rounds_
+                     << ", ratio " << (raw_bytes > 0 ? double(compressed_bytes) / double(raw_bytes) : 0.0)
+#if defined(ARK_HAVE_LZ4_REFERENCE)
+                     << ", with lz4 " << LZ4_versionString()
+#endif
+                     << (failed == 0 ? " ok" : " FAILED") << std::endl;
+    return (failed == 0);
+}
+
+//corrupt and truncated blocks, as a peer may send, must be refused without writing past dst
+bool CheckFuzz(const AFLZ4CheckConfig& config)
+{
+    std::mt19937 random(config.seed_ + 1);
+    uint32_t overrun = 0;
+    uint32_t refused = 0;
+    for (uint32_t i = 0; i < config.rounds_; ++i)
+    {
+        std::string input = MakeInput(random, 1 + random() % 4096);
+        std::string block(AFLZ4::CompressBound(input.size()), '\0');
+        block.resize(AFLZ4::Compress(input.data(), input.size(), &block[0], block.size()));
+
+        switch (random() % 3)
+        {
+        case 0:
+            for (uint32_t flips = 1 + random() % 4; flips > 0 && !block.empty(); --flips)
+            {
+                block[random() % block.size()] = char(random());
+            }
+            break;
+        case 1:
+            block.resize(random() % (block.size() + 1));
+            break;
+        default:
+            block.resize(random() % 256);
+            for (auto& c : block)
+            {
+                c = char(random());
+            }
+            break;
+        }
+
+        //the length in the compress head is not trusted either
+        size_t len = (random() % 2 == 0 ? input.size() : random() % (config.max_size_ + 1));
+        std::string output;
+        bool decoded = false;
+        if (!GuardedDecompress(block.data(), block.size(), len, output, decoded))
+        {
+            ++overrun;
+        }
+        else if (!decoded)
+        {
+            ++refused;
+        }
+    }
+
+    CONSOLE_INFO_LOG << "fuzz: " << config.rounds_ << " blocks, " << refused << " refused, "
+                     << overrun << " overruns" << (overrun == 0 ? " ok" : " FAILED") << std::endl;
+    return (overrun == 0);
+}
+
+bool ParseArgs(int argc, char* argv[], AFLZ4CheckConfig& config)
+{
+    args::ArgumentParser parser("Round trip and fuzz of the lz4 codec of net msgs", "If you have any questions, please report an issue in GitHub.");
+    args::HelpFlag help(parser, "help", "Display the help menu", { 'h', "help" });
+    args::ValueFlag<uint32_t> rounds(parser, "rounds", "Blocks of round trip and of fuzz", { 'n', "rounds" }, config.rounds_);
+    args::ValueFlag<uint32_t> max_size(parser, "max size", "Max input size in bytes", { "max_size" }, config.max_size_);
+    args::ValueFlag<uint32_t> seed(parser, "seed", "Random seed", { "seed" }, config.seed_);
+
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (args::Help)
+    {
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+    catch (args::Error& e)
+    {
+        CONSOLE_ERROR_LOG << e.what() << std::endl;
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+
+    config.rounds_ = rounds.Get();
+    config.max_size_ = max_size.Get();
+    config.seed_ = seed.Get();
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    AFLZ4CheckConfig config;
+    if (!ParseArgs(argc, argv, config))
+    {
+        return -1;
+    }
+
+    bool ok = CheckReferences();
+    ok = CheckRoundTrip(config) && ok;
+    ok = CheckFuzz(config) && ok;
+    return (ok ? 0 : -1);
+}
@@ -0,0 +1,273 @@
+﻿/*
+* This source file is part of ARK
+* For the latest info, see https://github.com/QuadHex
+*
+* Copyright (c) 2013-2018 QuadHex authors.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*/
+
+#include <args/args.hxx>
+#include <random>
+#include "sdk/net/AFNetKcp.h"
+
+using namespace ark;
+
+class AFLossConfig
+{
+public:
+    uint32_t loss_{ 20 };       //percent of segments dropped
+    uint32_t reorder_{ 20 };    //percent of segments delayed more than the others
+    uint32_t delay_{ 20 };      //ms of one way
+    uint32_t msgs_{ 2000 };
+    uint32_t max_size_{ 4096 }; //bytes, larger than mss so fragments are covered
+    uint32_t seed_{ 1 };
+    uint32_t timeout_{ 3600 };  //seconds of simulated time
+};
+
+//one direction of the loopback, drops and reorders segments on a simulated clock
+class AFLossyLink : public AFNetKcpOutput
+{
+public:
+    AFLossyLink(const AFLossConfig& config, std::mt19937& random) :
+        config_(config),
+        random_(random)
+    {
+    }
+
+    void SetNow(uint32_t now)
+    {
+        now_ = now;
+    }
+
+    void Output(const AFKcpSegHead& head, const char* data) override
+    {
+        ++sent_;
+        if (random_() % 100 < config_.loss_)
+        {
+            ++dropped_;
+            return;
+        }
+
+        uint32_t delay = config_.delay_;
+        if (random_() % 100 < config_.reorder_)
+        {
+            //late enough to arrive behind segments sent after it
+            delay += 1 + random_() % (config_.delay_ * 4 + 1);
+            ++reordered_;
+        }
+
+        AFLossySegment& seg = in_flight_.emplace(now_ + delay, AFLossySegment())->second;
+        seg.head_ = head;
+        if (data != nullptr)
+        {
+            seg.data_.assign(data, head.len_);
+        }
+    }
+
+    void Deliver(AFNetKcp& peer, uint32_t now)
+    {
+        while (!in_flight_.empty() && in_flight_.begin()->first <= now)
+        {
+            const AFLossySegment& seg = in_flight_.begin()->second;
+            peer.Input(seg.head_, seg.data_.data(), now);
+            in_flight_.erase(in_flight_.begin());
+        }
+    }
+
+    bool IsEmpty() const
+    {
+        return in_flight_.empty();
+    }
+
+    uint64_t sent_{ 0 };
+    uint64_t dropped_{ 0 };
+    uint64_t reordered_{ 0 };
+
+private:
+    class AFLossySegment
+    {
+    public:
+        AFKcpSegHead head_;
+        std::string data_;
+    };
+
+    const AFLossConfig& config_;
+    std::mt19937& random_;
+    uint32_t now_{ 0 };
+    std::multimap<uint32_t, AFLossySegment> in_flight_; //arrive time -> segment
+};
+
+//index + bytes derived from index, so corruption is found
+std::string MakeMsg(uint32_t index, size_t size)
+{
+    std::string msg(sizeof(index) + size, '\0');
+    memcpy(&msg[0], &index, sizeof(index));
+    for (size_t i = 0; i < size; ++i)
+    {
+        msg[sizeof(index) + i] = char((index * 31 + i) & 0xFF);
+    }
+
+    return msg;
+}
+
+bool CheckMsg(const std::string& msg, uint32_t& index)
+{
+    if (msg.size() < sizeof(index))
+    {
+        return false;
+    }
+
+    memcpy(&index, msg.data(), sizeof(index));
+    return (msg == MakeMsg(index, msg.size() - sizeof(index)));
+}
+
+//send msgs from one channel to another through lossy links, check what the mode promises
+bool RunChannel(const AFLossConfig& config, AFKcpChannelMode mode, const char* name)
+{
+    std::mt19937 random(config.seed_);
+    AFLossyLink forward(config, random);
+    AFLossyLink backward(config, random);
+
+    AFKcpChannelConfig channel_config;
+    channel_config.mode_ = mode;
+    AFNetKcp sender(1, 0, channel_config, &forward);
+    AFNetKcp receiver(1, 0, channel_config, &backward);
+
+    const uint32_t start = 1000;
+    const uint32_t deadline = start + config.timeout_ * 1000;
+    uint32_t now = start;
+    forward.SetNow(now);
+    backward.SetNow(now);
+
+    //small msgs of unreliable channel go out right now, large ones take the reliable way
+    uint32_t send_failed = 0;
+    for (uint32_t i = 0; i < config.msgs_; ++i)
+    {
+        std::string msg = MakeMsg(i, random() % (config.max_size_ + 1));
+        if (!sender.Send(msg.data(), msg.size()))
+        {
+            ++send_failed;
+        }
+    }
+
+    std::vector<bool> received(config.msgs_, false);
+    uint32_t received_count = 0;
+    uint32_t next_index = 0;
+    bool in_order = true;
+    bool broken = false;
+
+    std::string msg;
+    while (now < deadline && !sender.IsDeadLink() && !receiver.IsDeadLink())
+    {
+        forward.SetNow(now);
+        backward.SetNow(now);
+        forward.Deliver(receiver, now);
+        backward.Deliver(sender, now);
+        sender.Update(now);
+        receiver.Update(now);
+
+        while (receiver.Recv(msg))
+        {
+            uint32_t index = 0;
+            if (!CheckMsg(msg, index) || index >= config.msgs_ || received[index])
+            {
+                broken = true;
+                continue;
+            }
+
+            in_order = (in_order && index == next_index);
+            next_index = index + 1;
+            received[index] = true;
+            ++received_count;
+        }
+
+        if (sender.GetWaitSend() == 0 && forward.IsEmpty() && backward.IsEmpty())
+        {
+            break;
+        }
+
+        ++now;
+    }
+
+    bool ok = (send_failed == 0 && !broken);
+    if (mode != ARK_KCP_UNRELIABLE)
+    {
+        ok = (ok && received_count == config.msgs_);
+    }
+
+    if (mode == ARK_KCP_RELIABLE_ORDERED)
+    {
+        ok = (ok && in_order);
+    }
+
+    CONSOLE_INFO_LOG << name << ": received " << received_count << "/" << config.msgs_
+                     << ", segments sent " << (forward.sent_ + backward.sent_)
+                     << " dropped " << (forward.dropped_ + backward.dropped_)
+                     << " reordered " << (forward.reordered_ + backward.reordered_)
+                     << ", " << (now - start) << " ms" << (ok ? " ok" : " FAILED") << std::endl;
+    return ok;
+}
+
+bool ParseArgs(int argc, char* argv[], AFLossConfig& config)
+{
+    args::ArgumentParser parser("Loopback of reliable udp channels with packet loss and reordering", "If you have any questions, please report an issue in GitHub.");
+    args::HelpFlag help(parser, "help", "Display the help menu", { 'h', "help" });
+    args::ValueFlag<uint32_t> loss(parser, "loss", "Percent of segments dropped", { "loss" }, config.loss_);
+    args::ValueFlag<uint32_t> reorder(parser, "reorder", "Percent of segments delayed behind later ones", { "reorder" }, config.reorder_);
+    args::ValueFlag<uint32_t> delay(parser, "delay", "One way delay in ms", { "delay" }, config.delay_);
+    args::ValueFlag<uint32_t> msgs(parser, "msgs", "Msgs sent on every channel mode", { 'n', "msgs" }, config.msgs_);
+    args::ValueFlag<uint32_t> max_size(parser, "max size", "Max msg size in bytes", { "max_size" }, config.max_size_);
+    args::ValueFlag<uint32_t> seed(parser, "seed", "Random seed", { "seed" }, config.seed_);
+    args::ValueFlag<uint32_t> timeout(parser, "timeout", "Seconds of simulated time", { "timeout" }, config.timeout_);
+
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (args::Help)
+    {
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+    catch (args::Error& e)
+    {
+        CONSOLE_ERROR_LOG << e.what() << std::endl;
+        CONSOLE_ERROR_LOG << parser;
+        return false;
+    }
+
+    config.loss_ = std::min<uint32_t>(loss.Get(), 100);
+    config.reorder_ = std::min<uint32_t>(reorder.Get(), 100);
+    config.delay_ = delay.Get();
+    config.msgs_ = msgs.Get();
+    config.max_size_ = max_size.Get();
+    config.seed_ = seed.Get();
+    config.timeout_ = timeout.Get();
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    AFLossConfig config;
+    if (!ParseArgs(argc, argv, config))
+    {
+        return -1;
+    }
+
+    bool ok = RunChannel(config, ARK_KCP_RELIABLE_ORDERED, "reliable ordered");
+    ok = RunChannel(config, ARK_KCP_RELIABLE_UNORDERED, "reliable unordered") && ok;
+    ok = RunChannel(config, ARK_KCP_UNRELIABLE, "unreliable") && ok;
+    return (ok ? 0 : -1);
+}